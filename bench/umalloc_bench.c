@@ -0,0 +1,227 @@
+#define _DEFAULT_SOURCE  // clock_gettime
+#include "umalloc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#define MAX_THREADS     64       // Upper bound on the threads of one run.
+#define DEFAULT_THREADS 8        // Threads of the largest run without an argument.
+#define DEFAULT_OPS     1000000  // Allocations per thread without an argument.
+#define SLOTS           256      // Blocks each thread keeps live at once.
+#define HANDOFF_EVERY   64       // Every so many allocations, one goes to another thread.
+
+/**
+ * @brief The state of one benchmark thread.
+ */
+typedef struct {
+    size_t          index;         // Position of the thread in the run.
+    size_t          ops;           // Number of allocations to make.
+    uint64_t        seed;          // State of the random number generator.
+    void           *slots[SLOTS];  // Live blocks, replaced at random.
+    _Atomic(void *) mailbox;       // A block another thread handed over, to free here.
+    size_t          corrupt;       // Blocks found overwritten when freed.
+} Worker;
+
+static Worker workers[MAX_THREADS];
+static size_t worker_count;
+
+static int      worker_main(void *arg);
+static size_t   random_size(Worker *worker);
+static void    *fill(void *block, size_t size);
+static void     check_free(Worker *worker, void *block);
+static uint64_t next_random(uint64_t *state);
+static double   run(size_t threads, size_t ops);
+static double   now_seconds(void);
+
+/**
+ * @brief Times umalloc on 1, 2, 4, ... up to N threads.
+ *
+ * Usage: umalloc_bench [threads [allocations per thread]]
+ */
+int main(int argc, char **argv) {
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_THREADS;
+    size_t ops         = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_OPS;
+    if (max_threads < 1 || max_threads > MAX_THREADS || ops < 1) {
+        fprintf(stderr, "Usage: %s [threads (1-%d) [allocations per thread]]\n", argv[0],
+                MAX_THREADS);
+        return 1;
+    }
+    if (uinit() != 0) {
+        fprintf(stderr, "Unable to allocate memory. Aborting\n");
+        return 1;
+    }
+
+    printf("%8s %14s %10s\n", "threads", "ops/s", "speedup");
+    double base = 0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double rate = run(threads, ops);
+        if (rate < 0) {
+            return 1;
+        }
+        if (threads == 1) {
+            base = rate;
+        }
+        printf("%8zu %14.0f %9.2fx\n", threads, rate, rate / base);
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;  // end on max_threads itself
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs the benchmark on a number of threads.
+ *
+ * @param threads Number of threads.
+ * @param ops Allocations per thread.
+ * @return Allocation and free pairs per second over all threads, or -1 if a
+ * thread could not be created or a block was found corrupted.
+ */
+static double run(size_t threads, size_t ops) {
+    worker_count = threads;
+    for (size_t i = 0; i < threads; i++) {
+        Worker *worker = &workers[i];
+        memset(worker->slots, 0, sizeof(worker->slots));
+        worker->index   = i;
+        worker->ops     = ops;
+        worker->seed    = 0x9E3779B97F4A7C15u * (i + 1);
+        worker->corrupt = 0;
+        atomic_init(&worker->mailbox, NULL);
+    }
+
+    thrd_t handles[MAX_THREADS];
+    double start = now_seconds();
+    for (size_t i = 0; i < threads; i++) {
+        if (thrd_create(&handles[i], worker_main, &workers[i]) != thrd_success) {
+            fprintf(stderr, "Unable to create thread %zu\n", i);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < threads; i++) {
+        thrd_join(handles[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    // Blocks still in a mailbox go back from here, as a remote free.
+    size_t corrupt = 0;
+    for (size_t i = 0; i < threads; i++) {
+        check_free(&workers[i], atomic_exchange(&workers[i].mailbox, NULL));
+        corrupt += workers[i].corrupt;
+    }
+    if (corrupt > 0) {
+        fprintf(stderr, "%zu blocks were corrupted\n", corrupt);
+        return -1;
+    }
+    return (double) (threads * ops) / elapsed;
+}
+
+/**
+ * @brief Replaces random live blocks with new ones, handing some of them to
+ * the next thread to free, then frees what it still holds.
+ *
+ * @param arg The `Worker` of the thread.
+ * @return 0, or 1 if memory ran out.
+ */
+static int worker_main(void *arg) {
+    Worker *worker = arg;
+    Worker *peer   = &workers[(worker->index + 1) % worker_count];
+    for (size_t op = 0; op < worker->ops; op++) {
+        size_t slot = next_random(&worker->seed) % SLOTS;
+        check_free(worker, worker->slots[slot]);
+
+        size_t size  = random_size(worker);
+        void  *block = fill(umalloc(size), size);
+        if (!block) {
+            return 1;
+        }
+        if (op % HANDOFF_EVERY == 0 && worker_count > 1) {
+            // The peer frees it, from a thread that does not own it.
+            check_free(worker, atomic_exchange(&peer->mailbox, block));
+            block = NULL;
+        }
+        worker->slots[slot] = block;
+        check_free(worker, atomic_exchange(&worker->mailbox, NULL));
+    }
+
+    for (size_t slot = 0; slot < SLOTS; slot++) {
+        check_free(worker, worker->slots[slot]);
+        worker->slots[slot] = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Picks the size of the next allocation: mostly small, sometimes up
+ * to a few KiB, like the Commands, strings and frames of a program.
+ *
+ * @param worker The worker allocating.
+ * @return The size in bytes, more than `sizeof(size_t)`.
+ */
+static size_t random_size(Worker *worker) {
+    uint64_t r = next_random(&worker->seed);
+    if (r % 8 != 0) {
+        return sizeof(size_t) + 1 + (r >> 8) % 248;
+    }
+    return sizeof(size_t) + 1 + (r >> 8) % 4096;
+}
+
+/**
+ * @brief Stamps both ends of a block with its size, so a free can tell
+ * whether another allocation overlapped it.
+ *
+ * @param block The block, or NULL.
+ * @param size Its size in bytes, more than `sizeof(size_t)`.
+ * @return The block.
+ */
+static void *fill(void *block, size_t size) {
+    if (block) {
+        memcpy(block, &size, sizeof(size));
+        ((unsigned char *) block)[size - 1] = (unsigned char) size;
+    }
+    return block;
+}
+
+/**
+ * @brief Checks the stamps of a block, then frees it.
+ *
+ * @param worker The worker freeing, which counts a bad stamp.
+ * @param block The block, or NULL.
+ */
+static void check_free(Worker *worker, void *block) {
+    if (!block) {
+        return;
+    }
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    if (size <= sizeof(size) || ((unsigned char *) block)[size - 1] != (unsigned char) size) {
+        worker->corrupt++;
+    }
+    ufree(block);
+}
+
+/**
+ * @brief Advances a xorshift64* generator.
+ *
+ * @param state The state of the generator, never 0.
+ * @return The next random number.
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Du;
+}
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * @return The time in seconds since an arbitrary fixed point.
+ */
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE  // clock_gettime
+#include "umalloc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_REPEATS 10  // Passes over the trace without an argument.
+#define INITIAL_EVENTS  1024
+#define INITIAL_TABLE   1024
+
+/**
+ * @brief One call of a trace, with its pointer replaced by a slot number.
+ */
+typedef struct {
+    bool   alloc;  // umalloc if set, ufree otherwise.
+    size_t slot;   // Which live block the call makes or frees.
+    size_t size;   // The size asked for by the umalloc of the block.
+} Event;
+
+/**
+ * @brief Maps the pointers of a trace to slots while it is read.
+ */
+typedef struct {
+    uintptr_t *keys;      // Traced pointers, 0 for an unused entry.
+    size_t    *slots;     // The slot of each pointer.
+    size_t    *sizes;     // The size each pointer was allocated with.
+    size_t     capacity;  // Number of entries, a power of two.
+    size_t     used;      // Entries that hold a pointer.
+} SlotTable;
+
+static bool     load_trace(FILE *file, Event **events, size_t *count, size_t *slot_count);
+static bool     table_init(SlotTable *table, size_t capacity);
+static void     table_free(SlotTable *table);
+static bool     table_put(SlotTable *table, uintptr_t key, size_t slot, size_t size);
+static bool     table_take(SlotTable *table, uintptr_t key, size_t *slot, size_t *size);
+static size_t   table_index(const SlotTable *table, uintptr_t key);
+static bool     replay(const Event *events, size_t count, void **live, size_t *peak_live);
+static double   now_seconds(void);
+
+/**
+ * @brief Replays a trace recorded with UMALLOC_TRACE and reports how much of
+ * the heap it fragments and how fast it runs.
+ *
+ * Usage: umalloc_replay trace [passes]
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s trace [passes]\n", argv[0]);
+        return 1;
+    }
+    size_t repeats = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_REPEATS;
+    FILE  *file    = fopen(argv[1], "r");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", argv[1]);
+        return 1;
+    }
+
+    Event *events;
+    size_t count, slot_count;
+    bool   loaded = load_trace(file, &events, &count, &slot_count);
+    fclose(file);
+    void **live = loaded ? calloc(slot_count + 1, sizeof(void *)) : NULL;
+    if (!live || uinit() != 0) {
+        fprintf(stderr, "Unable to allocate memory. Aborting\n");
+        return 1;
+    }
+
+    // Fragmentation is measured on the first pass, from a fresh heap.
+    size_t base      = uheap_size();
+    size_t peak_live = 0;
+    double start     = now_seconds();
+    bool   ok        = replay(events, count, live, &peak_live);
+    size_t heap      = uheap_size() - base;
+    for (size_t pass = 1; ok && pass < repeats; pass++) {
+        ok = replay(events, count, live, &peak_live);
+    }
+    double elapsed = now_seconds() - start;
+    if (!ok) {
+        fprintf(stderr, "Unable to allocate memory. Aborting\n");
+        return 1;
+    }
+
+    printf("%s: %zu calls, peak live %zu B, heap %zu B, fragmentation %.1f%%, %.0f calls/s\n",
+           argv[1], count, peak_live, heap,
+           heap ? 100.0 * (double) (heap - peak_live) / (double) heap : 0.0,
+           (double) (count * (repeats ? repeats : 1)) / elapsed);
+    free(live);
+    free(events);
+    return 0;
+}
+
+/**
+ * @brief Reads a trace, numbering its blocks so a replay needs no lookups.
+ *
+ * Frees of pointers the trace never allocated, and failed allocations, are
+ * left out.
+ *
+ * @param file The trace.
+ * @param events Set to the calls, owned by the caller.
+ * @param count Set to the number of calls.
+ * @param slot_count Set to the number of slots the calls use.
+ * @return True if the trace was read, false if memory ran out.
+ */
+static bool load_trace(FILE *file, Event **events, size_t *count, size_t *slot_count) {
+    SlotTable table;
+    size_t    capacity   = INITIAL_EVENTS;
+    size_t   *free_slots = malloc(capacity * sizeof(size_t));
+    size_t    free_count = 0;
+    bool      ok         = table_init(&table, INITIAL_TABLE) && free_slots;
+
+    *events     = malloc(capacity * sizeof(Event));
+    *count      = 0;
+    *slot_count = 0;
+    ok          = ok && *events;
+
+    char   op;
+    char   pointer[32];
+    size_t size;
+    while (ok && fscanf(file, " %c %31s %zu", &op, pointer, &size) == 3) {
+        uintptr_t key = (uintptr_t) strtoull(pointer, NULL, 16);  // 0 for "(nil)"
+        Event     event = {op == 'a', 0, size};
+        if (key == 0 || (!event.alloc && !table_take(&table, key, &event.slot, &event.size))) {
+            continue;
+        }
+        if (event.alloc) {
+            // Slots of freed blocks are reused, so `live` stays small.
+            event.slot = free_count > 0 ? free_slots[--free_count] : (*slot_count)++;
+            ok         = table_put(&table, key, event.slot, event.size);
+        } else {
+            free_slots[free_count++] = event.slot;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            Event  *grown       = realloc(*events, capacity * sizeof(Event));
+            size_t *grown_slots = realloc(free_slots, capacity * sizeof(size_t));
+            ok                  = grown && grown_slots;
+            *events             = grown ? grown : *events;
+            free_slots          = grown_slots ? grown_slots : free_slots;
+        }
+        (*events)[(*count)++] = event;
+    }
+
+    table_free(&table);
+    free(free_slots);
+    return ok;
+}
+
+/**
+ * @brief Allocates an empty table.
+ *
+ * @param table The table to initialize.
+ * @param capacity Number of entries, a power of two.
+ * @return True if the table was allocated, false if memory ran out.
+ */
+static bool table_init(SlotTable *table, size_t capacity) {
+    table->keys     = calloc(capacity, sizeof(uintptr_t));
+    table->slots    = malloc(capacity * sizeof(size_t));
+    table->sizes    = malloc(capacity * sizeof(size_t));
+    table->capacity = capacity;
+    table->used     = 0;
+    if (!table->keys || !table->slots || !table->sizes) {
+        table_free(table);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Frees the entries of a table.
+ *
+ * @param table The table to free.
+ */
+static void table_free(SlotTable *table) {
+    free(table->keys);
+    free(table->slots);
+    free(table->sizes);
+    table->keys  = NULL;
+    table->slots = NULL;
+    table->sizes = NULL;
+}
+
+/**
+ * @brief Records the slot of a pointer, growing the table when it is half full.
+ *
+ * @param table The table.
+ * @param key The pointer, not 0.
+ * @param slot Its slot.
+ * @param size The size it was allocated with.
+ * @return True if it was recorded, false if memory ran out.
+ */
+static bool table_put(SlotTable *table, uintptr_t key, size_t slot, size_t size) {
+    if (2 * (table->used + 1) > table->capacity) {
+        SlotTable grown;
+        if (!table_init(&grown, 2 * table->capacity)) {
+            return false;
+        }
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != 0) {
+                table_put(&grown, table->keys[i], table->slots[i], table->sizes[i]);
+            }
+        }
+        table_free(table);
+        *table = grown;
+    }
+
+    size_t i        = table_index(table, key);
+    table->used    += table->keys[i] == 0;
+    table->keys[i]  = key;
+    table->slots[i] = slot;
+    table->sizes[i] = size;
+    return true;
+}
+
+/**
+ * @brief Removes a pointer from the table.
+ *
+ * Later entries of its run are moved back, so lookups never need markers for
+ * removed entries.
+ *
+ * @param table The table.
+ * @param key The pointer.
+ * @param slot Set to its slot.
+ * @param size Set to the size it was allocated with.
+ * @return True if the pointer was in the table.
+ */
+static bool table_take(SlotTable *table, uintptr_t key, size_t *slot, size_t *size) {
+    size_t mask = table->capacity - 1;
+    size_t hole = table_index(table, key);
+    if (table->keys[hole] == 0) {
+        return false;
+    }
+    *slot = table->slots[hole];
+    *size = table->sizes[hole];
+
+    for (size_t i = (hole + 1) & mask; table->keys[i] != 0; i = (i + 1) & mask) {
+        // An entry may fill the hole unless its home lies after the hole.
+        size_t home = (size_t) (table->keys[i] * 0x9E3779B97F4A7C15u) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->keys[hole]  = table->keys[i];
+            table->slots[hole] = table->slots[i];
+            table->sizes[hole] = table->sizes[i];
+            hole               = i;
+        }
+    }
+    table->keys[hole] = 0;
+    table->used--;
+    return true;
+}
+
+/**
+ * @brief Finds the entry of a pointer, or the free entry it would take.
+ *
+ * @param table The table, never full.
+ * @param key The pointer.
+ * @return The index of the entry.
+ */
+static size_t table_index(const SlotTable *table, uintptr_t key) {
+    size_t mask = table->capacity - 1;
+    size_t i    = (size_t) (key * 0x9E3779B97F4A7C15u) & mask;
+    while (table->keys[i] != 0 && table->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Replays the calls of a trace once, then frees what is still live.
+ *
+ * @param events The calls.
+ * @param count The number of calls.
+ * @param live The block of each slot, all NULL on entry and on return.
+ * @param peak_live Raised to the most bytes asked for and not yet freed.
+ * @return True if every allocation succeeded.
+ */
+static bool replay(const Event *events, size_t count, void **live, size_t *peak_live) {
+    size_t live_bytes = 0;
+    size_t high       = 0;
+    bool   ok         = true;
+    for (size_t i = 0; i < count; i++) {
+        const Event *event = &events[i];
+        if (event->alloc) {
+            live[event->slot] = umalloc(event->size);
+            ok                = ok && live[event->slot];
+            live_bytes       += event->size;
+            high              = live_bytes > high ? live_bytes : high;
+        } else {
+            live_bytes -= event->size;
+            ufree(live[event->slot]);
+            live[event->slot] = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].alloc && live[events[i].slot]) {
+            ufree(live[events[i].slot]);
+            live[events[i].slot] = NULL;
+        }
+    }
+    *peak_live = high > *peak_live ? high : *peak_live;
+    return ok;
+}
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * @return The time in seconds since an arbitrary fixed point.
+ */
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
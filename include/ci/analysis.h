@@ -0,0 +1,109 @@
+#ifndef CI_ANALYSIS_H
+#define CI_ANALYSIS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "program.h"
+
+/**
+ * @brief A set of variables, plus the comparison flags, used by the analyses.
+ *
+ * Bit `i` stands for variable `xi`; `MASK_FLAGS` stands for all three flags.
+ */
+typedef uint64_t RegMask;
+
+#define REG_BIT(r)     ((RegMask) 1 << (r))
+#define MASK_FLAGS     ((RegMask) 1 << NUM_VARIABLES)
+#define MASK_ALL_REGS  (((RegMask) 1 << NUM_VARIABLES) - 1)
+#define MASK_ALL       (MASK_ALL_REGS | MASK_FLAGS)
+#define MASK_CALLEE    (MASK_ALL_REGS & ~REG_BIT(0))  // What a ret restores: x1..x31.
+#define MASK_IMPURE    ((RegMask) 1 << 63)            // Marks a routine that is not pure.
+
+#define MAX_SUCCESSORS 2  // No instruction has more than two successors.
+
+/**
+ * @brief Lists the instructions that may execute right after another one.
+ *
+ * Calls are treated as returning to the following instruction, and tail calls
+ * as jumps to their target, so the result describes control flow within a
+ * single routine. Instructions that always
+ * end the routine or the program (ret, halt, an unresolved call) have none.
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the instruction.
+ * @param succ Filled in with up to `MAX_SUCCESSORS` instruction indices.
+ * @return The number of successors written to `succ`.
+ */
+size_t instr_successors(const Program *prog, size_t i, size_t succ[MAX_SUCCESSORS]);
+
+/**
+ * @brief Returns the variables and flags an instruction writes.
+ *
+ * A call only counts as writing x0 and the flags, since the return restores
+ * everything else.
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the instruction.
+ * @return The written set.
+ */
+RegMask instr_defs(const Program *prog, size_t i);
+
+/**
+ * @brief Returns the variables and flags an instruction may observe.
+ *
+ * Any instruction that can end the program, whether normally or through a
+ * run-time error, observes everything, since the final state is printed. Calls
+ * and returns are treated the same way.
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the instruction.
+ * @return The observed set.
+ */
+RegMask instr_uses(const Program *prog, size_t i);
+
+/**
+ * @brief Computes the set of variables live on entry to every instruction.
+ *
+ * A standard backward dataflow analysis, iterated until nothing changes.
+ *
+ * @param prog The program to analyze.
+ * @param live_in Filled in with one set per instruction, plus the halt.
+ * @return The set live on entry to the program.
+ */
+RegMask compute_liveness(const Program *prog, RegMask *live_in);
+
+/**
+ * @brief Computes the variables each call site actually has to save.
+ *
+ * A call site only needs to save and restore a variable if the callee can
+ * clobber it and the caller can still observe it after the call returns.
+ * Every other variable ends up with the same value whether it is restored or
+ * not. The result is stored in `prog->save_masks`; on allocation failure the
+ * masks are left NULL and every call saves everything.
+ *
+ * @param prog Pointer to the `Program` to analyze.
+ * @return True if the masks were computed, false otherwise.
+ */
+bool compute_save_masks(Program *prog);
+
+/**
+ * @brief Finds the pure routines and the inputs their results depend on.
+ *
+ * A routine is pure if it only computes on variables: nothing it can reach
+ * loads, stores, prints, puts, halts or fails, and every routine it calls is
+ * pure too. Its result, x0 and the flags on return, then depends only on the
+ * variables and flags it reads before writing them. Every other variable it
+ * clobbers is either restored by the caller's frame or dead after the call, so
+ * the result alone is enough to replay a call.
+ *
+ * Must run before `fuse_superinstructions()`.
+ *
+ * @param prog The program to analyze.
+ * @param inputs Filled in with one set per instruction: the inputs of the
+ * routine starting there, or `MASK_IMPURE` if no call targets it or it is
+ * not pure.
+ * @return True if the analysis ran, false if memory ran out.
+ */
+bool compute_pure_inputs(const Program *prog, RegMask *inputs);
+
+#endif
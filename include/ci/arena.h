@@ -0,0 +1,66 @@
+#ifndef CI_ARENA_H
+#define CI_ARENA_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_INITIAL_BLOCK 4096  // Bytes of the first block; each later one is twice as large.
+
+/**
+ * @brief A block of memory an arena hands out, followed by its bytes.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;  // The block allocated before this one, or NULL.
+    size_t             size;  // Number of bytes after the header.
+} ArenaBlock;
+
+/**
+ * @brief A bump allocator whose allocations are all freed at once.
+ *
+ * Allocating moves a cursor through the newest block; when it runs out, a
+ * block twice the size of the last is taken from umalloc. There is no way to
+ * free a single allocation: `arena_free()` releases everything, one `ufree()`
+ * per block, and the blocks are few because they double.
+ */
+typedef struct {
+    ArenaBlock *blocks;  // The newest block, which allocations come from.
+    char       *cursor;  // The first free byte of the newest block.
+    char       *limit;   // The end of the newest block.
+} Arena;
+
+/**
+ * @brief Initializes an empty arena. It takes no memory until the first
+ * allocation.
+ *
+ * @param arena Pointer to the `Arena` to initialize.
+ */
+void arena_init(Arena *arena);
+
+/**
+ * @brief Allocates memory from an arena.
+ *
+ * @param arena Pointer to the arena.
+ * @param size Number of bytes to allocate.
+ * @param align Alignment of the memory; a power of two.
+ * @return A pointer to the memory, valid until `arena_free()`, or NULL if
+ * memory ran out.
+ */
+void *arena_alloc(Arena *arena, size_t size, size_t align);
+
+/**
+ * @brief Copies a string of known length into an arena.
+ *
+ * @param arena Pointer to the arena.
+ * @param str The characters to copy; need not be terminated.
+ * @param length Number of characters to copy.
+ * @return The NUL-terminated copy, or NULL if memory ran out.
+ */
+char *arena_strndup(Arena *arena, const char *str, size_t length);
+
+/**
+ * @brief Frees everything allocated from an arena and leaves it empty.
+ *
+ * @param arena Pointer to the arena to free.
+ */
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef CI_BATCH_H
+#define CI_BATCH_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define BATCH_MAX_THREADS 64  // Upper bound on the number of threads running a batch.
+
+/**
+ * @brief Runs one program of a batch.
+ *
+ * Called from any of the batch's threads at once, so it may only touch state
+ * of its own: guest memory is per interpreter, umalloc is thread safe, and
+ * everything it prints must go to `out`.
+ *
+ * @param path The path of the program.
+ * @param out The stream capturing the output of the run.
+ * @param ctx The context passed to `batch_run()`.
+ * @return The exit status of the run; anything but 0 counts as a failure.
+ */
+typedef int (*BatchRunner)(const char *path, FILE *out, void *ctx);
+
+/**
+ * @brief One program of a batch and, once it ran, its results.
+ */
+typedef struct {
+    char       *path;     // The path of the program.
+    char       *output;   // Everything the run printed, or NULL if it could not be captured.
+    size_t      length;   // Number of bytes in `output`.
+    int         status;   // What the runner returned.
+    double      millis;   // Wall time of the run, in milliseconds.
+    atomic_bool done;     // Set once the fields above hold the results.
+} BatchJob;
+
+/**
+ * @brief A list of programs to run side by side in one process.
+ */
+typedef struct {
+    BatchJob *jobs;      // The programs, in the order their output is printed.
+    size_t    count;     // Number of entries in `jobs`.
+    size_t    capacity;  // Number of entries allocated in `jobs`.
+} Batch;
+
+/**
+ * @brief Initializes an empty batch.
+ *
+ * @param batch Pointer to the `Batch` to initialize.
+ */
+void batch_init(Batch *batch);
+
+/**
+ * @brief Adds a program, or every `.s` file in a directory, to a batch.
+ *
+ * The files of a directory are added in the order of their names, and its
+ * subdirectories are not searched. A path that is not a directory is added
+ * as is; if it cannot be read, the run reports that in its output.
+ *
+ * @param batch Pointer to the `Batch` to add to.
+ * @param path The path of a program or of a directory of programs.
+ * @return True if the programs were added, false if memory ran out.
+ */
+bool batch_add(Batch *batch, const char *path);
+
+/**
+ * @brief Runs every program of a batch on a pool of threads.
+ *
+ * The output of each run is captured and printed to `out` as soon as it and
+ * every run before it finished, so it appears in batch order whatever order
+ * the runs end in. A header line before each output gives the path, the
+ * exit status and the wall time of the run. A summary line follows the last.
+ * If no thread starts, the calling thread runs the programs itself.
+ *
+ * @param batch Pointer to the `Batch` to run.
+ * @param thread_count Number of threads; 0 uses one per online processor.
+ * At most `BATCH_MAX_THREADS`.
+ * @param run The function running one program.
+ * @param ctx Passed through to `run`.
+ * @param out The stream to print the outputs and the summary to.
+ * @return The number of runs that failed, or -1 if the pool could not be set up.
+ */
+int batch_run(Batch *batch, size_t thread_count, BatchRunner run, void *ctx, FILE *out);
+
+/**
+ * @brief Frees the programs of a batch and their outputs.
+ *
+ * @param batch Pointer to the `Batch` to free.
+ */
+void batch_free(Batch *batch);
+
+#endif
@@ -1,13 +1,28 @@
 #ifndef CI_CMD_ARGS_CONFIG_H
 #define CI_CMD_ARGS_CONFIG_H
 #include <stdbool.h>
+#include <stddef.h>
+#include "memo.h"
 
 typedef struct {
-    bool  print_lex;     // Lex; do not parse
-    bool  print_parse;   // Print result of parsing. Implicitly performs lexing
-    bool  repl;          // Set when no arguments are supplied
-    char *in_filename;   // What are we running?
-    char *out_filename;  // File to output to
+    bool         print_lex;      // Lex; do not parse
+    bool         print_parse;    // Print result of parsing. Implicitly performs lexing
+    bool         repl;           // Set when no arguments are supplied
+    char        *in_filename;    // What are we running?
+    char        *out_filename;   // File to output to
+    size_t       max_depth;      // Maximum number of nested calls
+    bool         jit;            // Run natively compiled code when possible
+    bool         optimize;       // Run the dataflow optimizer before executing
+    size_t       memo_capacity;  // Results of pure calls to keep; 0 disables memoization
+    MemoEviction memo_eviction;  // How a full memo table makes room
+    bool         verbose;        // Report what the optimizer did, where warnings go
+    size_t       inline_size;    // Longest routine inlined; 0 disables inlining
+    size_t       inline_depth;   // Rounds of inlining
+    size_t       unroll;         // Iterations per test in unrolled loops; < 2 disables it
+    size_t       threads;        // Threads running independent pure calls; < 2 runs them in order
+    char       **batch_paths;    // Programs, or directories of them, to run as one batch
+    size_t       batch_count;    // Number of entries in `batch_paths`
+    size_t       batch_threads;  // Threads running the batch; 0 uses one per processor
 } CmdArgsConfig;
 
 void config_free(CmdArgsConfig *conf);
@@ -2,6 +2,7 @@
 #define CI_COMMAND_H
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "command_type.h"
 
 /**
@@ -44,24 +45,21 @@ typedef struct cmd {
     bool            is_a_string;       // Indicates if the first operand is a string.
     bool            is_b_string;       // Indicates if the second operand is a string.
     BranchCondition branch_condition;  // The branching condition for the command.
+    bool            is_linked;         // Indicates if `target` was resolved by the linker.
+    struct cmd     *target;            // Resolved destination of a branch or call (NULL
+                                       // branches off the end of the program).
 } Command;
 
-/**
- * @brief Frees memory associated with a command.
- *
- * @param command Pointer to the `Command` to be freed.
- */
-void free_command(Command *command);
-
 /**
  * @brief Prints the details of a command.
  *
  * Outputs information about the command, including its type, operands,
  * destination, and branching condition, in a human-readable format.
  *
+ * @param out The stream to print to.
  * @param cmd Pointer to the `Command` to print.
  */
-void print_command(Command *cmd);
+void print_command(FILE *out, Command *cmd);
 
 /**
  * @brief Prints the details of a single operand.
@@ -69,11 +67,12 @@ void print_command(Command *cmd);
  * Outputs the value of the operand and whether it is immediate or a string,
  * in a human-readable format.
  *
+ * @param out The stream to print to.
  * @param op The operand to print.
  * @param is_imm `true` if the operand is immediate, `false` otherwise.
  * @param is_str `true` if the operand is a string, `false` otherwise.
  */
-void print_command_op(Operand op, bool is_imm, bool is_str);
+void print_command_op(FILE *out, Operand op, bool is_imm, bool is_str);
 
 /**
  * @brief Prints a list of commands.
@@ -81,8 +80,9 @@ void print_command_op(Operand op, bool is_imm, bool is_str);
  * Outputs all commands in the given list, one by one, in a human-readable
  * format.
  *
+ * @param out The stream to print to.
  * @param cmd Pointer to the first `Command` in the list.
  */
-void print_commands(Command *cmd);
+void print_commands(FILE *out, Command *cmd);
 
 #endif
@@ -0,0 +1,40 @@
+#ifndef CI_FUSE_H
+#define CI_FUSE_H
+#include "program.h"
+
+/**
+ * @brief Replaces common instruction sequences with superinstructions.
+ *
+ * Recognizes a compare immediately followed by a conditional branch, and an
+ * add of an immediate immediately followed by such a pair (a typical loop
+ * latch). The first instruction of each sequence is rewritten into a single
+ * superinstruction that executes the whole sequence with one dispatch.
+ *
+ * The remaining instructions of the sequence are left in place, so jumps into
+ * the middle of it and every jump target index stay valid, and the fused
+ * compare still sets the interpreter's flags.
+ *
+ * @param prog Pointer to the `Program` to rewrite in place.
+ */
+void fuse_superinstructions(Program *prog);
+
+/**
+ * @brief Turns calls in tail position into tail calls.
+ *
+ * A call is in tail position when the next instruction to run after it
+ * returns is a ret, possibly through unconditional branches. A tail call
+ * inside a routine jumps to its target without pushing a frame, so the
+ * target's ret pops the current routine's frame and returns straight to its
+ * caller. That gives the same final state as the two returns would, while
+ * deep tail recursion runs in constant frame memory. With no frame on the
+ * stack, a tail call behaves like an ordinary call, because the top-level ret
+ * ends the program without restoring anything.
+ *
+ * Must run before `compute_save_masks()`, which sizes each caller's frame to
+ * cover what its tail-called routines clobber as well.
+ *
+ * @param prog Pointer to the `Program` to rewrite in place.
+ */
+void fuse_tail_calls(Program *prog);
+
+#endif
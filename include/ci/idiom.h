@@ -0,0 +1,43 @@
+#ifndef CI_IDIOM_H
+#define CI_IDIOM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "interpreter.h"
+#include "program.h"
+
+/**
+ * @brief Replaces code with a known closed form by a native kernel.
+ *
+ * Recognizes:
+ *
+ * - 32-bit SWAR popcount: the five mask, shift and add stages that sum bits
+ *   in pairs, nibbles, bytes and halves. Becomes a host popcount.
+ * - Counted accumulation: a loop stepping a counter by one until it equals a
+ *   bound, adding an invariant or the counter itself to an accumulator on the
+ *   way. Becomes its closed form in wrapping arithmetic, so even a loop that
+ *   only ends after the counter wraps around gets the same result.
+ *
+ * The kernel, an `OP_IDIOM`, leaves every variable and flag exactly as the
+ * code it replaces would. It takes the place of the first instruction only;
+ * the rest stays, so jumps into the middle still run the original code.
+ *
+ * Only the interpreter runs `OP_IDIOM`, so this must be the last pass before
+ * `fuse_superinstructions()`.
+ *
+ * @param prog Pointer to the `Program` to rewrite.
+ * @param log Stream to report each rewrite on, or NULL for none.
+ * @return The number of rewrites. Stops early if memory runs out.
+ */
+size_t recognize_idioms(Program *prog, FILE *log);
+
+/**
+ * @brief Executes an `OP_IDIOM`.
+ *
+ * @param intr Pointer to the `Interpreter` holding guest state.
+ * @param prog Pointer to the `Program` being run.
+ * @param ins The `OP_IDIOM` instruction.
+ * @return The index of the instruction the replaced code would continue at.
+ */
+size_t idiom_run(Interpreter *intr, const Program *prog, const Instr *ins);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef CI_INLINE_H
+#define CI_INLINE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "program.h"
+
+#define DEFAULT_INLINE_SIZE  8  // Longest routine, in instructions, copied into its callers.
+#define DEFAULT_INLINE_DEPTH 2  // Rounds of inlining, so levels of nested routines flattened.
+
+/**
+ * @brief Replaces calls to small leaf routines by copies of their bodies.
+ *
+ * A routine qualifies if everything reachable from its entry fits in
+ * `max_size` instructions and ends in a ret, without calls, halts or
+ * unresolved labels. Since it calls nothing, it cannot be recursive. Each ret
+ * in the copy becomes a jump past it.
+ *
+ * A ret restores x1 to x31. The copy keeps that for the variables it writes
+ * that are still live after the call by working on variables the program
+ * never mentions instead, copying the originals in where the body reads them
+ * and zeroing the stand-ins again on the way out. Bodies that need this may
+ * not access memory, since a failing access would print the stand-ins. Calls
+ * needing more stand-ins than there are unused variables stay calls.
+ *
+ * Each round inlines the routines that are leaves at its start, which can turn
+ * their callers into leaves for the next one. Removing frames also removes
+ * the call depth they count against, as frameless tail calls already do.
+ *
+ * Must run before `fuse_tail_calls()`, `compute_save_masks()` and
+ * `fuse_superinstructions()`.
+ *
+ * @param prog Pointer to the `Program` to rewrite.
+ * @param max_size Longest routine inlined; 0 disables inlining.
+ * @param max_depth Number of rounds.
+ * @param log Stream to report each inlined call on, or NULL for none.
+ * @return True if every round ran, false if memory ran out. The program is
+ * valid either way.
+ */
+bool inline_calls(Program *prog, size_t max_size, size_t max_depth, FILE *log);
+
+#endif
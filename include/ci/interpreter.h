@@ -1,17 +1,23 @@
 #ifndef CI_INTERPRETER_H
 #define CI_INTERPRETER_H
+#include <stdint.h>
 #include "command.h"
-#include "label_map.h"
+#include "mem.h"
+#include "program.h"
 
-#define NUM_VARIABLES 32  // Maximum number of defined variables.
+#define DEFAULT_MAX_DEPTH SIZE_MAX  // No limit on nested calls unless -d sets one.
+#define INITIAL_FRAMES    64      // Frames allocated by the first call.
+
+struct MemoTable;
+struct ParallelContext;
 
 /**
  * @brief Represents a single entry in the interpreter's call stack.
  */
-typedef struct st_entry {
-    Command         *command;                   // The command stored in this stack entry.
-    int64_t          variables[NUM_VARIABLES];  // Variables in this stack frame.
-    struct st_entry *next;                      // Pointer to the next stack entry.
+typedef struct {
+    const Instr *caller;                    // The call instruction that pushed this entry.
+    uint32_t     saved;                     // Mask of the variables saved in this frame.
+    int64_t      variables[NUM_VARIABLES];  // Variables in this stack frame.
 } StackEntry;
 
 /**
@@ -22,30 +28,56 @@ typedef struct {
                                        // interpreter.
     bool had_error;                    // Flag indicating if an error occurred during
                                        // interpretation.
-    LabelMap *label_map;               // Pointer to the map of labels for branch resolution.
-    bool      is_greater;              //  Flag indicating the result of the last comparison
+    bool is_greater;                   //  Flag indicating the result of the last comparison
                                        //  (greater).
     bool        is_less;               // Flag indicating the result of the last comparison (less).
     bool        is_equal;              // Flag indicating the result of the last comparison (equal).
-    StackEntry *the_stack;             // Pointer to the top of the interpreter's stack.
+    StackEntry             *frames;          // Contiguous call stack; the top is the last entry.
+    size_t                  frame_count;     // Number of frames currently on the stack.
+    size_t                  frame_capacity;  // Number of frames allocated in `frames`.
+    size_t                  max_depth;       // Calls nested deeper than this raise an error.
+    struct MemoTable       *memo;            // Results of pure calls to reuse, or NULL.
+    struct ParallelContext *parallel;        // Fork-join state of this interpreter, or NULL.
+    FILE                   *out;             // Where the program prints; stdout by default.
+    Memory                  memory;          // The program's memory, owned by the interpreter.
 } Interpreter;
 
 /**
  * @brief Initializes the interpreter state.
  *
  * @param intr Pointer to the `Interpreter` to initialize.
- * @param map Pointer to the `LabelMap` used for jump resolution.
+ * @param max_depth The maximum number of nested calls before execution stops
+ * with a stack overflow error, or `DEFAULT_MAX_DEPTH` to stop only when the
+ * stack cannot grow.
+ * @param mem_capacity The number of bytes of memory the program gets.
+ * @return True if the memory was allocated, false if memory ran out. The
+ * interpreter is usable either way, with no memory in the second case.
  */
-void interpreter_init(Interpreter *intr, LabelMap *map);
+bool interpreter_init(Interpreter *intr, size_t max_depth, size_t mem_capacity);
 
 /**
- * @brief Executes a list of commands using the interpreter.
+ * @brief Releases the memory and call stack of an interpreter.
  *
- * @param intr Pointer to the `Interpreter` that will execute the commands.
- * @param commands Pointer to the first `Command` in the list of commands to
- * interpret.
+ * @param intr Pointer to the `Interpreter` to free.
  */
-void interpret(Interpreter *intr, Command *commands);
+void interpreter_free(Interpreter *intr);
+
+/**
+ * @brief Executes a program using the interpreter.
+ *
+ * @param intr Pointer to the `Interpreter` that will execute the program.
+ * @param prog Pointer to the `Program` built by `program_build()`.
+ */
+void interpret(Interpreter *intr, Program *prog);
+
+/**
+ * @brief Executes a program from some instruction other than the first.
+ *
+ * @param intr Pointer to the `Interpreter` that will execute the program.
+ * @param prog Pointer to the `Program` built by `program_build()`.
+ * @param entry The index of the first instruction to execute.
+ */
+void interpret_from(Interpreter *intr, Program *prog, size_t entry);
 
 /**
  * @brief Prints the current state of the interpreter.
@@ -57,4 +89,41 @@ void interpret(Interpreter *intr, Command *commands);
  */
 void print_interpreter_state(Interpreter *intr);
 
+/**
+ * @brief Pushes a frame for a call, saving the variables selected by `saved`.
+ *
+ * @param intr Pointer to the `Interpreter` making the call.
+ * @param caller The call instruction, which the matching return resumes after.
+ * @param saved Bit `i` saves variable `xi`; see `Program.save_masks`.
+ * @return True if the frame was pushed, false on stack overflow or allocation
+ * failure.
+ */
+bool interpreter_push_frame(Interpreter *intr, const Instr *caller, uint32_t saved);
+
+/**
+ * @brief Pops the top frame, restoring the variables it saved.
+ *
+ * @param intr Pointer to the `Interpreter` returning from a call.
+ * @return The call instruction that pushed the frame, or NULL if the stack was
+ * empty.
+ */
+const Instr *interpreter_pop_frame(Interpreter *intr);
+
+/**
+ * @brief Releases the call stack once execution is over.
+ *
+ * @param intr Pointer to the `Interpreter` owning the stack.
+ */
+void interpreter_free_frames(Interpreter *intr);
+
+/**
+ * @brief Prints a value in a specified base.
+ *
+ * @param intr Pointer to the `Interpreter` holding variable state.
+ * @param varOrImm The value to print (or the address of the string to print).
+ * @param base The base to print in: d, x, b or s.
+ * @return True whether the print was successful, false otherwise.
+ */
+bool print_base(Interpreter *intr, int64_t varOrImm, char base);
+
 #endif
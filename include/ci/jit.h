@@ -0,0 +1,123 @@
+#ifndef CI_JIT_H
+#define CI_JIT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "interpreter.h"
+#include "program.h"
+#include "x86_emit.h"
+
+// Displacements of the guest state from rbx, which generated code points at
+// the `Interpreter`.
+#define JIT_VAR(r)       ((int32_t) (offsetof(Interpreter, variables) + (r) * sizeof(int64_t)))
+#define JIT_MEMORY       ((int32_t) offsetof(Interpreter, memory))
+#define JIT_FLAG_GREATER ((int32_t) offsetof(Interpreter, is_greater))
+#define JIT_FLAG_LESS    ((int32_t) offsetof(Interpreter, is_less))
+#define JIT_FLAG_EQUAL   ((int32_t) offsetof(Interpreter, is_equal))
+#define JIT_HAD_ERROR    ((int32_t) offsetof(Interpreter, had_error))
+
+/**
+ * @brief A program translated into native x86-64 machine code.
+ *
+ * Each instruction is expanded from a fixed template. Guest variables stay in
+ * the `Interpreter`, addressed off a host register, and a compare directly
+ * followed by its branch is tested straight from the host flags. Anything that
+ * can fail (memory accesses, prints, calls) calls back into the same C code the
+ * interpreter uses, so both engines print exactly the same output.
+ */
+typedef struct {
+    uint8_t       *code;     // Executable machine code, mapped with mmap.
+    size_t         size;     // Size of the mapping in bytes.
+    uint8_t      **targets;  // Native address of each instruction, indexed like
+                             // `Program.code`; used to return from calls.
+    const Program *prog;     // The program the code was generated from.
+} JitCode;
+
+/**
+ * @brief Translates a program into native code.
+ *
+ * The program must not have been through `fuse_superinstructions()`. If the
+ * host is not x86-64 Linux, or the program contains an instruction the JIT has
+ * no template for, nothing is generated and the caller should fall back to
+ * `interpret()`.
+ *
+ * @param jit Pointer to the `JitCode` to fill in.
+ * @param prog Pointer to the `Program` to translate. It must outlive `jit`.
+ * @return True if the program was translated, false otherwise.
+ */
+bool jit_compile(JitCode *jit, const Program *prog);
+
+/**
+ * @brief Runs translated code, with the same semantics as `interpret()`.
+ *
+ * @param jit Pointer to the `JitCode` built by `jit_compile()`.
+ * @param intr Pointer to the initialized `Interpreter` holding guest state.
+ */
+void jit_run(JitCode *jit, Interpreter *intr);
+
+/**
+ * @brief Unmaps the generated code and frees the resources of a `JitCode`.
+ *
+ * @param jit Pointer to the `JitCode` to free.
+ */
+void jit_free(JitCode *jit);
+
+/*
+ * Building blocks shared with the trace compiler. They are only defined when
+ * HAVE_NATIVE_CODE is.
+ */
+
+/**
+ * @brief Copies the host flags left by a compare into the interpreter's flags.
+ *
+ * setcc leaves the host flags intact, so a branch can still test them.
+ *
+ * @param e The emitter to append to.
+ * @param is_unsigned True if the compare was unsigned.
+ */
+void jit_emit_set_flags(Emitter *e, bool is_unsigned);
+
+/**
+ * @brief Tests a branch condition against the interpreter's flags.
+ *
+ * @param e The emitter to append to.
+ * @param cond The condition, counted from `OP_B_EQ` (eq, ne, gt, lt, ge, le).
+ * @return The condition code that is set when the branch is taken.
+ */
+uint8_t jit_emit_flag_test(Emitter *e, int cond);
+
+/**
+ * @brief Returns the condition code testing a branch condition directly
+ * against the host flags left by a compare.
+ *
+ * @param cond The condition, counted from `OP_B_EQ`.
+ * @param is_unsigned True if the compare was unsigned.
+ * @return The condition code that is set when the branch is taken.
+ */
+uint8_t jit_branch_cc(int cond, bool is_unsigned);
+
+/**
+ * @brief Maps an add, sub, and, orr, eor or cmp opcode to its `ALU_*` operation.
+ *
+ * @param op The opcode.
+ * @return The matching `ALU_*` operation.
+ */
+uint8_t jit_alu_op(uint8_t op);
+
+/**
+ * @brief Maps an lsl, lsr or asr opcode to its `SHIFT_*` operation.
+ *
+ * @param op The opcode.
+ * @return The matching `SHIFT_*` operation.
+ */
+uint8_t jit_shift_op(uint8_t op);
+
+/**
+ * @brief Prints the error for a jump to a label that does not exist.
+ *
+ * @param intr The interpreter running the generated code.
+ * @param label The name of the label.
+ */
+void jit_label_not_found(Interpreter *intr, const char *label);
+
+#endif
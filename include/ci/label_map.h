@@ -1,5 +1,6 @@
 #ifndef CI_LABEL_MAP_H
 #define CI_LABEL_MAP_H
+#include "arena.h"
 #include "command.h"
 
 /**
@@ -7,6 +8,7 @@
  *
  * Each entry contains an identifier (label), a corresponding command,
  * and a pointer to the next entry in the chain used for handling collisions.
+ * Entries live in the arena of their map.
  */
 typedef struct entry {
     char         *id;       // The identifier for this label.
@@ -20,6 +22,7 @@ typedef struct entry {
 typedef struct {
     Entry **entries;   // Array of pointers to entry chains.
     int     capacity;  // The number of buckets in the map.
+    Arena  *arena;     // Owns the entries.
 } LabelMap;
 
 /**
@@ -27,15 +30,15 @@ typedef struct {
  *
  * @param map Pointer to the `LabelMap` to initialize.
  * @param capacity The number of buckets to allocate for the map.
+ * @param arena The arena the entries are allocated from.
  * @return true if the map was successfully initialized, false otherwise.
  */
-bool label_map_init(LabelMap *map, int capacity);
+bool label_map_init(LabelMap *map, int capacity, Arena *arena);
 
 /**
  * @brief Frees the resources associated with a label map.
  *
- * Releases all memory allocated for the map, including entries and their
- * contents.
+ * Releases the buckets of the map. The entries go with its arena.
  *
  * @param map Pointer to the LabelMap to free.
  */
@@ -48,7 +51,8 @@ void label_map_free(LabelMap *map);
  * with the same ID already exists, its associated command will be replaced.
  *
  * @param map Pointer to the label map.
- * @param id The identifier for the label.
+ * @param id The identifier for the label, which must live as long as the
+ * arena of the map; it is not copied.
  * @param command Pointer to the `Command` associated with the label.
  * @return true if the label was successfully added, false otherwise.
  */
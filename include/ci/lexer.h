@@ -39,8 +39,9 @@ Token lexer_next_token(Lexer *lex);
  * If called, the given lexer must be reinitialized if one wishes to re-lex the
  * tokens.
  *
+ * @param out The stream to print to.
  * @param lex A pointer to the lexer, the input stream.
  */
-void print_lexed_tokens(Lexer *lex);
+void print_lexed_tokens(FILE *out, Lexer *lex);
 
 #endif
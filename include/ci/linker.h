@@ -0,0 +1,27 @@
+#ifndef CI_LINKER_H
+#define CI_LINKER_H
+#include <stdbool.h>
+#include <stdio.h>
+#include "command.h"
+#include "label_map.h"
+
+/**
+ * @brief Resolves every branch and call label to the command it refers to.
+ *
+ * Walks the parsed command list once and stores the destination of each
+ * `CMD_BRANCH` and `CMD_CALL` in its `target` field, so the interpreter never
+ * has to consult the label map while running. A branch to a label with no
+ * command after it resolves to NULL, which ends the program when taken.
+ *
+ * Unresolved labels are reported on `err` before execution starts. They are
+ * not fatal on their own: the commands are left unlinked and the interpreter
+ * only raises an error if one of them is actually taken.
+ *
+ * @param commands Pointer to the first `Command` in the list to link.
+ * @param map Pointer to the `LabelMap` filled in by the parser.
+ * @param err The stream to report unresolved labels on.
+ * @return True if every label was resolved, false otherwise.
+ */
+bool link_commands(Command *commands, LabelMap *map, FILE *err);
+
+#endif
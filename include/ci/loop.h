@@ -0,0 +1,47 @@
+#ifndef CI_LOOP_H
+#define CI_LOOP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "program.h"
+
+#define DEFAULT_UNROLL 4  // Copies of the body per guard in an unrolled loop.
+
+/**
+ * @brief Optimizes the natural loops of a program.
+ *
+ * Loops are found from back edges to an instruction that dominates their
+ * source. Loops that call or return are left alone. Runs, until nothing
+ * changes:
+ *
+ * - Invariant hoisting: arithmetic whose operands the loop never writes, and
+ *   whose result the loop writes nowhere else, moves to a preheader.
+ * - Strength reduction: a variable the loop recomputes as a shifted basic
+ *   induction variable plus a constant is stepped alongside it instead.
+ *
+ * Both write their variable before the loop, so they only apply if its old
+ * value is dead on entry to the loop. The state printed when the program ends
+ * reads every variable, so that mostly holds for loops in routines, whose ret
+ * restores what they write, and not for loops the program may leave before
+ * writing the variable, such as the inner loop of knapsack_simple.s.
+ *
+ * Then every small counted loop, a single block stepping a variable by a
+ * constant until a compare against an immediate fails, gets an unrolled
+ * copy. The copy runs `unroll` iterations per test for as long as that many
+ * are left, then hands over to the original loop. Bodies that read or set
+ * the flags, or can fail, are not unrolled, since the copy tests the flags
+ * differently.
+ *
+ * Must run before `fuse_tail_calls()`, `compute_save_masks()` and
+ * `fuse_superinstructions()`.
+ *
+ * @param prog Pointer to the `Program` to optimize.
+ * @param unroll Iterations per test in unrolled loops; below 2 disables
+ * unrolling.
+ * @param log Stream to report each change on, or NULL for none.
+ * @return True if every pass ran, false if memory ran out. The program is
+ * valid either way.
+ */
+bool optimize_loops(Program *prog, size_t unroll, FILE *log);
+
+#endif
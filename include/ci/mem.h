@@ -3,32 +3,149 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
-#define MEM_CAPACITY 1024  // Maximum capacity of available memory.
+#define MEM_CAPACITY 1024  // Default capacity of available memory.
+
+/**
+ * @brief The memory of one running program, zeroed at creation.
+ */
+typedef struct {
+    uint8_t *bytes;     // The contents, or NULL if the capacity is 0.
+    size_t   capacity;  // Number of bytes in `bytes`.
+} Memory;
+
+/**
+ * @brief Allocates a zeroed memory.
+ *
+ * @param mem Pointer to the `Memory` to initialize.
+ * @param capacity Number of bytes; 0 makes every access fail.
+ * @return True if the memory was allocated, false if memory ran out. `mem`
+ * has a capacity of 0 in that case.
+ */
+bool mem_init(Memory *mem, size_t capacity);
+
+/**
+ * @brief Frees the contents of a memory.
+ *
+ * @param mem Pointer to the `Memory` to free.
+ */
+void mem_free(Memory *mem);
 
 /**
  * @brief Loads the value from memory into the given destination.
  *
+ * @param mem The memory to load from.
  * @param destination The buffer to load values into.
  * @param offset The offset in memory where to start loading from.
  * @param bytes The amount of bytes to load starting from the given offset.
  * @return True if the value could be loaded, false otherwise.
  */
-bool mem_load(uint8_t *destination, size_t offset, size_t bytes);
+bool mem_load(const Memory *mem, uint8_t *destination, size_t offset, size_t bytes);
 
 /**
  * @brief Stores the given value at the specified memory address.
  *
+ * @param mem The memory to store to.
  * @param source The buffer to read the value from.
  * @param offset The offset in memory where to start storing.
  * @param bytes The amount of bytes to store starting at `offset`.
  * @return True if the value was stored, false otherwise.
  */
-bool mem_store(uint8_t *source, size_t offset, size_t bytes);
+bool mem_store(Memory *mem, uint8_t *source, size_t offset, size_t bytes);
+
+/**
+ * @brief Loads a little-endian value into a 64-bit variable.
+ *
+ * The fast path used by both execution engines: the value is zero-extended
+ * straight into `value` instead of going through a byte buffer.
+ *
+ * @param mem The memory to load from.
+ * @param value The variable to load into. It is zeroed if the load fails.
+ * @param offset The offset in memory where to start loading from.
+ * @param bytes The amount of bytes to load: 1, 2, 4 or 8.
+ * @return True if the value could be loaded, false otherwise.
+ */
+bool mem_load_word(const Memory *mem, int64_t *value, size_t offset, size_t bytes);
+
+/**
+ * @brief Stores the low `bytes` bytes of a value, little-endian.
+ *
+ * @param mem The memory to store to.
+ * @param value The value to store.
+ * @param offset The offset in memory where to start storing.
+ * @param bytes The amount of bytes to store: 1, 2, 4 or 8.
+ * @return True if the value was stored, false otherwise.
+ */
+bool mem_store_word(Memory *mem, int64_t value, size_t offset, size_t bytes);
+
+/**
+ * @brief Stores a NUL-terminated string in memory, one byte at a time.
+ *
+ * Bytes before the first one out of bounds are still written.
+ *
+ * @param mem The memory to store to.
+ * @param str The string to store.
+ * @param offset The offset of the first character.
+ * @return True if the whole string, terminator included, was stored.
+ */
+bool mem_store_string(Memory *mem, const char *str, size_t offset);
+
+/**
+ * @brief Sets a range of memory to one byte value.
+ *
+ * @param mem The memory to write.
+ * @param offset The offset of the first byte.
+ * @param value The value to write.
+ * @param length Number of bytes to write.
+ * @return True if the range is in bounds and was written, false otherwise.
+ */
+bool mem_fill(Memory *mem, size_t offset, uint8_t value, size_t length);
+
+/**
+ * @brief Copies a range of bytes, within one memory or between two.
+ *
+ * The ranges may overlap. Copying a whole memory into another of the same
+ * capacity takes a snapshot of it, or restores one.
+ *
+ * @param dst The memory to write.
+ * @param dst_offset The offset of the first byte written.
+ * @param src The memory to read.
+ * @param src_offset The offset of the first byte read.
+ * @param length Number of bytes to copy.
+ * @return True if both ranges are in bounds and the bytes were copied.
+ */
+bool mem_copy(Memory *dst, size_t dst_offset, const Memory *src, size_t src_offset,
+              size_t length);
+
+/**
+ * @brief Compares two ranges of bytes, within one memory or between two.
+ *
+ * @param a The memory of the first range.
+ * @param a_offset The offset of the first range.
+ * @param b The memory of the second range.
+ * @param b_offset The offset of the second range.
+ * @param length Number of bytes to compare.
+ * @param order Set to a negative, zero or positive value as the first range
+ * sorts before, equal to or after the second, comparing unsigned bytes.
+ * @return True if both ranges are in bounds, false otherwise.
+ */
+bool mem_compare(const Memory *a, size_t a_offset, const Memory *b, size_t b_offset,
+                 size_t length, int *order);
+
+/**
+ * @brief Clears memory, as before the first store.
+ *
+ * @param mem The memory to clear.
+ */
+void mem_reset(Memory *mem);
 
 /**
  * @brief Prints the memory state to the console
+ *
+ * @param mem The memory to print.
+ * @param out The stream to print to.
  */
-void mem_print(void);
+void mem_print(const Memory *mem, FILE *out);
 
 #endif
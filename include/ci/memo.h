@@ -0,0 +1,118 @@
+#ifndef CI_MEMO_H
+#define CI_MEMO_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "analysis.h"
+#include "interpreter.h"
+#include "program.h"
+
+#define MEMO_MAX_INPUTS 8  // Routines reading more variables than this are not memoized.
+#define MEMO_WAYS       4  // Entries per set of the table.
+
+/**
+ * @brief Which entry a full set gives up for a new one.
+ */
+typedef enum {
+    MEMO_EVICT_NONE,  // Keep the entries already there; the new result is dropped.
+    MEMO_EVICT_FIFO,  // Replace the entry inserted first.
+    MEMO_EVICT_LRU,   // Replace the entry hit least recently.
+} MemoEviction;
+
+/**
+ * @brief The result of one call to a pure routine, keyed by its inputs.
+ */
+typedef struct {
+    uint64_t stamp;                    // When the entry was inserted, or last hit under LRU.
+    uint32_t routine;                  // Index of the routine's first instruction.
+    bool     valid;                    // Set once the entry holds a result.
+    uint8_t  flags_in;                 // The flags on entry, if the routine reads them.
+    uint8_t  flags_out;                // The flags on return.
+    int64_t  inputs[MEMO_MAX_INPUTS];  // The variables read, in register order.
+    int64_t  result;                   // x0 on return.
+} MemoEntry;
+
+/**
+ * @brief A call whose result is stored once its frame returns.
+ */
+typedef struct {
+    size_t    depth;  // `frame_count` while the callee runs.
+    MemoEntry key;    // The routine and its inputs.
+} MemoPending;
+
+/**
+ * @brief The memoization state for one run of a program.
+ *
+ * A call to a pure routine (see `compute_pure_inputs()`) looks up its inputs
+ * in a bounded, set-associative table. On a hit the call is skipped and the
+ * stored x0 and flags are applied instead; on a miss the call runs and its
+ * result is stored when it returns.
+ */
+typedef struct MemoTable {
+    RegMask     *inputs;            // Inputs of the routine at each index, or `MASK_IMPURE`.
+    MemoEntry   *entries;           // `set_count` sets of `MEMO_WAYS` entries.
+    size_t       set_count;         // Number of sets; a power of two.
+    MemoEviction eviction;          // How full sets make room.
+    uint64_t     clock;             // Source of entry stamps.
+    MemoPending *pending;           // Calls being recorded, innermost last.
+    size_t       pending_count;     // Number of entries in `pending`.
+    size_t       pending_capacity;  // Number of entries allocated in `pending`.
+    size_t       hits;              // Calls answered from the table.
+    size_t       misses;            // Calls to pure routines that had to run.
+    size_t       evictions;         // Entries replaced by newer results.
+} MemoTable;
+
+/**
+ * @brief Finds the pure routines of a program and allocates an empty table.
+ *
+ * Must run before `fuse_superinstructions()`.
+ *
+ * @param memo Pointer to the `MemoTable` to initialize.
+ * @param prog Pointer to the `Program` about to run.
+ * @param capacity Upper bound on the number of results kept; rounded down to
+ * a power of two number of sets, but at least one set.
+ * @param eviction How a full set makes room for a new result.
+ * @return True on success, false if memory ran out.
+ */
+bool memo_init(MemoTable *memo, const Program *prog, size_t capacity, MemoEviction eviction);
+
+/**
+ * @brief Handles a call about to push a frame.
+ *
+ * On a hit, x0 and the flags are set from the stored result. On a miss of a
+ * pure routine, the call is recorded so `memo_return()` can store its result.
+ * A call that would overflow the stack is never skipped, so it still raises
+ * the error.
+ *
+ * @param memo Pointer to the `MemoTable` of the run.
+ * @param intr Pointer to the `Interpreter` making the call.
+ * @param routine The index of the routine called.
+ * @return True if the call can be skipped, false if it must run.
+ */
+bool memo_call(MemoTable *memo, Interpreter *intr, size_t routine);
+
+/**
+ * @brief Handles a return about to pop a frame, storing the result if the
+ * frame belongs to a recorded call.
+ *
+ * @param memo Pointer to the `MemoTable` of the run.
+ * @param intr Pointer to the `Interpreter` returning.
+ */
+void memo_return(MemoTable *memo, Interpreter *intr);
+
+/**
+ * @brief Prints the hit, miss and eviction counters.
+ *
+ * @param memo Pointer to the `MemoTable` to report on.
+ * @param out The stream to print to.
+ */
+void memo_print_stats(const MemoTable *memo, FILE *out);
+
+/**
+ * @brief Frees the resources of a `MemoTable`.
+ *
+ * @param memo Pointer to the `MemoTable` to free.
+ */
+void memo_free(MemoTable *memo);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CI_OPTIMIZE_H
+#define CI_OPTIMIZE_H
+#include <stdbool.h>
+#include "program.h"
+
+/**
+ * @brief Simplifies a program without changing anything it prints.
+ *
+ * Runs, until nothing changes:
+ *
+ * - Constant and copy propagation over the control-flow graph. Operations on
+ *   constants are folded into moves, constant operands are turned into
+ *   immediates, and copies are replaced by their source.
+ * - Branch folding: a branch whose flags are known becomes unconditional, or
+ *   disappears if it is never taken.
+ * - Dead-store elimination: operations whose results are never observed are
+ *   removed. Since the final state is printed, only values that are
+ *   overwritten before the program can end are dead.
+ * - Unreachable-code removal.
+ *
+ * Must run before `fuse_tail_calls()`, `compute_save_masks()` and
+ * `fuse_superinstructions()`. On allocation failure the program is left as it
+ * was, or partly optimized, and is still valid either way.
+ *
+ * @param prog Pointer to the `Program` to optimize.
+ * @return True if every pass ran, false if memory ran out.
+ */
+bool optimize_program(Program *prog);
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef CI_PARALLEL_H
+#define CI_PARALLEL_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+#include "analysis.h"
+#include "interpreter.h"
+#include "program.h"
+
+#define PARALLEL_MAX_THREADS 64   // Upper bound on the number of threads, the main one included.
+#define PARALLEL_FORK_DEPTH  12   // Calls nested deeper than this never fork.
+#define PARALLEL_MAX_GAP     16   // Longest run of instructions between the two calls of a pair.
+#define PARALLEL_DEQUE_SIZE  256  // Tasks a worker can have queued; further forks do not fork.
+#define PARALLEL_MAX_NESTING 32   // Tasks a waiting thread nests before it only waits.
+
+struct ucache_struct;
+
+/**
+ * @brief What the interpreter does with a call after `parallel_call()`.
+ */
+typedef enum {
+    PARALLEL_CALL,   // Make the call.
+    PARALLEL_SKIP,   // A task already made it; x0 and the flags hold its result.
+    PARALLEL_ABORT,  // Stop quietly; the task running this interpreter is not needed.
+} ParallelAction;
+
+/**
+ * @brief One call to a pure routine, run on whichever thread gets to it first.
+ */
+typedef struct {
+    atomic_bool done;                      // Set once the fields below hold the result.
+    bool        ok;                        // Set if the call returned without an error.
+    uint32_t    routine;                   // Index of the routine called.
+    size_t      depth;                     // Frames on the stack at the call.
+    int64_t     variables[NUM_VARIABLES];  // The variables at the call; x0 is the result once done.
+    bool        is_greater;                // The flags at the call, then on return.
+    bool        is_less;
+    bool        is_equal;
+} ParallelTask;
+
+/**
+ * @brief The tasks queued by one thread. The owner pushes and pops at the
+ * bottom; idle threads steal the oldest task from the top.
+ */
+typedef struct {
+    struct Parallel *parallel;                     // The pool this deque belongs to.
+    mtx_t            lock;                         // Guards the fields below.
+    ParallelTask    *tasks[PARALLEL_DEQUE_SIZE];   // A ring buffer of queued tasks.
+    size_t           top;                          // Index of the oldest task in `tasks`.
+    size_t           count;                        // Number of tasks queued.
+} ParallelDeque;
+
+/**
+ * @brief A task an interpreter forked and still has to collect.
+ */
+typedef struct {
+    size_t        depth;  // `frame_count` at the fork, and so at the call the task makes.
+    size_t        site;   // The call the task makes in its place.
+    ParallelTask *task;   // The task.
+} ParallelJoin;
+
+/**
+ * @brief The fork-join state of one interpreter.
+ */
+typedef struct ParallelContext {
+    struct Parallel *parallel;       // The pool the interpreter forks onto.
+    size_t           worker;         // The thread running the interpreter.
+    size_t           base_depth;     // Frames below the interpreter's own, on the main stack.
+    size_t           nesting;        // Tasks this one runs inside on the same thread.
+    bool             in_task;        // Set for the interpreter of a task.
+    ParallelJoin    *joins;          // Forks still to collect, innermost last.
+    size_t           join_count;     // Number of entries in `joins`.
+    size_t           join_capacity;  // Number of entries allocated in `joins`.
+} ParallelContext;
+
+/**
+ * @brief A work-stealing pool running independent pure calls side by side.
+ *
+ * Two calls form a pair if the second goes to a pure routine (see
+ * `compute_pure_inputs()`) and follows the first after at most
+ * `PARALLEL_MAX_GAP` branch-free arithmetic and compare instructions, none of
+ * which carry x0 or the flags the first call returns into the inputs of the
+ * second. At the first call of a pair, the variables the second call will see
+ * are computed right away and the second call is queued as a task. The
+ * caller then runs the first call itself. On reaching the second call, it
+ * takes the result of the task, which it runs itself if no other thread has
+ * started it yet.
+ *
+ * A task runs on a copy of the variables in an interpreter of its own, and
+ * pure routines neither print nor touch memory, so the output is the same as
+ * that of a sequential run. A task that fails, which for a pure routine can
+ * only be a stack overflow, is thrown away and the call made again in order,
+ * so errors are reported exactly where a sequential run reports them.
+ */
+typedef struct Parallel {
+    Program              *prog;          // The program being run.
+    Instr                *code;          // The unfused instructions, to compute a task's variables.
+    uint32_t             *partner;       // Second call of the pair each call starts, or UINT32_MAX.
+    size_t                max_depth;     // The call depth limit of the run.
+    size_t                thread_count;  // Number of threads, the main one included.
+    thrd_t               *threads;       // Threads 1 and up; thread 0 is the main one.
+    ParallelDeque        *deques;        // The tasks queued by each thread.
+    struct ucache_struct *tasks;         // The slots every task is allocated from.
+    mtx_t                 lock;          // Lets idle threads sleep on `wake`.
+    cnd_t                 wake;          // Signalled when a task is queued or the pool stops.
+    atomic_size_t         queued;        // Number of tasks in all deques.
+    atomic_size_t         sleeping;      // Number of threads waiting on `wake`.
+    atomic_bool           stop;          // Set when the run is over.
+    atomic_size_t         forks;         // Number of tasks queued.
+    atomic_size_t         steals;        // Number of tasks run by a thread other than their own.
+    ParallelContext       main;          // The fork-join state of the main interpreter.
+} Parallel;
+
+/**
+ * @brief Finds the pairs of independent calls and starts the worker threads.
+ *
+ * Must run before `fuse_superinstructions()`.
+ *
+ * @param parallel Pointer to the `Parallel` to initialize.
+ * @param prog Pointer to the `Program` about to run.
+ * @param thread_count Number of threads, the main one included; at most
+ * `PARALLEL_MAX_THREADS`.
+ * @param max_depth The call depth limit of the run.
+ * @return True if the pool is running, false if there is nothing to run in
+ * parallel, fewer than two threads were asked for, or starting failed.
+ */
+bool parallel_init(Parallel *parallel, Program *prog, size_t thread_count, size_t max_depth);
+
+/**
+ * @brief Handles a call about to push a frame.
+ *
+ * Collects the task standing in for this call if there is one, and otherwise
+ * forks the second call of the pair this call starts.
+ *
+ * @param ctx Pointer to the `ParallelContext` of the interpreter.
+ * @param intr Pointer to the `Interpreter` making the call.
+ * @param site The index of the call.
+ * @return What the interpreter should do with the call.
+ */
+ParallelAction parallel_call(ParallelContext *ctx, Interpreter *intr, size_t site);
+
+/**
+ * @brief Prints the fork and steal counters, and the hit and refill counters
+ * of the task cache.
+ *
+ * @param parallel Pointer to the `Parallel` to report on.
+ * @param out The stream to print to.
+ */
+void parallel_print_stats(const Parallel *parallel, FILE *out);
+
+/**
+ * @brief Stops the worker threads and frees the resources of a `Parallel`.
+ *
+ * Tasks whose results are no longer needed, because the main interpreter
+ * stopped early, are abandoned at their next call.
+ *
+ * @param parallel Pointer to the `Parallel` to free.
+ */
+void parallel_free(Parallel *parallel);
+
+#endif
@@ -1,5 +1,6 @@
 #ifndef CI_PARSER_H
 #define CI_PARSER_H
+#include "arena.h"
 #include "command.h"
 #include "label_map.h"
 #include "lexer.h"
@@ -17,6 +18,7 @@ typedef struct {
     Token     current;    // The current token being processed.
     Token     next;       // The next token to be processed.
     LabelMap *label_map;  // Pointer to the label map mapping labels to commands.
+    Arena    *arena;      // Owns the commands and strings parsed.
 } Parser;
 
 /**
@@ -25,8 +27,10 @@ typedef struct {
  * @param parser Pointer to the `Parser` structure to initialize.
  * @param lexer Pointer to the `Lexer` to be used for tokenizing input.
  * @param map Pointer to the `LabelMap` for associating labels with commands.
+ * @param arena Pointer to the `Arena` the commands and their strings are
+ * allocated from.
  */
-void parser_init(Parser *parser, Lexer *lexer, LabelMap *map);
+void parser_init(Parser *parser, Lexer *lexer, LabelMap *map, Arena *arena);
 
 /**
  * @brief Parses commands from the input token stream.
@@ -39,8 +43,8 @@ void parser_init(Parser *parser, Lexer *lexer, LabelMap *map);
  * @return Pointer to the head of a linked list of parsed `Command` objects.
  *         Returns NULL if no commands were parsed or an error occurred.
  *
- * @note The caller is responsible for freeing the memory associated with the
- * returned commands.
+ * @note The commands, their strings and the labels all belong to the arena of
+ * the parser; freeing the arena frees them at once.
  */
 Command *parse_commands(Parser *parser);
 
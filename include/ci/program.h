@@ -0,0 +1,227 @@
+#ifndef CI_PROGRAM_H
+#define CI_PROGRAM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "command.h"
+
+#define NUM_VARIABLES 32  // Maximum number of defined variables.
+
+/**
+ * @brief Lists every opcode executed by the interpreter.
+ *
+ * Each command is lowered into the variant matching its operand kinds, so no
+ * handler has to test whether an operand is a register or an immediate. The
+ * suffix spells the operands in order: R for a register, I for an immediate
+ * from the constant pool.
+ */
+#define OPCODE_LIST(X)      \
+    X(OP_MOV_RI)            \
+    X(OP_ADD_RRR)           \
+    X(OP_ADD_RRI)           \
+    X(OP_SUB_RRR)           \
+    X(OP_SUB_RRI)           \
+    X(OP_CMP_RR)            \
+    X(OP_CMP_RI)            \
+    X(OP_CMP_U_RR)          \
+    X(OP_CMP_U_RI)          \
+    X(OP_AND_RRR)           \
+    X(OP_ORR_RRR)           \
+    X(OP_EOR_RRR)           \
+    X(OP_LSL_RRI)           \
+    X(OP_LSR_RRI)           \
+    X(OP_ASR_RRI)           \
+    X(OP_LOAD_RR)           \
+    X(OP_LOAD_RI)           \
+    X(OP_STORE_RR)          \
+    X(OP_STORE_RI)          \
+    X(OP_PRINT_R)           \
+    X(OP_PRINT_I)           \
+    X(OP_PUT_R)             \
+    X(OP_PUT_I)             \
+    X(OP_B)                 \
+    X(OP_B_EQ)              \
+    X(OP_B_NE)              \
+    X(OP_B_GT)              \
+    X(OP_B_LT)              \
+    X(OP_B_GE)              \
+    X(OP_B_LE)              \
+    X(OP_B_UNLINKED)        \
+    X(OP_CALL)              \
+    X(OP_TAIL_CALL)         \
+    X(OP_CALL_UNLINKED)     \
+    X(OP_RET)               \
+    X(OP_CMP_RR_B_EQ)       \
+    X(OP_CMP_RR_B_NE)       \
+    X(OP_CMP_RR_B_GT)       \
+    X(OP_CMP_RR_B_LT)       \
+    X(OP_CMP_RR_B_GE)       \
+    X(OP_CMP_RR_B_LE)       \
+    X(OP_CMP_RI_B_EQ)       \
+    X(OP_CMP_RI_B_NE)       \
+    X(OP_CMP_RI_B_GT)       \
+    X(OP_CMP_RI_B_LT)       \
+    X(OP_CMP_RI_B_GE)       \
+    X(OP_CMP_RI_B_LE)       \
+    X(OP_ADD_CMP_RR_B_EQ)   \
+    X(OP_ADD_CMP_RR_B_NE)   \
+    X(OP_ADD_CMP_RR_B_GT)   \
+    X(OP_ADD_CMP_RR_B_LT)   \
+    X(OP_ADD_CMP_RR_B_GE)   \
+    X(OP_ADD_CMP_RR_B_LE)   \
+    X(OP_ADD_CMP_RI_B_EQ)   \
+    X(OP_ADD_CMP_RI_B_NE)   \
+    X(OP_ADD_CMP_RI_B_GT)   \
+    X(OP_ADD_CMP_RI_B_LT)   \
+    X(OP_ADD_CMP_RI_B_GE)   \
+    X(OP_ADD_CMP_RI_B_LE)   \
+    X(OP_IDIOM)             \
+    X(OP_HALT)              \
+    X(OP_ERR)
+
+#define OPCODE_ENUM(op) op,
+
+/**
+ * @brief The operand-specialized opcodes; see `OPCODE_LIST`.
+ */
+typedef enum { OPCODE_LIST(OPCODE_ENUM) OP_COUNT } Opcode;
+
+/**
+ * @brief A single encoded instruction.
+ *
+ * Every command is lowered into one fixed-width, eight byte instruction.
+ * Register operands are stored directly as byte indices, while immediates live
+ * in the program's constant pool and are referenced through `arg`. The meaning
+ * of each field per opcode is:
+ *
+ * - MOV_RI:                    dst, consts[arg]
+ * - ADD/SUB_RRR, AND/ORR/EOR:  dst, a, b
+ * - ADD/SUB/LSL/LSR/ASR_RRI:   dst, a, consts[arg]
+ * - CMP(_U)_RR, CMP(_U)_RI:    a, b or consts[arg]
+ * - LOAD_RR, LOAD_RI:          dst, a = size, b or consts[arg] = address
+ * - STORE_RR, STORE_RI:        dst = value, a or consts[arg] = address, b = size
+ * - PRINT_R, PRINT_I:          a or consts[arg], b = base
+ * - PUT_R, PUT_I:              strings[consts[arg]], a or consts[arg + 1] = address
+ * - B*, CALL, TAIL_CALL:       arg = target index
+ * - B_UNLINKED, CALL_UNLINKED: dst = condition, arg = label string index
+ *
+ * The superinstructions installed by `fuse_superinstructions()` keep the
+ * operands of the instruction they replace and read the rest of the fused
+ * sequence from the instructions that follow it:
+ *
+ * - CMP_*_B_*:     the compare's operands; the branch target is code[i + 1].arg
+ * - ADD_CMP_*_B_*: the add's operands; the compare is code[i + 1] and the branch
+ *                  target code[i + 2].arg
+ *
+ * `recognize_idioms()` installs `OP_IDIOM` over the first instruction of code
+ * it has a native kernel for. Its operands are private to idiom.c and
+ * continue in the constant pool from consts[arg] on.
+ *
+ * Access sizes that are not 1, 2, 4 or 8 are encoded as 0 so they still fail
+ * the memory bounds checks at run time.
+ */
+typedef struct {
+    uint8_t  op;   // The `Opcode` of this instruction.
+    uint8_t  dst;  // The destination register, or the branch condition.
+    uint8_t  a;    // The first source register or access size.
+    uint8_t  b;    // The second source register, access size or print base.
+    uint32_t arg;  // A constant pool index, jump target or string index.
+} Instr;
+
+/**
+ * @brief A parsed program lowered into a contiguous instruction array.
+ *
+ * Jump targets are indices into `code`. The array always holds one more
+ * instruction than `length`, an `OP_HALT`, so an index equal to `length` ends
+ * the program without a bounds check.
+ */
+typedef struct {
+    Instr    *code;            // The encoded instructions, in program order, plus the halt.
+    size_t    length;          // The number of instructions in `code`.
+    int64_t  *consts;          // The constant pool holding every immediate.
+    size_t    const_count;     // The number of entries in `consts`.
+    size_t    const_capacity;  // The number of entries `consts` has room for.
+    char    **strings;         // Put literals and unresolved label names.
+    size_t    string_count;    // The number of entries in `strings`.
+    uint32_t *save_masks;      // Variables each call must save, indexed like `code`; NULL
+                               // saves everything.
+} Program;
+
+/**
+ * @brief Lowers a linked list of commands into a flat program.
+ *
+ * The commands must already have been linked with `link_commands()`. The
+ * program copies everything it needs, so the command list and label map can be
+ * freed as soon as this returns.
+ *
+ * @param prog Pointer to the `Program` to fill in.
+ * @param commands Pointer to the first `Command` in the list.
+ * @return True if the program was built, false if memory ran out.
+ */
+bool program_build(Program *prog, Command *commands);
+
+/**
+ * @brief Inserts instructions and renumbers every jump around them.
+ *
+ * A jump to `at` lands on the first inserted instruction, unless `inside`
+ * marks the jumping instruction, in which case it skips them. Jumps within
+ * the inserted instructions must already use the new numbering. Must run
+ * before `fuse_superinstructions()`.
+ *
+ * @param prog Pointer to the `Program` to extend.
+ * @param at The index the first inserted instruction takes.
+ * @param code The instructions to insert.
+ * @param count The number of instructions in `code`.
+ * @param inside Marks, by old index, the jumps to `at` that skip the inserted
+ * instructions, or NULL for none.
+ * @return True if the instructions were inserted, false if memory ran out.
+ */
+bool program_insert(Program *prog, size_t at, const Instr *code, size_t count,
+                    const bool *inside);
+
+/**
+ * @brief Drops the marked instructions and renumbers every jump.
+ *
+ * A jump to a dropped instruction lands on the next one that is kept. Must
+ * run before `fuse_superinstructions()`.
+ *
+ * @param prog Pointer to the `Program` to compact.
+ * @param removed Marks the instructions to drop.
+ * @return True if the program was compacted, false if memory ran out.
+ */
+bool program_compact(Program *prog, const bool *removed);
+
+/**
+ * @brief Appends a constant to the pool, growing it if it is full.
+ *
+ * @param prog Pointer to the `Program` to extend.
+ * @param value The constant.
+ * @return The index of the constant, or UINT32_MAX if memory ran out.
+ */
+uint32_t program_add_const(Program *prog, int64_t value);
+
+/**
+ * @brief Reads the immediate operand of an instruction.
+ *
+ * @param prog The program holding the constant pool.
+ * @param ins The instruction to read.
+ * @return The constant `ins->arg` refers to, or 0 if it is out of range.
+ */
+int64_t program_imm(const Program *prog, const Instr *ins);
+
+/**
+ * @brief Determines if an opcode's `arg` is an instruction index.
+ *
+ * @param op The opcode to check.
+ * @return True for branches and calls.
+ */
+bool program_has_target(uint8_t op);
+
+/**
+ * @brief Frees the resources associated with a program.
+ *
+ * @param prog Pointer to the `Program` to free.
+ */
+void program_free(Program *prog);
+
+#endif
@@ -1,5 +1,6 @@
 #ifndef CI_TOKEN_H
 #define CI_TOKEN_H
+#include <stdio.h>
 #include "token_type.h"
 
 /**
@@ -32,8 +33,9 @@ void token_init(Token *tok, TokenType tok_type, const char *lexeme, int lexeme_l
  * Outputs the token's type, lexeme, and positional information in a
  * human-readable format.
  *
+ * @param out The stream to print to.
  * @param tok The token to print.
  */
-void print_token(Token tok);
+void print_token(FILE *out, Token tok);
 
 #endif
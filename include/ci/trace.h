@@ -0,0 +1,61 @@
+#ifndef CI_TRACE_H
+#define CI_TRACE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "interpreter.h"
+#include "program.h"
+
+#define TRACE_HOT_THRESHOLD 64   // Backward jumps to a loop header before it is traced.
+#define TRACE_MAX_LENGTH    256  // Longest path through a loop that is recorded.
+
+/**
+ * @brief The state of the tiering engine for one run of a program.
+ *
+ * `interpret()` counts every backward jump against its target. Once a loop
+ * header gets hot, the next iteration is executed by a recorder that logs the
+ * path it takes. That linear trace is then compiled to native code, with the
+ * guest variables it touches kept in host registers for the whole loop, and
+ * every branch turned into a guard that leaves the trace for the interpreter
+ * when execution strays from the recorded path. Loops whose body cannot be
+ * traced (calls, returns, halts) are left to the interpreter.
+ */
+typedef struct {
+    int32_t  *counters;  // Backward jumps taken to each instruction.
+    uint8_t **traces;    // Compiled trace entered at each loop header, or NULL.
+    size_t   *sizes;     // Size of the mapping behind each trace.
+    size_t    length;    // Number of entries in each array.
+} TraceCache;
+
+/**
+ * @brief Prepares the tiering engine for a run of a program.
+ *
+ * @param cache Pointer to the `TraceCache` to initialize.
+ * @param prog Pointer to the `Program` about to run.
+ * @return True if tiering is available, false if the host cannot run native
+ * code or memory ran out. `cache->counters` is NULL in that case.
+ */
+bool trace_cache_init(TraceCache *cache, const Program *prog);
+
+/**
+ * @brief Handles a hot backward jump to a loop header.
+ *
+ * Runs the compiled trace for `header` if there is one. Otherwise records and
+ * compiles one, which executes the next iteration of the loop on the way.
+ *
+ * @param cache Pointer to the `TraceCache` of the run.
+ * @param intr Pointer to the `Interpreter` holding guest state.
+ * @param prog Pointer to the `Program` being run.
+ * @param header The index of the instruction the jump lands on.
+ * @return The index of the instruction the interpreter should continue at.
+ */
+size_t trace_enter(TraceCache *cache, Interpreter *intr, const Program *prog, size_t header);
+
+/**
+ * @brief Frees every compiled trace and the resources of a `TraceCache`.
+ *
+ * @param cache Pointer to the `TraceCache` to free.
+ */
+void trace_cache_free(TraceCache *cache);
+
+#endif
@@ -1,40 +1,132 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
 
 #define ALIGNMENT 16 /* The alignment of all payloads returned by umalloc */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
-#define BIN_COUNT 4
+#define SMALL_BIN_MAX 1024  /* Largest size kept in a bin; larger free blocks go in a tree */
+#define BIN_COUNT (SMALL_BIN_MAX / ALIGNMENT)
+#define BIN_MAP_WORDS ((BIN_COUNT + 63) / 64)
+#define PREV_ALLOCATED 2    /* Bit of block_metadata set unless the block before is in a free list */
+#define ARENA_COUNT 8       /* Arenas the threads are spread over */
+#define TCACHE_CLASSES 16   /* Size classes a thread caches: 16, 32, ... bytes */
+#define TCACHE_DEPTH 32     /* Blocks a thread caches per size class */
+#define TCACHE_MAX_SIZE (TCACHE_CLASSES * ALIGNMENT)
+#define UCACHE_SLAB_SIZE 4096  /* Bytes of a slab of an object cache: one page */
+#define UCACHE_MAP_WORDS (UCACHE_SLAB_SIZE / ALIGNMENT / 64)
+
+struct umalloc_arena_struct;
 
 /*
- * mem_block_header_t - Represents a block of memory managed by the heap. The 
+ * mem_block_header_t - Represents a block of memory managed by the heap. The
  * struct can be left as is, or modified for your design.
  * In the current design bit0 is the allocated bit
- * bits 1-3 are unused.
+ * bit1 is the PREV_ALLOCATED bit, bits 2-3 are unused.
  * and the remaining 60 bit represent the size.
+ * While a block is free, or sits in a thread cache or a remote-free queue,
+ * next links it into that list. While it is allocated, arena records the
+ * arena it returns to.
+ * A block in a free list also keeps the block before it in the list in the
+ * first word of its payload, and its size in the last word, as a footer the
+ * block after it finds it by.
  */
 typedef struct mem_block_header_struct {
     size_t block_metadata; // This field stores the block size in bits [63:4], and allocation status in bit 0
-    struct mem_block_header_struct *next;
+    union {
+        struct mem_block_header_struct *next;
+        struct umalloc_arena_struct *arena;
+    };
 } mem_block_header_t;
 
-// Helper Functions. Their parameters may be edited if you change their 
+/*
+ * umalloc_arena_t - A set of free lists behind a lock of its own. Every block
+ * belongs to the arena that carved it out of the heap. Threads of other
+ * arenas hand the blocks they free back through remote_frees, a lock-free
+ * stack the arena drains the next time it takes its lock.
+ * The bins hold blocks of exactly 16, 32, ... bytes up to SMALL_BIN_MAX, and
+ * a bit of bin_map is set for every bin that is not empty. Larger blocks are
+ * kept in a balanced tree ordered by size, then address, for best fit.
+ */
+typedef struct umalloc_arena_struct {
+    mtx_t lock;                                  // Guards free_heads and bin_map
+    mem_block_header_t *free_heads[BIN_COUNT];   // Free blocks by size class
+    uint64_t bin_map[BIN_MAP_WORDS];             // Bit i is set if free_heads[i] is not empty
+    mem_block_header_t *large_blocks;            // Root of the tree of larger free blocks
+    _Atomic(mem_block_header_t *) remote_frees;  // Blocks freed by other arenas' threads
+} umalloc_arena_t;
+
+/*
+ * ucache_slab_t - A page of an object cache, starting at a page boundary, so
+ * the slab of an object is found by rounding its address down. The slots
+ * follow this header, and bit i of free_map is set while slot i is free.
+ */
+typedef struct ucache_slab_struct {
+    struct ucache_struct *cache;          // The cache the slab belongs to
+    struct ucache_slab_struct *next;      // Neighbors in the cache's list of slabs with free slots
+    struct ucache_slab_struct *prev;
+    size_t free_count;                    // Number of free slots
+    uint64_t free_map[UCACHE_MAP_WORDS];  // Bit i is set while slot i is free
+} ucache_slab_t;
+
+/*
+ * ucache_t - A cache of objects of one size, in equal slots carved out of
+ * whole pages. Allocating takes the first free slot of a slab that has one;
+ * only when none does is a page taken from the heap, a refill. Every other
+ * allocation is a hit. A slab whose slots are all free goes back to umalloc,
+ * unless it is the only such slab the cache has.
+ */
+typedef struct ucache_struct {
+    mtx_t lock;                 // Guards the slabs and the counters
+    size_t slot_size;           // Bytes per object, a multiple of the alignment
+    size_t first_slot;          // Offset of slot 0 from the start of a slab
+    size_t slots_per_slab;      // Number of slots in a slab
+    ucache_slab_t *partial;     // Slabs with at least one free slot
+    size_t empty_slabs;         // Slabs of partial with every slot free
+    size_t hits;                // Allocations from a slab the cache had
+    size_t refills;             // Allocations that took a new slab
+} ucache_t;
+
+// Helper Functions. Their parameters may be edited if you change their
 // signature in umalloc.c. Do not change their purpose.
 bool is_allocated(mem_block_header_t *block);
+bool is_prev_allocated(mem_block_header_t *block);
 void allocate(mem_block_header_t *block);
 void deallocate(mem_block_header_t *block);
 size_t get_size(mem_block_header_t *block);
 mem_block_header_t *get_next(mem_block_header_t *block);
+mem_block_header_t *get_successor(mem_block_header_t *block);
+mem_block_header_t *get_predecessor(mem_block_header_t *block);
 void set_block_metadata(mem_block_header_t *block, size_t size, bool alloc);
 void *get_payload(mem_block_header_t *block);
 mem_block_header_t *get_block(void *payload);
 
-mem_block_header_t *find(size_t size);
+mem_block_header_t *find(umalloc_arena_t *arena, size_t size);
 mem_block_header_t *extend(size_t size);
-mem_block_header_t *split(mem_block_header_t *block, size_t size);
-mem_block_header_t *coalesce(mem_block_header_t *block);
+mem_block_header_t *split(umalloc_arena_t *arena, mem_block_header_t *block, size_t size);
+mem_block_header_t *coalesce(umalloc_arena_t *arena, mem_block_header_t *block);
+
+// Number of bytes umalloc has taken from the heap so far.
+size_t uheap_size(void);
 
 
 // Portion that may not be edited
 int uinit();
 void *umalloc(size_t size);
-void ufree(void *ptr);
\ No newline at end of file
+void ufree(void *ptr);
+
+// Extensions of the interface above.
+void *urealloc(void *ptr, size_t size);
+void *ucalloc(size_t count, size_t size);
+
+// Object caches. align must be a power of two; a cache returns NULL when the
+// heap is full, and create when an object of size bytes does not fit a page.
+// try_alloc also returns NULL rather than grow the heap, so it is safe on a
+// thread that must not move the program break.
+ucache_t *ucache_create(size_t size, size_t align);
+void *ucache_alloc(ucache_t *cache);
+void *ucache_try_alloc(ucache_t *cache);
+void ucache_free(ucache_t *cache, void *ptr);
+void ucache_stats(ucache_t *cache, size_t *hits, size_t *refills);
+void ucache_destroy(ucache_t *cache);
\ No newline at end of file
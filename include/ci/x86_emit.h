@@ -0,0 +1,327 @@
+#ifndef CI_X86_EMIT_H
+#define CI_X86_EMIT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Native code generation is only available on x86-64 Linux.
+#if defined(__x86_64__) && defined(__linux__)
+#define HAVE_NATIVE_CODE
+#endif
+
+// Host registers, numbered as in their x86-64 encoding.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R9  9
+#define R10 10
+#define R11 11
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+// Condition codes, as used by jcc and setcc. Flipping the low bit negates one.
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+
+// Two-operand ALU operations, given by their `op r/m64, r64` opcode. The
+// `op r64, r/m64` form is the opcode plus 2 and the immediate form's
+// extension is the opcode shifted right by 3.
+#define ALU_ADD 0x01
+#define ALU_OR  0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+
+// Shift operations, given by their opcode extension.
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+#define SHIFT_SAR 7
+
+/**
+ * @brief A jump whose 32-bit displacement is filled in once its label is
+ * placed.
+ */
+typedef struct {
+    size_t at;     // Offset of the displacement in the code.
+    size_t label;  // The label the jump lands on.
+} Fixup;
+
+/**
+ * @brief A growable buffer of machine code.
+ *
+ * Memory operands are always addressed off rbx, which the generated code
+ * points at the `Interpreter`. Allocation failures are sticky: emitting keeps
+ * going, and `failed` is checked once at the end.
+ */
+typedef struct {
+    uint8_t *buf;             // The generated code.
+    size_t   length;          // Number of bytes in `buf`.
+    size_t   capacity;        // Number of bytes allocated for `buf`.
+    Fixup   *fixups;          // Jumps still to be resolved.
+    size_t   fixup_count;     // Number of entries in `fixups`.
+    size_t   fixup_capacity;  // Number of entries allocated for `fixups`.
+    bool     failed;          // Set once an allocation fails.
+} Emitter;
+
+/**
+ * @brief Appends a byte to the code.
+ *
+ * @param e The emitter to append to.
+ * @param byte The byte to append.
+ */
+void emit8(Emitter *e, uint8_t byte);
+
+/**
+ * @brief Appends a little-endian 32-bit value to the code.
+ *
+ * @param e The emitter to append to.
+ * @param value The value to append.
+ */
+void emit32(Emitter *e, uint32_t value);
+
+/**
+ * @brief Appends a little-endian 64-bit value to the code.
+ *
+ * @param e The emitter to append to.
+ * @param value The value to append.
+ */
+void emit64(Emitter *e, uint64_t value);
+
+/**
+ * @brief Points the 32-bit displacement at `at` to the code offset `to`.
+ *
+ * @param e The emitter holding the code.
+ * @param at Offset of the displacement, which ends the jump instruction.
+ * @param to Offset the jump should land on.
+ */
+void emit_patch32(Emitter *e, size_t at, size_t to);
+
+/**
+ * @brief Emits `mov reg, [rbx + disp]`.
+ *
+ * @param e The emitter to append to.
+ * @param reg The host register to load into.
+ * @param disp The displacement from rbx.
+ */
+void emit_load(Emitter *e, uint8_t reg, int32_t disp);
+
+/**
+ * @brief Emits `mov [rbx + disp], reg`.
+ *
+ * @param e The emitter to append to.
+ * @param disp The displacement from rbx.
+ * @param reg The host register to store.
+ */
+void emit_store(Emitter *e, int32_t disp, uint8_t reg);
+
+/**
+ * @brief Emits `lea reg, [rbx + disp]`.
+ *
+ * @param e The emitter to append to.
+ * @param reg The host register to load the address into.
+ * @param disp The displacement from rbx.
+ */
+void emit_lea(Emitter *e, uint8_t reg, int32_t disp);
+
+/**
+ * @brief Emits `mov qword [rbx + disp], imm`, going through rax if `value`
+ * does not fit a sign-extended 32-bit immediate.
+ *
+ * @param e The emitter to append to.
+ * @param disp The displacement from rbx.
+ * @param value The value to store.
+ */
+void emit_store_imm(Emitter *e, int32_t disp, int64_t value);
+
+/**
+ * @brief Emits `mov byte [rbx + disp], imm`.
+ *
+ * @param e The emitter to append to.
+ * @param disp The displacement from rbx.
+ * @param value The byte to store.
+ */
+void emit_store_byte(Emitter *e, int32_t disp, uint8_t value);
+
+/**
+ * @brief Emits `mov dst, src` between two host registers.
+ *
+ * @param e The emitter to append to.
+ * @param dst The register to write.
+ * @param src The register to read.
+ */
+void emit_mov(Emitter *e, uint8_t dst, uint8_t src);
+
+/**
+ * @brief Emits `mov reg, imm`, using the shortest encoding.
+ *
+ * @param e The emitter to append to.
+ * @param reg The host register to load into.
+ * @param value The immediate.
+ */
+void emit_mov_imm(Emitter *e, uint8_t reg, int64_t value);
+
+/**
+ * @brief Emits a 64-bit `op dst, src` between two host registers.
+ *
+ * @param e The emitter to append to.
+ * @param op One of the `ALU_*` operations.
+ * @param dst The register holding the first operand and the result.
+ * @param src The register holding the second operand.
+ */
+void emit_alu(Emitter *e, uint8_t op, uint8_t dst, uint8_t src);
+
+/**
+ * @brief Emits a 64-bit `op reg, [rbx + disp]`.
+ *
+ * @param e The emitter to append to.
+ * @param op One of the `ALU_*` operations.
+ * @param reg The register holding the first operand and the result.
+ * @param disp The displacement of the second operand from rbx.
+ */
+void emit_alu_load(Emitter *e, uint8_t op, uint8_t reg, int32_t disp);
+
+/**
+ * @brief Emits a 64-bit `op reg, imm`.
+ *
+ * Immediates that do not fit a sign-extended 32-bit field go through rcx, so
+ * `reg` must not be rcx.
+ *
+ * @param e The emitter to append to.
+ * @param op One of the `ALU_*` operations.
+ * @param reg The register holding the first operand and the result.
+ * @param value The immediate.
+ */
+void emit_alu_imm(Emitter *e, uint8_t op, uint8_t reg, int64_t value);
+
+/**
+ * @brief Emits a 64-bit shift of a register by a constant.
+ *
+ * Counts are masked to 6 bits, exactly as the hardware does for a variable
+ * count.
+ *
+ * @param e The emitter to append to.
+ * @param shift One of the `SHIFT_*` operations.
+ * @param reg The register to shift.
+ * @param count The shift count.
+ */
+void emit_shift(Emitter *e, uint8_t shift, uint8_t reg, int64_t count);
+
+/**
+ * @brief Emits `setcc byte [rbx + disp]`, which leaves the host flags intact.
+ *
+ * @param e The emitter to append to.
+ * @param cc The condition code to store.
+ * @param disp The displacement of the byte from rbx.
+ */
+void emit_setcc(Emitter *e, uint8_t cc, int32_t disp);
+
+/**
+ * @brief Emits `cmp byte [rbx + disp], 0`.
+ *
+ * @param e The emitter to append to.
+ * @param disp The displacement of the byte from rbx.
+ */
+void emit_test_byte(Emitter *e, int32_t disp);
+
+/**
+ * @brief Emits `movzx eax, byte [rbx + first]; or al, byte [rbx + second]`,
+ * setting the zero flag if both bytes are zero.
+ *
+ * @param e The emitter to append to.
+ * @param first The displacement of the first byte from rbx.
+ * @param second The displacement of the second byte from rbx.
+ */
+void emit_test_either(Emitter *e, int32_t first, int32_t second);
+
+/**
+ * @brief Emits `push reg`.
+ *
+ * @param e The emitter to append to.
+ * @param reg The register to push.
+ */
+void emit_push(Emitter *e, uint8_t reg);
+
+/**
+ * @brief Emits `pop reg`.
+ *
+ * @param e The emitter to append to.
+ * @param reg The register to pop.
+ */
+void emit_pop(Emitter *e, uint8_t reg);
+
+/**
+ * @brief Emits a call to a C function at an absolute address, through rax.
+ *
+ * @param e The emitter to append to.
+ * @param function The address of the function.
+ */
+void emit_call(Emitter *e, uint64_t function);
+
+/**
+ * @brief Emits `jmp label`.
+ *
+ * @param e The emitter to append to.
+ * @param label The label to jump to, resolved by `emit_resolve()`.
+ */
+void emit_jump(Emitter *e, size_t label);
+
+/**
+ * @brief Emits a conditional jump to a label.
+ *
+ * @param e The emitter to append to.
+ * @param cc The condition code to test.
+ * @param label The label to jump to, resolved by `emit_resolve()`.
+ */
+void emit_jcc(Emitter *e, uint8_t cc, size_t label);
+
+/**
+ * @brief Patches every jump once all labels have been placed.
+ *
+ * @param e The emitter holding the code.
+ * @param offsets The code offset of each label.
+ */
+void emit_resolve(Emitter *e, const size_t *offsets);
+
+/**
+ * @brief Copies the finished code into executable memory.
+ *
+ * @param e The emitter holding the code.
+ * @param size Set to the size of the mapping.
+ * @return The executable copy, to be released with `emit_unmap()`, or NULL if
+ * emitting or mapping failed.
+ */
+uint8_t *emit_map(Emitter *e, size_t *size);
+
+/**
+ * @brief Releases code mapped by `emit_map()`.
+ *
+ * @param code The executable code, or NULL.
+ * @param size The size of the mapping.
+ */
+void emit_unmap(uint8_t *code, size_t size);
+
+/**
+ * @brief Frees the buffers of an emitter.
+ *
+ * @param e The emitter to free.
+ */
+void emit_free(Emitter *e);
+
+#endif
@@ -0,0 +1,443 @@
+#include "analysis.h"
+#include <stdlib.h>
+#include <string.h>
+
+static RegMask routine_clobbers(const Program *prog, size_t entry, uint32_t *visited,
+                                uint32_t stamp, size_t *worklist);
+static bool    closure_is_pure(const Program *prog, const RegMask *inputs, const size_t *closure,
+                               size_t count);
+static size_t  routine_closure(const Program *prog, size_t entry, uint32_t *visited,
+                               uint32_t stamp, size_t *closure);
+static RegMask routine_inputs(const Program *prog, size_t entry, const RegMask *inputs,
+                              const size_t *closure, size_t count, RegMask *live);
+static bool    is_fused_compare(uint8_t op);
+static bool    is_fused_latch(uint8_t op);
+
+size_t instr_successors(const Program *prog, size_t i, size_t succ[MAX_SUCCESSORS]) {
+    const Instr *ins = &prog->code[i];
+    if (is_fused_compare(ins->op)) {
+        succ[0] = prog->code[i + 1].arg;
+        succ[1] = i + 2;
+        return 2;
+    }
+    if (is_fused_latch(ins->op)) {
+        succ[0] = prog->code[i + 2].arg;
+        succ[1] = i + 3;
+        return 2;
+    }
+
+    switch ((Opcode) ins->op) {
+        case OP_B:
+        case OP_TAIL_CALL:
+            succ[0] = ins->arg;
+            return 1;
+        case OP_B_EQ:
+        case OP_B_NE:
+        case OP_B_GT:
+        case OP_B_LT:
+        case OP_B_GE:
+        case OP_B_LE:
+            succ[0] = ins->arg;
+            succ[1] = i + 1;
+            return 2;
+        case OP_CALL_UNLINKED:
+        case OP_RET:
+        case OP_HALT:
+        case OP_ERR:
+            return 0;
+        default:
+            succ[0] = i + 1;
+            return 1;
+    }
+}
+
+RegMask instr_defs(const Program *prog, size_t i) {
+    const Instr *ins = &prog->code[i];
+    if (is_fused_compare(ins->op)) {
+        return MASK_FLAGS;
+    }
+    if (is_fused_latch(ins->op)) {
+        return REG_BIT(ins->dst) | MASK_FLAGS;
+    }
+
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+        case OP_ADD_RRR:
+        case OP_ADD_RRI:
+        case OP_SUB_RRR:
+        case OP_SUB_RRI:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+        case OP_LOAD_RR:
+        case OP_LOAD_RI:
+            return REG_BIT(ins->dst);
+        case OP_CMP_RR:
+        case OP_CMP_RI:
+        case OP_CMP_U_RR:
+        case OP_CMP_U_RI:
+            return MASK_FLAGS;
+        case OP_CALL:
+            return REG_BIT(0) | MASK_FLAGS;
+        default:
+            return 0;
+    }
+}
+
+RegMask instr_uses(const Program *prog, size_t i) {
+    const Instr *ins = &prog->code[i];
+    if (is_fused_compare(ins->op)) {
+        return REG_BIT(ins->a) | (ins->op <= OP_CMP_RR_B_LE ? REG_BIT(ins->b) : 0);
+    }
+    if (is_fused_latch(ins->op)) {
+        const Instr *cmp = &prog->code[i + 1];
+        return REG_BIT(ins->a) | REG_BIT(cmp->a) |
+               (ins->op <= OP_ADD_CMP_RR_B_LE ? REG_BIT(cmp->b) : 0);
+    }
+
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+        case OP_PRINT_I:
+        case OP_B:
+            return 0;
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+            return REG_BIT(ins->a) | REG_BIT(ins->b);
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+        case OP_PRINT_R:
+            return REG_BIT(ins->a);
+        case OP_B_EQ:
+        case OP_B_NE:
+        case OP_B_GT:
+        case OP_B_LT:
+        case OP_B_GE:
+        case OP_B_LE:
+            return MASK_FLAGS;
+        default:
+            // Memory accesses and unresolved labels can fail, and calls, returns
+            // and halts can end the program; either way the whole state is printed.
+            return MASK_ALL;
+    }
+}
+
+RegMask compute_liveness(const Program *prog, RegMask *live_in) {
+    live_in[prog->length] = MASK_ALL;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = prog->length; i-- > 0;) {
+            size_t  succ[MAX_SUCCESSORS];
+            size_t  count = instr_successors(prog, i, succ);
+            RegMask out   = 0;
+            for (size_t s = 0; s < count; s++) {
+                out |= live_in[succ[s]];
+            }
+
+            RegMask in = instr_uses(prog, i) | (out & ~instr_defs(prog, i));
+            if (in != live_in[i]) {
+                live_in[i] = in;
+                changed    = true;
+            }
+        }
+    }
+    return live_in[0];
+}
+
+bool compute_save_masks(Program *prog) {
+    if (!prog || !prog->code) {
+        return false;
+    }
+    free(prog->save_masks);
+    prog->save_masks = NULL;
+
+    bool has_calls = false;
+    for (size_t i = 0; i < prog->length && !has_calls; i++) {
+        has_calls = prog->code[i].op == OP_CALL || prog->code[i].op == OP_TAIL_CALL;
+    }
+    if (!has_calls) {
+        return true;
+    }
+
+    uint32_t *masks    = calloc(prog->length + 1, sizeof(uint32_t));
+    RegMask  *live_in  = calloc(prog->length + 1, sizeof(RegMask));
+    RegMask  *clobbers = calloc(prog->length + 1, sizeof(RegMask));
+    uint8_t  *known    = calloc(prog->length + 1, sizeof(uint8_t));
+    uint32_t *visited  = calloc(prog->length + 1, sizeof(uint32_t));
+    size_t   *worklist = malloc((prog->length + 1) * sizeof(size_t));
+    if (!masks || !live_in || !clobbers || !known || !visited || !worklist) {
+        free(masks);
+        free(live_in);
+        free(clobbers);
+        free(known);
+        free(visited);
+        free(worklist);
+        return false;
+    }
+
+    compute_liveness(prog, live_in);
+
+    uint32_t stamp = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->code[i].op != OP_CALL && prog->code[i].op != OP_TAIL_CALL) {
+            continue;
+        }
+        size_t target = prog->code[i].arg;
+        if (!known[target]) {
+            clobbers[target] = routine_clobbers(prog, target, visited, ++stamp, worklist);
+            known[target]    = true;
+        }
+        masks[i] = (uint32_t) (clobbers[target] & live_in[i + 1] & MASK_CALLEE);
+    }
+
+    free(live_in);
+    free(clobbers);
+    free(known);
+    free(visited);
+    free(worklist);
+    prog->save_masks = masks;
+    return true;
+}
+
+bool compute_pure_inputs(const Program *prog, RegMask *inputs) {
+    if (!prog || !prog->code || !inputs) {
+        return false;
+    }
+    for (size_t i = 0; i <= prog->length; i++) {
+        inputs[i] = MASK_IMPURE;
+    }
+
+    uint32_t *visited = calloc(prog->length + 1, sizeof(uint32_t));
+    size_t   *closure = malloc((prog->length + 1) * sizeof(size_t));
+    RegMask  *live    = malloc((prog->length + 1) * sizeof(RegMask));
+    if (!visited || !closure || !live) {
+        free(visited);
+        free(closure);
+        free(live);
+        return false;
+    }
+
+    // Every call target starts out pure, then loses that if it does anything
+    // else or calls a routine that has lost it.
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->code[i].op == OP_CALL) {
+            inputs[prog->code[i].arg] = 0;
+        }
+    }
+    uint32_t stamp   = 0;
+    bool     changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i <= prog->length; i++) {
+            if (inputs[i] == MASK_IMPURE) {
+                continue;
+            }
+            size_t count = routine_closure(prog, i, visited, ++stamp, closure);
+            if (!closure_is_pure(prog, inputs, closure, count)) {
+                inputs[i] = MASK_IMPURE;
+                changed   = true;
+            }
+        }
+    }
+
+    // The inputs only grow as those of the routines called grow.
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i <= prog->length; i++) {
+            if (inputs[i] == MASK_IMPURE) {
+                continue;
+            }
+            size_t  count = routine_closure(prog, i, visited, ++stamp, closure);
+            RegMask found = routine_inputs(prog, i, inputs, closure, count, live);
+            if (found != inputs[i]) {
+                inputs[i] = found;
+                changed   = true;
+            }
+        }
+    }
+
+    free(visited);
+    free(closure);
+    free(live);
+    return true;
+}
+
+/**
+ * @brief Computes every variable a routine may leave modified when it returns.
+ *
+ * Follows every path from the entry of the routine up to its returns. Nested
+ * calls only contribute x0, since their own returns restore everything else
+ * that is still observable.
+ *
+ * @param prog The program to analyze.
+ * @param entry The index of the first instruction of the routine.
+ * @param visited Scratch array of visit stamps, one per instruction.
+ * @param stamp A stamp not yet used in `visited`.
+ * @param worklist Scratch array with room for every instruction.
+ * @return The set of variables the routine may write.
+ */
+static RegMask routine_clobbers(const Program *prog, size_t entry, uint32_t *visited,
+                                uint32_t stamp, size_t *worklist) {
+    RegMask clobbers = 0;
+    size_t  pending  = 0;
+
+    worklist[pending++] = entry;
+    visited[entry]      = stamp;
+    while (pending > 0) {
+        size_t i = worklist[--pending];
+        clobbers |= instr_defs(prog, i);
+
+        size_t succ[MAX_SUCCESSORS];
+        size_t count = instr_successors(prog, i, succ);
+        for (size_t s = 0; s < count; s++) {
+            if (visited[succ[s]] != stamp) {
+                visited[succ[s]]    = stamp;
+                worklist[pending++] = succ[s];
+            }
+        }
+    }
+    return clobbers;
+}
+
+/**
+ * @brief Lists every instruction a routine can run before it returns.
+ *
+ * Calls are followed to the instruction after them, not into the callee.
+ *
+ * @param prog The program to analyze.
+ * @param entry The index of the first instruction of the routine.
+ * @param visited Scratch array of visit stamps, one per instruction.
+ * @param stamp A stamp not yet used in `visited`.
+ * @param closure Filled in with the instructions, entry first.
+ * @return The number of instructions written to `closure`.
+ */
+static size_t routine_closure(const Program *prog, size_t entry, uint32_t *visited,
+                              uint32_t stamp, size_t *closure) {
+    size_t count = 0;
+    closure[count++] = entry;
+    visited[entry]   = stamp;
+    for (size_t next = 0; next < count; next++) {
+        size_t succ[MAX_SUCCESSORS];
+        size_t n = instr_successors(prog, closure[next], succ);
+        for (size_t s = 0; s < n; s++) {
+            if (visited[succ[s]] != stamp) {
+                visited[succ[s]]  = stamp;
+                closure[count++] = succ[s];
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Determines if a routine only computes on variables.
+ *
+ * @param prog The program to analyze.
+ * @param inputs The routines still considered pure.
+ * @param closure The instructions of the routine.
+ * @param count The number of entries in `closure`.
+ * @return True if nothing in the routine has an effect beyond the variables.
+ */
+static bool closure_is_pure(const Program *prog, const RegMask *inputs, const size_t *closure,
+                            size_t count) {
+    for (size_t c = 0; c < count; c++) {
+        const Instr *ins = &prog->code[closure[c]];
+        if (ins->op == OP_CALL) {
+            if (inputs[ins->arg] == MASK_IMPURE) {
+                return false;
+            }
+        } else if (ins->op > OP_B_LE && ins->op != OP_TAIL_CALL && ins->op != OP_RET) {
+            return false;
+        } else if (ins->op >= OP_LOAD_RR && ins->op <= OP_PUT_I) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Computes the variables and flags a pure routine's result depends on.
+ *
+ * A backward liveness analysis over the routine alone, where a ret only uses
+ * x0 and the flags, and a call uses the inputs of its target and defines x0
+ * and the flags.
+ *
+ * @param prog The program to analyze.
+ * @param entry The index of the first instruction of the routine.
+ * @param inputs The inputs found so far for every pure routine.
+ * @param closure The instructions of the routine.
+ * @param count The number of entries in `closure`.
+ * @param live Scratch array with one entry per instruction.
+ * @return The set live on entry to the routine.
+ */
+static RegMask routine_inputs(const Program *prog, size_t entry, const RegMask *inputs,
+                              const size_t *closure, size_t count, RegMask *live) {
+    for (size_t c = 0; c < count; c++) {
+        live[closure[c]] = 0;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t c = count; c-- > 0;) {
+            size_t       i   = closure[c];
+            const Instr *ins = &prog->code[i];
+            RegMask      in;
+            if (ins->op == OP_RET) {
+                in = REG_BIT(0) | MASK_FLAGS;
+            } else {
+                size_t  succ[MAX_SUCCESSORS];
+                size_t  n   = instr_successors(prog, i, succ);
+                RegMask out = 0;
+                for (size_t s = 0; s < n; s++) {
+                    out |= live[succ[s]];
+                }
+                if (ins->op == OP_CALL) {
+                    in = inputs[ins->arg] | (out & ~(REG_BIT(0) | MASK_FLAGS));
+                } else {
+                    in = instr_uses(prog, i) | (out & ~instr_defs(prog, i));
+                }
+            }
+            if (in != live[i]) {
+                live[i] = in;
+                changed = true;
+            }
+        }
+    }
+    return live[entry];
+}
+
+/**
+ * @brief Determines if an opcode is a fused compare-and-branch.
+ *
+ * @param op The opcode to check.
+ * @return True if `op` is one of the `OP_CMP_*_B_*` superinstructions.
+ */
+static bool is_fused_compare(uint8_t op) {
+    return op >= OP_CMP_RR_B_EQ && op <= OP_CMP_RI_B_LE;
+}
+
+/**
+ * @brief Determines if an opcode is a fused add-compare-and-branch.
+ *
+ * @param op The opcode to check.
+ * @return True if `op` is one of the `OP_ADD_CMP_*_B_*` superinstructions.
+ */
+static bool is_fused_latch(uint8_t op) {
+    return op >= OP_ADD_CMP_RR_B_EQ && op <= OP_ADD_CMP_RI_B_LE;
+}
@@ -0,0 +1,76 @@
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+#include "umalloc.h"
+
+static bool grow(Arena *arena, size_t size, size_t align);
+
+void arena_init(Arena *arena) {
+    arena->blocks = NULL;
+    arena->cursor = NULL;
+    arena->limit  = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size, size_t align) {
+    uintptr_t start = ((uintptr_t) arena->cursor + align - 1) & ~(uintptr_t) (align - 1);
+    if (!arena->blocks || start > (uintptr_t) arena->limit ||
+        size > (uintptr_t) arena->limit - start) {
+        if (!grow(arena, size, align)) {
+            return NULL;
+        }
+        start = ((uintptr_t) arena->cursor + align - 1) & ~(uintptr_t) (align - 1);
+    }
+
+    arena->cursor = (char *) (start + size);
+    return (void *) start;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t length) {
+    char *copy = arena_alloc(arena, length + 1, 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        ufree(block);
+        block = next;
+    }
+    arena_init(arena);
+}
+
+/**
+ * @brief Starts a new block, twice the size of the last, or larger if one
+ * allocation needs it. What is left of the last block is abandoned.
+ *
+ * @param arena The arena to grow.
+ * @param size The allocation the block must hold.
+ * @param align The alignment of that allocation.
+ * @return True if the block was allocated, false if memory ran out.
+ */
+static bool grow(Arena *arena, size_t size, size_t align) {
+    size_t block_size = arena->blocks ? arena->blocks->size * 2 : ARENA_INITIAL_BLOCK;
+    if (size > SIZE_MAX - sizeof(ArenaBlock) - align) {
+        return false;
+    }
+    if (block_size < size + align) {
+        block_size = size + align;
+    }
+
+    ArenaBlock *block = umalloc(sizeof(ArenaBlock) + block_size);
+    if (!block) {
+        return false;
+    }
+    block->next   = arena->blocks;
+    block->size   = block_size;
+    arena->blocks = block;
+    arena->cursor = (char *) (block + 1);
+    arena->limit  = arena->cursor + block_size;
+    return true;
+}
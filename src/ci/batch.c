@@ -0,0 +1,334 @@
+#define _DEFAULT_SOURCE  // opendir, open_memstream, clock_gettime and sysconf
+#include "batch.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INITIAL_JOBS 16  // Jobs allocated by the first `batch_add()`.
+
+/**
+ * @brief The state shared by the threads of one `batch_run()`.
+ */
+typedef struct {
+    Batch        *batch;     // The batch being run.
+    BatchRunner   run;       // Runs one program.
+    void         *ctx;       // Passed through to `run`.
+    atomic_size_t next;      // Index of the next job to take.
+    bool          open;      // Set once every thread was created; guarded by `lock`.
+    mtx_t         lock;      // Lets threads sleep on `finished`.
+    cnd_t         finished;  // Signalled when the pool opens and whenever a job is done.
+} BatchPool;
+
+static bool   add_job(Batch *batch, char *path);
+static bool   add_directory(Batch *batch, DIR *dir, const char *path);
+static char  *join_path(const char *dir, const char *name);
+static bool   is_program(const char *name);
+static int    compare_names(const void *a, const void *b);
+static int    worker_main(void *arg);
+static void   run_job(BatchPool *pool, BatchJob *job);
+static size_t online_processors(void);
+static double now_millis(void);
+
+void batch_init(Batch *batch) {
+    batch->jobs     = NULL;
+    batch->count    = 0;
+    batch->capacity = 0;
+}
+
+bool batch_add(Batch *batch, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir) {
+        bool added = add_directory(batch, dir, path);
+        closedir(dir);
+        return added;
+    }
+
+    char *copy = malloc(strlen(path) + 1);
+    if (!copy) {
+        return false;
+    }
+    strcpy(copy, path);
+    return add_job(batch, copy);
+}
+
+int batch_run(Batch *batch, size_t thread_count, BatchRunner run, void *ctx, FILE *out) {
+    BatchPool pool;
+    pool.batch = batch;
+    pool.run   = run;
+    pool.ctx   = ctx;
+    pool.open  = false;
+    atomic_init(&pool.next, 0);
+    if (mtx_init(&pool.lock, mtx_plain) != thrd_success) {
+        return -1;
+    }
+    if (cnd_init(&pool.finished) != thrd_success) {
+        mtx_destroy(&pool.lock);
+        return -1;
+    }
+
+    if (thread_count == 0) {
+        thread_count = online_processors();
+    }
+    if (thread_count > batch->count) {
+        thread_count = batch->count;
+    }
+
+    // The workers grow the umalloc heap, so this thread must not be in malloc
+    // while they run (see main()). It allocates everything it needs, the
+    // buffer of `out` and the threads themselves, before any worker runs a
+    // program, and from then on only frees outputs, which the workers
+    // allocated from arenas of their own.
+    fprintf(out, "Batch: %zu programs on %zu threads\n", batch->count, thread_count);
+    fflush(out);
+
+    double start = now_millis();
+    thrd_t threads[BATCH_MAX_THREADS];
+    size_t started = 0;
+    while (started < thread_count &&
+           thrd_create(&threads[started], worker_main, &pool) == thrd_success) {
+        started++;
+    }
+    mtx_lock(&pool.lock);
+    pool.open = true;
+    cnd_broadcast(&pool.finished);
+    mtx_unlock(&pool.lock);
+    if (started == 0 && batch->count > 0) {
+        // Run everything here rather than not at all.
+        worker_main(&pool);
+    }
+
+    // Print each output as soon as it and all before it are in.
+    int    failed  = 0;
+    double elapsed = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        BatchJob *job = &batch->jobs[i];
+        mtx_lock(&pool.lock);
+        while (!atomic_load(&job->done)) {
+            cnd_wait(&pool.finished, &pool.lock);
+        }
+        mtx_unlock(&pool.lock);
+
+        fprintf(out, "==> %s: status %d, %.3f ms\n", job->path, job->status, job->millis);
+        if (job->output) {
+            fwrite(job->output, 1, job->length, out);
+        } else {
+            fprintf(out, "Could not capture the output of %s\n", job->path);
+        }
+        free(job->output);
+        job->output = NULL;
+
+        failed  += job->status != 0;
+        elapsed += job->millis;
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    fprintf(out, "Batch: %d of %zu failed, %.3f ms of wall time for %.3f ms of runs\n", failed,
+            batch->count, now_millis() - start, elapsed);
+
+    cnd_destroy(&pool.finished);
+    mtx_destroy(&pool.lock);
+    return failed;
+}
+
+void batch_free(Batch *batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->jobs[i].path);
+        free(batch->jobs[i].output);
+    }
+    free(batch->jobs);
+    batch_init(batch);
+}
+
+/**
+ * @brief Appends a job for a program to a batch.
+ *
+ * @param batch The batch to append to.
+ * @param path The path of the program; the job owns it, even on failure.
+ * @return True if the job was added, false if memory ran out.
+ */
+static bool add_job(Batch *batch, char *path) {
+    if (batch->count == batch->capacity) {
+        size_t    capacity = batch->capacity ? 2 * batch->capacity : INITIAL_JOBS;
+        BatchJob *jobs     = realloc(batch->jobs, capacity * sizeof(BatchJob));
+        if (!jobs) {
+            free(path);
+            return false;
+        }
+        batch->jobs     = jobs;
+        batch->capacity = capacity;
+    }
+
+    BatchJob *job = &batch->jobs[batch->count++];
+    job->path     = path;
+    job->output   = NULL;
+    job->length   = 0;
+    job->status   = 0;
+    job->millis   = 0;
+    atomic_init(&job->done, false);
+    return true;
+}
+
+/**
+ * @brief Appends a job for every program in a directory, sorted by name.
+ *
+ * @param batch The batch to append to.
+ * @param dir The open directory.
+ * @param path The path of the directory.
+ * @return True if the jobs were added, false if memory ran out.
+ */
+static bool add_directory(Batch *batch, DIR *dir, const char *path) {
+    char  **names    = NULL;
+    size_t  count    = 0;
+    size_t  capacity = 0;
+    bool    ok       = true;
+
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (!is_program(entry->d_name)) {
+            continue;
+        }
+        if (count == capacity) {
+            size_t grown_capacity = capacity ? 2 * capacity : INITIAL_JOBS;
+            char **grown          = realloc(names, grown_capacity * sizeof(char *));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            names    = grown;
+            capacity = grown_capacity;
+        }
+
+        names[count] = join_path(path, entry->d_name);
+        ok           = names[count] != NULL;
+        count += ok;
+    }
+
+    if (count > 1) {
+        qsort(names, count, sizeof(char *), compare_names);
+    }
+    size_t added = 0;
+    while (ok && added < count) {
+        ok = add_job(batch, names[added++]);
+    }
+    for (size_t i = added; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+/**
+ * @brief Builds the path of a file in a directory.
+ *
+ * @param dir The path of the directory.
+ * @param name The name of the file.
+ * @return The joined path, owned by the caller, or NULL if memory ran out.
+ */
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_length = strlen(dir);
+    bool   slash      = dir_length > 0 && dir[dir_length - 1] == '/';
+    char  *path       = malloc(dir_length + !slash + strlen(name) + 1);
+    if (!path) {
+        return NULL;
+    }
+
+    strcpy(path, dir);
+    if (!slash) {
+        strcat(path, "/");
+    }
+    strcat(path, name);
+    return path;
+}
+
+/**
+ * @brief Determines if a directory entry is a program, by its extension.
+ *
+ * @param name The name of the entry.
+ * @return True if the name ends in `.s` and has something before it.
+ */
+static bool is_program(const char *name) {
+    size_t length = strlen(name);
+    return length > 2 && strcmp(name + length - 2, ".s") == 0;
+}
+
+/**
+ * @brief Orders paths for `qsort()`.
+ *
+ * @param a Pointer to the first path.
+ * @param b Pointer to the second path.
+ * @return Negative, zero or positive as `a` sorts before, with or after `b`.
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @brief Waits for the pool to open, then takes jobs until none are left.
+ *
+ * @param arg The `BatchPool` of the run.
+ * @return Always 0.
+ */
+static int worker_main(void *arg) {
+    BatchPool *pool = arg;
+    mtx_lock(&pool->lock);
+    while (!pool->open) {
+        cnd_wait(&pool->finished, &pool->lock);
+    }
+    mtx_unlock(&pool->lock);
+
+    size_t index;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->batch->count) {
+        run_job(pool, &pool->batch->jobs[index]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs one job, capturing its output, and reports it done.
+ *
+ * @param pool The pool the job belongs to.
+ * @param job The job to run.
+ */
+static void run_job(BatchPool *pool, BatchJob *job) {
+    FILE  *stream = open_memstream(&job->output, &job->length);
+    double start  = now_millis();
+    job->status   = stream ? pool->run(job->path, stream, pool->ctx) : -1;
+    job->millis   = now_millis() - start;
+    if (stream) {
+        fclose(stream);
+    }
+
+    mtx_lock(&pool->lock);
+    atomic_store(&job->done, true);
+    cnd_broadcast(&pool->finished);
+    mtx_unlock(&pool->lock);
+}
+
+/**
+ * @brief Counts the processors available to run threads.
+ *
+ * @return The number of online processors, between 1 and `BATCH_MAX_THREADS`.
+ */
+static size_t online_processors(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) {
+        return 1;
+    }
+    return (size_t) count < BATCH_MAX_THREADS ? (size_t) count : BATCH_MAX_THREADS;
+}
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * @return The time in milliseconds since an arbitrary fixed point.
+ */
+static double now_millis(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec * 1e3 + (double) now.tv_nsec / 1e6;
+}
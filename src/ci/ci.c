@@ -1,13 +1,27 @@
+#include "analysis.h"
+#include "arena.h"
+#include "batch.h"
 #include "cmd_args_config.h"
 #include "command.h"
+#include "fuse.h"
+#include "idiom.h"
+#include "inline.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "label_map.h"
 #include "lexer.h"
+#include "linker.h"
+#include "loop.h"
 #include "mem.h"
+#include "memo.h"
+#include "optimize.h"
+#include "parallel.h"
 #include "parser.h"
+#include "program.h"
 #include "token.h"
 #include "token_type.h"
 #include <ctype.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,12 +30,24 @@
 #define CAPACITY 50
 
 static int   run_interpreter(CmdArgsConfig *conf);
+static int   run_batch(CmdArgsConfig *conf);
+static int   run_batch_file(const char *path, FILE *out, void *ctx);
 static char *run_repl(void);
-static char *read_file(const char *path);
-static int   run_file(const char *src, bool print_lex, bool print_parse);
+static char *read_file(const char *path, FILE *out);
+static int   run_file(const char *src, CmdArgsConfig *conf, FILE *out, FILE *err);
 
 int main(int argc, char **argv) {
-    CmdArgsConfig conf = {false, false, false, NULL, NULL};
+    // umalloc and malloc both move the program break, and only umalloc takes
+    // its lock to do so. malloc only moves it for the arena of the main thread,
+    // so every other thread gets an arena of its own, which malloc maps
+    // elsewhere, and batch.c and parallel.c only grow the umalloc heap while
+    // the main thread is not in malloc.
+#ifdef M_ARENA_MAX
+    mallopt(M_ARENA_MAX, BATCH_MAX_THREADS * PARALLEL_MAX_THREADS + 1);
+#endif
+    CmdArgsConfig conf = {false, false, false, NULL, NULL, DEFAULT_MAX_DEPTH,
+                          false, false, 0,     MEMO_EVICT_LRU,    false, DEFAULT_INLINE_SIZE,
+                          DEFAULT_INLINE_DEPTH, DEFAULT_UNROLL, 0, NULL, 0, 0};
     if (!parse_cmd_args(&conf, argv + 1, argc - 1)) {
         printf("Aborting\n");
         config_free(&conf);
@@ -48,6 +74,10 @@ static int run_interpreter(CmdArgsConfig *conf) {
     char *src;
     int   status;
 
+    if (conf->batch_count > 0) {
+        return run_batch(conf);
+    }
+
     if (conf->repl) {
         src = run_repl();
         if (!src) {
@@ -58,12 +88,48 @@ static int run_interpreter(CmdArgsConfig *conf) {
             printf("No file specified.\n");
             return -1;
         }
-        src = read_file(conf->in_filename);
+        src = read_file(conf->in_filename, stdout);
         if (!src) {
             return -1;
         }
     }
-    status = run_file(src, conf->print_lex, conf->print_parse);
+    status = run_file(src, conf, stdout, stderr);
+    free(src);
+    return status;
+}
+
+static int run_batch(CmdArgsConfig *conf) {
+    Batch batch;
+    batch_init(&batch);
+    for (size_t i = 0; i < conf->batch_count; i++) {
+        if (!batch_add(&batch, conf->batch_paths[i])) {
+            printf("Unable to allocate batch. Aborting\n");
+            batch_free(&batch);
+            return -1;
+        }
+    }
+
+    int failed = batch_run(&batch, conf->batch_threads, run_batch_file, conf, stdout);
+    batch_free(&batch);
+    return failed == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Runs one program of a batch; a `BatchRunner`.
+ *
+ * @param path The path of the program.
+ * @param out The stream capturing the output of the run, and its warnings and
+ * reports, so they stay with the program they are about.
+ * @param ctx The `CmdArgsConfig` of the batch.
+ * @return The exit status of the run.
+ */
+static int run_batch_file(const char *path, FILE *out, void *ctx) {
+    char *src = read_file(path, out);
+    if (!src) {
+        return -1;
+    }
+
+    int status = run_file(src, ctx, out, out);
     free(src);
     return status;
 }
@@ -127,10 +193,10 @@ static char *run_repl(void) {
     return buffer;
 }
 
-static char *read_file(const char *path) {
+static char *read_file(const char *path, FILE *out) {
     FILE *file = fopen(path, "rb");
     if (!file) {
-        printf("Failed to open file %s\n", path);
+        fprintf(out, "Failed to open file %s\n", path);
         return NULL;
     }
 
@@ -140,60 +206,135 @@ static char *read_file(const char *path) {
 
     char *buffer = (char *) calloc(filesize + 1, sizeof(char));
     if (!buffer) {
-        printf("Could not allocate enough space for %s\n", path);
+        fprintf(out, "Could not allocate enough space for %s\n", path);
         return NULL;
     }
 
     size_t bytes_read = fread(buffer, sizeof(char), filesize, file);
     if (bytes_read < filesize) {
-        printf("Could not read %s\n", path);
+        fprintf(out, "Could not read %s\n", path);
     }
 
     fclose(file);
     return buffer;
 }
 
-static int run_file(const char *src, bool print_lex, bool print_parse) {
+static int run_file(const char *src, CmdArgsConfig *conf, FILE *out, FILE *err) {
     Lexer l;
     lexer_init(&l, src);
-    if (print_lex) {
-        print_lexed_tokens(&l);
+    if (conf->print_lex) {
+        print_lexed_tokens(out, &l);
         // Reset so we can parse
         lexer_init(&l, src);
     }
 
+    // Everything the parser makes goes in one arena, freed as soon as the
+    // program is built.
+    Arena arena;
+    arena_init(&arena);
     LabelMap lbm;
-    if (!label_map_init(&lbm, 100)) {
-        printf("Unable to allocate label hashmap. Aborting\n");
+    if (!label_map_init(&lbm, 100, &arena)) {
+        fprintf(out, "Unable to allocate label hashmap. Aborting\n");
         return -1;
     }
 
     Parser p;
-    parser_init(&p, &l, &lbm);
+    parser_init(&p, &l, &lbm, &arena);
     Command *commands = parse_commands(&p);
-    if (print_parse) {
-        print_commands(commands);
+    if (conf->print_parse) {
+        print_commands(out, commands);
     }
 
     if (p.had_error) {
-        printf("Parser encountered an error:\n");
-        printf("At ");
-        print_token(p.current);
-        printf("\nParsed commands up to this point:\n");
-        print_commands(commands);
-        free_command(commands);
+        fprintf(out, "Parser encountered an error:\n");
+        fprintf(out, "At ");
+        print_token(out, p.current);
+        fprintf(out, "\nParsed commands up to this point:\n");
+        print_commands(out, commands);
         label_map_free(&lbm);
+        arena_free(&arena);
+        return -1;
+    }
+
+    // Resolve every label up front and lower the list into a flat program. Neither
+    // the commands nor the label map are needed at run time.
+    link_commands(commands, &lbm, err);
+    label_map_free(&lbm);
+
+    Program prog;
+    bool    built = program_build(&prog, commands);
+    arena_free(&arena);
+    if (!built) {
+        fprintf(out, "Unable to allocate program. Aborting\n");
         return -1;
     }
+    FILE *log = conf->verbose ? err : NULL;
+    if (conf->optimize) {
+        inline_calls(&prog, conf->inline_size, conf->inline_depth, log);
+        optimize_program(&prog);
+        optimize_loops(&prog, conf->unroll, log);
+    }
+    fuse_tail_calls(&prog);
+    compute_save_masks(&prog);
 
     Interpreter i;
-    interpreter_init(&i, &lbm);
-    interpret(&i, commands);
+    if (!interpreter_init(&i, conf->max_depth, MEM_CAPACITY)) {
+        fprintf(out, "Unable to allocate memory. Aborting\n");
+        interpreter_free(&i);
+        program_free(&prog);
+        return -1;
+    }
+    i.out = out;
+
+    // Memoization needs the unfused program to find pure routines, and only
+    // the interpreter consults it.
+    MemoTable memo;
+    bool      memoize = conf->memo_capacity > 0 && !conf->jit &&
+                   memo_init(&memo, &prog, conf->memo_capacity, conf->memo_eviction);
+    if (memoize) {
+        i.memo = &memo;
+    }
+
+    // Forking looks for pure routines the same way. Memoized calls mostly
+    // return at once, so memoization takes precedence.
+    Parallel parallel;
+    bool     forking = conf->threads > 1 && !conf->jit && !memoize &&
+                   parallel_init(&parallel, &prog, conf->threads, conf->max_depth);
+    if (forking) {
+        i.parallel = &parallel.main;
+    }
+
+    // The JIT works on the unfused program; anything it cannot translate runs
+    // on the interpreter instead.
+    JitCode jit;
+    if (conf->jit && jit_compile(&jit, &prog)) {
+        jit_run(&jit, &i);
+        jit_free(&jit);
+    } else {
+        if (conf->optimize) {
+            recognize_idioms(&prog, log);
+        }
+        fuse_superinstructions(&prog);
+        interpret(&i, &prog);
+    }
     print_interpreter_state(&i);
-    mem_print();
+    mem_print(&i.memory, out);
+    if (memoize) {
+        if (log) {
+            memo_print_stats(&memo, log);
+        }
+        memo_free(&memo);
+    }
+    if (forking) {
+        if (log) {
+            parallel_print_stats(&parallel, log);
+        }
+        parallel_free(&parallel);
+    }
 
-    free_command(commands);
-    label_map_free(&lbm);
+    program_free(&prog);
 
-    return (i.had_error) ? -1 : 0;
+    bool had_error = i.had_error;
+    interpreter_free(&i);
+    return (had_error) ? -1 : 0;
 }
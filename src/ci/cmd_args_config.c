@@ -1,4 +1,6 @@
 #include "cmd_args_config.h"
+#include "batch.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,8 +12,14 @@ void config_free(CmdArgsConfig *conf) {
 
     free(conf->in_filename);
     free(conf->out_filename);
+    for (size_t i = 0; i < conf->batch_count; i++) {
+        free(conf->batch_paths[i]);
+    }
+    free(conf->batch_paths);
     conf->in_filename  = NULL;
     conf->out_filename = NULL;
+    conf->batch_paths  = NULL;
+    conf->batch_count  = 0;
 }
 
 bool parse_cmd_args(CmdArgsConfig *conf, char **args, int arg_count) {
@@ -28,6 +36,94 @@ bool parse_cmd_args(CmdArgsConfig *conf, char **args, int arg_count) {
             conf->print_lex = true;
         } else if (strncmp(args[i], "-p", 2) == 0) {
             conf->print_parse = true;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            conf->jit = true;
+        } else if (strncmp(args[i], "-O", 2) == 0) {
+            conf->optimize = true;
+        } else if (strncmp(args[i], "-v", 2) == 0) {
+            conf->verbose = true;
+        } else if (strncmp(args[i], "-m", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Memo capacity not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->memo_capacity = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0') {
+                printf("Invalid memo capacity %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-e", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Memo eviction policy not specified\n");
+                return false;
+            }
+
+            if (strcmp(args[i], "none") == 0) {
+                conf->memo_eviction = MEMO_EVICT_NONE;
+            } else if (strcmp(args[i], "fifo") == 0) {
+                conf->memo_eviction = MEMO_EVICT_FIFO;
+            } else if (strcmp(args[i], "lru") == 0) {
+                conf->memo_eviction = MEMO_EVICT_LRU;
+            } else {
+                printf("Invalid memo eviction policy %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-s", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Inline size not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->inline_size = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0') {
+                printf("Invalid inline size %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-n", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Inline depth not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->inline_depth = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0') {
+                printf("Invalid inline depth %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-u", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Unroll factor not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->unroll = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0') {
+                printf("Invalid unroll factor %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-t", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Thread count not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->threads = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0' || conf->threads > PARALLEL_MAX_THREADS) {
+                printf("Invalid thread count %s\n", args[i]);
+                return false;
+            }
         } else if (strncmp(args[i], "-i", 2) == 0) {
             i++;
             if (i >= arg_count) {
@@ -42,6 +138,54 @@ bool parse_cmd_args(CmdArgsConfig *conf, char **args, int arg_count) {
             }
 
             strcpy(conf->in_filename, args[i]);
+        } else if (strncmp(args[i], "-b", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Batch path not specified\n");
+                return false;
+            }
+
+            char **paths = realloc(conf->batch_paths, (conf->batch_count + 1) * sizeof(char *));
+            if (!paths) {
+                printf("Failed to allocate space for batch path\n");
+                return false;
+            }
+            conf->batch_paths = paths;
+
+            char *path = calloc(strlen(args[i]) + 1, sizeof(char));
+            if (!path) {
+                printf("Failed to allocate space for batch path\n");
+                return false;
+            }
+
+            strcpy(path, args[i]);
+            conf->batch_paths[conf->batch_count++] = path;
+        } else if (strncmp(args[i], "-w", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Batch thread count not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->batch_threads = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0' || conf->batch_threads > BATCH_MAX_THREADS) {
+                printf("Invalid batch thread count %s\n", args[i]);
+                return false;
+            }
+        } else if (strncmp(args[i], "-d", 2) == 0) {
+            i++;
+            if (i >= arg_count) {
+                printf("Call depth not specified\n");
+                return false;
+            }
+
+            char *endptr;
+            conf->max_depth = strtoull(args[i], &endptr, 10);
+            if (*args[i] == '\0' || *endptr != '\0') {
+                printf("Invalid call depth %s\n", args[i]);
+                return false;
+            }
         } else if (strncmp(args[i], "-o", 2) == 0) {
             i++;
             if (i >= arg_count) {
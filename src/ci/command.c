@@ -3,54 +3,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void free_command(Command *command) {
-    while (command != NULL) {
-        Command *tempNext = command->next;
-        if (command->is_b_string) {
-            ufree(command->destination.str_val);
-        }
-        ufree(command);
-        command = tempNext;
+void print_command(FILE *out, Command *cmd) {
+    Operand dest = cmd->destination;
+    Operand a = cmd->val_a, b = cmd->val_b;
+    bool    a_imm = cmd->is_a_immediate, a_str = cmd->is_a_string;
+    bool    b_imm = cmd->is_b_immediate, b_str = cmd->is_b_string;
+
+    // Branches, calls and puts keep their label or string in `destination`;
+    // it is printed as the first operand instead of as a pointer.
+    if (cmd->type == CMD_PUT || cmd->is_b_string) {
+        b     = cmd->type == CMD_PUT ? a : (Operand) {0};
+        b_imm = cmd->type == CMD_PUT && a_imm;
+        b_str = false;
+        a     = dest;
+        a_imm = false;
+        a_str = true;
+        dest  = (Operand) {0};
     }
-}
 
-void print_command(Command *cmd) {
-    printf("Command type: %u\n", cmd->type);
-    printf("Destination: %" PRId64 "\n", cmd->destination.num_val);
-    printf("Operands:\n");
-    printf("A:\n");
-    print_command_op(cmd->val_a, cmd->is_a_immediate, cmd->is_a_string);
-    printf("\n");
-    printf("B:\n");
-    print_command_op(cmd->val_b, cmd->is_b_immediate, cmd->is_b_string);
-    printf("\n");
-    printf("Branch condition: %d\n", cmd->branch_condition);
-    printf("\n\n");
+    fprintf(out, "Command type: %u\n", cmd->type);
+    fprintf(out, "Destination: %" PRId64 "\n", dest.num_val);
+    fprintf(out, "Operands:\n");
+    fprintf(out, "A:\n");
+    print_command_op(out, a, a_imm, a_str);
+    fprintf(out, "\n");
+    fprintf(out, "B:\n");
+    print_command_op(out, b, b_imm, b_str);
+    fprintf(out, "\n");
+    fprintf(out, "Branch condition: %d\n", cmd->branch_condition);
+    fprintf(out, "\n\n");
 }
 
-void print_command_op(Operand op, bool is_imm, bool is_str) {
-    printf("Is immediate: %d\n", is_imm);
-    printf("Is a string: %d\n", is_str);
-    printf("Value: ");
+void print_command_op(FILE *out, Operand op, bool is_imm, bool is_str) {
+    fprintf(out, "Is immediate: %d\n", is_imm);
+    fprintf(out, "Is a string: %d\n", is_str);
+    fprintf(out, "Value: ");
     if (!is_str) {
-        printf("%" PRId64 "", op.num_val);
+        fprintf(out, "%" PRId64 "", op.num_val);
     } else {
-        printf("%s", op.str_val);
+        fprintf(out, "%s", op.str_val ? op.str_val : "(null)");
     }
 
-    printf("\n");
+    fprintf(out, "\n");
 }
 
-void print_commands(Command *cmd) {
+void print_commands(FILE *out, Command *cmd) {
     if (!cmd) {
-        printf("No commands found.\n");
+        fprintf(out, "No commands found.\n");
     }
 
     while (cmd) {
-        print_command(cmd);
+        print_command(out, cmd);
         cmd = cmd->next;
         if (cmd) {
-            printf("\n");
+            fprintf(out, "\n");
         }
     }
 }
@@ -0,0 +1,87 @@
+#include "fuse.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// The fused opcodes list their conditions in the same order as the branches,
+// so a condition can be carried over by offset.
+_Static_assert(OP_B_LE - OP_B_EQ == 5, "branch opcodes must stay contiguous");
+_Static_assert(OP_CMP_RR_B_LE - OP_CMP_RR_B_EQ == 5, "fused opcodes must stay contiguous");
+_Static_assert(OP_CMP_RI_B_EQ - OP_CMP_RR_B_EQ == 6, "fused opcodes must stay contiguous");
+_Static_assert(OP_ADD_CMP_RI_B_EQ - OP_ADD_CMP_RR_B_EQ == 6, "fused opcodes must stay contiguous");
+
+static bool is_conditional_branch(uint8_t op);
+static bool is_fused_compare(uint8_t op);
+static bool returns_next(const Program *prog, size_t i);
+
+void fuse_superinstructions(Program *prog) {
+    if (!prog || !prog->code) {
+        return;
+    }
+    Instr *code = prog->code;
+
+    // cmp + b.cond. The halt after the last instruction means code[i + 1] always
+    // exists.
+    for (size_t i = 0; i < prog->length; i++) {
+        if ((code[i].op != OP_CMP_RR && code[i].op != OP_CMP_RI) ||
+            !is_conditional_branch(code[i + 1].op)) {
+            continue;
+        }
+        Opcode base = code[i].op == OP_CMP_RR ? OP_CMP_RR_B_EQ : OP_CMP_RI_B_EQ;
+        code[i].op  = base + (code[i + 1].op - OP_B_EQ);
+    }
+
+    // add + cmp + b.cond, built on top of the fused pairs found above.
+    for (size_t i = 0; i < prog->length; i++) {
+        if (code[i].op != OP_ADD_RRI || !is_fused_compare(code[i + 1].op)) {
+            continue;
+        }
+        code[i].op = OP_ADD_CMP_RR_B_EQ + (code[i + 1].op - OP_CMP_RR_B_EQ);
+    }
+}
+
+void fuse_tail_calls(Program *prog) {
+    if (!prog || !prog->code) {
+        return;
+    }
+
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->code[i].op == OP_CALL && returns_next(prog, i + 1)) {
+            prog->code[i].op = OP_TAIL_CALL;
+        }
+    }
+}
+
+/**
+ * @brief Determines if an instruction is a ret, or only branches to one.
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the instruction.
+ * @return True if the first instruction with an effect from `i` on is a ret.
+ */
+static bool returns_next(const Program *prog, size_t i) {
+    // Bounded, since a cycle of branches never reaches a ret.
+    for (size_t steps = 0; steps < prog->length && prog->code[i].op == OP_B; steps++) {
+        i = prog->code[i].arg;
+    }
+    return prog->code[i].op == OP_RET;
+}
+
+/**
+ * @brief Determines if an opcode is a linked conditional branch.
+ *
+ * @param op The opcode to check.
+ * @return True if `op` is one of `OP_B_EQ` through `OP_B_LE`.
+ */
+static bool is_conditional_branch(uint8_t op) {
+    return op >= OP_B_EQ && op <= OP_B_LE;
+}
+
+/**
+ * @brief Determines if an opcode is a fused compare-and-branch.
+ *
+ * @param op The opcode to check.
+ * @return True if `op` is one of the `OP_CMP_*_B_*` superinstructions.
+ */
+static bool is_fused_compare(uint8_t op) {
+    return op >= OP_CMP_RR_B_EQ && op <= OP_CMP_RI_B_LE;
+}
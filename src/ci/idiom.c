@@ -0,0 +1,354 @@
+#include "idiom.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define POPCOUNT_STAGES 5     // Pairs, nibbles, bytes, halves, words.
+#define POPCOUNT_LENGTH 25    // Five instructions per stage.
+#define SUM_LENGTH      5     // Counter step, compare, exit, accumulate, back edge.
+#define NO_VAR          0xFF  // Operand slot holding an immediate instead.
+
+// Each `OP_IDIOM` describes itself in the constant pool from consts[arg] on.
+// Every kind starts with DESC_KIND and DESC_NEXT.
+#define DESC_KIND   0  // The `IdiomKind`.
+#define DESC_NEXT   1  // Where the replaced code continues.
+#define DESC_MASK   2  // Popcount: the variable left holding 0xFFFF.
+#define DESC_BOUND  2  // Counted sum: the bound, if b is NO_VAR.
+#define DESC_ADDEND 3  // Counted sum: the variable added, or NO_VAR.
+#define DESC_IMM    4  // Counted sum: the immediate added, if DESC_ADDEND is NO_VAR.
+#define DESC_STEP   5  // Counted sum: +1 or -1, added to the counter each iteration.
+#define DESC_SIGN   6  // Counted sum: +1 to add to the accumulator, -1 to subtract.
+#define DESC_SHAPE  7  // Counted sum: the SHAPE_* bits.
+#define DESC_SIZE   8  // Largest descriptor.
+
+#define SHAPE_STEP_FIRST 0x1  // The counter is stepped before the compare.
+#define SHAPE_ADD_FIRST  0x2  // The accumulator is updated before the compare.
+#define SHAPE_STEP_ADD   0x4  // The counter is stepped before the accumulator is updated.
+
+typedef enum {
+    IDIOM_POPCOUNT,
+    IDIOM_COUNTED_SUM,
+} IdiomKind;
+
+/**
+ * @brief The operands of a recognized counted accumulation loop.
+ */
+typedef struct {
+    uint8_t  counter;  // The variable stepped and compared.
+    uint8_t  bound;    // The variable compared against, or NO_VAR.
+    uint8_t  acc;      // The accumulator.
+    uint8_t  addend;   // The variable added to the accumulator, or NO_VAR.
+    int64_t  bound_imm;
+    int64_t  addend_imm;
+    int64_t  step;
+    int64_t  sign;
+    int64_t  shape;
+    uint32_t exit;  // Where the loop continues once the counter hits the bound.
+} CountedSum;
+
+static const int64_t popcount_masks[POPCOUNT_STAGES] = {0x55555555, 0x33333333, 0x0F0F0F0F,
+                                                         0x00FF00FF, 0x0000FFFF};
+
+static bool     match_popcount(const Program *prog, size_t i, uint8_t regs[4]);
+static bool     match_counted_sum(const Program *prog, size_t i, CountedSum *sum);
+static bool     match_step(const Program *prog, const Instr *ins, uint8_t counter, int64_t *step);
+static bool     match_accumulate(const Program *prog, const Instr *ins, CountedSum *sum);
+static bool     operands_are(const Instr *ins, uint8_t x, uint8_t y);
+static uint32_t add_descriptor(Program *prog, const int64_t *desc, size_t count);
+
+size_t recognize_idioms(Program *prog, FILE *log) {
+    if (!prog || !prog->code) {
+        return 0;
+    }
+
+    size_t rewrites = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        uint8_t    regs[4];
+        CountedSum sum;
+        int64_t    desc[DESC_SIZE] = {0};
+        uint32_t   arg;
+        if (match_popcount(prog, i, regs)) {
+            desc[DESC_KIND] = IDIOM_POPCOUNT;
+            desc[DESC_NEXT] = (int64_t) (i + POPCOUNT_LENGTH);
+            desc[DESC_MASK] = regs[3];
+            if ((arg = add_descriptor(prog, desc, DESC_MASK + 1)) == UINT32_MAX) {
+                break;
+            }
+            prog->code[i] = (Instr) {OP_IDIOM, regs[0], regs[1], regs[2], arg};
+            if (log) {
+                fprintf(log, "Idiom: popcount at instruction %zu\n", i);
+            }
+        } else if (match_counted_sum(prog, i, &sum)) {
+            desc[DESC_KIND]   = IDIOM_COUNTED_SUM;
+            desc[DESC_NEXT]   = sum.exit;
+            desc[DESC_BOUND]  = sum.bound_imm;
+            desc[DESC_ADDEND] = sum.addend;
+            desc[DESC_IMM]    = sum.addend_imm;
+            desc[DESC_STEP]   = sum.step;
+            desc[DESC_SIGN]   = sum.sign;
+            desc[DESC_SHAPE]  = sum.shape;
+            if ((arg = add_descriptor(prog, desc, DESC_SIZE)) == UINT32_MAX) {
+                break;
+            }
+            prog->code[i] = (Instr) {OP_IDIOM, sum.acc, sum.counter, sum.bound, arg};
+            if (log) {
+                fprintf(log, "Idiom: counted %s at instruction %zu\n",
+                        sum.addend == sum.counter ? "series" : "sum", i);
+            }
+        } else {
+            continue;
+        }
+        rewrites++;
+    }
+    return rewrites;
+}
+
+size_t idiom_run(Interpreter *intr, const Program *prog, const Instr *ins) {
+    const int64_t *desc = &prog->consts[ins->arg];
+    int64_t       *vars = intr->variables;
+
+    if (desc[DESC_KIND] == IDIOM_POPCOUNT) {
+        // Only the low 32 bits reach the sum; the halves are what the last
+        // stage leaves behind in its temporaries.
+        uint64_t value        = (uint64_t) vars[ins->dst];
+        int64_t  low          = __builtin_popcountll(value & 0xFFFF);
+        int64_t  high         = __builtin_popcountll((value >> 16) & 0xFFFF);
+        vars[ins->a]          = low;
+        vars[ins->b]          = high;
+        vars[desc[DESC_MASK]] = 0xFFFF;
+        vars[ins->dst]        = low + high;
+        return (size_t) desc[DESC_NEXT];
+    }
+
+    // The compare sees the counter at start + step * (t + step_first) in
+    // iteration t, so the loop leaves in iteration (bound - start) * step -
+    // step_first, all modulo 2^64.
+    uint64_t shape = (uint64_t) desc[DESC_SHAPE];
+    uint64_t start = (uint64_t) vars[ins->a];
+    uint64_t bound = ins->b == NO_VAR ? (uint64_t) desc[DESC_BOUND] : (uint64_t) vars[ins->b];
+    uint64_t step  = (uint64_t) desc[DESC_STEP];
+    uint64_t last  = (bound - start) * step - ((shape & SHAPE_STEP_FIRST) != 0);
+    uint64_t count = last + ((shape & SHAPE_ADD_FIRST) != 0);
+
+    uint64_t delta;
+    if (desc[DESC_ADDEND] == ins->a) {
+        // Adds start + step * (t + step_add) for t below count. One of count
+        // and count - 1 is even, which keeps the halving exact modulo 2^64.
+        uint64_t pairs    = count % 2 == 0 ? count / 2 * (count - 1) : (count - 1) / 2 * count;
+        uint64_t step_add = (shape & SHAPE_STEP_ADD) != 0;
+        delta             = count * start + step * (count * step_add + pairs);
+    } else {
+        uint64_t addend = desc[DESC_ADDEND] == NO_VAR ? (uint64_t) desc[DESC_IMM]
+                                                      : (uint64_t) vars[desc[DESC_ADDEND]];
+        delta = count * addend;
+    }
+    vars[ins->dst]   = (int64_t) ((uint64_t) vars[ins->dst] + (uint64_t) desc[DESC_SIGN] * delta);
+    vars[ins->a]     = (int64_t) bound;
+    intr->is_greater = false;
+    intr->is_less    = false;
+    intr->is_equal   = true;
+    return (size_t) desc[DESC_NEXT];
+}
+
+/**
+ * @brief Matches the five stages of a 32-bit SWAR popcount.
+ *
+ * Each stage is, for its mask M and shift k:
+ *
+ *     mov m, M
+ *     and t1, v, m
+ *     lsr t2, v, k
+ *     and t2, t2, m
+ *     add v, t1, t2
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the first instruction.
+ * @param regs Set to v, t1, t2 and m, which must all differ.
+ * @return True if the sequence starting at `i` is a popcount.
+ */
+static bool match_popcount(const Program *prog, size_t i, uint8_t regs[4]) {
+    if (i + POPCOUNT_LENGTH > prog->length) {
+        return false;
+    }
+    const Instr *code = &prog->code[i];
+    uint8_t      v = code[2].a, t1 = code[1].dst, t2 = code[2].dst, m = code[0].dst;
+    if (v == t1 || v == t2 || v == m || t1 == t2 || t1 == m || t2 == m) {
+        return false;
+    }
+
+    for (size_t s = 0; s < POPCOUNT_STAGES; s++) {
+        const Instr *stage = &code[s * 5];
+        if (stage[0].op != OP_MOV_RI || stage[0].dst != m ||
+            program_imm(prog, &stage[0]) != popcount_masks[s] || stage[1].op != OP_AND_RRR ||
+            stage[1].dst != t1 || !operands_are(&stage[1], v, m) || stage[2].op != OP_LSR_RRI ||
+            stage[2].dst != t2 || stage[2].a != v || program_imm(prog, &stage[2]) != 1 << s ||
+            stage[3].op != OP_AND_RRR || stage[3].dst != t2 || !operands_are(&stage[3], t2, m) ||
+            stage[4].op != OP_ADD_RRR || stage[4].dst != v || !operands_are(&stage[4], t1, t2)) {
+            return false;
+        }
+    }
+
+    regs[0] = v;
+    regs[1] = t1;
+    regs[2] = t2;
+    regs[3] = m;
+    return true;
+}
+
+/**
+ * @brief Matches a counted accumulation loop headed at `i`.
+ *
+ * The loop is five instructions ending in a branch back to `i`. It holds a
+ * compare of the counter against a bound directly followed by a b.eq out of
+ * the loop, and, in either order around it, a step of the counter by one and
+ * an update of an accumulator by an invariant or the counter.
+ *
+ * @param prog The program to inspect.
+ * @param i The index of the loop header.
+ * @param sum Filled in with the operands of the loop.
+ * @return True if the loop has a closed form.
+ */
+static bool match_counted_sum(const Program *prog, size_t i, CountedSum *sum) {
+    if (i + SUM_LENGTH > prog->length) {
+        return false;
+    }
+    const Instr *code = &prog->code[i];
+    if (code[SUM_LENGTH - 1].op != OP_B || code[SUM_LENGTH - 1].arg != i) {
+        return false;
+    }
+
+    // The compare and its exit, which must leave the loop.
+    size_t cmp = 0;
+    while (cmp < SUM_LENGTH - 2 && code[cmp + 1].op != OP_B_EQ) {
+        cmp++;
+    }
+    if (cmp == SUM_LENGTH - 2 || code[cmp + 1].arg - i < SUM_LENGTH) {
+        return false;
+    }
+    sum->exit = code[cmp + 1].arg;
+    switch (code[cmp].op) {
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+            sum->counter = code[cmp].a;
+            sum->bound   = code[cmp].b;
+            break;
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+            sum->counter   = code[cmp].a;
+            sum->bound     = NO_VAR;
+            sum->bound_imm = program_imm(prog, &code[cmp]);
+            break;
+        default:
+            return false;
+    }
+
+    // The two updates fill the other slots; either may be the counter step.
+    size_t slots[2], n = 0;
+    for (size_t s = 0; s < SUM_LENGTH - 1; s++) {
+        if (s != cmp && s != cmp + 1) {
+            slots[n++] = s;
+        }
+    }
+    size_t step = slots[0], add = slots[1];
+    if (!match_step(prog, &code[step], sum->counter, &sum->step)) {
+        step = slots[1];
+        add  = slots[0];
+        if (!match_step(prog, &code[step], sum->counter, &sum->step)) {
+            return false;
+        }
+    }
+    if (!match_accumulate(prog, &code[add], sum) || sum->acc == sum->counter ||
+        sum->acc == sum->bound || sum->addend == sum->acc || sum->bound == sum->counter) {
+        return false;
+    }
+
+    sum->shape = (step < cmp ? SHAPE_STEP_FIRST : 0) | (add < cmp ? SHAPE_ADD_FIRST : 0) |
+                 (step < add ? SHAPE_STEP_ADD : 0);
+    return true;
+}
+
+/**
+ * @brief Matches a step of the counter by one.
+ *
+ * @param prog The program to inspect.
+ * @param ins The instruction to match.
+ * @param counter The counter variable.
+ * @param step Set to +1 or -1.
+ * @return True if `ins` adds or subtracts one to or from `counter`.
+ */
+static bool match_step(const Program *prog, const Instr *ins, uint8_t counter, int64_t *step) {
+    if ((ins->op != OP_ADD_RRI && ins->op != OP_SUB_RRI) || ins->dst != counter ||
+        ins->a != counter) {
+        return false;
+    }
+    int64_t imm = program_imm(prog, ins);
+    if (imm != 1 && imm != -1) {
+        return false;
+    }
+    *step = ins->op == OP_ADD_RRI ? imm : -imm;
+    return true;
+}
+
+/**
+ * @brief Matches an update of the accumulator.
+ *
+ * @param prog The program to inspect.
+ * @param ins The instruction to match.
+ * @param sum Has its accumulator, addend and sign filled in.
+ * @return True if `ins` adds a variable or immediate to, or subtracts one
+ * from, a variable.
+ */
+static bool match_accumulate(const Program *prog, const Instr *ins, CountedSum *sum) {
+    sum->acc        = ins->dst;
+    sum->addend     = NO_VAR;
+    sum->addend_imm = 0;
+    sum->sign       = ins->op == OP_ADD_RRR || ins->op == OP_ADD_RRI ? 1 : -1;
+    switch (ins->op) {
+        case OP_ADD_RRR:
+            if (ins->a != ins->dst && ins->b != ins->dst) {
+                return false;
+            }
+            sum->addend = ins->a == ins->dst ? ins->b : ins->a;
+            return true;
+        case OP_SUB_RRR:
+            sum->addend = ins->b;
+            return ins->a == ins->dst;
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+            sum->addend_imm = program_imm(prog, ins);
+            return ins->a == ins->dst;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Determines if a two-operand instruction reads exactly `x` and `y`.
+ *
+ * @param ins The instruction to inspect.
+ * @param x One operand.
+ * @param y The other operand.
+ * @return True if the operands are `x` and `y`, in either order.
+ */
+static bool operands_are(const Instr *ins, uint8_t x, uint8_t y) {
+    return (ins->a == x && ins->b == y) || (ins->a == y && ins->b == x);
+}
+
+
+/**
+ * @brief Appends an idiom descriptor to the constant pool.
+ *
+ * @param prog The program to extend.
+ * @param desc The descriptor.
+ * @param count The number of entries in `desc`.
+ * @return The index of the first entry, or UINT32_MAX if memory ran out.
+ */
+static uint32_t add_descriptor(Program *prog, const int64_t *desc, size_t count) {
+    uint32_t first = (uint32_t) prog->const_count;
+    for (size_t d = 0; d < count; d++) {
+        if (program_add_const(prog, desc[d]) == UINT32_MAX) {
+            return UINT32_MAX;
+        }
+    }
+    return first;
+}
@@ -0,0 +1,517 @@
+#include "inline.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+
+/**
+ * @brief The code replacing one call.
+ */
+typedef struct {
+    size_t site;   // Index of the call.
+    Instr *code;   // The copied body; its jumps are relative to its first instruction.
+    size_t count;  // Number of instructions in `code`.
+} Inlining;
+
+/**
+ * @brief What a round needs to know about the program as it was at its start.
+ */
+typedef struct {
+    RegMask  *live_in;   // Variables and flags live on entry to each instruction.
+    RegMask   unused;    // Variables no instruction mentions, free to stand in for others.
+    uint32_t  zero;      // Constant pool index of 0, or UINT32_MAX until one is needed.
+    uint32_t *visited;   // Stamp of the last walk that reached each instruction.
+    uint32_t  stamp;     // Stamp of the current walk.
+    size_t   *closure;   // The instructions reached by the current walk.
+    uint32_t *incoming;  // Number of edges into each instruction, from anywhere.
+    uint32_t *inside;    // Edges into each instruction of `closure` from within it.
+} Round;
+
+static int     inline_round(Program *prog, size_t max_size, FILE *log);
+static int     plan_round(Program *prog, Round *round, size_t max_size, FILE *log,
+                          Inlining **plans, size_t *count);
+static int     plan_call(Program *prog, Round *round, size_t site, size_t max_size,
+                         Inlining *plan);
+static size_t  routine_body(const Program *prog, Round *round, size_t entry, size_t max_size);
+static bool    is_closed(const Program *prog, Round *round, size_t entry, size_t count);
+static bool    build_copy(Program *prog, Round *round, size_t count, RegMask restore,
+                          Inlining *plan);
+static bool    splice(Program *prog, const Inlining *plans, size_t count);
+static size_t  body_index(const size_t *closure, size_t count, size_t target);
+static RegMask operand_regs(const Instr *ins);
+static void    rename_operands(Instr *ins, const uint8_t *map);
+
+bool inline_calls(Program *prog, size_t max_size, size_t max_depth, FILE *log) {
+    if (!prog || !prog->code) {
+        return false;
+    }
+
+    for (size_t depth = 0; depth < max_depth && max_size > 0; depth++) {
+        int result = inline_round(prog, max_size, log);
+        if (result < 0) {
+            return false;
+        }
+        if (result == 0) {
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Inlines every call to a routine that is a small leaf right now.
+ *
+ * @param prog The program to rewrite.
+ * @param max_size Longest routine inlined.
+ * @param log Stream to report each inlined call on, or NULL for none.
+ * @return 1 if the program changed, 0 if not, -1 if memory ran out.
+ */
+static int inline_round(Program *prog, size_t max_size, FILE *log) {
+    Round     round  = {0};
+    Inlining *plans  = NULL;
+    size_t    count  = 0;
+    int       result = -1;
+
+    round.zero    = UINT32_MAX;
+    round.live_in = malloc((prog->length + 1) * sizeof(RegMask));
+    round.visited = calloc(prog->length + 1, sizeof(uint32_t));
+    round.closure  = malloc((max_size + 1) * sizeof(size_t));
+    round.incoming = calloc(prog->length + 1, sizeof(uint32_t));
+    round.inside   = malloc((max_size + 1) * sizeof(uint32_t));
+    if (round.live_in && round.visited && round.closure && round.incoming && round.inside) {
+        compute_liveness(prog, round.live_in);
+        for (size_t i = 0; i < prog->length; i++) {
+            size_t succ[MAX_SUCCESSORS];
+            size_t n = instr_successors(prog, i, succ);
+            for (size_t s = 0; s < n; s++) {
+                round.incoming[succ[s]]++;
+            }
+        }
+        result = plan_round(prog, &round, max_size, log, &plans, &count);
+    }
+    if (result > 0 && !splice(prog, plans, count)) {
+        result = -1;
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        free(plans[k].code);
+    }
+    free(plans);
+    free(round.live_in);
+    free(round.visited);
+    free(round.closure);
+    free(round.incoming);
+    free(round.inside);
+    return result;
+}
+
+/**
+ * @brief Builds a copy for every call that can be inlined.
+ *
+ * @param prog The program to inspect; only its constant pool can grow.
+ * @param round The facts of the current round, with liveness computed.
+ * @param max_size Longest routine inlined.
+ * @param log Stream to report each inlined call on, or NULL for none.
+ * @param plans Set to the copies, in increasing order of their calls.
+ * @param count Set to the number of entries in `plans`.
+ * @return 1 if any call can be inlined, 0 if none, -1 if memory ran out.
+ */
+static int plan_round(Program *prog, Round *round, size_t max_size, FILE *log,
+                      Inlining **plans, size_t *count) {
+    RegMask mentioned = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        mentioned |= operand_regs(&prog->code[i]);
+    }
+    round->unused = MASK_ALL_REGS & ~mentioned;
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->code[i].op != OP_CALL) {
+            continue;
+        }
+        if (*count == capacity) {
+            size_t    grown = capacity ? capacity * 2 : 8;
+            Inlining *more  = realloc(*plans, grown * sizeof(Inlining));
+            if (!more) {
+                return -1;
+            }
+            *plans   = more;
+            capacity = grown;
+        }
+        int planned = plan_call(prog, round, i, max_size, &(*plans)[*count]);
+        if (planned < 0) {
+            return -1;
+        }
+        if (planned > 0) {
+            if (log) {
+                fprintf(log, "Inline: inlined the call at %zu to the routine at %zu\n", i,
+                        (size_t) prog->code[i].arg);
+            }
+            (*count)++;
+        }
+    }
+    return *count > 0;
+}
+
+/**
+ * @brief Builds the copy replacing a call, if the routine qualifies.
+ *
+ * @param prog The program to inspect; only its constant pool can grow.
+ * @param round The facts of the current round.
+ * @param site The index of the call.
+ * @param max_size Longest routine inlined.
+ * @param plan Filled in with the copy on success.
+ * @return 1 if the call gets inlined, 0 if not, -1 if memory ran out.
+ */
+static int plan_call(Program *prog, Round *round, size_t site, size_t max_size,
+                     Inlining *plan) {
+    // A body running into the code after the call would be copied into it.
+    size_t count = routine_body(prog, round, prog->code[site].arg, max_size);
+    if (count == 0 || round->visited[site] == round->stamp ||
+        round->visited[site + 1] == round->stamp) {
+        return 0;
+    }
+
+    RegMask clobbered = 0;
+    bool    accesses  = false;
+    for (size_t j = 0; j < count; j++) {
+        const Instr *ins = &prog->code[round->closure[j]];
+        clobbered |= instr_defs(prog, round->closure[j]);
+        accesses |= ins->op >= OP_LOAD_RR && ins->op <= OP_STORE_RI;
+        accesses |= ins->op == OP_PUT_R || ins->op == OP_PUT_I;
+    }
+
+    // Variables the ret would have restored and the caller still reads.
+    RegMask restore = clobbered & MASK_CALLEE & round->live_in[site + 1];
+    if (restore && (accesses || __builtin_popcountll(restore) >
+                                    __builtin_popcountll(round->unused))) {
+        return 0;
+    }
+    plan->site = site;
+    return build_copy(prog, round, count, restore, plan) ? 1 : -1;
+}
+
+/**
+ * @brief Collects a routine into `round->closure`, sorted by index.
+ *
+ * @param prog The program to inspect.
+ * @param round The facts of the current round.
+ * @param entry The first instruction of the routine.
+ * @param max_size Longest routine accepted.
+ * @return The number of instructions in the routine, or 0 if it is too long,
+ * not a leaf that always returns, or entered other than at its entry.
+ */
+static size_t routine_body(const Program *prog, Round *round, size_t entry, size_t max_size) {
+    size_t *closure = round->closure;
+    size_t  count   = 0;
+    round->stamp++;
+    round->visited[entry] = round->stamp;
+    closure[count++]      = entry;
+
+    for (size_t next = 0; next < count; next++) {
+        // Every opcode past the plain branches calls, stops or is unlinked.
+        size_t  i  = closure[next];
+        uint8_t op = prog->code[i].op;
+        if (op > OP_B_LE && op != OP_RET) {
+            return 0;
+        }
+
+        size_t succ[MAX_SUCCESSORS];
+        size_t n = instr_successors(prog, i, succ);
+        for (size_t s = 0; s < n; s++) {
+            if (round->visited[succ[s]] == round->stamp) {
+                continue;
+            }
+            if (count == max_size) {
+                return 0;
+            }
+            round->visited[succ[s]] = round->stamp;
+            closure[count++]        = succ[s];
+        }
+    }
+
+    // Insertion sort; routines this small are not worth more.
+    for (size_t j = 1; j < count; j++) {
+        size_t i = closure[j], k = j;
+        for (; k > 0 && closure[k - 1] > i; k--) {
+            closure[k] = closure[k - 1];
+        }
+        closure[k] = i;
+    }
+    return is_closed(prog, round, entry, count) ? count : 0;
+}
+
+/**
+ * @brief Determines if only the entry of a routine is reached from outside it.
+ *
+ * Code that falls or branches into the middle of a routine shares its
+ * instructions, and its ret, so such a routine is not one to copy.
+ *
+ * @param prog The program to inspect.
+ * @param round The facts of the current round, with the routine sorted in
+ * `closure`.
+ * @param entry The first instruction of the routine.
+ * @param count The number of instructions in the routine.
+ * @return True if every edge into the routine goes to its entry.
+ */
+static bool is_closed(const Program *prog, Round *round, size_t entry, size_t count) {
+    const size_t *closure = round->closure;
+    memset(round->inside, 0, count * sizeof(uint32_t));
+    for (size_t j = 0; j < count; j++) {
+        size_t succ[MAX_SUCCESSORS];
+        size_t n = instr_successors(prog, closure[j], succ);
+        for (size_t s = 0; s < n; s++) {
+            round->inside[body_index(closure, count, succ[s])]++;
+        }
+    }
+
+    for (size_t j = 0; j < count; j++) {
+        if (closure[j] != entry && round->incoming[closure[j]] != round->inside[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Copies a routine, renaming the variables it must not clobber.
+ *
+ * The copy is laid out as the stand-ins being loaded, the body in program
+ * order with each ret jumping to the end, and the stand-ins being zeroed:
+ *
+ *     add s, r, #0      for each restored r the body reads
+ *     body              with r renamed to s, and ret as b end
+ *     end: mov s, #0    for each restored r
+ *
+ * @param prog The program to copy from; only its constant pool can grow.
+ * @param round The facts of the current round, with the routine in `closure`.
+ * @param count The number of instructions in the routine.
+ * @param restore The variables to rename.
+ * @param plan Filled in with the copy.
+ * @return True on success, false if memory ran out.
+ */
+static bool build_copy(Program *prog, Round *round, size_t count, RegMask restore,
+                       Inlining *plan) {
+    const size_t *closure = round->closure;
+    uint8_t       map[NUM_VARIABLES];
+    RegMask       reads = 0;
+    for (uint8_t r = 0; r < NUM_VARIABLES; r++) {
+        map[r] = r;
+    }
+    RegMask free_regs = round->unused;
+    for (RegMask left = restore; left; left &= left - 1) {
+        uint8_t r = (uint8_t) __builtin_ctzll(left);
+        map[r]    = (uint8_t) __builtin_ctzll(free_regs);
+        free_regs &= free_regs - 1;
+    }
+    for (size_t j = 0; j < count; j++) {
+        reads |= instr_uses(prog, closure[j]);
+    }
+    if (restore && round->zero == UINT32_MAX) {
+        round->zero = program_add_const(prog, 0);
+        if (round->zero == UINT32_MAX) {
+            return false;
+        }
+    }
+
+    // A ret at the very end just falls through to the epilogue.
+    size_t loads = (size_t) __builtin_popcountll(restore & reads);
+    size_t body  = count - (prog->code[closure[count - 1]].op == OP_RET);
+    size_t end   = loads + body;
+    size_t total = end + (size_t) __builtin_popcountll(restore);
+    Instr *code  = malloc(total * sizeof(Instr));
+    if (!code) {
+        return false;
+    }
+
+    size_t out = 0;
+    for (RegMask left = restore & reads; left; left &= left - 1) {
+        uint8_t r   = (uint8_t) __builtin_ctzll(left);
+        code[out++] = (Instr) {OP_ADD_RRI, map[r], r, 0, round->zero};
+    }
+    for (size_t j = 0; j < body; j++) {
+        Instr ins = prog->code[closure[j]];
+        if (ins.op == OP_RET) {
+            ins = (Instr) {OP_B, 0, 0, 0, (uint32_t) end};
+        } else if (program_has_target(ins.op)) {
+            size_t target = body_index(closure, count, ins.arg);
+            ins.arg       = (uint32_t) (target < body ? loads + target : end);
+        }
+        if (restore) {
+            rename_operands(&ins, map);
+        }
+        code[out++] = ins;
+    }
+    for (RegMask left = restore; left; left &= left - 1) {
+        uint8_t r   = (uint8_t) __builtin_ctzll(left);
+        code[out++] = (Instr) {OP_MOV_RI, map[r], 0, 0, round->zero};
+    }
+
+    plan->code  = code;
+    plan->count = total;
+    return true;
+}
+
+/**
+ * @brief Replaces each planned call by its copy and renumbers every jump.
+ *
+ * @param prog The program to rewrite.
+ * @param plans The copies, in increasing order of their calls.
+ * @param count The number of entries in `plans`.
+ * @return True on success, false if memory ran out.
+ */
+static bool splice(Program *prog, const Inlining *plans, size_t count) {
+    size_t length = prog->length;
+    for (size_t k = 0; k < count; k++) {
+        length += plans[k].count - 1;
+    }
+    if (length >= UINT32_MAX) {
+        return false;
+    }
+
+    // map[i] is the new index of instruction i, or of the start of its copy.
+    uint32_t *map  = malloc((prog->length + 1) * sizeof(uint32_t));
+    Instr    *code = malloc((length + 1) * sizeof(Instr));
+    if (!map || !code) {
+        free(map);
+        free(code);
+        return false;
+    }
+    size_t out = 0, k = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        map[i] = (uint32_t) out;
+        if (k < count && plans[k].site == i) {
+            for (size_t j = 0; j < plans[k].count; j++) {
+                code[out] = plans[k].code[j];
+                if (program_has_target(code[out].op)) {
+                    code[out].arg += map[i];
+                }
+                out++;
+            }
+            k++;
+        } else {
+            code[out++] = prog->code[i];
+        }
+    }
+    map[prog->length] = (uint32_t) out;
+    code[out]         = prog->code[prog->length];
+
+    k = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        if (k < count && plans[k].site == i) {
+            k++;
+        } else if (program_has_target(code[map[i]].op)) {
+            code[map[i]].arg = map[code[map[i]].arg];
+        }
+    }
+
+    free(map);
+    free(prog->code);
+    free(prog->save_masks);
+    prog->code       = code;
+    prog->length     = length;
+    prog->save_masks = NULL;
+    return true;
+}
+
+/**
+ * @brief Finds an instruction in a sorted routine.
+ *
+ * @param closure The instructions of the routine, sorted.
+ * @param count The number of instructions in `closure`.
+ * @param target The instruction to look for, which must be in the routine.
+ * @return Its position in `closure`.
+ */
+static size_t body_index(const size_t *closure, size_t count, size_t target) {
+    size_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (closure[mid] <= target) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Lists the variables an instruction names in its operands.
+ *
+ * Unlike `instr_uses()`, memory accesses only report the variables they
+ * actually name.
+ *
+ * @param ins The instruction to inspect.
+ * @return The mask of variables it reads or writes.
+ */
+static RegMask operand_regs(const Instr *ins) {
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+        case OP_LOAD_RI:
+        case OP_STORE_RI:
+            return REG_BIT(ins->dst);
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+            return REG_BIT(ins->dst) | REG_BIT(ins->a) | REG_BIT(ins->b);
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+        case OP_STORE_RR:
+            return REG_BIT(ins->dst) | REG_BIT(ins->a);
+        case OP_LOAD_RR:
+            return REG_BIT(ins->dst) | REG_BIT(ins->b);
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+            return REG_BIT(ins->a) | REG_BIT(ins->b);
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+        case OP_PRINT_R:
+        case OP_PUT_R:
+            return REG_BIT(ins->a);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Renames the variables an instruction reads and writes.
+ *
+ * Only called on copies without memory accesses.
+ *
+ * @param ins The instruction to rename in place.
+ * @param map The new name of each variable.
+ */
+static void rename_operands(Instr *ins, const uint8_t *map) {
+    RegMask regs = operand_regs(ins);
+    if (regs == 0) {
+        return;
+    }
+    switch ((Opcode) ins->op) {
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+        case OP_PRINT_R:
+            break;
+        default:
+            ins->dst = map[ins->dst];
+            break;
+    }
+    if (ins->op != OP_MOV_RI) {
+        ins->a = map[ins->a];
+    }
+    if (ins->op == OP_ADD_RRR || ins->op == OP_SUB_RRR || ins->op == OP_AND_RRR ||
+        ins->op == OP_ORR_RRR || ins->op == OP_EOR_RRR || ins->op == OP_CMP_RR ||
+        ins->op == OP_CMP_U_RR) {
+        ins->b = map[ins->b];
+    }
+}
+
+
@@ -5,261 +5,573 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "analysis.h"
 #include "command_type.h"
+#include "idiom.h"
 #include "mem.h"
+#include "memo.h"
+#include "parallel.h"
+#include "program.h"
+#include "trace.h"
 
 static bool    cond_holds(Interpreter *intr, BranchCondition cond);
-static int64_t fetch_number_value(Interpreter *intr, Operand *op, bool is_im);
-static bool    print_base(Interpreter *intr, Command *cmd);
+static void    set_flags(Interpreter *intr, int64_t a, int64_t b);
+static void    set_flags_unsigned(Interpreter *intr, uint64_t a, uint64_t b);
+static bool    grow_frames(Interpreter *intr);
+static inline bool push_frame(Interpreter *intr, const Instr *caller, uint32_t saved);
+static inline const Instr *pop_frame(Interpreter *intr);
+static void    copy_variables(int64_t *dst, const int64_t *src, uint32_t mask);
 
-void interpreter_init(Interpreter *intr, LabelMap *map) {
+bool interpreter_init(Interpreter *intr, size_t max_depth, size_t mem_capacity) {
     if (!intr) {
-        return;
+        return false;
     }
 
     intr->had_error  = false;
-    intr->label_map  = map;
     intr->is_greater = false;
     intr->is_equal   = false;
     intr->is_less    = false;
-    intr->the_stack  = NULL;
+    intr->frames         = NULL;
+    intr->frame_count    = 0;
+    intr->frame_capacity = 0;
+    intr->max_depth      = max_depth;
+    intr->memo           = NULL;
+    intr->parallel       = NULL;
+    intr->out            = stdout;
 
     for (size_t i = 0; i < NUM_VARIABLES; i++) {
         intr->variables[i] = 0;
     }
+    return mem_init(&intr->memory, mem_capacity);
+}
+
+void interpreter_free(Interpreter *intr) {
+    interpreter_free_frames(intr);
+    mem_free(&intr->memory);
 }
 
-void interpret(Interpreter *intr, Command *commands) {
-    if (!intr || !commands) {
+/*
+ * interpret() has two dispatch engines sharing the same handler bodies. With
+ * CI_THREADED_DISPATCH (the default in the Makefile) every handler ends in its
+ * own computed goto through `dispatch_table`, so each guest instruction gets a
+ * separately predicted indirect branch. Otherwise the handlers become the cases
+ * of a portable `switch` loop.
+ */
+#if defined(CI_THREADED_DISPATCH) && defined(__GNUC__)
+#define USE_THREADED_DISPATCH
+#endif
+
+#ifdef USE_THREADED_DISPATCH
+#define TARGET(op) target_##op:
+#define DISPATCH()                                    \
+    do {                                              \
+        ins = current++;                              \
+        goto *dispatch_table[ins->op];                \
+    } while (0)
+#define DISPATCH_ENTRY(op) [op] = &&target_##op,
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+#endif
+
+// Stops execution after a run-time error.
+#define FAIL()                    \
+    do {                          \
+        intr->had_error = true;   \
+        goto done;                \
+    } while (0)
+
+/*
+ * With CI_TIERING (on by default in the Makefile) every backward jump counts
+ * against the loop header it lands on. Once a header is hot, trace_enter()
+ * records and compiles the loop, then runs it natively on later iterations.
+ */
+#ifdef CI_TIERING
+#define JUMP(target)                                                         \
+    do {                                                                     \
+        current = code + (target);                                           \
+        if (current <= ins && tiers.counters &&                              \
+            ++tiers.counters[target] >= TRACE_HOT_THRESHOLD) {               \
+            current = code + trace_enter(&tiers, intr, prog, (target));      \
+        }                                                                    \
+    } while (0)
+#else
+#define JUMP(target) (current = code + (target))
+#endif
+
+// Shorthands for the operands of the current instruction.
+#define REG(field) (intr->variables[ins->field])
+#define IMM        (prog->consts[ins->arg])
+
+// Branch conditions, evaluated against the flags.
+#define COND_EQ (intr->is_equal)
+#define COND_NE (!intr->is_equal)
+#define COND_GT (intr->is_greater)
+#define COND_LT (intr->is_less)
+#define COND_GE (intr->is_greater || intr->is_equal)
+#define COND_LE (intr->is_less || intr->is_equal)
+
+// cmp + b.cond: compares the operands of `ins`, then branches to the target of
+// the b.cond that follows it or skips over it.
+#define CMP_BRANCH(op, rhs, cond)                              \
+    TARGET(op) {                                               \
+        set_flags(intr, REG(a), rhs);                          \
+        if (cond) {                                            \
+            JUMP(ins[1].arg);                                  \
+        } else {                                               \
+            current = ins + 2;                                 \
+        }                                                      \
+        DISPATCH();                                            \
+    }
+
+// add + cmp + b.cond: as above, with an add of an immediate in front.
+#define ADD_CMP_BRANCH(op, rhs, cond)                          \
+    TARGET(op) {                                               \
+        REG(dst) = REG(a) + IMM;                               \
+        set_flags(intr, intr->variables[ins[1].a], rhs);       \
+        if (cond) {                                            \
+            JUMP(ins[2].arg);                                  \
+        } else {                                               \
+            current = ins + 3;                                 \
+        }                                                      \
+        DISPATCH();                                            \
+    }
+
+#define NEXT_REG(field) (intr->variables[ins[1].field])
+#define NEXT_IMM        (prog->consts[ins[1].arg])
+
+#ifdef USE_THREADED_DISPATCH
+// Computed gotos are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+void interpret(Interpreter *intr, Program *prog) {
+    interpret_from(intr, prog, 0);
+}
+
+void interpret_from(Interpreter *intr, Program *prog, size_t entry) {
+    if (!intr || !prog || !prog->code || entry > prog->length) {
         return;
     }
-    Command *current = commands;
-    while (current && !intr->had_error) {
-        switch (current->type) {
-            case CMD_MOV:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, true);
-                current = current->next;
-                break;
-            case CMD_ADD:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    + fetch_number_value(intr, &current -> val_b, current -> is_b_immediate);
-                current = current->next;
-                break;
-            case CMD_SUB: {
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    - fetch_number_value(intr, &current -> val_b, current -> is_b_immediate);
-                current = current->next;
-                break;
-            }
-            case CMD_CMP:
-                intr -> is_greater = false;
-                intr -> is_equal = false;
-                intr -> is_less = false;
-                if (fetch_number_value(intr, &current -> val_a, false) > fetch_number_value(intr, &current -> val_b, current -> is_b_immediate)) {
-                    intr -> is_greater = true;
-                } else if (fetch_number_value(intr, &current -> val_a, false) < fetch_number_value(intr, &current -> val_b, current -> is_b_immediate)) {
-                    intr -> is_less = true;
-                } else {
-                    intr -> is_equal = true;
+    const Instr *code    = prog->code;
+    const Instr *current = code + entry;
+    const Instr *ins     = NULL;
+#ifdef CI_TIERING
+    TraceCache tiers;
+    trace_cache_init(&tiers, prog);
+#endif
+
+#ifdef USE_THREADED_DISPATCH
+    static void *const dispatch_table[OP_COUNT] = {OPCODE_LIST(DISPATCH_ENTRY)};
+    DISPATCH();
+#else
+    for (;;) {
+        ins = current++;
+        switch ((Opcode) ins->op) {
+#endif
+            TARGET(OP_MOV_RI) {
+                REG(dst) = IMM;
+                DISPATCH();
+            }
+            TARGET(OP_ADD_RRR) {
+                REG(dst) = REG(a) + REG(b);
+                DISPATCH();
+            }
+            TARGET(OP_ADD_RRI) {
+                REG(dst) = REG(a) + IMM;
+                DISPATCH();
+            }
+            TARGET(OP_SUB_RRR) {
+                REG(dst) = REG(a) - REG(b);
+                DISPATCH();
+            }
+            TARGET(OP_SUB_RRI) {
+                REG(dst) = REG(a) - IMM;
+                DISPATCH();
+            }
+            TARGET(OP_CMP_RR) {
+                set_flags(intr, REG(a), REG(b));
+                DISPATCH();
+            }
+            TARGET(OP_CMP_RI) {
+                set_flags(intr, REG(a), IMM);
+                DISPATCH();
+            }
+            TARGET(OP_CMP_U_RR) {
+                set_flags_unsigned(intr, REG(a), REG(b));
+                DISPATCH();
+            }
+            TARGET(OP_CMP_U_RI) {
+                set_flags_unsigned(intr, REG(a), IMM);
+                DISPATCH();
+            }
+            TARGET(OP_AND_RRR) {
+                REG(dst) = REG(a) & REG(b);
+                DISPATCH();
+            }
+            TARGET(OP_ORR_RRR) {
+                REG(dst) = REG(a) | REG(b);
+                DISPATCH();
+            }
+            TARGET(OP_EOR_RRR) {
+                REG(dst) = REG(a) ^ REG(b);
+                DISPATCH();
+            }
+            TARGET(OP_LSL_RRI) {
+                REG(dst) = (uint64_t) REG(a) << (uint64_t) IMM;
+                DISPATCH();
+            }
+            TARGET(OP_LSR_RRI) {
+                REG(dst) = (uint64_t) REG(a) >> (uint64_t) IMM;
+                DISPATCH();
+            }
+            TARGET(OP_ASR_RRI) {
+                REG(dst) = REG(a) >> IMM;
+                DISPATCH();
+            }
+            TARGET(OP_LOAD_RR) {
+                if (!mem_load_word(&intr->memory, &REG(dst), REG(b), ins->a)) {
+                    FAIL();
                 }
-                current = current->next;
-                break;
-            case CMD_CMP_U:
-                intr -> is_greater = false;
-                intr -> is_equal   = false;
-                intr -> is_less    = false;
-                if ((uint64_t) fetch_number_value(intr, &current -> val_a, false) > (uint64_t) fetch_number_value(intr, &current -> val_b, current -> is_b_immediate)) {
-                    intr -> is_greater = true;
-                } else if ((uint64_t) fetch_number_value(intr, &current -> val_a, false) < (uint64_t) fetch_number_value(intr, &current -> val_b, current -> is_b_immediate)) {
-                    intr -> is_less = true;
-                } else {
-                    intr -> is_equal = true;
+                DISPATCH();
+            }
+            TARGET(OP_LOAD_RI) {
+                if (!mem_load_word(&intr->memory, &REG(dst), IMM, ins->a)) {
+                    FAIL();
                 }
-                current = current->next;
-                break;
-            case CMD_PRINT:
-                print_base(intr, current);
-                current = current->next;
-                break;
-            case CMD_AND:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    & fetch_number_value(intr, &current -> val_b, false);
-                current = current->next;
-                break;
-            case CMD_ORR:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    | fetch_number_value(intr, &current -> val_b, false);
-                current = current->next;
-                break;
-            case CMD_EOR:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    ^ fetch_number_value(intr, &current -> val_b, false);
-                current = current->next;
-                break;
-            case CMD_LSL:
-                intr -> variables[current -> destination.num_val] = (uint64_t) fetch_number_value(intr, &current -> val_a, false) 
-                    << (uint64_t) fetch_number_value(intr, &current -> val_b, true);
-                current = current->next;
-                break;
-            case CMD_LSR:
-                intr -> variables[current -> destination.num_val] = (uint64_t) fetch_number_value(intr, &current -> val_a, false) 
-                    >> (uint64_t) fetch_number_value(intr, &current -> val_b, true);
-                current = current->next;
-                break; 
-            case CMD_ASR:
-                intr -> variables[current -> destination.num_val] = fetch_number_value(intr, &current -> val_a, false) 
-                    >> fetch_number_value(intr, &current -> val_b, true);
-                current = current->next;
-                break;      
-            case CMD_LOAD: {
-                int64_t num = 0;
-                if (!mem_load((uint8_t *) &num, fetch_number_value(intr, &current -> val_b, current -> is_b_immediate), 
-                    fetch_number_value(intr, &current -> val_a, true))) {
-                        intr -> had_error = true;
-                    } 
-                intr -> variables[current -> destination.num_val] = num;  
-                current = current -> next;    
-                break;    
-            }
-            case CMD_STORE:
-                if (!mem_store((uint8_t *) &intr -> variables[current -> destination.num_val], fetch_number_value(intr, &current -> val_a, current -> is_a_immediate), 
-                    fetch_number_value(intr, &current -> val_b, true))) {
-                        intr -> had_error = true;
-                    }
-                current = current->next;
-                break;
-            case CMD_PUT: {
-                char *charArray = current->destination.str_val;
-                int count = 0;
-                while (*charArray != '\0') {
-                    if (!mem_store((uint8_t *) charArray, fetch_number_value(intr, &current->val_a, current->is_a_immediate) + count, 1)) {
-                        intr->had_error = true;
-                        break;
-                    }
-                    count++;
-                    charArray++;
+                DISPATCH();
+            }
+            TARGET(OP_STORE_RR) {
+                if (!mem_store_word(&intr->memory, REG(dst), REG(a), ins->b)) {
+                    FAIL();
+                }
+                DISPATCH();
+            }
+            TARGET(OP_STORE_RI) {
+                if (!mem_store_word(&intr->memory, REG(dst), IMM, ins->b)) {
+                    FAIL();
+                }
+                DISPATCH();
+            }
+            TARGET(OP_PRINT_R) {
+                print_base(intr, REG(a), (char) ins->b);
+                DISPATCH();
+            }
+            TARGET(OP_PRINT_I) {
+                print_base(intr, IMM, (char) ins->b);
+                DISPATCH();
+            }
+            TARGET(OP_PUT_R) {
+                // The constant pool holds the string index.
+                if (!mem_store_string(&intr->memory, prog->strings[IMM], REG(a))) {
+                    FAIL();
+                }
+                DISPATCH();
+            }
+            TARGET(OP_PUT_I) {
+                // The string index is directly followed by the address.
+                if (!mem_store_string(&intr->memory, prog->strings[IMM],
+                                      prog->consts[ins->arg + 1])) {
+                    FAIL();
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B) {
+                JUMP(ins->arg);
+                DISPATCH();
+            }
+            TARGET(OP_B_EQ) {
+                if (COND_EQ) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_NE) {
+                if (COND_NE) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_GT) {
+                if (COND_GT) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_LT) {
+                if (COND_LT) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_GE) {
+                if (COND_GE) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_LE) {
+                if (COND_LE) {
+                    JUMP(ins->arg);
+                }
+                DISPATCH();
+            }
+            TARGET(OP_B_UNLINKED) {
+                if (cond_holds(intr, (BranchCondition) (int8_t) ins->dst)) {
+                    fprintf(intr->out, "Label not found: %s\n", prog->strings[ins->arg]);
+                    FAIL();
                 }
-                if (!mem_store((uint8_t *) charArray, fetch_number_value(intr, &current->val_a, current->is_a_immediate) + count, 1)) {
-                    intr->had_error = true;
-                    ufree(current->destination.str_val);
-                    break;
+                DISPATCH();
+            }
+            TARGET(OP_CALL) {
+                if (intr->memo && memo_call(intr->memo, intr, ins->arg)) {
+                    DISPATCH();
                 }
-                ufree(current -> destination.str_val);
-                current = current->next;
-                break;
-            }
-            case CMD_BRANCH:
-                if (cond_holds(intr, current -> branch_condition)) {
-                    Entry * ent = get_label(intr -> label_map, current -> destination.str_val);
-                    if (ent == NULL) {
-                        printf("Label not found: ");
-                        printf("%s\n", current -> destination.str_val);
-                        intr -> had_error = true;
-                        return;
+                if (intr->parallel) {
+                    ParallelAction action =
+                        parallel_call(intr->parallel, intr, (size_t) (ins - code));
+                    if (action == PARALLEL_SKIP) {
+                        DISPATCH();
+                    }
+                    if (action == PARALLEL_ABORT) {
+                        FAIL();
                     }
-                    current = ent -> command;
-                } else {
-                    current = current -> next;
                 }
-                break;
-            case CMD_CALL: {
-                StackEntry* se = umalloc(sizeof(StackEntry));
-                if (!se) {
-                    intr->had_error = true;
-                    return;
+                uint32_t saved = prog->save_masks ? prog->save_masks[ins - code]
+                                                  : (uint32_t) MASK_CALLEE;
+                if (!push_frame(intr, ins, saved)) {
+                    FAIL();
                 }
-                Entry* ent = get_label(intr->label_map, current->destination.str_val);
-                if (ent != NULL && ent->command != NULL) {
-                    se->command = current;
-                } else {
-                    printf("Label not found: %s\n", current->destination.str_val);
-                    intr->had_error = true;
-                    ufree(se);
-                    return;
+                current = code + ins->arg;
+                DISPATCH();
+            }
+            TARGET(OP_CALL_UNLINKED) {
+                fprintf(intr->out, "Label not found: %s\n", prog->strings[ins->arg]);
+                FAIL();
+            }
+            TARGET(OP_TAIL_CALL) {
+                // Inside a routine, the callee's ret returns for us too. Only
+                // a tail call from the top level needs a frame of its own.
+                if (intr->frame_count == 0) {
+                    uint32_t saved = prog->save_masks ? prog->save_masks[ins - code]
+                                                      : (uint32_t) MASK_CALLEE;
+                    if (!interpreter_push_frame(intr, ins, saved)) {
+                        FAIL();
+                    }
                 }
-                for (int i = 0; i < 32; i++) {
-                    se->variables[i] = intr->variables[i];
+                current = code + ins->arg;
+                DISPATCH();
+            }
+            TARGET(OP_RET) {
+                if (intr->memo) {
+                    memo_return(intr->memo, intr);
                 }
-                // Always initialize the next pointer, regardless of the current stack state.
-                se->next = intr->the_stack;
-                intr->the_stack = se;
-                current = ent->command;
-                break;
-            }
-            case CMD_RET:
-                if (intr -> the_stack == NULL) {
-                    current = NULL;
-                    break;
-                } else {
-                    StackEntry* temp = intr -> the_stack;
-                    current = intr -> the_stack -> command;
-                    for (int i = 1; i < 32; i++) {
-                        intr -> variables[i] = intr -> the_stack -> variables[i];
-                    }                
-                    intr -> the_stack = intr -> the_stack -> next;
-                    ufree(temp);  // Free the allocated memory for StackEntry
+                const Instr *caller = pop_frame(intr);
+                if (!caller) {
+                    goto done;
                 }
-                current = current -> next;
-                break;
-                default:
-                    intr -> had_error = true;
-                    break;
-        }          
+                current = caller + 1;
+                DISPATCH();
+            }
+            CMP_BRANCH(OP_CMP_RR_B_EQ, REG(b), COND_EQ)
+            CMP_BRANCH(OP_CMP_RR_B_NE, REG(b), COND_NE)
+            CMP_BRANCH(OP_CMP_RR_B_GT, REG(b), COND_GT)
+            CMP_BRANCH(OP_CMP_RR_B_LT, REG(b), COND_LT)
+            CMP_BRANCH(OP_CMP_RR_B_GE, REG(b), COND_GE)
+            CMP_BRANCH(OP_CMP_RR_B_LE, REG(b), COND_LE)
+            CMP_BRANCH(OP_CMP_RI_B_EQ, IMM, COND_EQ)
+            CMP_BRANCH(OP_CMP_RI_B_NE, IMM, COND_NE)
+            CMP_BRANCH(OP_CMP_RI_B_GT, IMM, COND_GT)
+            CMP_BRANCH(OP_CMP_RI_B_LT, IMM, COND_LT)
+            CMP_BRANCH(OP_CMP_RI_B_GE, IMM, COND_GE)
+            CMP_BRANCH(OP_CMP_RI_B_LE, IMM, COND_LE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_EQ, NEXT_REG(b), COND_EQ)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_NE, NEXT_REG(b), COND_NE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_GT, NEXT_REG(b), COND_GT)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_LT, NEXT_REG(b), COND_LT)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_GE, NEXT_REG(b), COND_GE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RR_B_LE, NEXT_REG(b), COND_LE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_EQ, NEXT_IMM, COND_EQ)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_NE, NEXT_IMM, COND_NE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_GT, NEXT_IMM, COND_GT)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_LT, NEXT_IMM, COND_LT)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_GE, NEXT_IMM, COND_GE)
+            ADD_CMP_BRANCH(OP_ADD_CMP_RI_B_LE, NEXT_IMM, COND_LE)
+            TARGET(OP_IDIOM) {
+                current = code + idiom_run(intr, prog, ins);
+                DISPATCH();
+            }
+            TARGET(OP_HALT) {
+                goto done;
+            }
+            TARGET(OP_ERR) {
+                FAIL();
+            }
+#ifndef USE_THREADED_DISPATCH
+            case OP_COUNT:
+                FAIL();
+        }
     }
+#endif
 
+done:
     // Week 4: free the stack at the end
-    while (intr->the_stack != NULL) {
-        StackEntry *temp = intr->the_stack;
-        intr->the_stack  = intr->the_stack->next;
-        ufree(temp);
-    }
+    interpreter_free_frames(intr);
+#ifdef CI_TIERING
+    trace_cache_free(&tiers);
+#endif
 }
 
+#ifdef USE_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
 void print_interpreter_state(Interpreter *intr) {
     if (!intr) {
         return;
     }
 
-    printf("Error: %d\n", intr->had_error);
-    printf("Flags:\n");
-    printf("Is greater: %d\n", intr->is_greater);
-    printf("Is equal: %d\n", intr->is_equal);
-    printf("Is less: %d\n", intr->is_less);
+    fprintf(intr->out, "Error: %d\n", intr->had_error);
+    fprintf(intr->out, "Flags:\n");
+    fprintf(intr->out, "Is greater: %d\n", intr->is_greater);
+    fprintf(intr->out, "Is equal: %d\n", intr->is_equal);
+    fprintf(intr->out, "Is less: %d\n", intr->is_less);
 
-    printf("\n");
+    fprintf(intr->out, "\n");
 
-    printf("Variable values:\n");
+    fprintf(intr->out, "Variable values:\n");
     for (size_t i = 0; i < NUM_VARIABLES; i++) {
-        printf("x%zu: %" PRId64 "", i, intr->variables[i]);
+        fprintf(intr->out, "x%zu: %" PRId64 "", i, intr->variables[i]);
 
         if (i < NUM_VARIABLES - 1) {
-            printf(", ");
+            fprintf(intr->out, ", ");
         }
 
         if ((i + 1) % 8 == 0) {
-            printf("\n");
+            fprintf(intr->out, "\n");
         }
     }
 
-    printf("\n");
+    fprintf(intr->out, "\n");
+}
+
+bool interpreter_push_frame(Interpreter *intr, const Instr *caller, uint32_t saved) {
+    return push_frame(intr, caller, saved);
+}
+
+const Instr *interpreter_pop_frame(Interpreter *intr) {
+    return pop_frame(intr);
+}
+
+void interpreter_free_frames(Interpreter *intr) {
+    free(intr->frames);
+    intr->frames         = NULL;
+    intr->frame_count    = 0;
+    intr->frame_capacity = 0;
+}
+
+/**
+ * @brief Pushes a frame for a call; see `interpreter_push_frame()`.
+ *
+ * Kept static so the dispatch loop can inline it.
+ *
+ * @param intr The pointer to the interpreter making the call.
+ * @param caller The call instruction.
+ * @param saved The variables to save.
+ * @return True if the frame was pushed, false otherwise.
+ */
+static inline bool push_frame(Interpreter *intr, const Instr *caller, uint32_t saved) {
+    if (intr->frame_count == intr->frame_capacity && !grow_frames(intr)) {
+        return false;
+    }
+
+    StackEntry *se = &intr->frames[intr->frame_count++];
+    se->caller     = caller;
+    se->saved      = saved;
+    copy_variables(se->variables, intr->variables, saved);
+    return true;
+}
+
+/**
+ * @brief Pops the top frame; see `interpreter_pop_frame()`.
+ *
+ * @param intr The pointer to the interpreter returning from a call.
+ * @return The call instruction that pushed the frame, or NULL.
+ */
+static inline const Instr *pop_frame(Interpreter *intr) {
+    if (intr->frame_count == 0) {
+        return NULL;
+    }
+
+    // x0 carries the return value; every variable the caller still needs is
+    // restored.
+    StackEntry *se = &intr->frames[--intr->frame_count];
+    copy_variables(intr->variables, se->variables, se->saved);
+    return se->caller;
+}
+
+/**
+ * @brief Sets the comparison flags from a signed comparison.
+ *
+ * @param intr The pointer to the interpreter holding the flags.
+ * @param a The left-hand side of the comparison.
+ * @param b The right-hand side of the comparison.
+ */
+static void set_flags(Interpreter *intr, int64_t a, int64_t b) {
+    intr->is_greater = a > b;
+    intr->is_less    = a < b;
+    intr->is_equal   = a == b;
+}
+
+/**
+ * @brief Sets the comparison flags from an unsigned comparison.
+ *
+ * @param intr The pointer to the interpreter holding the flags.
+ * @param a The left-hand side of the comparison.
+ * @param b The right-hand side of the comparison.
+ */
+static void set_flags_unsigned(Interpreter *intr, uint64_t a, uint64_t b) {
+    intr->is_greater = a > b;
+    intr->is_less    = a < b;
+    intr->is_equal   = a == b;
 }
 
 /**
- * @brief Fetches the appropriate value from the given operand.
+ * @brief Makes room for at least one more frame on the call stack.
+ *
+ * The stack doubles in size each time it fills up, so calls and returns only
+ * touch the allocator a logarithmic number of times.
  *
- * @param intr The pointer to the interpreter holding variable state.
- * @param op The operand used to fetch the value.
- * @param is_im A boolean representing whether this value is an immediate or
- * must be read in from the interpreter state.
- * @return The fetched value.
+ * @param intr The pointer to the interpreter owning the stack.
+ * @return True if a frame is available, false on overflow or allocation
+ * failure.
  */
-static int64_t fetch_number_value(Interpreter *intr, Operand *op, bool is_im) {
-    if (is_im) {
-        return op -> num_val;
-    } else {
-        return intr -> variables[op -> num_val];
+static bool grow_frames(Interpreter *intr) {
+    if (intr->frame_capacity >= intr->max_depth) {
+        fprintf(intr->out, "Stack overflow: more than %zu nested calls\n", intr->max_depth);
+        return false;
+    }
+
+    // Without -d the stack grows for as long as memory lasts.
+    size_t capacity = intr->frame_capacity ? intr->frame_capacity * 2 : INITIAL_FRAMES;
+    if (capacity > intr->max_depth) {
+        capacity = intr->max_depth;
     }
+    StackEntry *frames = capacity <= SIZE_MAX / sizeof(StackEntry)
+                             ? realloc(intr->frames, capacity * sizeof(StackEntry))
+                             : NULL;
+    if (!frames) {
+        fprintf(intr->out, "Stack overflow: out of memory after %zu nested calls\n",
+                intr->frame_count);
+        return false;
+    }
+
+    intr->frames         = frames;
+    intr->frame_capacity = capacity;
+    return true;
 }
 
 /**
@@ -301,27 +613,14 @@ static bool cond_holds(Interpreter *intr, BranchCondition cond) {
     return false;
 }
 
-/**
- * @brief Prints the given command's value in a specified base.
- *
- * @param intr The pointer to the interpreter holding variable state.
- * @param cmd The command being processed.
- * @return True whether the print was successful, false otherwise.
- */
-static bool print_base(Interpreter *intr, Command *cmd) {
-    int64_t varOrImm;
-    if (cmd -> is_a_immediate) {
-        varOrImm = cmd -> val_a.num_val;
-    } else {
-        varOrImm = intr -> variables[cmd -> val_a.num_val];
-    }
-    if (cmd -> val_b.base == 'd') {
-        printf("%" PRId64 "\n", varOrImm);
+bool print_base(Interpreter *intr, int64_t varOrImm, char base) {
+    if (base == 'd') {
+        fprintf(intr->out, "%" PRId64 "\n", varOrImm);
         return true;
-    } else if (cmd -> val_b.base == 'x') {
-        printf("0x%lx\n", (uint64_t) varOrImm);
+    } else if (base == 'x') {
+        fprintf(intr->out, "0x%lx\n", (uint64_t) varOrImm);
         return true;
-    } else if (cmd -> val_b.base == 'b') {
+    } else if (base == 'b') {
         int numDigits[64];
         int maxIndices = 0;
         uint64_t num = varOrImm;
@@ -330,25 +629,25 @@ static bool print_base(Interpreter *intr, Command *cmd) {
             num = num / 2;
             maxIndices++;
         }
-        printf("0b");
+        fprintf(intr->out, "0b");
         if (maxIndices == 0) {
-            printf("0\n");
+            fprintf(intr->out, "0\n");
             return true;
         }
         for (int i = maxIndices - 1; i >= 0; i--) {
-            printf("%d", numDigits[i]);
+            fprintf(intr->out, "%d", numDigits[i]);
         }
-        printf("\n");
+        fprintf(intr->out, "\n");
         return true;
-    } else if (cmd -> val_b.base == 's') {
+    } else if (base == 's') {
         char character = 0;
         int count = 0;
         while (true) {
-            if (mem_load((uint8_t *) &character, varOrImm + count, 1)) {
+            if (mem_load(&intr->memory, (uint8_t *) &character, varOrImm + count, 1)) {
                 if (character == 0) {
                     break;                    
                 }
-                printf("%c", character);
+                fprintf(intr->out, "%c", character);
             } else {
                 return false;
             }
@@ -357,8 +656,27 @@ static bool print_base(Interpreter *intr, Command *cmd) {
             }
             count++;
         }
-        printf("\n");
+        fprintf(intr->out, "\n");
         return true;
     }
     return false;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Copies the variables selected by a mask between two register files.
+ *
+ * @param dst The variables to write.
+ * @param src The variables to read.
+ * @param mask Bit `i` selects variable `xi`.
+ */
+static void copy_variables(int64_t *dst, const int64_t *src, uint32_t mask) {
+    if (mask == (uint32_t) MASK_CALLEE) {
+        memcpy(&dst[1], &src[1], (NUM_VARIABLES - 1) * sizeof(int64_t));
+        return;
+    }
+    while (mask) {
+        int i  = __builtin_ctz(mask);
+        dst[i] = src[i];
+        mask &= mask - 1;
+    }
+}
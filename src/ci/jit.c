@@ -0,0 +1,431 @@
+#include "jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "mem.h"
+
+#ifdef HAVE_NATIVE_CODE
+
+// Labels past the last instruction: the error path and the common exit.
+#define LABEL_FAIL(prog) ((prog)->length + 1)
+#define LABEL_EXIT(prog) ((prog)->length + 2)
+
+typedef void (*JitEntry)(Interpreter *intr, const JitCode *jit);
+
+static bool     has_template(uint8_t op);
+static void     emit_instr(Emitter *e, const Program *prog, size_t i, const bool *is_target);
+static void     emit_fail_unless_al(Emitter *e, const Program *prog);
+static void     emit_label_not_found(Emitter *e, const Program *prog, uint32_t label);
+static bool     jit_call(Interpreter *intr, const JitCode *jit, uint64_t index);
+static bool     jit_tail_call(Interpreter *intr, const JitCode *jit, uint64_t index);
+static uint8_t *jit_return(Interpreter *intr, const JitCode *jit);
+
+bool jit_compile(JitCode *jit, const Program *prog) {
+    if (!jit || !prog || !prog->code) {
+        return false;
+    }
+    memset(jit, 0, sizeof(JitCode));
+    for (size_t i = 0; i < prog->length; i++) {
+        if (!has_template(prog->code[i].op)) {
+            return false;
+        }
+    }
+
+    // A branch may only test the host flags left by the compare before it if
+    // nothing else can jump in between, so every jump target is marked.
+    bool   *is_target = calloc(prog->length + 1, sizeof(bool));
+    size_t *offsets   = malloc((prog->length + 3) * sizeof(size_t));
+    jit->targets      = malloc((prog->length + 1) * sizeof(uint8_t *));
+    if (!is_target || !offsets || !jit->targets) {
+        free(is_target);
+        free(offsets);
+        jit_free(jit);
+        return false;
+    }
+    for (size_t i = 0; i < prog->length; i++) {
+        const Instr *ins = &prog->code[i];
+        if (ins->op >= OP_B && ins->op <= OP_B_LE) {
+            is_target[ins->arg] = true;
+        } else if (ins->op == OP_CALL || ins->op == OP_TAIL_CALL) {
+            is_target[ins->arg] = true;
+            is_target[i + 1]    = true;
+        }
+    }
+
+    // Prologue: rbx holds the interpreter and r12 this JitCode. The third push
+    // keeps the stack 16-byte aligned for the helpers.
+    Emitter e = {0};
+    emit_push(&e, RBX);
+    emit_push(&e, R12);
+    emit_push(&e, RBP);
+    emit_mov(&e, RBX, RDI);
+    emit_mov(&e, R12, RSI);
+
+    // The halt after the last instruction gets a template too.
+    for (size_t i = 0; i <= prog->length; i++) {
+        offsets[i] = e.length;
+        emit_instr(&e, prog, i, is_target);
+    }
+
+    offsets[LABEL_FAIL(prog)] = e.length;
+    emit_store_byte(&e, JIT_HAD_ERROR, 1);
+    offsets[LABEL_EXIT(prog)] = e.length;
+    emit_pop(&e, RBP);
+    emit_pop(&e, R12);
+    emit_pop(&e, RBX);
+    emit8(&e, 0xC3);  // ret
+
+    emit_resolve(&e, offsets);
+    jit->code = emit_map(&e, &jit->size);
+    emit_free(&e);
+    free(is_target);
+    if (!jit->code) {
+        free(offsets);
+        jit_free(jit);
+        return false;
+    }
+
+    jit->prog = prog;
+    for (size_t i = 0; i <= prog->length; i++) {
+        jit->targets[i] = jit->code + offsets[i];
+    }
+    free(offsets);
+    return true;
+}
+
+void jit_run(JitCode *jit, Interpreter *intr) {
+    if (!jit || !jit->code || !intr) {
+        return;
+    }
+
+    JitEntry entry = (JitEntry) (uintptr_t) jit->code;
+    entry(intr, jit);
+    interpreter_free_frames(intr);
+}
+
+void jit_free(JitCode *jit) {
+    if (!jit) {
+        return;
+    }
+
+    emit_unmap(jit->code, jit->size);
+    free(jit->targets);
+    memset(jit, 0, sizeof(JitCode));
+}
+
+void jit_emit_set_flags(Emitter *e, bool is_unsigned) {
+    emit_setcc(e, is_unsigned ? CC_A : CC_G, JIT_FLAG_GREATER);
+    emit_setcc(e, is_unsigned ? CC_B : CC_L, JIT_FLAG_LESS);
+    emit_setcc(e, CC_E, JIT_FLAG_EQUAL);
+}
+
+uint8_t jit_emit_flag_test(Emitter *e, int cond) {
+    static const int32_t flags[] = {JIT_FLAG_EQUAL, JIT_FLAG_EQUAL,   JIT_FLAG_GREATER,
+                                    JIT_FLAG_LESS,  JIT_FLAG_GREATER, JIT_FLAG_LESS};
+    if (cond >= 4) {
+        // ge and le also hold on equal.
+        emit_test_either(e, flags[cond], JIT_FLAG_EQUAL);
+        return CC_NE;
+    }
+    emit_test_byte(e, flags[cond]);
+    return cond == 1 ? CC_E : CC_NE;
+}
+
+uint8_t jit_branch_cc(int cond, bool is_unsigned) {
+    static const uint8_t signed_cc[]   = {CC_E, CC_NE, CC_G, CC_L, CC_GE, CC_LE};
+    static const uint8_t unsigned_cc[] = {CC_E, CC_NE, CC_A, CC_B, CC_AE, CC_BE};
+    return is_unsigned ? unsigned_cc[cond] : signed_cc[cond];
+}
+
+uint8_t jit_alu_op(uint8_t op) {
+    switch (op) {
+        case OP_ADD_RRR:
+        case OP_ADD_RRI:
+            return ALU_ADD;
+        case OP_SUB_RRR:
+        case OP_SUB_RRI:
+            return ALU_SUB;
+        case OP_AND_RRR:
+            return ALU_AND;
+        case OP_ORR_RRR:
+            return ALU_OR;
+        case OP_EOR_RRR:
+            return ALU_XOR;
+        default:
+            return ALU_CMP;
+    }
+}
+
+uint8_t jit_shift_op(uint8_t op) {
+    return op == OP_LSL_RRI ? SHIFT_SHL : op == OP_LSR_RRI ? SHIFT_SHR : SHIFT_SAR;
+}
+
+void jit_label_not_found(Interpreter *intr, const char *label) {
+    fprintf(intr->out, "Label not found: %s\n", label);
+}
+
+/**
+ * @brief Determines if the JIT can translate an opcode.
+ *
+ * Superinstructions are left to the interpreter; the JIT gets the same effect
+ * from testing the host flags directly.
+ *
+ * @param op The opcode to check.
+ * @return True if `emit_instr()` has a template for `op`.
+ */
+static bool has_template(uint8_t op) {
+    return op <= OP_RET || op == OP_HALT || op == OP_ERR;
+}
+
+/**
+ * @brief Emits the template of a single instruction.
+ *
+ * @param e The emitter to append to.
+ * @param prog The program being translated.
+ * @param i The index of the instruction.
+ * @param is_target Marks every instruction that something can jump to.
+ */
+static void emit_instr(Emitter *e, const Program *prog, size_t i, const bool *is_target) {
+    const Instr *ins = &prog->code[i];
+    int64_t      imm = ins->arg < prog->const_count ? prog->consts[ins->arg] : 0;
+
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+            emit_store_imm(e, JIT_VAR(ins->dst), imm);
+            break;
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+            emit_load(e, RAX, JIT_VAR(ins->a));
+            emit_alu_load(e, jit_alu_op(ins->op), RAX, JIT_VAR(ins->b));
+            emit_store(e, JIT_VAR(ins->dst), RAX);
+            break;
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+            emit_load(e, RAX, JIT_VAR(ins->a));
+            emit_alu_imm(e, jit_alu_op(ins->op), RAX, imm);
+            emit_store(e, JIT_VAR(ins->dst), RAX);
+            break;
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+            emit_load(e, RAX, JIT_VAR(ins->a));
+            emit_shift(e, jit_shift_op(ins->op), RAX, imm);
+            emit_store(e, JIT_VAR(ins->dst), RAX);
+            break;
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+            emit_load(e, RAX, JIT_VAR(ins->a));
+            emit_alu_load(e, ALU_CMP, RAX, JIT_VAR(ins->b));
+            jit_emit_set_flags(e, ins->op == OP_CMP_U_RR);
+            break;
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+            emit_load(e, RAX, JIT_VAR(ins->a));
+            emit_alu_imm(e, ALU_CMP, RAX, imm);
+            jit_emit_set_flags(e, ins->op == OP_CMP_U_RI);
+            break;
+        case OP_LOAD_RR:
+        case OP_LOAD_RI:
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_lea(e, RSI, JIT_VAR(ins->dst));
+            if (ins->op == OP_LOAD_RR) {
+                emit_load(e, RDX, JIT_VAR(ins->b));
+            } else {
+                emit_mov_imm(e, RDX, imm);
+            }
+            emit_mov_imm(e, RCX, ins->a);
+            emit_call(e, (uint64_t) (uintptr_t) mem_load_word);
+            emit_fail_unless_al(e, prog);
+            break;
+        case OP_STORE_RR:
+        case OP_STORE_RI:
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_load(e, RSI, JIT_VAR(ins->dst));
+            if (ins->op == OP_STORE_RR) {
+                emit_load(e, RDX, JIT_VAR(ins->a));
+            } else {
+                emit_mov_imm(e, RDX, imm);
+            }
+            emit_mov_imm(e, RCX, ins->b);
+            emit_call(e, (uint64_t) (uintptr_t) mem_store_word);
+            emit_fail_unless_al(e, prog);
+            break;
+        case OP_PRINT_R:
+        case OP_PRINT_I:
+            emit_mov(e, RDI, RBX);
+            if (ins->op == OP_PRINT_R) {
+                emit_load(e, RSI, JIT_VAR(ins->a));
+            } else {
+                emit_mov_imm(e, RSI, imm);
+            }
+            emit_mov_imm(e, RDX, ins->b);
+            emit_call(e, (uint64_t) (uintptr_t) print_base);
+            break;
+        case OP_PUT_R:
+        case OP_PUT_I:
+            // The constant pool holds the string index, followed by the address.
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_mov_imm(e, RSI, (int64_t) (uintptr_t) prog->strings[imm]);
+            if (ins->op == OP_PUT_R) {
+                emit_load(e, RDX, JIT_VAR(ins->a));
+            } else {
+                emit_mov_imm(e, RDX, prog->consts[ins->arg + 1]);
+            }
+            emit_call(e, (uint64_t) (uintptr_t) mem_store_string);
+            emit_fail_unless_al(e, prog);
+            break;
+        case OP_B:
+            emit_jump(e, ins->arg);
+            break;
+        case OP_B_EQ:
+        case OP_B_NE:
+        case OP_B_GT:
+        case OP_B_LT:
+        case OP_B_GE:
+        case OP_B_LE: {
+            int cond = ins->op - OP_B_EQ;
+            if (i > 0 && !is_target[i] && prog->code[i - 1].op >= OP_CMP_RR &&
+                prog->code[i - 1].op <= OP_CMP_U_RI) {
+                bool is_unsigned = prog->code[i - 1].op >= OP_CMP_U_RR;
+                emit_jcc(e, jit_branch_cc(cond, is_unsigned), ins->arg);
+            } else {
+                emit_jcc(e, jit_emit_flag_test(e, cond), ins->arg);
+            }
+            break;
+        }
+        case OP_B_UNLINKED: {
+            BranchCondition cond = (BranchCondition) (int8_t) ins->dst;
+            if (cond == BRANCH_ALWAYS) {
+                emit_label_not_found(e, prog, ins->arg);
+            } else if (cond >= BRANCH_EQUAL && cond <= BRANCH_LESS_EQUAL) {
+                // Skip the error path unless the condition holds.
+                uint8_t cc = jit_emit_flag_test(e, cond - BRANCH_EQUAL);
+                emit8(e, 0x0F), emit8(e, 0x80 | (cc ^ 1)), emit32(e, 0);
+                size_t skip = e->length - 4;
+                emit_label_not_found(e, prog, ins->arg);
+                emit_patch32(e, skip, e->length);
+            }
+            break;
+        }
+        case OP_CALL:
+            emit_mov(e, RDI, RBX);
+            emit_mov(e, RSI, R12);
+            emit_mov_imm(e, RDX, (int64_t) i);
+            emit_call(e, (uint64_t) (uintptr_t) jit_call);
+            emit_fail_unless_al(e, prog);
+            emit_jump(e, ins->arg);
+            break;
+        case OP_TAIL_CALL:
+            emit_mov(e, RDI, RBX);
+            emit_mov(e, RSI, R12);
+            emit_mov_imm(e, RDX, (int64_t) i);
+            emit_call(e, (uint64_t) (uintptr_t) jit_tail_call);
+            emit_fail_unless_al(e, prog);
+            emit_jump(e, ins->arg);
+            break;
+        case OP_CALL_UNLINKED:
+            emit_label_not_found(e, prog, ins->arg);
+            break;
+        case OP_RET:
+            // Resume after the caller, or stop if the stack is empty.
+            emit_mov(e, RDI, RBX);
+            emit_mov(e, RSI, R12);
+            emit_call(e, (uint64_t) (uintptr_t) jit_return);
+            emit8(e, 0x48), emit8(e, 0x85), emit8(e, 0xC0);  // test rax, rax
+            emit_jcc(e, CC_E, LABEL_EXIT(prog));
+            emit8(e, 0xFF), emit8(e, 0xE0);  // jmp rax
+            break;
+        case OP_HALT:
+            emit_jump(e, LABEL_EXIT(prog));
+            break;
+        default:
+            emit_jump(e, LABEL_FAIL(prog));
+            break;
+    }
+}
+
+/**
+ * @brief Jumps to the error path if the helper just called returned false.
+ *
+ * @param e The emitter to append to.
+ * @param prog The program being translated.
+ */
+static void emit_fail_unless_al(Emitter *e, const Program *prog) {
+    emit8(e, 0x84), emit8(e, 0xC0);  // test al, al
+    emit_jcc(e, CC_E, LABEL_FAIL(prog));
+}
+
+/**
+ * @brief Reports a jump to a missing label and takes the error path.
+ *
+ * @param e The emitter to append to.
+ * @param prog The program being translated.
+ * @param label The index of the label name in the string pool.
+ */
+static void emit_label_not_found(Emitter *e, const Program *prog, uint32_t label) {
+    emit_mov(e, RDI, RBX);
+    emit_mov_imm(e, RSI, (int64_t) (uintptr_t) prog->strings[label]);
+    emit_call(e, (uint64_t) (uintptr_t) jit_label_not_found);
+    emit_jump(e, LABEL_FAIL(prog));
+}
+
+/**
+ * @brief Pushes the frame of a call made from generated code.
+ *
+ * @param intr The pointer to the interpreter making the call.
+ * @param jit The code being run.
+ * @param index The index of the call instruction.
+ * @return True if the frame was pushed, false otherwise.
+ */
+static bool jit_call(Interpreter *intr, const JitCode *jit, uint64_t index) {
+    const Program *prog  = jit->prog;
+    uint32_t       saved = prog->save_masks ? prog->save_masks[index] : (uint32_t) MASK_CALLEE;
+    return interpreter_push_frame(intr, &prog->code[index], saved);
+}
+
+/**
+ * @brief Handles a tail call made from generated code.
+ *
+ * @param intr The pointer to the interpreter making the call.
+ * @param jit The code being run.
+ * @param index The index of the tail call instruction.
+ * @return True unless a frame had to be pushed and could not be.
+ */
+static bool jit_tail_call(Interpreter *intr, const JitCode *jit, uint64_t index) {
+    // Only a tail call from the top level needs a frame of its own.
+    return intr->frame_count > 0 || jit_call(intr, jit, index);
+}
+
+/**
+ * @brief Pops the frame of a return made from generated code.
+ *
+ * @param intr The pointer to the interpreter returning from a call.
+ * @param jit The code being run.
+ * @return The native address to resume at, or NULL if the stack was empty.
+ */
+static uint8_t *jit_return(Interpreter *intr, const JitCode *jit) {
+    const Instr *caller = interpreter_pop_frame(intr);
+    return caller ? jit->targets[caller - jit->prog->code + 1] : NULL;
+}
+
+#else
+
+bool jit_compile(JitCode *jit, const Program *prog) {
+    if (jit) {
+        memset(jit, 0, sizeof(JitCode));
+    }
+    return false;
+}
+
+void jit_run(JitCode *jit, Interpreter *intr) {
+}
+
+void jit_free(JitCode *jit) {
+}
+
+#endif
@@ -4,53 +4,24 @@
 #include <stdlib.h>
 #include <string.h>
 
-static void          free_entry(Entry *e);
-static void          free_entries(Entry *e);
 static unsigned long hash_function(char *s);
-static Entry        *entry_init(char *id, Command *command);
+static Entry        *entry_init(Arena *arena, char *id, Command *command);
 
-bool label_map_init(LabelMap *map, int capacity) {
+bool label_map_init(LabelMap *map, int capacity, Arena *arena) {
     map->entries = malloc(capacity * sizeof(Entry *));
     memset(map -> entries, 0, capacity * sizeof(Entry *));
     if (map != NULL) {
         map->capacity = capacity;
+        map->arena    = arena;
         return true;
     }
     return false;
 }
 
-/**
- * @brief Frees the resources for a `singular` entry.
- *
- * @param e The pointer to the entry to free.
- */
-static void free_entry(Entry *e) {
-    // Do not free children; see below
-    free(e->id);
-    free(e);
-}
-
-/**
- * @brief Frees the given list of entries.
- *
- * @param e A pointer to the first entry to free.
- */
-static void free_entries(Entry *e) {
-    while (e != NULL) {
-        Entry *temp = e->next;
-        free_entry(e);
-        e = temp;
-    }
-}
-
 void label_map_free(LabelMap *map) {
     // Do not free the pointer itself, as you do not know whether it was allocated on the heap
+    // The entries need no walk; they are freed with the arena.
     if (map != NULL) {
-        for (int i = 0; i < map->capacity; i++) {
-            if (map->entries[i] != NULL) {
-                free_entries(map->entries[i]);
-            }
-        }
         free(map->entries);
     }
 }
@@ -73,18 +44,15 @@ static unsigned long hash_function(char *s) {
 /**
  * @brief Initializes the given entry's state.
  *
+ * @param arena The arena to allocate the entry from.
  * @param id The id associated with this entry.
  * @param command The command associated with this entry.
  * @return True if the entry was initialized successfully, false otherwise.
  */
-static Entry *entry_init(char *id, Command *command) {
-    Entry *ent = malloc(sizeof(Entry));
+static Entry *entry_init(Arena *arena, char *id, Command *command) {
+    Entry *ent = arena_alloc(arena, sizeof(Entry), _Alignof(Entry));
     if (ent != NULL) {
-        ent->id = malloc(sizeof(char) * (strlen(id) + 1));
-        if (ent->id == NULL) {
-            return NULL;
-        }
-        strcpy(ent->id, id);
+        ent->id      = id;
         ent->command = command;
         ent->next    = NULL;
     }
@@ -96,7 +64,7 @@ bool put_label(LabelMap *map, char *id, Command *command) {
     if (id == NULL || map == NULL) {
         return false;
     }
-    Entry *ent = entry_init(id, command);
+    Entry *ent = entry_init(map->arena, id, command);
     if (ent == NULL) {
         return false;
     }
@@ -107,7 +75,6 @@ bool put_label(LabelMap *map, char *id, Command *command) {
     }
     while (currentEnt->next != NULL) {
         if (strcmp(currentEnt->id, id) == 0) {
-            free(ent);
             return false;
         }
         currentEnt = currentEnt->next;
@@ -388,14 +388,14 @@ static Token make_string(Lexer *lex) {
     return t;
 }
 
-void print_lexed_tokens(Lexer *lex) {
+void print_lexed_tokens(FILE *out, Lexer *lex) {
     bool should_stop = false;
     while (!should_stop) {
         Token t = lexer_next_token(lex);
-        print_token(t);
+        print_token(out, t);
         should_stop = t.type == TOK_ERR || t.type == TOK_EOF;
         if (!should_stop) {
-            printf("\n");
+            fprintf(out, "\n");
         }
     }
 }
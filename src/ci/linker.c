@@ -0,0 +1,49 @@
+#include "linker.h"
+#include <stddef.h>
+#include <stdio.h>
+
+#include "command_type.h"
+
+static bool resolve_target(Command *cmd, LabelMap *map);
+
+bool link_commands(Command *commands, LabelMap *map, FILE *err) {
+    if (!map) {
+        return false;
+    }
+
+    bool linked = true;
+    for (Command *cmd = commands; cmd != NULL; cmd = cmd->next) {
+        if (cmd->type != CMD_BRANCH && cmd->type != CMD_CALL) {
+            continue;
+        }
+        if (!resolve_target(cmd, map)) {
+            fprintf(err, "Warning: label not found: %s\n", cmd->destination.str_val);
+            linked = false;
+        }
+    }
+    return linked;
+}
+
+/**
+ * @brief Looks up the label of a single branch or call and stores its target.
+ *
+ * @param cmd The branch or call command to resolve.
+ * @param map The label map to search.
+ * @return True if the label names a valid destination, false otherwise.
+ */
+static bool resolve_target(Command *cmd, LabelMap *map) {
+    Entry *ent = get_label(map, cmd->destination.str_val);
+    if (ent == NULL) {
+        return false;
+    }
+
+    // A label at the very end of the file has no command. Branching there simply
+    // ends the program, but there is nothing to call.
+    if (cmd->type == CMD_CALL && ent->command == NULL) {
+        return false;
+    }
+
+    cmd->target    = ent->command;
+    cmd->is_linked = true;
+    return true;
+}
@@ -0,0 +1,764 @@
+#include "loop.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+
+#define MAX_LOOP_EDITS  64          // Upper bound on hoists and reductions per program.
+#define UNROLL_MAX_BODY 8           // Longest body, without its compare and branch, unrolled.
+#define NO_NODE         UINT32_MAX  // Marks an unreachable instruction.
+
+/**
+ * @brief The control-flow facts the loop passes work from.
+ *
+ * Node `count` is a virtual root jumping to the program entry and to every
+ * call target, so routines get dominators too.
+ */
+typedef struct {
+    size_t    count;       // Number of instructions, including the halt.
+    uint32_t *pred_start;  // The predecessors of i are preds[pred_start[i]..pred_start[i + 1]).
+    uint32_t *preds;       // Predecessor lists, the virtual root included.
+    uint32_t *rpo;         // Position of each node in reverse postorder, or NO_NODE.
+    uint32_t *idom;        // Immediate dominator of each node, or NO_NODE.
+    RegMask  *live_in;     // Variables and flags live on entry to each instruction.
+    bool     *in_loop;     // The body of the loop being looked at.
+    uint32_t *stack;       // Scratch space for walks.
+} Flow;
+
+static bool     build_flow(Flow *flow, const Program *prog);
+static void     free_flow(Flow *flow);
+static bool     build_preds(Flow *flow, const Program *prog);
+static bool     build_dominators(Flow *flow, const Program *prog);
+static size_t   successors(const Program *prog, size_t node, size_t *succ);
+static uint32_t intersect(const Flow *flow, uint32_t a, uint32_t b);
+static bool     dominates(const Flow *flow, size_t a, size_t b);
+static bool     find_loop(const Program *prog, Flow *flow, size_t header);
+static bool     find_preheader(const Program *prog, const Flow *flow, size_t header, size_t *at,
+                               bool *skip_inside);
+static int      hoist(Program *prog, Flow *flow, size_t header, FILE *log);
+static int      reduce(Program *prog, Flow *flow, size_t header, FILE *log);
+static bool     unroll_loops(Program *prog, Flow *flow, size_t factor, FILE *log);
+static bool     unroll_guard(int64_t bound, int64_t step, uint8_t cond, size_t factor,
+                             int64_t *guard, uint8_t *exit_op);
+static bool     straight_line(const Program *prog, const Flow *flow, size_t from, size_t to);
+static bool     is_hoistable(uint8_t op);
+
+bool optimize_loops(Program *prog, size_t unroll, FILE *log) {
+    if (!prog || !prog->code) {
+        return false;
+    }
+
+    // Every edit invalidates the analyses, so each one starts over.
+    for (int edits = 0; edits < MAX_LOOP_EDITS; edits++) {
+        Flow flow;
+        if (!build_flow(&flow, prog)) {
+            return false;
+        }
+        int result = 0;
+        for (size_t h = 0; h < prog->length && result == 0; h++) {
+            if (find_loop(prog, &flow, h)) {
+                result = hoist(prog, &flow, h, log);
+                if (result == 0) {
+                    result = reduce(prog, &flow, h, log);
+                }
+            }
+        }
+        free_flow(&flow);
+        if (result < 0) {
+            return false;
+        }
+        if (result == 0) {
+            break;
+        }
+    }
+
+    if (unroll < 2) {
+        return true;
+    }
+    Flow flow;
+    if (!build_flow(&flow, prog)) {
+        return false;
+    }
+    bool ok = unroll_loops(prog, &flow, unroll, log);
+    free_flow(&flow);
+    return ok;
+}
+
+/**
+ * @brief Computes predecessors, dominators and liveness for a program.
+ *
+ * @param flow The `Flow` to fill in.
+ * @param prog The program to analyze.
+ * @return True on success, false if memory ran out.
+ */
+static bool build_flow(Flow *flow, const Program *prog) {
+    memset(flow, 0, sizeof(Flow));
+    flow->count   = prog->length + 1;
+    flow->rpo     = malloc((flow->count + 1) * sizeof(uint32_t));
+    flow->idom    = malloc((flow->count + 1) * sizeof(uint32_t));
+    flow->stack   = malloc((flow->count + 1) * sizeof(uint32_t));
+    flow->live_in = malloc(flow->count * sizeof(RegMask));
+    flow->in_loop = calloc(flow->count, sizeof(bool));
+    if (!flow->rpo || !flow->idom || !flow->stack || !flow->live_in || !flow->in_loop ||
+        !build_preds(flow, prog) || !build_dominators(flow, prog)) {
+        free_flow(flow);
+        return false;
+    }
+    compute_liveness(prog, flow->live_in);
+    return true;
+}
+
+/**
+ * @brief Frees the arrays of a `Flow`.
+ *
+ * @param flow The `Flow` to free.
+ */
+static void free_flow(Flow *flow) {
+    free(flow->pred_start);
+    free(flow->preds);
+    free(flow->rpo);
+    free(flow->idom);
+    free(flow->live_in);
+    free(flow->in_loop);
+    free(flow->stack);
+    memset(flow, 0, sizeof(Flow));
+}
+
+/**
+ * @brief Builds the predecessor lists, virtual root included.
+ *
+ * @param flow The `Flow` to fill in.
+ * @param prog The program to analyze.
+ * @return True on success, false if memory ran out.
+ */
+static bool build_preds(Flow *flow, const Program *prog) {
+    size_t  nodes = flow->count + 1;
+    size_t *succ  = malloc(nodes * sizeof(size_t));
+    flow->pred_start = calloc(nodes + 1, sizeof(uint32_t));
+    if (!succ || !flow->pred_start) {
+        free(succ);
+        return false;
+    }
+
+    size_t edges = 0;
+    for (size_t node = 0; node < nodes; node++) {
+        size_t n = successors(prog, node, succ);
+        for (size_t s = 0; s < n; s++) {
+            flow->pred_start[succ[s] + 1]++;
+        }
+        edges += n;
+    }
+    for (size_t node = 0; node < nodes; node++) {
+        flow->pred_start[node + 1] += flow->pred_start[node];
+    }
+
+    // Fill each list from its end, using the next list's start as a cursor.
+    flow->preds = malloc((edges + 1) * sizeof(uint32_t));
+    if (!flow->preds) {
+        free(succ);
+        return false;
+    }
+    uint32_t *fill = flow->stack;
+    memcpy(fill, flow->pred_start, nodes * sizeof(uint32_t));
+    for (size_t node = 0; node < nodes; node++) {
+        size_t n = successors(prog, node, succ);
+        for (size_t s = 0; s < n; s++) {
+            flow->preds[fill[succ[s]]++] = (uint32_t) node;
+        }
+    }
+    free(succ);
+    return true;
+}
+
+/**
+ * @brief Computes immediate dominators.
+ *
+ * Uses the iterative algorithm of Cooper, Harvey and Kennedy over a reverse
+ * postorder from the virtual root.
+ *
+ * @param flow The `Flow` to fill in, with its predecessors built.
+ * @param prog The program to analyze.
+ * @return True on success, false if memory ran out.
+ */
+static bool build_dominators(Flow *flow, const Program *prog) {
+    size_t    nodes = flow->count + 1;
+    uint32_t  root  = (uint32_t) flow->count;
+    uint32_t *order = malloc(nodes * sizeof(uint32_t));
+    size_t   *next  = calloc(nodes, sizeof(size_t));
+    size_t   *succ  = malloc(nodes * sizeof(size_t));
+    if (!order || !next || !succ) {
+        free(order);
+        free(next);
+        free(succ);
+        return false;
+    }
+
+    // Iterative depth-first search, numbering nodes in postorder.
+    for (size_t node = 0; node < nodes; node++) {
+        flow->rpo[node]  = NO_NODE;
+        flow->idom[node] = NO_NODE;
+    }
+    size_t sp = 0, post = 0;
+    flow->stack[sp++] = root;
+    flow->rpo[root]   = 0;
+    while (sp > 0) {
+        uint32_t node = flow->stack[sp - 1];
+        size_t   n    = successors(prog, node, succ);
+        if (next[node] < n) {
+            size_t s = succ[next[node]++];
+            if (flow->rpo[s] == NO_NODE) {
+                flow->rpo[s]        = 0;
+                flow->stack[sp++]   = (uint32_t) s;
+            }
+            continue;
+        }
+        sp--;
+        order[post++] = node;
+    }
+    for (size_t k = 0; k < post; k++) {
+        flow->rpo[order[k]] = (uint32_t) (post - 1 - k);
+    }
+
+    flow->idom[root] = root;
+    bool changed     = true;
+    while (changed) {
+        changed = false;
+        for (size_t k = post - 1; k-- > 0;) {
+            uint32_t node = order[k];
+            uint32_t idom = NO_NODE;
+            for (uint32_t p = flow->pred_start[node]; p < flow->pred_start[node + 1]; p++) {
+                uint32_t pred = flow->preds[p];
+                if (flow->idom[pred] != NO_NODE) {
+                    idom = idom == NO_NODE ? pred : intersect(flow, pred, idom);
+                }
+            }
+            if (idom != flow->idom[node]) {
+                flow->idom[node] = idom;
+                changed          = true;
+            }
+        }
+    }
+
+    free(order);
+    free(next);
+    free(succ);
+    return true;
+}
+
+/**
+ * @brief Lists the successors of a node, the virtual root included.
+ *
+ * @param prog The program to analyze.
+ * @param node An instruction index, or the virtual root.
+ * @param succ Filled in with the successors; must have room for one per
+ * instruction.
+ * @return The number of successors written to `succ`.
+ */
+static size_t successors(const Program *prog, size_t node, size_t *succ) {
+    if (node < prog->length + 1) {
+        return instr_successors(prog, node, succ);
+    }
+    size_t n  = 0;
+    succ[n++] = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->code[i].op == OP_CALL || prog->code[i].op == OP_TAIL_CALL) {
+            succ[n++] = prog->code[i].arg;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Finds the nearest common dominator of two nodes.
+ *
+ * @param flow The `Flow` being built.
+ * @param a A node with a dominator.
+ * @param b Another node with a dominator.
+ * @return The nearest node dominating both.
+ */
+static uint32_t intersect(const Flow *flow, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (flow->rpo[a] > flow->rpo[b]) {
+            a = flow->idom[a];
+        }
+        while (flow->rpo[b] > flow->rpo[a]) {
+            b = flow->idom[b];
+        }
+    }
+    return a;
+}
+
+/**
+ * @brief Determines if every path from the entry to `b` passes through `a`.
+ *
+ * @param flow The analyzed program.
+ * @param a The candidate dominator.
+ * @param b The instruction to check.
+ * @return True if `a` dominates `b`.
+ */
+static bool dominates(const Flow *flow, size_t a, size_t b) {
+    if (flow->idom[b] == NO_NODE) {
+        return false;
+    }
+    while (b != a && b != flow->count) {
+        b = flow->idom[b];
+    }
+    return b == a;
+}
+
+/**
+ * @brief Collects the natural loop headed at an instruction into `in_loop`.
+ *
+ * @param prog The program to inspect.
+ * @param flow The analyzed program.
+ * @param header The candidate loop header.
+ * @return True if `header` heads a loop that neither calls nor returns.
+ */
+static bool find_loop(const Program *prog, Flow *flow, size_t header) {
+    memset(flow->in_loop, 0, flow->count * sizeof(bool));
+    flow->in_loop[header] = true;
+
+    size_t sp = 0;
+    for (uint32_t p = flow->pred_start[header]; p < flow->pred_start[header + 1]; p++) {
+        uint32_t tail = flow->preds[p];
+        if (tail < flow->count && dominates(flow, header, tail) && !flow->in_loop[tail]) {
+            flow->in_loop[tail] = true;
+            flow->stack[sp++]   = tail;
+        }
+    }
+    if (sp == 0) {
+        return false;
+    }
+
+    // Everything that reaches a back edge without passing the header. The
+    // header dominates all of it, so the walk never leaves the routine.
+    while (sp > 0) {
+        uint32_t node = flow->stack[--sp];
+        for (uint32_t p = flow->pred_start[node]; p < flow->pred_start[node + 1]; p++) {
+            uint32_t pred = flow->preds[p];
+            if (pred < flow->count && !flow->in_loop[pred]) {
+                flow->in_loop[pred] = true;
+                flow->stack[sp++]   = pred;
+            }
+        }
+    }
+
+    // Every opcode past the plain branches calls, returns, stops or is unlinked.
+    for (size_t i = 0; i < prog->length; i++) {
+        if (flow->in_loop[i] && prog->code[i].op > OP_B_LE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Picks where code that must run once before a loop goes.
+ *
+ * Right before the header, unless the loop falls through into its own header.
+ * Then before the one jump entering the loop instead.
+ *
+ * @param prog The program to inspect.
+ * @param flow The analyzed program, with the loop in `in_loop`.
+ * @param header The loop header.
+ * @param at Set to the index to insert at.
+ * @param skip_inside Set if jumps from inside the loop to `at` must skip the
+ * inserted code.
+ * @return True if the loop has a place for a preheader.
+ */
+static bool find_preheader(const Program *prog, const Flow *flow, size_t header, size_t *at,
+                           bool *skip_inside) {
+    size_t succ[MAX_SUCCESSORS];
+    bool   falls_in = false;
+    if (header > 0 && flow->in_loop[header - 1] && prog->code[header - 1].op != OP_B) {
+        size_t n = instr_successors(prog, header - 1, succ);
+        for (size_t s = 0; s < n; s++) {
+            falls_in |= succ[s] == header;
+        }
+    }
+    if (!falls_in) {
+        *at          = header;
+        *skip_inside = true;
+        return true;
+    }
+
+    size_t entry = NO_NODE;
+    for (uint32_t p = flow->pred_start[header]; p < flow->pred_start[header + 1]; p++) {
+        uint32_t pred = flow->preds[p];
+        if (pred == flow->count || (!flow->in_loop[pred] && entry != NO_NODE)) {
+            return false;
+        }
+        if (!flow->in_loop[pred]) {
+            entry = pred;
+        }
+    }
+    if (entry == NO_NODE || prog->code[entry].op != OP_B) {
+        return false;
+    }
+    *at          = entry;
+    *skip_inside = false;
+    return true;
+}
+
+/**
+ * @brief Moves the invariant arithmetic of a loop to its preheader.
+ *
+ * An instruction is invariant if the loop writes none of its operands and no
+ * other instruction in the loop writes its result. It may only move if that
+ * result is dead on entry to the loop, so the earlier write goes unobserved.
+ *
+ * @param prog The program to edit.
+ * @param flow The analyzed program, with the loop in `in_loop`.
+ * @param header The loop header.
+ * @param log Stream to report the change on, or NULL for none.
+ * @return 1 if the program changed, 0 if not, -1 if memory ran out.
+ */
+static int hoist(Program *prog, Flow *flow, size_t header, FILE *log) {
+    uint8_t defs[NUM_VARIABLES] = {0};
+    for (size_t i = 0; i < prog->length; i++) {
+        RegMask written = flow->in_loop[i] ? instr_defs(prog, i) & MASK_ALL_REGS : 0;
+        for (; written; written &= written - 1) {
+            uint8_t var = (uint8_t) __builtin_ctzll(written);
+            defs[var] += defs[var] < UINT8_MAX;
+        }
+    }
+
+    // Hoisting an instruction can make the ones reading its result invariant,
+    // so keep going until nothing moves. Each round only depends on earlier
+    // ones, which keeps the hoisted instructions in a valid order.
+    bool    *hoisted = calloc(flow->count, sizeof(bool));
+    uint32_t *order  = flow->stack;
+    size_t   moved   = 0;
+    if (!hoisted) {
+        return -1;
+    }
+    bool progress = true;
+    while (progress) {
+        RegMask written = 0;
+        for (size_t i = 0; i < prog->length; i++) {
+            if (flow->in_loop[i] && !hoisted[i]) {
+                written |= instr_defs(prog, i);
+            }
+        }
+        progress = false;
+        for (size_t i = 0; i < prog->length; i++) {
+            const Instr *ins = &prog->code[i];
+            if (!flow->in_loop[i] || hoisted[i] || !is_hoistable(ins->op) ||
+                defs[ins->dst] != 1 || (flow->live_in[header] & REG_BIT(ins->dst)) ||
+                (instr_uses(prog, i) & written)) {
+                continue;
+            }
+            hoisted[i]     = true;
+            order[moved++] = (uint32_t) i;
+            progress       = true;
+        }
+    }
+
+    size_t at;
+    bool   skip_inside;
+    if (moved == 0 || !find_preheader(prog, flow, header, &at, &skip_inside)) {
+        free(hoisted);
+        return 0;
+    }
+
+    Instr *code = malloc(moved * sizeof(Instr));
+    if (!code) {
+        free(hoisted);
+        return -1;
+    }
+    for (size_t k = 0; k < moved; k++) {
+        code[k] = prog->code[order[k]];
+    }
+    if (!program_insert(prog, at, code, moved, skip_inside ? flow->in_loop : NULL)) {
+        free(code);
+        free(hoisted);
+        return -1;
+    }
+    free(code);
+
+    bool *removed = calloc(prog->length + 1, sizeof(bool));
+    if (!removed) {
+        free(hoisted);
+        return -1;
+    }
+    for (size_t i = 0; i < flow->count; i++) {
+        if (hoisted[i]) {
+            removed[i >= at ? i + moved : i] = true;
+        }
+    }
+    bool ok = program_compact(prog, removed);
+    free(removed);
+    free(hoisted);
+    if (ok && log) {
+        fprintf(log, "Loop: hoisted %zu instructions out of the loop at %zu\n", moved, header);
+    }
+    return ok ? 1 : -1;
+}
+
+/**
+ * @brief Strength-reduces one derived induction variable of a loop.
+ *
+ * Looks for `lsl j, i, k` followed by `add j, j, c`, where the only write to
+ * `i` in the loop is a constant step in the same straight-line block. Then
+ * `j` moves by the step shifted by `k` every time it is recomputed, so the
+ * pair becomes a single add, with `j` set up in the preheader. That write
+ * must go unobserved, so `j` has to be dead on entry to the loop.
+ *
+ * @param prog The program to edit.
+ * @param flow The analyzed program, with the loop in `in_loop`.
+ * @param header The loop header.
+ * @param log Stream to report the change on, or NULL for none.
+ * @return 1 if the program changed, 0 if not, -1 if memory ran out.
+ */
+static int reduce(Program *prog, Flow *flow, size_t header, FILE *log) {
+    for (size_t p = 0; p + 1 < prog->length; p++) {
+        const Instr *shift = &prog->code[p];
+        const Instr *add   = &prog->code[p + 1];
+        if (!flow->in_loop[p] || !flow->in_loop[p + 1] || shift->op != OP_LSL_RRI ||
+            (add->op != OP_ADD_RRI && add->op != OP_SUB_RRI) || add->dst != shift->dst ||
+            add->a != shift->dst || shift->a == shift->dst ||
+            (flow->live_in[header] & REG_BIT(shift->dst))) {
+            continue;
+        }
+        uint8_t j = shift->dst, i = shift->a;
+
+        // j must be written by the pair alone, i by a single constant step.
+        size_t step_at = NO_NODE, j_defs = 0, i_defs = 0;
+        for (size_t x = 0; x < prog->length; x++) {
+            if (!flow->in_loop[x]) {
+                continue;
+            }
+            RegMask written = instr_defs(prog, x);
+            j_defs += (written & REG_BIT(j)) != 0;
+            if (written & REG_BIT(i)) {
+                i_defs++;
+                step_at = x;
+            }
+        }
+        if (j_defs != 2 || i_defs != 1) {
+            continue;
+        }
+        const Instr *step = &prog->code[step_at];
+        if ((step->op != OP_ADD_RRI && step->op != OP_SUB_RRI) || step->a != i ||
+            !straight_line(prog, flow, step_at < p ? step_at : p,
+                           step_at > p + 1 ? step_at : p + 1)) {
+            continue;
+        }
+
+        // Stepping i by s moves j by s << k. If i is stepped after j is
+        // recomputed, the first recomputation sees i unstepped.
+        int64_t  k      = program_imm(prog, shift);
+        uint64_t s      = (uint64_t) program_imm(prog, step);
+        uint64_t c      = (uint64_t) program_imm(prog, add);
+        uint64_t stride = (step->op == OP_ADD_RRI ? s : -s) << (k & 63);
+        uint64_t init   = (add->op == OP_ADD_RRI ? c : -c) - (step_at > p ? stride : 0);
+        uint32_t stride_const = program_add_const(prog, (int64_t) stride);
+        uint32_t init_const   = program_add_const(prog, (int64_t) init);
+        size_t   at;
+        bool     skip_inside;
+        if (stride_const == UINT32_MAX || init_const == UINT32_MAX) {
+            return -1;
+        }
+        if (!find_preheader(prog, flow, header, &at, &skip_inside)) {
+            continue;
+        }
+
+        Instr setup[2] = {*shift, {OP_ADD_RRI, j, j, 0, init_const}};
+        prog->code[p]  = (Instr) {OP_ADD_RRI, j, j, 0, stride_const};
+        if (!program_insert(prog, at, setup, 2, skip_inside ? flow->in_loop : NULL)) {
+            return -1;
+        }
+        bool *removed = calloc(prog->length + 1, sizeof(bool));
+        if (!removed) {
+            return -1;
+        }
+        removed[p + 1 >= at ? p + 3 : p + 1] = true;
+        bool ok                              = program_compact(prog, removed);
+        free(removed);
+        if (ok && log) {
+            fprintf(log, "Loop: strength-reduced x%u in the loop at %zu\n", j, header);
+        }
+        return ok ? 1 : -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Unrolls every small counted loop.
+ *
+ * A loop qualifies if it is one block ending in `cmp i, #n` and a branch back
+ * to its start, steps `i` by a constant exactly once, and neither reads nor
+ * sets the flags before the compare. It is preceded by a copy that tests
+ * whether `factor` more iterations all continue, runs them back to back if
+ * so, and otherwise falls through to the original loop:
+ *
+ *     guard: cmp i, #g
+ *            b.ge/b.le loop
+ *            body x factor
+ *            b guard
+ *     loop:  body
+ *            cmp i, #n
+ *            b.cond loop
+ *
+ * The original loop always runs at least once, so the flags at the exit come
+ * from its compare as before.
+ *
+ * @param prog The program to edit.
+ * @param flow The analyzed program.
+ * @param factor The number of copies of the body.
+ * @param log Stream to report each change on, or NULL for none.
+ * @return True on success, false if memory ran out.
+ */
+static bool unroll_loops(Program *prog, Flow *flow, size_t factor, FILE *log) {
+    // Going backwards, an unrolled loop only renumbers what was already seen.
+    for (size_t t = prog->length; t-- > 2;) {
+        const Instr *branch = &prog->code[t];
+        const Instr *cmp    = &prog->code[t - 1];
+        size_t       header = branch->arg;
+        size_t       length = t - 1 - header;
+        if (branch->op < OP_B_NE || branch->op > OP_B_LE || header + 2 > t ||
+            length > UNROLL_MAX_BODY || cmp->op != OP_CMP_RI ||
+            !straight_line(prog, flow, header, t)) {
+            continue;
+        }
+
+        size_t  step_at = NO_NODE;
+        bool    plain   = true;
+        uint8_t i       = cmp->a;
+        for (size_t x = header; x < t - 1 && plain; x++) {
+            RegMask touched = instr_uses(prog, x) | instr_defs(prog, x);
+            plain           = (touched & MASK_FLAGS) == 0;
+            if (instr_defs(prog, x) & REG_BIT(i)) {
+                plain   = step_at == NO_NODE;
+                step_at = x;
+            }
+        }
+        if (!plain || step_at == NO_NODE) {
+            continue;
+        }
+        const Instr *step = &prog->code[step_at];
+        int64_t      s    = program_imm(prog, step);
+        int64_t      guard;
+        uint8_t      exit_op;
+        if ((step->op != OP_ADD_RRI && step->op != OP_SUB_RRI) || step->a != i || s == 0 ||
+            s == INT64_MIN ||
+            !unroll_guard(program_imm(prog, cmp), step->op == OP_ADD_RRI ? s : -s, branch->op,
+                          factor, &guard, &exit_op)) {
+            continue;
+        }
+
+        size_t   count      = 2 + factor * length + 1;
+        Instr   *code       = malloc(count * sizeof(Instr));
+        uint32_t guard_imm  = program_add_const(prog, guard);
+        if (!code || guard_imm == UINT32_MAX) {
+            free(code);
+            return false;
+        }
+        code[0] = (Instr) {OP_CMP_RI, 0, i, 0, guard_imm};
+        code[1] = (Instr) {exit_op, 0, 0, 0, (uint32_t) (header + count)};
+        for (size_t copy = 0; copy < factor; copy++) {
+            memcpy(&code[2 + copy * length], &prog->code[header], length * sizeof(Instr));
+        }
+        code[count - 1] = (Instr) {OP_B, 0, 0, 0, (uint32_t) header};
+
+        // Only the loop's own back edge keeps going to the original loop.
+        memset(flow->in_loop, 0, flow->count * sizeof(bool));
+        flow->in_loop[t] = true;
+        bool ok          = program_insert(prog, header, code, count, flow->in_loop);
+        free(code);
+        if (!ok) {
+            return false;
+        }
+        if (log) {
+            fprintf(log, "Loop: unrolled the loop at %zu %zu times\n", header, factor);
+        }
+        t = header;
+    }
+    return true;
+}
+
+/**
+ * @brief Computes the test that lets an unrolled loop run `factor` iterations.
+ *
+ * With the counter at `i` before the iterations, every one of them continues
+ * if i + factor * step still satisfies the loop condition, which reduces to a
+ * single compare of `i` against an immediate.
+ *
+ * @param bound The immediate the loop compares against.
+ * @param step The signed amount added to the counter each iteration.
+ * @param cond The branch closing the loop.
+ * @param factor The number of iterations to check for.
+ * @param guard Set to the immediate to compare the counter against.
+ * @param exit_op Set to the branch leaving for the original loop.
+ * @return True if the loop condition and step fit, and nothing overflows.
+ */
+static bool unroll_guard(int64_t bound, int64_t step, uint8_t cond, size_t factor,
+                         int64_t *guard, uint8_t *exit_op) {
+    int64_t span;
+    if (factor > INT64_MAX || __builtin_mul_overflow((int64_t) factor, step, &span) ||
+        __builtin_sub_overflow(bound, span, guard)) {
+        return false;
+    }
+    if (step > 0 && (cond == OP_B_NE || cond == OP_B_LT || cond == OP_B_LE)) {
+        // i + span < bound, or <= for b.le.
+        *exit_op = OP_B_GE;
+        return cond != OP_B_LE || !__builtin_add_overflow(*guard, 1, guard);
+    }
+    if (step < 0 && (cond == OP_B_NE || cond == OP_B_GT || cond == OP_B_GE)) {
+        // i + span > bound, or >= for b.ge.
+        *exit_op = OP_B_LE;
+        return cond != OP_B_GE || !__builtin_sub_overflow(*guard, 1, guard);
+    }
+    return false;
+}
+
+/**
+ * @brief Determines if a range of instructions always runs as one block.
+ *
+ * @param prog The program to inspect.
+ * @param flow The analyzed program.
+ * @param from The first instruction.
+ * @param to The last instruction.
+ * @return True if nothing but the previous instruction leads to any
+ * instruction after `from`, and none before `to` can go anywhere else.
+ */
+static bool straight_line(const Program *prog, const Flow *flow, size_t from, size_t to) {
+    size_t succ[MAX_SUCCESSORS];
+    for (size_t x = from + 1; x <= to; x++) {
+        if (flow->pred_start[x + 1] - flow->pred_start[x] != 1 ||
+            flow->preds[flow->pred_start[x]] != x - 1 ||
+            instr_successors(prog, x - 1, succ) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Determines if an opcode is arithmetic that only writes `dst`.
+ *
+ * @param op The opcode to check.
+ * @return True if an instruction with this opcode can move out of a loop.
+ */
+static bool is_hoistable(uint8_t op) {
+    switch (op) {
+        case OP_MOV_RI:
+        case OP_ADD_RRR:
+        case OP_ADD_RRI:
+        case OP_SUB_RRR:
+        case OP_SUB_RRI:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
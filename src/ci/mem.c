@@ -1,10 +1,15 @@
 #include "mem.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-static uint8_t mem[MEM_CAPACITY];
-
-static bool validate_bytes(size_t bytes);
+static bool   validate_bytes(size_t bytes);
+static bool   in_bounds(const Memory *mem, size_t offset, size_t bytes);
+static size_t nonzero_start(const uint8_t *bytes, size_t length);
+static size_t nonzero_end(const uint8_t *bytes, size_t length);
 
 /**
  * @brief Verifies that the given amount of `bytes` is valid to load.
@@ -18,64 +23,202 @@ static bool validate_bytes(size_t bytes) {
     return bytes == 1 || bytes == 2 || bytes == 4 || bytes == 8;
 }
 
-bool mem_load(uint8_t *destination, size_t offset, size_t bytes) {
-    if (!validate_bytes(bytes) || !destination || offset + bytes > MEM_CAPACITY) {
+/**
+ * @brief Checks that an access of `bytes` bytes at `offset` stays in memory.
+ *
+ * Written so that offsets close to `SIZE_MAX` cannot wrap around.
+ *
+ * @param mem The memory accessed.
+ * @param offset The offset of the first byte.
+ * @param bytes The size of the access.
+ * @return True if every byte of the access is in bounds.
+ */
+static bool in_bounds(const Memory *mem, size_t offset, size_t bytes) {
+    return bytes <= mem->capacity && offset <= mem->capacity - bytes;
+}
+
+bool mem_init(Memory *mem, size_t capacity) {
+    mem->bytes    = capacity > 0 ? calloc(capacity, 1) : NULL;
+    mem->capacity = mem->bytes ? capacity : 0;
+    return mem->capacity == capacity;
+}
+
+void mem_free(Memory *mem) {
+    free(mem->bytes);
+    mem->bytes    = NULL;
+    mem->capacity = 0;
+}
+
+bool mem_load(const Memory *mem, uint8_t *destination, size_t offset, size_t bytes) {
+    if (!validate_bytes(bytes) || !destination || !in_bounds(mem, offset, bytes)) {
         return false;
     }
 
-    memcpy(destination, &mem[offset], bytes);
+    memcpy(destination, &mem->bytes[offset], bytes);
     return true;
 }
 
-bool mem_store(uint8_t *source, size_t offset, size_t bytes) {
-    if (!validate_bytes(bytes) || !source || offset + bytes > MEM_CAPACITY) {
+bool mem_store(Memory *mem, uint8_t *source, size_t offset, size_t bytes) {
+    if (!validate_bytes(bytes) || !source || !in_bounds(mem, offset, bytes)) {
         return false;
     }
 
-    memcpy(&mem[offset], source, bytes);
+    memcpy(&mem->bytes[offset], source, bytes);
     return true;
 }
 
-void mem_print(void) {
-    printf("Memory state:\n");
+bool mem_load_word(const Memory *mem, int64_t *value, size_t offset, size_t bytes) {
+    uint64_t word = 0;
+    if (!validate_bytes(bytes) || !in_bounds(mem, offset, bytes)) {
+        *value = 0;
+        return false;
+    }
 
-    // Calculate minimum hex digits needed based on capacity
-    int    addr_width = 1;
-    size_t temp       = MEM_CAPACITY - 1;
-    while (temp >>= 4) {
-        addr_width++;
+    memcpy(&word, &mem->bytes[offset], bytes);
+    *value = (int64_t) word;
+    return true;
+}
+
+bool mem_store_word(Memory *mem, int64_t value, size_t offset, size_t bytes) {
+    if (!validate_bytes(bytes) || !in_bounds(mem, offset, bytes)) {
+        return false;
+    }
+
+    memcpy(&mem->bytes[offset], &value, bytes);
+    return true;
+}
+
+bool mem_store_string(Memory *mem, const char *str, size_t offset) {
+    size_t count = 0;
+    do {
+        if (!in_bounds(mem, offset, count + 1)) {
+            return false;
+        }
+        mem->bytes[offset + count] = (uint8_t) str[count];
+    } while (str[count++] != '\0');
+    return true;
+}
+
+// The bulk operations go through the C library, whose memset, memmove and
+// memcmp already pick the widest vector instructions the host supports.
+
+bool mem_fill(Memory *mem, size_t offset, uint8_t value, size_t length) {
+    if (!in_bounds(mem, offset, length)) {
+        return false;
+    }
+    if (length > 0) {
+        memset(&mem->bytes[offset], value, length);
+    }
+    return true;
+}
+
+bool mem_copy(Memory *dst, size_t dst_offset, const Memory *src, size_t src_offset,
+              size_t length) {
+    if (!in_bounds(dst, dst_offset, length) || !in_bounds(src, src_offset, length)) {
+        return false;
+    }
+    if (length > 0) {
+        memmove(&dst->bytes[dst_offset], &src->bytes[src_offset], length);
     }
+    return true;
+}
 
-    size_t first_modified = 0;
-    while (first_modified < MEM_CAPACITY && mem[first_modified] == 0) {
-        first_modified++;
+bool mem_compare(const Memory *a, size_t a_offset, const Memory *b, size_t b_offset,
+                 size_t length, int *order) {
+    if (!in_bounds(a, a_offset, length) || !in_bounds(b, b_offset, length)) {
+        return false;
     }
+    *order = length > 0 ? memcmp(&a->bytes[a_offset], &b->bytes[b_offset], length) : 0;
+    return true;
+}
+
+void mem_reset(Memory *mem) {
+    mem_fill(mem, 0, 0, mem->capacity);
+}
+
+void mem_print(const Memory *mem, FILE *out) {
+    fprintf(out, "Memory state:\n");
 
-    if (first_modified == MEM_CAPACITY) {
-        printf("Unmodified\n");
+    size_t first_modified = nonzero_start(mem->bytes, mem->capacity);
+    if (first_modified == mem->capacity) {
+        fprintf(out, "Unmodified\n");
         return;
     }
+    size_t last_modified = nonzero_end(mem->bytes, mem->capacity) - 1;
 
-    size_t last_modified = MEM_CAPACITY - 1;
-    while (last_modified > first_modified && mem[last_modified] == 0) {
-        last_modified--;
+    // Calculate minimum hex digits needed based on capacity
+    int    addr_width = 1;
+    size_t temp       = mem->capacity - 1;
+    while (temp >>= 4) {
+        addr_width++;
     }
 
     size_t display_start = first_modified & ~0xF;
     size_t display_end   = (last_modified + 16) & ~0xF;
-    if (display_end > MEM_CAPACITY)
-        display_end = MEM_CAPACITY;
+    if (display_end > mem->capacity)
+        display_end = mem->capacity;
 
-    printf("0x%0*zx-0x%0*zx:\n", addr_width, display_start, addr_width, display_end - 1);
+    fprintf(out, "0x%0*zx-0x%0*zx:\n", addr_width, display_start, addr_width, display_end - 1);
 
     for (size_t j = display_start; j < display_end; j += 16) {
-        printf("    0x%0*zx: ", addr_width, j);
+        fprintf(out, "    0x%0*zx: ", addr_width, j);
         for (size_t k = 0; k < 16 && j + k < display_end; k++) {
-            printf("%02x", mem[j + k]);
+            fprintf(out, "%02x", mem->bytes[j + k]);
             if ((k + 1) % 4 == 0) {
-                printf(" ");
+                fprintf(out, " ");
             }
         }
-        printf("\n");
+        fprintf(out, "\n");
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Finds the first byte of a range that is not zero, 16 at a time.
+ *
+ * @param bytes The range to search.
+ * @param length Number of bytes in the range.
+ * @return The index of the byte, or `length` if every byte is zero.
+ */
+static size_t nonzero_start(const uint8_t *bytes, size_t length) {
+    size_t start = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; start + 16 <= length; start += 16) {
+        __m128i  chunk = _mm_loadu_si128((const __m128i *) &bytes[start]);
+        unsigned zeros = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        if (zeros != 0xFFFF) {
+            return start + (size_t) __builtin_ctz(~zeros);
+        }
+    }
+#endif
+    while (start < length && bytes[start] == 0) {
+        start++;
+    }
+    return start;
+}
+
+/**
+ * @brief Finds the end of the last byte of a range that is not zero, 16 at a
+ * time.
+ *
+ * @param bytes The range to search.
+ * @param length Number of bytes in the range.
+ * @return One past the index of the byte, or 0 if every byte is zero.
+ */
+static size_t nonzero_end(const uint8_t *bytes, size_t length) {
+    size_t end = length;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; end >= 16; end -= 16) {
+        __m128i  chunk = _mm_loadu_si128((const __m128i *) &bytes[end - 16]);
+        unsigned zeros = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        if (zeros != 0xFFFF) {
+            return end - 16 + (size_t) (32 - __builtin_clz(~zeros & 0xFFFF));
+        }
+    }
+#endif
+    while (end > 0 && bytes[end - 1] == 0) {
+        end--;
+    }
+    return end;
+}
@@ -0,0 +1,210 @@
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void       build_key(const Interpreter *intr, size_t routine, RegMask inputs,
+                            MemoEntry *key);
+static bool       same_key(const MemoEntry *entry, const MemoEntry *key);
+static MemoEntry *find_set(const MemoTable *memo, const MemoEntry *key);
+static void       store(MemoTable *memo, const MemoEntry *key, int64_t result, uint8_t flags);
+static uint8_t    pack_flags(const Interpreter *intr);
+
+bool memo_init(MemoTable *memo, const Program *prog, size_t capacity, MemoEviction eviction) {
+    if (!memo || !prog) {
+        return false;
+    }
+
+    memo->set_count = 1;
+    while (memo->set_count * 2 * MEMO_WAYS <= capacity) {
+        memo->set_count *= 2;
+    }
+    memo->eviction         = eviction;
+    memo->clock            = 0;
+    memo->pending          = NULL;
+    memo->pending_count    = 0;
+    memo->pending_capacity = 0;
+    memo->hits             = 0;
+    memo->misses           = 0;
+    memo->evictions        = 0;
+    memo->inputs           = malloc((prog->length + 1) * sizeof(RegMask));
+    memo->entries          = calloc(memo->set_count * MEMO_WAYS, sizeof(MemoEntry));
+    if (!memo->inputs || !memo->entries || !compute_pure_inputs(prog, memo->inputs)) {
+        memo_free(memo);
+        return false;
+    }
+
+    for (size_t i = 0; i <= prog->length; i++) {
+        if (__builtin_popcountll(memo->inputs[i] & MASK_ALL_REGS) > MEMO_MAX_INPUTS) {
+            memo->inputs[i] = MASK_IMPURE;
+        }
+    }
+    return true;
+}
+
+bool memo_call(MemoTable *memo, Interpreter *intr, size_t routine) {
+    // A call with no room for its frame must reach push_frame() to overflow.
+    RegMask inputs = memo->inputs[routine];
+    if (inputs == MASK_IMPURE || intr->frame_count >= intr->max_depth) {
+        return false;
+    }
+
+    MemoEntry key;
+    build_key(intr, routine, inputs, &key);
+    MemoEntry *set = find_set(memo, &key);
+    for (size_t w = 0; w < MEMO_WAYS; w++) {
+        if (same_key(&set[w], &key)) {
+            memo->hits++;
+            if (memo->eviction == MEMO_EVICT_LRU) {
+                set[w].stamp = ++memo->clock;
+            }
+            intr->variables[0] = set[w].result;
+            intr->is_greater   = (set[w].flags_out & 4) != 0;
+            intr->is_less      = (set[w].flags_out & 2) != 0;
+            intr->is_equal     = (set[w].flags_out & 1) != 0;
+            return true;
+        }
+    }
+    memo->misses++;
+
+    // Without room to record the call, it simply runs unrecorded.
+    if (memo->pending_count == memo->pending_capacity) {
+        size_t       capacity = memo->pending_capacity ? memo->pending_capacity * 2 : 16;
+        MemoPending *pending  = realloc(memo->pending, capacity * sizeof(MemoPending));
+        if (!pending) {
+            return false;
+        }
+        memo->pending          = pending;
+        memo->pending_capacity = capacity;
+    }
+    memo->pending[memo->pending_count].depth = intr->frame_count + 1;
+    memo->pending[memo->pending_count].key   = key;
+    memo->pending_count++;
+    return false;
+}
+
+void memo_return(MemoTable *memo, Interpreter *intr) {
+    if (memo->pending_count == 0 ||
+        memo->pending[memo->pending_count - 1].depth != intr->frame_count) {
+        return;
+    }
+    memo->pending_count--;
+    store(memo, &memo->pending[memo->pending_count].key, intr->variables[0], pack_flags(intr));
+}
+
+void memo_print_stats(const MemoTable *memo, FILE *out) {
+    if (!memo) {
+        return;
+    }
+    fprintf(out, "Memo: %zu hits, %zu misses, %zu evictions\n", memo->hits, memo->misses,
+            memo->evictions);
+}
+
+void memo_free(MemoTable *memo) {
+    if (!memo) {
+        return;
+    }
+    free(memo->inputs);
+    free(memo->entries);
+    free(memo->pending);
+    memo->inputs           = NULL;
+    memo->entries          = NULL;
+    memo->pending          = NULL;
+    memo->pending_count    = 0;
+    memo->pending_capacity = 0;
+}
+
+/**
+ * @brief Gathers the inputs of a call into a key.
+ *
+ * Unused input slots are zeroed so keys compare as plain memory.
+ *
+ * @param intr Pointer to the `Interpreter` making the call.
+ * @param routine The index of the routine called.
+ * @param inputs The variables and flags the routine reads.
+ * @param key The entry to fill in.
+ */
+static void build_key(const Interpreter *intr, size_t routine, RegMask inputs, MemoEntry *key) {
+    memset(key, 0, sizeof(*key));
+    key->routine  = (uint32_t) routine;
+    key->flags_in = (inputs & MASK_FLAGS) ? pack_flags(intr) : 0;
+
+    size_t  n    = 0;
+    RegMask regs = inputs & MASK_ALL_REGS;
+    while (regs) {
+        key->inputs[n++] = intr->variables[__builtin_ctzll(regs)];
+        regs &= regs - 1;
+    }
+}
+
+/**
+ * @brief Determines if an entry holds the result for a key.
+ *
+ * @param entry The entry to check.
+ * @param key The key looked up.
+ * @return True if the entry is valid and was stored under the same key.
+ */
+static bool same_key(const MemoEntry *entry, const MemoEntry *key) {
+    return entry->valid && entry->routine == key->routine && entry->flags_in == key->flags_in &&
+           memcmp(entry->inputs, key->inputs, sizeof(key->inputs)) == 0;
+}
+
+/**
+ * @brief Finds the set of the table a key belongs to.
+ *
+ * @param memo Pointer to the `MemoTable` to search.
+ * @param key The key looked up.
+ * @return The first of the `MEMO_WAYS` entries of the set.
+ */
+static MemoEntry *find_set(const MemoTable *memo, const MemoEntry *key) {
+    uint64_t hash = key->routine * 0x9E3779B97F4A7C15ULL ^ key->flags_in;
+    for (size_t i = 0; i < MEMO_MAX_INPUTS; i++) {
+        hash = (hash ^ (uint64_t) key->inputs[i]) * 0xFF51AFD7ED558CCDULL;
+    }
+    hash ^= hash >> 32;
+    return &memo->entries[(hash & (memo->set_count - 1)) * MEMO_WAYS];
+}
+
+/**
+ * @brief Stores the result of a recorded call, making room as configured.
+ *
+ * @param memo Pointer to the `MemoTable` to update.
+ * @param key The key the call was recorded under.
+ * @param result x0 on return.
+ * @param flags The flags on return.
+ */
+static void store(MemoTable *memo, const MemoEntry *key, int64_t result, uint8_t flags) {
+    MemoEntry *set    = find_set(memo, key);
+    MemoEntry *victim = NULL;
+    for (size_t w = 0; w < MEMO_WAYS; w++) {
+        if (!set[w].valid || same_key(&set[w], key)) {
+            victim = &set[w];
+            break;
+        }
+        if (!victim || set[w].stamp < victim->stamp) {
+            victim = &set[w];
+        }
+    }
+    if (victim->valid && !same_key(victim, key)) {
+        if (memo->eviction == MEMO_EVICT_NONE) {
+            return;
+        }
+        memo->evictions++;
+    }
+
+    *victim           = *key;
+    victim->valid     = true;
+    victim->stamp     = ++memo->clock;
+    victim->result    = result;
+    victim->flags_out = flags;
+}
+
+/**
+ * @brief Packs the comparison flags into the low three bits of a byte.
+ *
+ * @param intr Pointer to the `Interpreter` holding the flags.
+ * @return Greater, less and equal as bits 2, 1 and 0.
+ */
+static uint8_t pack_flags(const Interpreter *intr) {
+    return (uint8_t) (intr->is_greater << 2 | intr->is_less << 1 | intr->is_equal);
+}
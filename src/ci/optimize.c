@@ -0,0 +1,720 @@
+#include "optimize.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+
+#define FLAGS_KNOWN  0x8   // Set in `ConstState.flags` once the flags are known.
+#define FLAG_GREATER 0x4
+#define FLAG_LESS    0x2
+#define FLAG_EQUAL   0x1
+#define MAX_ROUNDS   16    // Upper bound on the passes over the whole program.
+
+/**
+ * @brief What is known about the variables and flags at one program point.
+ */
+typedef struct {
+    bool     reached;                // Whether any path reaches this point.
+    uint8_t  flags;                  // FLAGS_KNOWN and the flag bits, or 0.
+    uint32_t known;                  // Mask of the variables with a known value.
+    uint32_t copied;                 // Mask of the variables known to equal another one.
+    int64_t  values[NUM_VARIABLES];  // The value of each known variable.
+    uint8_t  copies[NUM_VARIABLES];  // The variable each copied one equals.
+} ConstState;
+
+/**
+ * @brief The basic blocks of a program, with what is known on entry to each.
+ */
+typedef struct {
+    uint32_t   *starts;    // First instruction of each block, in order. The last
+                           // block is the halt.
+    uint32_t   *block_of;  // Block starting at each instruction, indexed like `code`.
+    size_t      count;     // Number of blocks.
+    ConstState *states;    // State on entry to each block.
+} Cfg;
+
+static bool    build_cfg(Cfg *cfg, const Program *prog);
+static void    free_cfg(Cfg *cfg);
+static bool    ends_block(uint8_t op);
+static bool    propagate(const Program *prog, Cfg *cfg);
+static void    transfer(const Program *prog, size_t i, const ConstState *in, ConstState *out);
+static bool    merge(ConstState *dst, const ConstState *src);
+static void    define(ConstState *state, uint8_t var);
+static bool    fold(uint8_t op, int64_t a, int64_t b, int64_t *result);
+static bool    is_identity(uint8_t op, const Instr *ins, int64_t imm);
+static bool    is_arithmetic(uint8_t op);
+static bool    branch_taken(uint8_t op, uint8_t flags);
+static uint8_t root(const ConstState *state, uint8_t var);
+static bool    rewrite(Program *prog, const Cfg *cfg, bool *removed, bool *changed);
+static bool    rewrite_instr(Program *prog, const ConstState *in, const ConstState *out,
+                             Instr *ins, bool *removed);
+static void    rewrite_operands(Program *prog, const ConstState *in, Instr *ins);
+static bool    remove_dead(Program *prog, bool *removed, bool *changed);
+
+bool optimize_program(Program *prog) {
+    if (!prog || !prog->code) {
+        return false;
+    }
+    free(prog->save_masks);
+    prog->save_masks = NULL;
+
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        Cfg   cfg;
+        bool *removed = calloc(prog->length + 1, sizeof(bool));
+        if (!removed || !build_cfg(&cfg, prog)) {
+            free(removed);
+            return false;
+        }
+
+        bool changed = false;
+        bool ok      = propagate(prog, &cfg) && rewrite(prog, &cfg, removed, &changed);
+        free_cfg(&cfg);
+        if (ok && program_compact(prog, removed)) {
+            memset(removed, 0, (prog->length + 1) * sizeof(bool));
+            ok = remove_dead(prog, removed, &changed) && program_compact(prog, removed);
+        } else {
+            ok = false;
+        }
+        free(removed);
+
+        if (!ok) {
+            return false;
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Splits a program into basic blocks.
+ *
+ * A block starts at the entry, at every jump or call target, and after every
+ * instruction that does not simply fall through.
+ *
+ * @param cfg The control-flow graph to fill in.
+ * @param prog The program to split.
+ * @return True if the graph was built, false if memory ran out.
+ */
+static bool build_cfg(Cfg *cfg, const Program *prog) {
+    memset(cfg, 0, sizeof(Cfg));
+    bool *leader  = calloc(prog->length + 1, sizeof(bool));
+    cfg->block_of = malloc((prog->length + 1) * sizeof(uint32_t));
+    if (!leader || !cfg->block_of) {
+        free(leader);
+        free_cfg(cfg);
+        return false;
+    }
+
+    leader[0]            = true;
+    leader[prog->length] = true;
+    for (size_t i = 0; i < prog->length; i++) {
+        const Instr *ins = &prog->code[i];
+        if ((ins->op >= OP_B && ins->op <= OP_B_LE) || ins->op == OP_CALL) {
+            leader[ins->arg] = true;
+        }
+        if (ends_block(ins->op)) {
+            leader[i + 1] = true;
+        }
+    }
+    for (size_t i = 0; i <= prog->length; i++) {
+        cfg->count += leader[i];
+    }
+
+    cfg->starts = malloc(cfg->count * sizeof(uint32_t));
+    cfg->states = calloc(cfg->count, sizeof(ConstState));
+    if (!cfg->starts || !cfg->states) {
+        free(leader);
+        free_cfg(cfg);
+        return false;
+    }
+    size_t b = 0;
+    for (size_t i = 0; i <= prog->length; i++) {
+        if (leader[i]) {
+            cfg->block_of[i] = (uint32_t) b;
+            cfg->starts[b++] = (uint32_t) i;
+        }
+    }
+
+    free(leader);
+    return true;
+}
+
+/**
+ * @brief Frees the resources of a control-flow graph.
+ *
+ * @param cfg The graph to free.
+ */
+static void free_cfg(Cfg *cfg) {
+    free(cfg->starts);
+    free(cfg->block_of);
+    free(cfg->states);
+    memset(cfg, 0, sizeof(Cfg));
+}
+
+/**
+ * @brief Determines if an instruction ends a basic block.
+ *
+ * @param op The opcode to check.
+ * @return True for jumps, calls, returns and anything that stops the program.
+ */
+static bool ends_block(uint8_t op) {
+    return (op >= OP_B && op <= OP_B_LE) || op == OP_CALL || op == OP_CALL_UNLINKED ||
+           op == OP_RET || op == OP_HALT || op == OP_ERR;
+}
+
+/**
+ * @brief Computes what is known on entry to every basic block.
+ *
+ * A forward dataflow analysis over a worklist of blocks. Branches whose flags
+ * are known only propagate along the way they go, so code behind them that
+ * nothing else reaches is never marked reached. A call reaches both its
+ * target, with the state before the call, and the following instruction,
+ * where the return has restored everything but x0.
+ *
+ * @param prog The program to analyze.
+ * @param cfg The blocks of the program, whose states are filled in.
+ * @return True if the analysis ran, false if memory ran out.
+ */
+static bool propagate(const Program *prog, Cfg *cfg) {
+    size_t *worklist = malloc(cfg->count * sizeof(size_t));
+    bool   *queued   = calloc(cfg->count, sizeof(bool));
+    if (!worklist || !queued) {
+        free(worklist);
+        free(queued);
+        return false;
+    }
+
+    // Every variable and flag starts out zeroed.
+    ConstState *states = cfg->states;
+    states[0].reached  = true;
+    states[0].known    = UINT32_MAX;
+    states[0].flags    = FLAGS_KNOWN;
+
+    size_t pending      = 0;
+    worklist[pending++] = 0;
+    queued[0]           = true;
+    while (pending > 0) {
+        size_t b  = worklist[--pending];
+        queued[b] = false;
+        if (cfg->starts[b] == prog->length) {
+            continue;
+        }
+
+        // Run the block up to its last instruction, which decides where to go.
+        ConstState in = states[b];
+        ConstState out;
+        size_t     last = cfg->starts[b + 1] - 1;
+        for (size_t i = cfg->starts[b]; i < last; i++) {
+            transfer(prog, i, &in, &out);
+            in = out;
+        }
+        transfer(prog, last, &in, &out);
+
+        const Instr *ins = &prog->code[last];
+        size_t       succ[MAX_SUCCESSORS];
+        size_t       count = instr_successors(prog, last, succ);
+        if (ins->op >= OP_B_EQ && ins->op <= OP_B_LE && (in.flags & FLAGS_KNOWN)) {
+            succ[0] = branch_taken(ins->op, in.flags) ? ins->arg : last + 1;
+            count   = 1;
+        } else if (ins->op == OP_CALL) {
+            succ[1] = ins->arg;
+            count   = 2;
+        }
+
+        for (size_t s = 0; s < count; s++) {
+            // The callee starts from the state before the call.
+            const ConstState *from = ins->op == OP_CALL && s == 1 ? &in : &out;
+            size_t            next = cfg->block_of[succ[s]];
+            if (merge(&states[next], from) && !queued[next]) {
+                worklist[pending++] = next;
+                queued[next]        = true;
+            }
+        }
+    }
+
+    free(worklist);
+    free(queued);
+    return true;
+}
+
+/**
+ * @brief Applies the effect of one instruction to a state.
+ *
+ * @param prog The program holding the instruction.
+ * @param i The index of the instruction.
+ * @param in The state on entry to the instruction.
+ * @param out Filled in with the state after it.
+ */
+static void transfer(const Program *prog, size_t i, const ConstState *in, ConstState *out) {
+    const Instr *ins = &prog->code[i];
+    int64_t      imm = program_imm(prog, ins);
+    int64_t      result;
+    *out = *in;
+
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+            define(out, ins->dst);
+            out->known |= 1u << ins->dst;
+            out->values[ins->dst] = imm;
+            break;
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI: {
+            bool    has_b   = ins->op <= OP_EOR_RRR && ins->op != OP_ADD_RRI &&
+                              ins->op != OP_SUB_RRI;
+            bool    a_known = in->known & (1u << ins->a);
+            bool    b_known = !has_b || (in->known & (1u << ins->b));
+            int64_t b       = has_b ? in->values[ins->b] : imm;
+            uint8_t source  = root(in, ins->a);
+            if (is_identity(ins->op, ins, imm) && ins->dst == source) {
+                break;  // Leaves the destination as it was.
+            }
+
+            define(out, ins->dst);
+            if (a_known && b_known && fold(ins->op, in->values[ins->a], b, &result)) {
+                out->known |= 1u << ins->dst;
+                out->values[ins->dst] = result;
+            } else if (has_b && ins->a == ins->b &&
+                       (ins->op == OP_SUB_RRR || ins->op == OP_EOR_RRR)) {
+                out->known |= 1u << ins->dst;
+                out->values[ins->dst] = 0;
+            } else if (is_identity(ins->op, ins, imm) && source != ins->dst) {
+                out->copied |= 1u << ins->dst;
+                out->copies[ins->dst] = source;
+            }
+            break;
+        }
+        case OP_CMP_RR:
+        case OP_CMP_RI:
+        case OP_CMP_U_RR:
+        case OP_CMP_U_RI: {
+            bool    has_b   = ins->op == OP_CMP_RR || ins->op == OP_CMP_U_RR;
+            bool    known   = (in->known & (1u << ins->a)) &&
+                              (!has_b || (in->known & (1u << ins->b)));
+            int64_t a       = in->values[ins->a];
+            int64_t b       = has_b ? in->values[ins->b] : imm;
+            bool    is_u    = ins->op == OP_CMP_U_RR || ins->op == OP_CMP_U_RI;
+            bool    greater = is_u ? (uint64_t) a > (uint64_t) b : a > b;
+            bool    less    = is_u ? (uint64_t) a < (uint64_t) b : a < b;
+            out->flags      = 0;
+            if (known) {
+                out->flags = FLAGS_KNOWN | (greater ? FLAG_GREATER : 0) | (less ? FLAG_LESS : 0) |
+                             (a == b ? FLAG_EQUAL : 0);
+            }
+            break;
+        }
+        case OP_LOAD_RR:
+        case OP_LOAD_RI:
+            define(out, ins->dst);
+            break;
+        case OP_CALL:
+            // The return restores every variable but x0.
+            define(out, 0);
+            out->flags = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Merges a state into the one at a join point.
+ *
+ * @param dst The state at the join point, updated in place.
+ * @param src The state flowing into it.
+ * @return True if `dst` changed.
+ */
+static bool merge(ConstState *dst, const ConstState *src) {
+    if (!src->reached) {
+        return false;
+    }
+    if (!dst->reached) {
+        *dst = *src;
+        return true;
+    }
+
+    bool     changed = false;
+    uint32_t known   = dst->known & src->known;
+    for (uint32_t mask = known; mask; mask &= mask - 1) {
+        int v = __builtin_ctz(mask);
+        if (dst->values[v] != src->values[v]) {
+            known &= ~(1u << v);
+        }
+    }
+    uint32_t copied = dst->copied & src->copied;
+    for (uint32_t mask = copied; mask; mask &= mask - 1) {
+        int v = __builtin_ctz(mask);
+        if (dst->copies[v] != src->copies[v]) {
+            copied &= ~(1u << v);
+        }
+    }
+    if (known != dst->known || copied != dst->copied) {
+        dst->known  = known;
+        dst->copied = copied;
+        changed     = true;
+    }
+    if (dst->flags != src->flags && dst->flags != 0) {
+        dst->flags = 0;
+        changed    = true;
+    }
+    return changed;
+}
+
+/**
+ * @brief Forgets everything known about a variable that is about to be written.
+ *
+ * @param state The state to update.
+ * @param var The variable being written.
+ */
+static void define(ConstState *state, uint8_t var) {
+    state->known &= ~(1u << var);
+    state->copied &= ~(1u << var);
+    for (uint32_t mask = state->copied; mask; mask &= mask - 1) {
+        int v = __builtin_ctz(mask);
+        if (state->copies[v] == var) {
+            state->copied &= ~(1u << v);
+        }
+    }
+}
+
+/**
+ * @brief Evaluates an arithmetic instruction on constants, as the interpreter
+ * would.
+ *
+ * @param op The opcode.
+ * @param a The first operand.
+ * @param b The second operand or immediate.
+ * @param result Set to the result.
+ * @return True if `op` could be folded.
+ */
+static bool fold(uint8_t op, int64_t a, int64_t b, int64_t *result) {
+    uint64_t ua = (uint64_t) a;
+    uint64_t ub = (uint64_t) b;
+    switch ((Opcode) op) {
+        case OP_ADD_RRR:
+        case OP_ADD_RRI:
+            *result = (int64_t) (ua + ub);
+            return true;
+        case OP_SUB_RRR:
+        case OP_SUB_RRI:
+            *result = (int64_t) (ua - ub);
+            return true;
+        case OP_AND_RRR:
+            *result = a & b;
+            return true;
+        case OP_ORR_RRR:
+            *result = a | b;
+            return true;
+        case OP_EOR_RRR:
+            *result = a ^ b;
+            return true;
+        case OP_LSL_RRI:
+            // Shift counts are taken modulo 64, as the host does.
+            *result = (int64_t) (ua << (ub & 63));
+            return true;
+        case OP_LSR_RRI:
+            *result = (int64_t) (ua >> (ub & 63));
+            return true;
+        case OP_ASR_RRI:
+            *result = a >> (ub & 63);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Determines if an instruction just copies its first operand.
+ *
+ * @param op The opcode.
+ * @param ins The instruction.
+ * @param imm The immediate of the instruction, if it has one.
+ * @return True if the result always equals `ins->a`.
+ */
+static bool is_identity(uint8_t op, const Instr *ins, int64_t imm) {
+    switch ((Opcode) op) {
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+            return imm == 0;
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+            return (imm & 63) == 0;
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+            return ins->a == ins->b;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Determines if an opcode computes a variable from other ones.
+ *
+ * @param op The opcode to check.
+ * @return True for adds, subs, ands, orrs, eors and shifts.
+ */
+static bool is_arithmetic(uint8_t op) {
+    return op >= OP_ADD_RRR && op <= OP_ASR_RRI && !(op >= OP_CMP_RR && op <= OP_CMP_U_RI);
+}
+
+
+/**
+ * @brief Evaluates a conditional branch against known flags.
+ *
+ * @param op The opcode of the branch.
+ * @param flags The known flags.
+ * @return True if the branch is taken.
+ */
+static bool branch_taken(uint8_t op, uint8_t flags) {
+    bool greater = flags & FLAG_GREATER;
+    bool less    = flags & FLAG_LESS;
+    bool equal   = flags & FLAG_EQUAL;
+    switch ((Opcode) op) {
+        case OP_B_EQ:
+            return equal;
+        case OP_B_NE:
+            return !equal;
+        case OP_B_GT:
+            return greater;
+        case OP_B_LT:
+            return less;
+        case OP_B_GE:
+            return greater || equal;
+        default:
+            return less || equal;
+    }
+}
+
+/**
+ * @brief Returns the variable holding the same value as another one.
+ *
+ * @param state The state at the point of use.
+ * @param var The variable.
+ * @return The variable `var` is a copy of, or `var` itself.
+ */
+static uint8_t root(const ConstState *state, uint8_t var) {
+    return (state->copied & (1u << var)) ? state->copies[var] : var;
+}
+
+/**
+ * @brief Rewrites every instruction with what is known on entry to it.
+ *
+ * @param prog The program to rewrite.
+ * @param cfg The blocks of the program, with the state on entry to each.
+ * @param removed Marks the instructions to drop.
+ * @param changed Set if anything was rewritten or dropped.
+ * @return True if the rewrite ran, false if memory ran out.
+ */
+static bool rewrite(Program *prog, const Cfg *cfg, bool *removed, bool *changed) {
+    // Each instruction adds at most two constants, so reserving room for them
+    // up front means no `program_add_const()` below can fail.
+    size_t   capacity = prog->const_count + 2 * prog->length + 1;
+    int64_t *consts   = realloc(prog->consts, capacity * sizeof(int64_t));
+    if (!consts) {
+        return false;
+    }
+    prog->consts         = consts;
+    prog->const_capacity = capacity;
+
+    for (size_t b = 0; b + 1 < cfg->count; b++) {
+        ConstState in = cfg->states[b];
+        for (size_t i = cfg->starts[b]; i < cfg->starts[b + 1]; i++) {
+            if (!in.reached) {
+                removed[i] = true;
+                *changed   = true;
+                continue;
+            }
+
+            // Step past the instruction before rewriting it.
+            ConstState out;
+            transfer(prog, i, &in, &out);
+            *changed |= rewrite_instr(prog, &in, &out, &prog->code[i], &removed[i]);
+            in = out;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Rewrites a single instruction.
+ *
+ * @param prog The program holding the instruction.
+ * @param in The state on entry to the instruction.
+ * @param out The state after it.
+ * @param ins The instruction to rewrite.
+ * @param removed Set if the instruction should be dropped.
+ * @return True if anything changed.
+ */
+static bool rewrite_instr(Program *prog, const ConstState *in, const ConstState *out, Instr *ins,
+                          bool *removed) {
+    Instr before = *ins;
+    if (is_arithmetic(ins->op) && is_identity(ins->op, ins, program_imm(prog, ins)) &&
+        ins->dst == root(in, ins->a)) {
+        *removed = true;
+    } else if (is_arithmetic(ins->op) && (out->known & (1u << ins->dst))) {
+        ins->op  = OP_MOV_RI;
+        ins->a   = 0;
+        ins->b   = 0;
+        ins->arg = program_add_const(prog, out->values[ins->dst]);
+    } else if (ins->op >= OP_B_EQ && ins->op <= OP_B_LE && (in->flags & FLAGS_KNOWN)) {
+        if (branch_taken(ins->op, in->flags)) {
+            ins->op = OP_B;
+        } else {
+            *removed = true;
+        }
+    } else {
+        rewrite_operands(prog, in, ins);
+        // A constant 0 can turn an add into a copy onto itself.
+        *removed = is_arithmetic(ins->op) && ins->dst == ins->a &&
+                   is_identity(ins->op, ins, program_imm(prog, ins));
+    }
+    return *removed || memcmp(&before, ins, sizeof(Instr)) != 0;
+}
+
+/**
+ * @brief Replaces the operands of an instruction with copies or constants.
+ *
+ * @param prog The program holding the instruction.
+ * @param in The state on entry to the instruction.
+ * @param ins The instruction to rewrite.
+ */
+static void rewrite_operands(Program *prog, const ConstState *in, Instr *ins) {
+    switch ((Opcode) ins->op) {
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+            ins->a = root(in, ins->a);
+            ins->b = root(in, ins->b);
+            if (in->known & (1u << ins->b)) {
+                static const uint8_t imm_forms[] = {[OP_ADD_RRR] = OP_ADD_RRI,
+                                                    [OP_SUB_RRR] = OP_SUB_RRI,
+                                                    [OP_CMP_RR]  = OP_CMP_RI,
+                                                    [OP_CMP_U_RR] = OP_CMP_U_RI};
+                ins->arg = program_add_const(prog, in->values[ins->b]);
+                ins->op  = imm_forms[ins->op];
+                ins->b   = 0;
+            } else if (ins->op == OP_ADD_RRR && (in->known & (1u << ins->a))) {
+                ins->arg = program_add_const(prog, in->values[ins->a]);
+                ins->op  = OP_ADD_RRI;
+                ins->a   = ins->b;
+                ins->b   = 0;
+            }
+            break;
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+            ins->a = root(in, ins->a);
+            ins->b = root(in, ins->b);
+            break;
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+            ins->a = root(in, ins->a);
+            break;
+        case OP_LOAD_RR:
+            if (in->known & (1u << ins->b)) {
+                ins->arg = program_add_const(prog, in->values[ins->b]);
+                ins->op  = OP_LOAD_RI;
+                ins->b   = 0;
+            } else {
+                ins->b = root(in, ins->b);
+            }
+            break;
+        case OP_STORE_RR:
+            ins->dst = root(in, ins->dst);
+            if (in->known & (1u << ins->a)) {
+                ins->arg = program_add_const(prog, in->values[ins->a]);
+                ins->op  = OP_STORE_RI;
+                ins->a   = 0;
+            } else {
+                ins->a = root(in, ins->a);
+            }
+            break;
+        case OP_STORE_RI:
+            ins->dst = root(in, ins->dst);
+            break;
+        case OP_PRINT_R:
+            if (in->known & (1u << ins->a)) {
+                ins->arg = program_add_const(prog, in->values[ins->a]);
+                ins->op  = OP_PRINT_I;
+                ins->a   = 0;
+            } else {
+                ins->a = root(in, ins->a);
+            }
+            break;
+        case OP_PUT_R:
+            if (in->known & (1u << ins->a)) {
+                // PUT_I reads the string index and the address from adjacent slots.
+                uint32_t string = program_add_const(prog, prog->consts[ins->arg]);
+                program_add_const(prog, in->values[ins->a]);
+                ins->arg = string;
+                ins->op  = OP_PUT_I;
+                ins->a   = 0;
+            } else {
+                ins->a = root(in, ins->a);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Marks arithmetic whose result is never observed, and jumps to the
+ * next instruction.
+ *
+ * @param prog The program to inspect.
+ * @param removed Marks the instructions to drop.
+ * @param changed Set if anything was marked.
+ * @return True if the pass ran, false if memory ran out.
+ */
+static bool remove_dead(Program *prog, bool *removed, bool *changed) {
+    RegMask *live_in = calloc(prog->length + 1, sizeof(RegMask));
+    if (!live_in) {
+        return false;
+    }
+    compute_liveness(prog, live_in);
+
+    for (size_t i = 0; i < prog->length; i++) {
+        const Instr *ins = &prog->code[i];
+        if (ins->op == OP_B && ins->arg == i + 1) {
+            removed[i] = true;
+            *changed   = true;
+            continue;
+        }
+        if (ins->op > OP_ASR_RRI) {
+            continue;  // Everything past the shifts has effects beyond its result.
+        }
+
+        size_t  succ[MAX_SUCCESSORS];
+        size_t  count    = instr_successors(prog, i, succ);
+        RegMask live_out = 0;
+        for (size_t s = 0; s < count; s++) {
+            live_out |= live_in[succ[s]];
+        }
+        if (!(instr_defs(prog, i) & live_out)) {
+            removed[i] = true;
+            *changed   = true;
+        }
+    }
+
+    free(live_in);
+    return true;
+}
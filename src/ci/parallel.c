@@ -0,0 +1,528 @@
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "umalloc.h"
+
+static bool          find_pairs(Parallel *parallel);
+static bool          is_straight(uint8_t op);
+static void          advance(const Parallel *parallel, size_t from, size_t to, ParallelTask *task);
+static int           worker_main(void *arg);
+static void          run_task(Parallel *parallel, size_t worker, size_t nesting,
+                              ParallelTask *task);
+static void          wait_for(ParallelContext *ctx, ParallelTask *task);
+static void          drain(ParallelContext *ctx);
+static bool          push_task(Parallel *parallel, size_t worker, ParallelTask *task);
+static bool          reclaim_task(Parallel *parallel, size_t worker, ParallelTask *task);
+static ParallelTask *take_task(Parallel *parallel, size_t worker);
+
+bool parallel_init(Parallel *parallel, Program *prog, size_t thread_count, size_t max_depth) {
+    if (!parallel) {
+        return false;
+    }
+    memset(parallel, 0, sizeof(Parallel));
+    if (!prog || !prog->code || thread_count < 2 || thread_count > PARALLEL_MAX_THREADS) {
+        return false;
+    }
+
+    parallel->prog         = prog;
+    parallel->max_depth    = max_depth;
+    parallel->main         = (ParallelContext) {parallel, 0, 0, 0, false, NULL, 0, 0};
+    atomic_init(&parallel->queued, 0);
+    atomic_init(&parallel->sleeping, 0);
+    atomic_init(&parallel->stop, false);
+    atomic_init(&parallel->forks, 0);
+    atomic_init(&parallel->steals, 0);
+    if (!find_pairs(parallel)) {
+        parallel_free(parallel);
+        return false;
+    }
+
+    // A task is allocated at every fork and freed at its join, so tasks come
+    // from a cache rather than from malloc.
+    parallel->deques  = calloc(thread_count, sizeof(ParallelDeque));
+    parallel->threads = calloc(thread_count - 1, sizeof(thrd_t));
+    parallel->tasks   = ucache_create(sizeof(ParallelTask), _Alignof(ParallelTask));
+    if (!parallel->deques || !parallel->threads || !parallel->tasks ||
+        mtx_init(&parallel->lock, mtx_plain)) {
+        parallel_free(parallel);
+        return false;
+    }
+    if (cnd_init(&parallel->wake)) {
+        mtx_destroy(&parallel->lock);
+        parallel_free(parallel);
+        return false;
+    }
+    for (size_t k = 0; k < thread_count; k++) {
+        parallel->deques[k].parallel = parallel;
+        if (mtx_init(&parallel->deques[k].lock, mtx_plain)) {
+            while (k-- > 0) {
+                mtx_destroy(&parallel->deques[k].lock);
+            }
+            mtx_destroy(&parallel->lock);
+            cnd_destroy(&parallel->wake);
+            parallel_free(parallel);
+            return false;
+        }
+    }
+
+    // From here on parallel_free() stops and joins the threads that started.
+    parallel->thread_count = 1;
+    for (size_t k = 1; k < thread_count; k++) {
+        if (thrd_create(&parallel->threads[k - 1], worker_main, &parallel->deques[k])) {
+            break;
+        }
+        parallel->thread_count++;
+    }
+    for (size_t k = parallel->thread_count; k < thread_count; k++) {
+        mtx_destroy(&parallel->deques[k].lock);
+    }
+    return true;
+}
+
+ParallelAction parallel_call(ParallelContext *ctx, Interpreter *intr, size_t site) {
+    Parallel *parallel = ctx->parallel;
+
+    // A task must neither report an overflow nor outlive the run. Either way
+    // its caller makes the call again, or no longer needs it.
+    if (ctx->in_task && (intr->frame_count >= intr->max_depth ||
+                         atomic_load_explicit(&parallel->stop, memory_order_relaxed))) {
+        return PARALLEL_ABORT;
+    }
+
+    if (ctx->join_count > 0) {
+        ParallelJoin *join = &ctx->joins[ctx->join_count - 1];
+        if (join->depth == intr->frame_count && join->site == site) {
+            ParallelTask *task = join->task;
+            ctx->join_count--;
+            if (reclaim_task(parallel, ctx->worker, task)) {
+                ucache_free(parallel->tasks, task);
+                return PARALLEL_CALL;
+            }
+
+            wait_for(ctx, task);
+            bool ok = task->ok;
+            if (ok) {
+                intr->variables[0] = task->variables[0];
+                intr->is_greater   = task->is_greater;
+                intr->is_less      = task->is_less;
+                intr->is_equal     = task->is_equal;
+            }
+            ucache_free(parallel->tasks, task);
+            return ok ? PARALLEL_SKIP : PARALLEL_CALL;
+        }
+    }
+
+    size_t   depth   = ctx->base_depth + intr->frame_count;
+    uint32_t partner = parallel->partner[site];
+    if (partner == UINT32_MAX || depth >= PARALLEL_FORK_DEPTH || depth >= parallel->max_depth) {
+        return PARALLEL_CALL;
+    }
+    if (ctx->join_count == ctx->join_capacity) {
+        size_t        capacity = ctx->join_capacity ? ctx->join_capacity * 2 : 8;
+        ParallelJoin *joins    = realloc(ctx->joins, capacity * sizeof(ParallelJoin));
+        if (!joins) {
+            return PARALLEL_CALL;
+        }
+        ctx->joins         = joins;
+        ctx->join_capacity = capacity;
+    }
+    // The thread running the program may be the main thread, which must not
+    // be in malloc while another grows the umalloc heap (see main()). So only
+    // it takes new slabs for tasks; workers that find none free do not fork.
+    ParallelTask *task = ctx == &parallel->main ? ucache_alloc(parallel->tasks)
+                                                : ucache_try_alloc(parallel->tasks);
+    if (!task) {
+        return PARALLEL_CALL;
+    }
+
+    atomic_init(&task->done, false);
+    task->ok         = false;
+    task->routine    = parallel->code[partner].arg;
+    task->depth      = depth;
+    task->is_greater = intr->is_greater;
+    task->is_less    = intr->is_less;
+    task->is_equal   = intr->is_equal;
+    memcpy(task->variables, intr->variables, sizeof(task->variables));
+    advance(parallel, site + 1, partner, task);
+    if (!push_task(parallel, ctx->worker, task)) {
+        ucache_free(parallel->tasks, task);
+        return PARALLEL_CALL;
+    }
+    ctx->joins[ctx->join_count++] = (ParallelJoin) {intr->frame_count, partner, task};
+    atomic_fetch_add_explicit(&parallel->forks, 1, memory_order_relaxed);
+    return PARALLEL_CALL;
+}
+
+void parallel_print_stats(const Parallel *parallel, FILE *out) {
+    if (!parallel) {
+        return;
+    }
+    size_t hits, refills;
+    ucache_stats(parallel->tasks, &hits, &refills);
+    fprintf(out, "Parallel: %zu forks, %zu steals on %zu threads\n",
+            atomic_load(&parallel->forks), atomic_load(&parallel->steals),
+            parallel->thread_count);
+    fprintf(out, "Parallel: task cache %zu hits, %zu refills\n", hits, refills);
+}
+
+void parallel_free(Parallel *parallel) {
+    if (!parallel) {
+        return;
+    }
+
+    if (parallel->thread_count > 0) {
+        atomic_store(&parallel->stop, true);
+        drain(&parallel->main);
+        mtx_lock(&parallel->lock);
+        cnd_broadcast(&parallel->wake);
+        mtx_unlock(&parallel->lock);
+        for (size_t k = 1; k < parallel->thread_count; k++) {
+            thrd_join(parallel->threads[k - 1], NULL);
+        }
+        for (size_t k = 0; k < parallel->thread_count; k++) {
+            mtx_destroy(&parallel->deques[k].lock);
+        }
+        mtx_destroy(&parallel->lock);
+        cnd_destroy(&parallel->wake);
+    }
+
+    free(parallel->main.joins);
+    free(parallel->threads);
+    free(parallel->deques);
+    ucache_destroy(parallel->tasks);
+    free(parallel->partner);
+    free(parallel->code);
+    memset(parallel, 0, sizeof(Parallel));
+}
+
+/**
+ * @brief Finds the second call of the pair each call starts, if any.
+ *
+ * Walks the instructions after each call, tracking which variables carry x0
+ * or the flags the call returns. The walk ends at the next call, which pairs
+ * up if it goes to a pure routine none of whose inputs are carried.
+ *
+ * @param parallel The pool to fill in `partner` and `code` for.
+ * @return True if any pair was found, false if none or memory ran out.
+ */
+static bool find_pairs(Parallel *parallel) {
+    const Program *prog   = parallel->prog;
+    RegMask       *inputs = malloc((prog->length + 1) * sizeof(RegMask));
+    parallel->partner     = malloc((prog->length + 1) * sizeof(uint32_t));
+    parallel->code        = malloc((prog->length + 1) * sizeof(Instr));
+    if (!inputs || !parallel->partner || !parallel->code ||
+        !compute_pure_inputs(prog, inputs)) {
+        free(inputs);
+        return false;
+    }
+    memcpy(parallel->code, prog->code, (prog->length + 1) * sizeof(Instr));
+
+    bool any = false;
+    for (size_t i = 0; i <= prog->length; i++) {
+        parallel->partner[i] = UINT32_MAX;
+        if (prog->code[i].op != OP_CALL) {
+            continue;
+        }
+
+        RegMask carried = REG_BIT(0) | MASK_FLAGS;
+        for (size_t j = i + 1; j < prog->length && j - i <= PARALLEL_MAX_GAP + 1; j++) {
+            const Instr *ins = &prog->code[j];
+            if (ins->op == OP_CALL) {
+                if (inputs[ins->arg] != MASK_IMPURE && !(inputs[ins->arg] & carried)) {
+                    parallel->partner[i] = (uint32_t) j;
+                    any                  = true;
+                }
+                break;
+            }
+            if (!is_straight(ins->op)) {
+                break;
+            }
+            RegMask defs = instr_defs(prog, j);
+            carried      = (instr_uses(prog, j) & carried) ? carried | defs : carried & ~defs;
+        }
+    }
+    free(inputs);
+    return any;
+}
+
+/**
+ * @brief Determines if an opcode only computes on variables and flags.
+ *
+ * @param op The opcode to check.
+ * @return True for moves, arithmetic and compares.
+ */
+static bool is_straight(uint8_t op) {
+    // The moves, arithmetic and compares come first in `OPCODE_LIST`.
+    return op <= OP_ASR_RRI;
+}
+
+/**
+ * @brief Runs the instructions between the calls of a pair on a task.
+ *
+ * x0 and the flags do not hold the first call's result yet, but nothing the
+ * second call reads depends on them.
+ *
+ * @param parallel The pool holding the unfused instructions.
+ * @param from The first instruction to run.
+ * @param to The index of the second call.
+ * @param task The task whose variables and flags to update.
+ */
+static void advance(const Parallel *parallel, size_t from, size_t to, ParallelTask *task) {
+    const int64_t *consts = parallel->prog->consts;
+    int64_t       *v      = task->variables;
+    for (size_t k = from; k < to; k++) {
+        const Instr *ins = &parallel->code[k];
+        int64_t      imm = ins->arg < parallel->prog->const_count ? consts[ins->arg] : 0;
+        switch ((Opcode) ins->op) {
+            case OP_MOV_RI:
+                v[ins->dst] = imm;
+                break;
+            case OP_ADD_RRR:
+                v[ins->dst] = v[ins->a] + v[ins->b];
+                break;
+            case OP_ADD_RRI:
+                v[ins->dst] = v[ins->a] + imm;
+                break;
+            case OP_SUB_RRR:
+                v[ins->dst] = v[ins->a] - v[ins->b];
+                break;
+            case OP_SUB_RRI:
+                v[ins->dst] = v[ins->a] - imm;
+                break;
+            case OP_CMP_RR:
+            case OP_CMP_RI: {
+                int64_t rhs      = ins->op == OP_CMP_RR ? v[ins->b] : imm;
+                task->is_greater = v[ins->a] > rhs;
+                task->is_less    = v[ins->a] < rhs;
+                task->is_equal   = v[ins->a] == rhs;
+                break;
+            }
+            case OP_CMP_U_RR:
+            case OP_CMP_U_RI: {
+                uint64_t lhs     = (uint64_t) v[ins->a];
+                uint64_t rhs     = (uint64_t) (ins->op == OP_CMP_U_RR ? v[ins->b] : imm);
+                task->is_greater = lhs > rhs;
+                task->is_less    = lhs < rhs;
+                task->is_equal   = lhs == rhs;
+                break;
+            }
+            case OP_AND_RRR:
+                v[ins->dst] = v[ins->a] & v[ins->b];
+                break;
+            case OP_ORR_RRR:
+                v[ins->dst] = v[ins->a] | v[ins->b];
+                break;
+            case OP_EOR_RRR:
+                v[ins->dst] = v[ins->a] ^ v[ins->b];
+                break;
+            case OP_LSL_RRI:
+                v[ins->dst] = (uint64_t) v[ins->a] << (uint64_t) imm;
+                break;
+            case OP_LSR_RRI:
+                v[ins->dst] = (uint64_t) v[ins->a] >> (uint64_t) imm;
+                break;
+            case OP_ASR_RRI:
+                v[ins->dst] = v[ins->a] >> imm;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Runs queued tasks until the pool stops.
+ *
+ * @param arg The `ParallelDeque` of the thread.
+ * @return Always 0.
+ */
+static int worker_main(void *arg) {
+    ParallelDeque *deque    = arg;
+    Parallel      *parallel = deque->parallel;
+    size_t         worker   = (size_t) (deque - parallel->deques);
+
+    while (!atomic_load(&parallel->stop)) {
+        ParallelTask *task = take_task(parallel, worker);
+        if (task) {
+            run_task(parallel, worker, 0, task);
+            continue;
+        }
+
+        // push_task() bumps `queued` before it looks for sleepers, and a
+        // sleeper counts itself before it looks at `queued`, so no wakeup is lost.
+        mtx_lock(&parallel->lock);
+        atomic_fetch_add(&parallel->sleeping, 1);
+        while (!atomic_load(&parallel->stop) && atomic_load(&parallel->queued) == 0) {
+            cnd_wait(&parallel->wake, &parallel->lock);
+        }
+        atomic_fetch_sub(&parallel->sleeping, 1);
+        mtx_unlock(&parallel->lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Makes the call a task stands for on a fresh interpreter.
+ *
+ * @param parallel The pool the task came from.
+ * @param worker The thread running the task.
+ * @param nesting Tasks the thread is already inside of.
+ * @param task The task to run; belongs to its joiner once `done` is set.
+ */
+static void run_task(Parallel *parallel, size_t worker, size_t nesting, ParallelTask *task) {
+    // Pure routines never touch memory, so the task gets none.
+    Interpreter intr;
+    interpreter_init(&intr, parallel->max_depth - task->depth, 0);
+    memcpy(intr.variables, task->variables, sizeof(intr.variables));
+    intr.is_greater = task->is_greater;
+    intr.is_less    = task->is_less;
+    intr.is_equal   = task->is_equal;
+
+    ParallelContext ctx = {parallel, worker, task->depth, nesting, true, NULL, 0, 0};
+    intr.parallel       = &ctx;
+
+    // The frame of the call itself. Its ret resumes at the closing halt.
+    const Instr *halt   = &parallel->prog->code[parallel->prog->length];
+    bool         pushed = interpreter_push_frame(&intr, halt - 1, 0);
+    if (pushed) {
+        interpret_from(&intr, parallel->prog, task->routine);
+    }
+    drain(&ctx);
+    free(ctx.joins);
+
+    task->ok = pushed && !intr.had_error;
+    if (task->ok) {
+        task->variables[0] = intr.variables[0];
+        task->is_greater   = intr.is_greater;
+        task->is_less      = intr.is_less;
+        task->is_equal     = intr.is_equal;
+    }
+    interpreter_free(&intr);
+    atomic_store_explicit(&task->done, true, memory_order_release);
+}
+
+/**
+ * @brief Waits for a task another thread took, running other tasks meanwhile.
+ *
+ * @param ctx The context of the interpreter waiting.
+ * @param task The task to wait for.
+ */
+static void wait_for(ParallelContext *ctx, ParallelTask *task) {
+    Parallel *parallel = ctx->parallel;
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        ParallelTask *other = NULL;
+        if (ctx->nesting < PARALLEL_MAX_NESTING && !atomic_load(&parallel->stop)) {
+            other = take_task(parallel, ctx->worker);
+        }
+        if (other) {
+            run_task(parallel, ctx->worker, ctx->nesting + 1, other);
+        } else {
+            thrd_yield();
+        }
+    }
+}
+
+/**
+ * @brief Collects and discards every task an interpreter forked but did not
+ * join, once it stopped early.
+ *
+ * @param ctx The context of the interpreter that stopped.
+ */
+static void drain(ParallelContext *ctx) {
+    while (ctx->join_count > 0) {
+        ParallelTask *task = ctx->joins[--ctx->join_count].task;
+        if (!reclaim_task(ctx->parallel, ctx->worker, task)) {
+            wait_for(ctx, task);
+        }
+        ucache_free(ctx->parallel->tasks, task);
+    }
+}
+
+/**
+ * @brief Queues a task at the bottom of a thread's deque.
+ *
+ * @param parallel The pool.
+ * @param worker The thread queueing the task.
+ * @param task The task.
+ * @return True if the task was queued, false if the deque is full.
+ */
+static bool push_task(Parallel *parallel, size_t worker, ParallelTask *task) {
+    ParallelDeque *deque = &parallel->deques[worker];
+    mtx_lock(&deque->lock);
+    bool room = deque->count < PARALLEL_DEQUE_SIZE;
+    if (room) {
+        deque->tasks[(deque->top + deque->count++) % PARALLEL_DEQUE_SIZE] = task;
+    }
+    mtx_unlock(&deque->lock);
+    if (!room) {
+        return false;
+    }
+
+    atomic_fetch_add(&parallel->queued, 1);
+    if (atomic_load(&parallel->sleeping) > 0) {
+        mtx_lock(&parallel->lock);
+        cnd_signal(&parallel->wake);
+        mtx_unlock(&parallel->lock);
+    }
+    return true;
+}
+
+/**
+ * @brief Takes a task back off the bottom of a thread's deque if no other
+ * thread took it.
+ *
+ * @param parallel The pool.
+ * @param worker The thread that queued the task.
+ * @param task The task.
+ * @return True if the task was still queued and now belongs to the caller.
+ */
+static bool reclaim_task(Parallel *parallel, size_t worker, ParallelTask *task) {
+    ParallelDeque *deque = &parallel->deques[worker];
+    mtx_lock(&deque->lock);
+    size_t bottom = (deque->top + deque->count - 1) % PARALLEL_DEQUE_SIZE;
+    bool   mine   = deque->count > 0 && deque->tasks[bottom] == task;
+    if (mine) {
+        deque->count--;
+    }
+    mtx_unlock(&deque->lock);
+    if (mine) {
+        atomic_fetch_sub(&parallel->queued, 1);
+    }
+    return mine;
+}
+
+/**
+ * @brief Takes the newest task of a thread's own deque, or else steals the
+ * oldest task of another thread.
+ *
+ * @param parallel The pool.
+ * @param worker The thread looking for work.
+ * @return The task, or NULL if every deque is empty.
+ */
+static ParallelTask *take_task(Parallel *parallel, size_t worker) {
+    if (atomic_load(&parallel->queued) == 0) {
+        return NULL;
+    }
+    for (size_t k = 0; k < parallel->thread_count; k++) {
+        ParallelDeque *deque = &parallel->deques[(worker + k) % parallel->thread_count];
+        ParallelTask  *task  = NULL;
+        mtx_lock(&deque->lock);
+        if (deque->count > 0 && k == 0) {
+            task = deque->tasks[(deque->top + --deque->count) % PARALLEL_DEQUE_SIZE];
+        } else if (deque->count > 0) {
+            task       = deque->tasks[deque->top];
+            deque->top = (deque->top + 1) % PARALLEL_DEQUE_SIZE;
+            deque->count--;
+        }
+        mtx_unlock(&deque->lock);
+        if (task) {
+            atomic_fetch_sub(&parallel->queued, 1);
+            if (k > 0) {
+                atomic_fetch_add_explicit(&parallel->steals, 1, memory_order_relaxed);
+            }
+            return task;
+        }
+    }
+    return NULL;
+}
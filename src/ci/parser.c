@@ -5,7 +5,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <umalloc.h>
 
 #include "command_type.h"
 #include "token_type.h"
@@ -15,7 +14,7 @@ static bool     consume(Parser *parser, TokenType type);
 static bool     is_at_end(Parser *parser);
 static void     skip_nls(Parser *parser);
 static bool     consume_newline(Parser *parser);
-static Command *create_command(CommandType type);
+static Command *create_command(Arena *arena, CommandType type);
 static bool     is_variable(Token token);
 static bool     parse_variable(Token token, int64_t *var_num);
 static bool     parse_number(Token token, int64_t *result);
@@ -23,7 +22,7 @@ static bool     parse_variable_operand(Parser *parser, Operand *op);
 static bool     parse_var_or_imm(Parser *parser, Operand *op, bool *is_immediate);
 static Command *parse_cmd(Parser *parser);
 
-void parser_init(Parser *parser, Lexer *lexer, LabelMap *map) {
+void parser_init(Parser *parser, Lexer *lexer, LabelMap *map, Arena *arena) {
     if (!parser) {
         return;
     }
@@ -31,6 +30,7 @@ void parser_init(Parser *parser, Lexer *lexer, LabelMap *map) {
     parser->lexer     = lexer;
     parser->had_error = false;
     parser->label_map = map;
+    parser->arena     = arena;
     parser->current   = lexer_next_token(parser->lexer);
     parser->next      = lexer_next_token(parser->lexer);
 }
@@ -80,14 +80,12 @@ static bool consume(Parser *parser, TokenType type) {
 /**
  * @brief Creates a command of the given type.
  *
+ * @param arena The arena to allocate the command from.
  * @param type The type of the command to create.
- * @return A pointer to a command with the requested type.
- *
- * @note It is the responsibility of the caller to free the memory associated
- * with the returned command.
+ * @return A pointer to a command with the requested type, owned by the arena.
  */
-static Command *create_command(CommandType type) {
-    Command *cmd = (Command *) umalloc(sizeof(Command));
+static Command *create_command(Arena *arena, CommandType type) {
+    Command *cmd = arena_alloc(arena, sizeof(Command), _Alignof(Command));
     if (!cmd) {
         return NULL;
     }
@@ -100,6 +98,8 @@ static Command *create_command(CommandType type) {
     cmd->is_b_immediate   = false;
     cmd->is_b_string      = false;
     cmd->branch_condition = BRANCH_NONE;
+    cmd->is_linked        = false;
+    cmd->target           = NULL;
     return cmd;
 }
 
@@ -286,8 +286,9 @@ static bool consume_newline(Parser *parser) {
 }
 
 static void error_occured(Parser *parser, Command *cmd) {
+    // The command stays in the arena until the whole parse is freed.
+    (void) cmd;
     parser->had_error = true;
-    free_command(cmd);
 }
 
 /**
@@ -298,11 +299,8 @@ static void error_occured(Parser *parser, Command *cmd) {
  * occurs.
  *
  * @param parser A pointer to the parser to read tokens from.
- * @return A pointer to the appropriate command.
+ * @return A pointer to the appropriate command, owned by the parser's arena.
  * Returns null if an error occurred or there are no commands to parse.
- *
- * @note The caller is responsible for freeing the memory associated with the
- * returned command.
  */
 static Command *parse_cmd(Parser *parser) {
     // TODO: Skip newlines before anything else
@@ -315,19 +313,15 @@ static Command *parse_cmd(Parser *parser) {
     if (token.type == TOK_IDENT) {
         // TODO Week 4: Handle labels
         // be careful of edge cases!
-        size_t labelLength = parser->current.length;
-        label              = umalloc(sizeof(char *) * (labelLength + 1));
+        // The label map keeps the copy, so it goes in the arena too.
+        label = arena_strndup(parser->arena, token.lexeme, token.length);
         if (label == NULL) {
             parser->had_error = true;
-            ufree(label);
             return NULL;
         }
-        strncpy(label, token.lexeme, labelLength);
-        label[labelLength] = '\0';
         advance(parser);
         if (parser->current.type != TOK_COLON) {
             parser->had_error = true;
-            ufree(label);
             return NULL;
         }
         advance(parser);
@@ -340,7 +334,6 @@ static Command *parse_cmd(Parser *parser) {
         if (label != NULL) {
             put_label(parser->label_map, label, NULL);
         }
-        ufree(label);
         // No commands to parse; we are done
         return NULL;
     }
@@ -348,7 +341,7 @@ static Command *parse_cmd(Parser *parser) {
     Command *cmd = NULL;
     switch (token.type) {
         case TOK_MOV:
-            cmd = create_command(CMD_MOV);
+            cmd = create_command(parser->arena, CMD_MOV);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -367,7 +360,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_ADD:
-            cmd = create_command(CMD_ADD);
+            cmd = create_command(parser->arena, CMD_ADD);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -390,7 +383,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_SUB:
-            cmd = create_command(CMD_SUB);
+            cmd = create_command(parser->arena, CMD_SUB);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -413,7 +406,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_CMP:
-            cmd = create_command(CMD_CMP);
+            cmd = create_command(parser->arena, CMD_CMP);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->val_a)) {
                 error_occured(parser, cmd);
@@ -431,7 +424,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_CMP_U:
-            cmd = create_command(CMD_CMP_U);
+            cmd = create_command(parser->arena, CMD_CMP_U);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->val_a)) {
                 error_occured(parser, cmd);
@@ -449,7 +442,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_PRINT:
-            cmd = create_command(CMD_PRINT);
+            cmd = create_command(parser->arena, CMD_PRINT);
             advance(parser);
             if (!parse_var_or_imm(parser, &cmd->val_a, &cmd->is_a_immediate)) {
                 error_occured(parser, cmd);
@@ -467,7 +460,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_AND:
-            cmd = create_command(CMD_AND);
+            cmd = create_command(parser->arena, CMD_AND);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -490,7 +483,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_ORR:
-            cmd = create_command(CMD_ORR);
+            cmd = create_command(parser->arena, CMD_ORR);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -513,7 +506,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_EOR:
-            cmd = create_command(CMD_EOR);
+            cmd = create_command(parser->arena, CMD_EOR);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -536,7 +529,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_LSL:
-            cmd = create_command(CMD_LSL);
+            cmd = create_command(parser->arena, CMD_LSL);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -559,7 +552,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_LSR:
-            cmd = create_command(CMD_LSR);
+            cmd = create_command(parser->arena, CMD_LSR);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -582,7 +575,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_ASR:
-            cmd = create_command(CMD_ASR);
+            cmd = create_command(parser->arena, CMD_ASR);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -605,7 +598,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_LOAD:
-            cmd = create_command(CMD_LOAD);
+            cmd = create_command(parser->arena, CMD_LOAD);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -628,7 +621,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_STORE:
-            cmd = create_command(CMD_STORE);
+            cmd = create_command(parser->arena, CMD_STORE);
             advance(parser);
             if (!parse_variable_operand(parser, &cmd->destination)) {
                 error_occured(parser, cmd);
@@ -651,15 +644,14 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_PUT:
-            cmd = create_command(CMD_PUT);
+            cmd = create_command(parser->arena, CMD_PUT);
             advance(parser);
-            cmd->destination.str_val = umalloc(parser->current.length + 1);
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!parse_var_or_imm(parser, &cmd->val_a, &cmd->is_a_immediate)) {
                 error_occured(parser, cmd);
@@ -672,17 +664,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_ALWAYS;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -690,17 +681,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_EQ:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_EQUAL;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -708,17 +698,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_GE:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_GREATER_EQUAL;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -726,17 +715,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_GT:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_GREATER;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -744,17 +732,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_LE:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_LESS_EQUAL;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -762,17 +749,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_LT:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_LESS;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -780,17 +766,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_BRANCH_NEQ:
-            cmd                   = create_command(CMD_BRANCH);
+            cmd                   = create_command(parser->arena, CMD_BRANCH);
             cmd->branch_condition = BRANCH_NOT_EQUAL;
             advance(parser);
-            cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
-            cmd->is_b_string         = true;
+            cmd->destination.str_val =
+                arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
+            cmd->is_b_string = true;
             if (cmd->destination.str_val == NULL) {
                 error_occured(parser, cmd);
                 return NULL;
             }
-            strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-            cmd->destination.str_val[parser->current.length] = '\0';
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -798,7 +783,7 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_RET:
-            cmd = create_command(CMD_RET);
+            cmd = create_command(parser->arena, CMD_RET);
             advance(parser);
             if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                 error_occured(parser, cmd);
@@ -806,17 +791,16 @@ static Command *parse_cmd(Parser *parser) {
             }
             break;
         case TOK_CALL:
-            cmd = create_command(CMD_CALL);
+            cmd = create_command(parser->arena, CMD_CALL);
             advance(parser);
             if (parser->current.type == TOK_IDENT) {
-                cmd->destination.str_val = umalloc(sizeof(char *) * ((parser->current.length) + 1));
+                cmd->destination.str_val =
+                    arena_strndup(parser->arena, parser->current.lexeme, parser->current.length);
                 cmd->is_b_string = true;
                 if (cmd->destination.str_val == NULL) {
                     error_occured(parser, cmd);
                     return NULL;
                 }
-                strncpy(cmd->destination.str_val, parser->current.lexeme, parser->current.length);
-                cmd->destination.str_val[parser->current.length] = '\0';
                 advance(parser);
                 if (!consume_newline(parser) && parser->current.type != TOK_EOF) {
                     error_occured(parser, cmd);
@@ -835,7 +819,6 @@ static Command *parse_cmd(Parser *parser) {
     if (label != NULL) {
         put_label(parser->label_map, label, cmd);
     }
-    ufree(label);
     // TODO: Check for errors and consume newlines
     return cmd;
 }
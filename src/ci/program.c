@@ -0,0 +1,396 @@
+#include "program.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "command_type.h"
+
+/**
+ * @brief Associates a command with its position in the flat program.
+ */
+typedef struct {
+    const Command *cmd;    // The command.
+    uint32_t       index;  // Its index in `Program.code`.
+} CommandIndex;
+
+static int      compare_command_index(const void *lhs, const void *rhs);
+static uint32_t index_of(CommandIndex *indices, size_t length, const Command *cmd);
+static int64_t  add_string(Program *prog, const char *str);
+static uint8_t  encode_size(int64_t size);
+static Opcode   branch_opcode(BranchCondition cond);
+static bool     encode_command(Program *prog, CommandIndex *indices, Command *cmd, Instr *ins);
+
+bool program_build(Program *prog, Command *commands) {
+    if (!prog) {
+        return false;
+    }
+    memset(prog, 0, sizeof(Program));
+
+    size_t length = 0;
+    for (Command *cmd = commands; cmd != NULL; cmd = cmd->next) {
+        length++;
+    }
+    if (length >= UINT32_MAX) {
+        return false;
+    }
+
+    // Every command references at most two constants and one string, so the
+    // pools never need to grow while encoding.
+    CommandIndex *indices = malloc((length + 1) * sizeof(CommandIndex));
+    prog->code            = malloc((length + 1) * sizeof(Instr));
+    prog->consts          = malloc((2 * length + 1) * sizeof(int64_t));
+    prog->strings         = malloc((length + 1) * sizeof(char *));
+    prog->const_capacity  = 2 * length + 1;
+    if (!indices || !prog->code || !prog->consts || !prog->strings) {
+        free(indices);
+        program_free(prog);
+        return false;
+    }
+
+    uint32_t i = 0;
+    for (Command *cmd = commands; cmd != NULL; cmd = cmd->next) {
+        indices[i].cmd   = cmd;
+        indices[i].index = i;
+        i++;
+    }
+    qsort(indices, length, sizeof(CommandIndex), compare_command_index);
+
+    prog->length = length;
+    i            = 0;
+    for (Command *cmd = commands; cmd != NULL; cmd = cmd->next) {
+        if (!encode_command(prog, indices, cmd, &prog->code[i++])) {
+            free(indices);
+            program_free(prog);
+            return false;
+        }
+    }
+
+    // Running off the end, or jumping to a label with no command, lands here.
+    memset(&prog->code[length], 0, sizeof(Instr));
+    prog->code[length].op = OP_HALT;
+
+    free(indices);
+    return true;
+}
+
+bool program_insert(Program *prog, size_t at, const Instr *code, size_t count,
+                    const bool *inside) {
+    if (!prog || !prog->code || at > prog->length || prog->length + count >= UINT32_MAX) {
+        return false;
+    }
+    Instr *grown = realloc(prog->code, (prog->length + count + 1) * sizeof(Instr));
+    if (!grown) {
+        return false;
+    }
+    prog->code = grown;
+
+    for (size_t i = 0; i < prog->length; i++) {
+        Instr *ins = &grown[i];
+        if (!program_has_target(ins->op) || ins->arg < at) {
+            continue;
+        }
+        if (ins->arg > at || (inside && inside[i])) {
+            ins->arg += (uint32_t) count;
+        }
+    }
+    memmove(&grown[at + count], &grown[at], (prog->length + 1 - at) * sizeof(Instr));
+    memcpy(&grown[at], code, count * sizeof(Instr));
+    prog->length += count;
+
+    free(prog->save_masks);
+    prog->save_masks = NULL;
+    return true;
+}
+
+bool program_compact(Program *prog, const bool *removed) {
+    if (!prog || !prog->code || !removed) {
+        return false;
+    }
+
+    // map[i] is the new index of instruction i.
+    uint32_t *map = malloc((prog->length + 1) * sizeof(uint32_t));
+    if (!map) {
+        return false;
+    }
+
+    uint32_t kept = 0;
+    for (size_t i = 0; i < prog->length; i++) {
+        map[i] = kept;
+        if (!removed[i]) {
+            prog->code[kept++] = prog->code[i];
+        }
+    }
+    map[prog->length] = kept;
+
+    for (size_t i = 0; i < kept; i++) {
+        Instr *ins = &prog->code[i];
+        if (program_has_target(ins->op)) {
+            ins->arg = map[ins->arg];
+        }
+    }
+
+    memset(&prog->code[kept], 0, sizeof(Instr));
+    prog->code[kept].op = OP_HALT;
+    prog->length        = kept;
+    free(map);
+
+    free(prog->save_masks);
+    prog->save_masks = NULL;
+    return true;
+}
+
+uint32_t program_add_const(Program *prog, int64_t value) {
+    if (prog->const_count >= UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    if (prog->const_count == prog->const_capacity) {
+        size_t   capacity = 2 * prog->const_capacity + 1;
+        int64_t *consts   = realloc(prog->consts, capacity * sizeof(int64_t));
+        if (!consts) {
+            return UINT32_MAX;
+        }
+        prog->consts         = consts;
+        prog->const_capacity = capacity;
+    }
+    prog->consts[prog->const_count] = value;
+    return (uint32_t) prog->const_count++;
+}
+
+int64_t program_imm(const Program *prog, const Instr *ins) {
+    return ins->arg < prog->const_count ? prog->consts[ins->arg] : 0;
+}
+
+bool program_has_target(uint8_t op) {
+    return (op >= OP_B && op <= OP_B_LE) || op == OP_CALL || op == OP_TAIL_CALL;
+}
+
+void program_free(Program *prog) {
+    if (!prog) {
+        return;
+    }
+
+    for (size_t i = 0; i < prog->string_count; i++) {
+        free(prog->strings[i]);
+    }
+    free(prog->strings);
+    free(prog->save_masks);
+    free(prog->consts);
+    free(prog->code);
+    memset(prog, 0, sizeof(Program));
+}
+
+/**
+ * @brief Orders command indices by the address of their command.
+ *
+ * @param lhs The first `CommandIndex` to compare.
+ * @param rhs The second `CommandIndex` to compare.
+ * @return A negative, zero or positive value, as expected by `qsort`.
+ */
+static int compare_command_index(const void *lhs, const void *rhs) {
+    uintptr_t a = (uintptr_t) ((const CommandIndex *) lhs)->cmd;
+    uintptr_t b = (uintptr_t) ((const CommandIndex *) rhs)->cmd;
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Finds the position of a command in the flat program.
+ *
+ * @param indices The command indices, sorted by command address.
+ * @param length The number of commands in the program.
+ * @param cmd The command to look up. NULL maps to the end of the program.
+ * @return The index of `cmd`, or `length` if it is not part of the program.
+ */
+static uint32_t index_of(CommandIndex *indices, size_t length, const Command *cmd) {
+    if (cmd == NULL) {
+        return length;
+    }
+
+    CommandIndex  key   = {cmd, 0};
+    CommandIndex *found = bsearch(&key, indices, length, sizeof(CommandIndex),
+                                  compare_command_index);
+    return found ? found->index : length;
+}
+
+/**
+ * @brief Copies a string into the string pool.
+ *
+ * @param prog The program being built.
+ * @param str The string to copy.
+ * @return The index of the new string, or -1 if it could not be allocated.
+ */
+static int64_t add_string(Program *prog, const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (!copy) {
+        return -1;
+    }
+    strcpy(copy, str);
+    prog->strings[prog->string_count] = copy;
+    return prog->string_count++;
+}
+
+/**
+ * @brief Encodes a memory access size in a single byte.
+ *
+ * @param size The access size given in the source program.
+ * @return The size, or 0 if it is not a valid access size.
+ */
+static uint8_t encode_size(int64_t size) {
+    return (size == 1 || size == 2 || size == 4 || size == 8) ? (uint8_t) size : 0;
+}
+
+/**
+ * @brief Selects the branch opcode testing the given condition.
+ *
+ * @param cond The condition of the branch.
+ * @return The matching `OP_B*` opcode.
+ */
+static Opcode branch_opcode(BranchCondition cond) {
+    switch (cond) {
+        case BRANCH_EQUAL:
+            return OP_B_EQ;
+        case BRANCH_NOT_EQUAL:
+            return OP_B_NE;
+        case BRANCH_GREATER:
+            return OP_B_GT;
+        case BRANCH_LESS:
+            return OP_B_LT;
+        case BRANCH_GREATER_EQUAL:
+            return OP_B_GE;
+        case BRANCH_LESS_EQUAL:
+            return OP_B_LE;
+        default:
+            return OP_B;
+    }
+}
+
+/**
+ * @brief Lowers a single command into its operand-specialized encoding.
+ *
+ * @param prog The program being built.
+ * @param indices The command indices used to resolve jump targets.
+ * @param cmd The command to encode.
+ * @param ins The instruction to fill in.
+ * @return True if the command was encoded, false if memory ran out.
+ */
+static bool encode_command(Program *prog, CommandIndex *indices, Command *cmd, Instr *ins) {
+    memset(ins, 0, sizeof(Instr));
+    ins->dst = (uint8_t) cmd->destination.num_val;
+
+    switch (cmd->type) {
+        case CMD_MOV:
+            ins->op  = OP_MOV_RI;
+            ins->arg = program_add_const(prog, cmd->val_a.num_val);
+            break;
+        case CMD_ADD:
+        case CMD_SUB:
+            ins->a = (uint8_t) cmd->val_a.num_val;
+            if (cmd->is_b_immediate) {
+                ins->op  = cmd->type == CMD_ADD ? OP_ADD_RRI : OP_SUB_RRI;
+                ins->arg = program_add_const(prog, cmd->val_b.num_val);
+            } else {
+                ins->op = cmd->type == CMD_ADD ? OP_ADD_RRR : OP_SUB_RRR;
+                ins->b  = (uint8_t) cmd->val_b.num_val;
+            }
+            break;
+        case CMD_CMP:
+        case CMD_CMP_U:
+            ins->dst = 0;
+            ins->a   = (uint8_t) cmd->val_a.num_val;
+            if (cmd->is_b_immediate) {
+                ins->op  = cmd->type == CMD_CMP ? OP_CMP_RI : OP_CMP_U_RI;
+                ins->arg = program_add_const(prog, cmd->val_b.num_val);
+            } else {
+                ins->op = cmd->type == CMD_CMP ? OP_CMP_RR : OP_CMP_U_RR;
+                ins->b  = (uint8_t) cmd->val_b.num_val;
+            }
+            break;
+        case CMD_AND:
+        case CMD_ORR:
+        case CMD_EOR:
+            ins->op = cmd->type == CMD_AND ? OP_AND_RRR
+                      : cmd->type == CMD_ORR ? OP_ORR_RRR
+                                             : OP_EOR_RRR;
+            ins->a  = (uint8_t) cmd->val_a.num_val;
+            ins->b  = (uint8_t) cmd->val_b.num_val;
+            break;
+        case CMD_LSL:
+        case CMD_LSR:
+        case CMD_ASR:
+            ins->op  = cmd->type == CMD_LSL ? OP_LSL_RRI
+                       : cmd->type == CMD_LSR ? OP_LSR_RRI
+                                              : OP_ASR_RRI;
+            ins->a   = (uint8_t) cmd->val_a.num_val;
+            ins->arg = program_add_const(prog, cmd->val_b.num_val);
+            break;
+        case CMD_LOAD:
+            ins->a = encode_size(cmd->val_a.num_val);
+            if (cmd->is_b_immediate) {
+                ins->op  = OP_LOAD_RI;
+                ins->arg = program_add_const(prog, cmd->val_b.num_val);
+            } else {
+                ins->op = OP_LOAD_RR;
+                ins->b  = (uint8_t) cmd->val_b.num_val;
+            }
+            break;
+        case CMD_STORE:
+            ins->b = encode_size(cmd->val_b.num_val);
+            if (cmd->is_a_immediate) {
+                ins->op  = OP_STORE_RI;
+                ins->arg = program_add_const(prog, cmd->val_a.num_val);
+            } else {
+                ins->op = OP_STORE_RR;
+                ins->a  = (uint8_t) cmd->val_a.num_val;
+            }
+            break;
+        case CMD_PRINT:
+            ins->dst = 0;
+            ins->b   = (uint8_t) cmd->val_b.base;
+            if (cmd->is_a_immediate) {
+                ins->op  = OP_PRINT_I;
+                ins->arg = program_add_const(prog, cmd->val_a.num_val);
+            } else {
+                ins->op = OP_PRINT_R;
+                ins->a  = (uint8_t) cmd->val_a.num_val;
+            }
+            break;
+        case CMD_PUT: {
+            int64_t str = add_string(prog, cmd->destination.str_val);
+            if (str < 0) {
+                return false;
+            }
+            ins->dst = 0;
+            ins->arg = program_add_const(prog, str);
+            if (cmd->is_a_immediate) {
+                ins->op = OP_PUT_I;
+                program_add_const(prog, cmd->val_a.num_val);
+            } else {
+                ins->op = OP_PUT_R;
+                ins->a  = (uint8_t) cmd->val_a.num_val;
+            }
+            break;
+        }
+        case CMD_BRANCH:
+        case CMD_CALL:
+            ins->dst = (uint8_t) cmd->branch_condition;
+            if (cmd->is_linked) {
+                ins->op  = cmd->type == CMD_CALL ? OP_CALL : branch_opcode(cmd->branch_condition);
+                ins->arg = index_of(indices, prog->length, cmd->target);
+            } else {
+                int64_t label = add_string(prog, cmd->destination.str_val);
+                if (label < 0) {
+                    return false;
+                }
+                ins->op  = cmd->type == CMD_CALL ? OP_CALL_UNLINKED : OP_B_UNLINKED;
+                ins->arg = (uint32_t) label;
+            }
+            break;
+        case CMD_RET:
+            ins->op  = OP_RET;
+            ins->dst = 0;
+            break;
+        default:
+            ins->op  = OP_ERR;
+            ins->dst = 0;
+            break;
+    }
+    return true;
+}
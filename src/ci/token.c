@@ -14,18 +14,18 @@ void token_init(Token *tok, TokenType tok_type, const char *lexeme, int lexeme_l
     tok->column = column;
 }
 
-void print_token(Token tok) {
-    printf("Token: ");
+void print_token(FILE *out, Token tok) {
+    fprintf(out, "Token: ");
     if (tok.type == TOK_EOF) {
-        printf("EOF");
+        fprintf(out, "EOF");
     } else if (tok.type == TOK_NL) {
-        printf("Newline");
+        fprintf(out, "Newline");
     } else {
-        printf("%.*s", tok.length, tok.lexeme);
+        fprintf(out, "%.*s", tok.length, tok.lexeme);
     }
-    printf("\n");
+    fprintf(out, "\n");
 
-    printf("Token type: %u\n", tok.type);
-    printf("Token length: %d\n", tok.length);
-    printf("Line: %d:%d\n", tok.line, tok.column);
+    fprintf(out, "Token type: %u\n", tok.type);
+    fprintf(out, "Token length: %d\n", tok.length);
+    fprintf(out, "Line: %d:%d\n", tok.line, tok.column);
 }
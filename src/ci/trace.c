@@ -0,0 +1,722 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "mem.h"
+#include "x86_emit.h"
+
+#ifdef HAVE_NATIVE_CODE
+
+#define NO_HOST       0xFF  // Marks a variable that stays in memory.
+#define LABEL_LOOP    0     // The top of the loop, after the entry loads.
+#define LABEL_RETURN  1     // The epilogue, returning the index in eax.
+#define LABEL_EXIT(k) (2 + (k))
+
+typedef uint64_t (*TraceFn)(Interpreter *intr);
+
+/**
+ * @brief One instruction on the recorded path through a loop.
+ */
+typedef struct {
+    Instr    ins;    // The instruction, with any superinstruction taken apart.
+    uint32_t index;  // Its index in the program.
+    bool     taken;  // For conditional branches, whether the branch was taken.
+} TraceStep;
+
+/**
+ * @brief A linear path through one iteration of a loop, ending at its header.
+ */
+typedef struct {
+    TraceStep steps[TRACE_MAX_LENGTH];
+    size_t    length;
+} Trace;
+
+/**
+ * @brief Where each guest variable lives while a trace runs.
+ */
+typedef struct {
+    uint8_t  host[NUM_VARIABLES];  // Host register of each variable, or NO_HOST.
+    uint32_t written;              // Mask of the variables the trace writes.
+} Allocation;
+
+static uint8_t  base_opcode(const Program *prog, size_t index);
+static bool     record(Trace *trace, Interpreter *intr, const Program *prog, size_t header,
+                       size_t *resume);
+static bool     record_step(TraceStep *step, Interpreter *intr, const Program *prog, size_t *next);
+static bool     cond_holds(const Interpreter *intr, int cond);
+static void     allocate(Allocation *alloc, const Trace *trace);
+static uint8_t *compile(const Trace *trace, const Program *prog, size_t *size);
+static void     emit_step(Emitter *e, const Trace *trace, size_t s, const Program *prog,
+                          const Allocation *alloc, uint32_t *exits, size_t *exit_count);
+static void     emit_get(Emitter *e, const Allocation *alloc, uint8_t reg, uint8_t var);
+static void     emit_set(Emitter *e, const Allocation *alloc, uint8_t var, uint8_t reg);
+static void     emit_operand(Emitter *e, const Allocation *alloc, uint8_t op, uint8_t reg,
+                             uint8_t var);
+static size_t   add_exit(uint32_t *exits, size_t *exit_count, uint32_t index);
+
+bool trace_cache_init(TraceCache *cache, const Program *prog) {
+    if (!cache) {
+        return false;
+    }
+    memset(cache, 0, sizeof(TraceCache));
+    if (!prog || !prog->code) {
+        return false;
+    }
+
+    cache->length   = prog->length + 1;
+    cache->counters = calloc(cache->length, sizeof(int32_t));
+    cache->traces   = calloc(cache->length, sizeof(uint8_t *));
+    cache->sizes    = calloc(cache->length, sizeof(size_t));
+    if (!cache->counters || !cache->traces || !cache->sizes) {
+        trace_cache_free(cache);
+        return false;
+    }
+    return true;
+}
+
+size_t trace_enter(TraceCache *cache, Interpreter *intr, const Program *prog, size_t header) {
+    // Keep the counter at the threshold so every later jump lands here again.
+    cache->counters[header] = TRACE_HOT_THRESHOLD - 1;
+    if (cache->traces[header]) {
+        TraceFn fn = (TraceFn) (uintptr_t) cache->traces[header];
+        return (size_t) fn(intr);
+    }
+
+    Trace *trace = malloc(sizeof(Trace));
+    if (!trace) {
+        cache->counters[header] = INT32_MIN;
+        return header;
+    }
+
+    size_t resume;
+    if (record(trace, intr, prog, header, &resume)) {
+        cache->traces[header] = compile(trace, prog, &cache->sizes[header]);
+    }
+    if (!cache->traces[header]) {
+        // Not worth another try: leave this loop to the interpreter for good.
+        cache->counters[header] = INT32_MIN;
+    }
+    free(trace);
+    return resume;
+}
+
+void trace_cache_free(TraceCache *cache) {
+    if (!cache) {
+        return;
+    }
+
+    if (cache->traces) {
+        for (size_t i = 0; i < cache->length; i++) {
+            emit_unmap(cache->traces[i], cache->sizes[i]);
+        }
+    }
+    free(cache->counters);
+    free(cache->traces);
+    free(cache->sizes);
+    memset(cache, 0, sizeof(TraceCache));
+}
+
+/**
+ * @brief Returns the opcode an instruction had before it was fused.
+ *
+ * A superinstruction still sits at the index of its first instruction and the
+ * ones it absorbed keep their own slots, so undoing the fusion one slot at a
+ * time gives back the plain sequence.
+ *
+ * @param prog The program holding the instruction.
+ * @param index The index of the instruction.
+ * @return The plain opcode of the instruction at `index`.
+ */
+static uint8_t base_opcode(const Program *prog, size_t index) {
+    uint8_t op = prog->code[index].op;
+    if (op >= OP_CMP_RR_B_EQ && op <= OP_CMP_RR_B_LE) {
+        return OP_CMP_RR;
+    }
+    if (op >= OP_CMP_RI_B_EQ && op <= OP_CMP_RI_B_LE) {
+        return OP_CMP_RI;
+    }
+    if (op >= OP_ADD_CMP_RR_B_EQ && op <= OP_ADD_CMP_RI_B_LE) {
+        return OP_ADD_RRI;
+    }
+    return op;
+}
+
+/**
+ * @brief Runs one iteration of a loop, recording the path it takes.
+ *
+ * @param trace The trace to fill in.
+ * @param intr The interpreter holding guest state.
+ * @param prog The program being run.
+ * @param header The index of the loop header.
+ * @param resume Set to the index the interpreter should continue at.
+ * @return True if execution made it back to the header, false if it hit an
+ * instruction that cannot be traced or the path got too long.
+ */
+static bool record(Trace *trace, Interpreter *intr, const Program *prog, size_t header,
+                   size_t *resume) {
+    size_t index  = header;
+    trace->length = 0;
+    do {
+        if (trace->length == TRACE_MAX_LENGTH) {
+            *resume = index;
+            return false;
+        }
+
+        TraceStep *step = &trace->steps[trace->length];
+        step->ins       = prog->code[index];
+        step->ins.op    = base_opcode(prog, index);
+        step->index     = (uint32_t) index;
+        step->taken     = false;
+
+        size_t next;
+        if (!record_step(step, intr, prog, &next)) {
+            // The interpreter runs this instruction again, and reports any error.
+            *resume = index;
+            return false;
+        }
+        trace->length++;
+        index = next;
+    } while (index != header);
+
+    *resume = header;
+    return true;
+}
+
+/**
+ * @brief Executes a single recorded instruction.
+ *
+ * Instructions that can fail are only committed once they succeed, so a
+ * failed step leaves the guest state exactly as it was.
+ *
+ * @param step The step to execute, whose `taken` is filled in.
+ * @param intr The interpreter holding guest state.
+ * @param prog The program being run.
+ * @param next Set to the index of the next instruction.
+ * @return True if the step ran, false if it cannot be traced or would fail.
+ */
+static bool record_step(TraceStep *step, Interpreter *intr, const Program *prog, size_t *next) {
+    const Instr *ins  = &step->ins;
+    int64_t     *vars = intr->variables;
+    int64_t      imm  = ins->arg < prog->const_count ? prog->consts[ins->arg] : 0;
+    int64_t      value;
+
+    *next = step->index + 1;
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+            vars[ins->dst] = imm;
+            return true;
+        case OP_ADD_RRR:
+            vars[ins->dst] = vars[ins->a] + vars[ins->b];
+            return true;
+        case OP_ADD_RRI:
+            vars[ins->dst] = vars[ins->a] + imm;
+            return true;
+        case OP_SUB_RRR:
+            vars[ins->dst] = vars[ins->a] - vars[ins->b];
+            return true;
+        case OP_SUB_RRI:
+            vars[ins->dst] = vars[ins->a] - imm;
+            return true;
+        case OP_AND_RRR:
+            vars[ins->dst] = vars[ins->a] & vars[ins->b];
+            return true;
+        case OP_ORR_RRR:
+            vars[ins->dst] = vars[ins->a] | vars[ins->b];
+            return true;
+        case OP_EOR_RRR:
+            vars[ins->dst] = vars[ins->a] ^ vars[ins->b];
+            return true;
+        case OP_LSL_RRI:
+            vars[ins->dst] = (int64_t) ((uint64_t) vars[ins->a] << (uint64_t) imm);
+            return true;
+        case OP_LSR_RRI:
+            vars[ins->dst] = (int64_t) ((uint64_t) vars[ins->a] >> (uint64_t) imm);
+            return true;
+        case OP_ASR_RRI:
+            vars[ins->dst] = vars[ins->a] >> imm;
+            return true;
+        case OP_CMP_RR:
+        case OP_CMP_RI:
+            value            = ins->op == OP_CMP_RR ? vars[ins->b] : imm;
+            intr->is_greater = vars[ins->a] > value;
+            intr->is_less    = vars[ins->a] < value;
+            intr->is_equal   = vars[ins->a] == value;
+            return true;
+        case OP_CMP_U_RR:
+        case OP_CMP_U_RI:
+            value            = ins->op == OP_CMP_U_RR ? vars[ins->b] : imm;
+            intr->is_greater = (uint64_t) vars[ins->a] > (uint64_t) value;
+            intr->is_less    = (uint64_t) vars[ins->a] < (uint64_t) value;
+            intr->is_equal   = vars[ins->a] == value;
+            return true;
+        case OP_LOAD_RR:
+        case OP_LOAD_RI:
+            if (!mem_load_word(&intr->memory, &value, ins->op == OP_LOAD_RR ? vars[ins->b] : imm,
+                               ins->a)) {
+                return false;
+            }
+            vars[ins->dst] = value;
+            return true;
+        case OP_STORE_RR:
+        case OP_STORE_RI:
+            return mem_store_word(&intr->memory, vars[ins->dst],
+                                  ins->op == OP_STORE_RR ? vars[ins->a] : imm, ins->b);
+        case OP_PRINT_R:
+        case OP_PRINT_I:
+            print_base(intr, ins->op == OP_PRINT_R ? vars[ins->a] : imm, (char) ins->b);
+            return true;
+        case OP_PUT_R:
+        case OP_PUT_I:
+            value = ins->op == OP_PUT_R ? vars[ins->a] : prog->consts[ins->arg + 1];
+            return mem_store_string(&intr->memory, prog->strings[imm], value);
+        case OP_B:
+            *next = ins->arg;
+            return true;
+        case OP_B_EQ:
+        case OP_B_NE:
+        case OP_B_GT:
+        case OP_B_LT:
+        case OP_B_GE:
+        case OP_B_LE:
+            step->taken = cond_holds(intr, ins->op - OP_B_EQ);
+            if (step->taken) {
+                *next = ins->arg;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Evaluates a branch condition against the interpreter's flags.
+ *
+ * @param intr The interpreter holding the flags.
+ * @param cond The condition, counted from `OP_B_EQ`.
+ * @return True if the branch is taken.
+ */
+static bool cond_holds(const Interpreter *intr, int cond) {
+    switch (cond) {
+        case 0:
+            return intr->is_equal;
+        case 1:
+            return !intr->is_equal;
+        case 2:
+            return intr->is_greater;
+        case 3:
+            return intr->is_less;
+        case 4:
+            return intr->is_greater || intr->is_equal;
+        default:
+            return intr->is_less || intr->is_equal;
+    }
+}
+
+/**
+ * @brief Gives the most used variables of a trace a host register each.
+ *
+ * rax and rcx stay free as scratch. The callee-saved registers go first; the
+ * caller-saved ones are only used when the trace never calls out to C.
+ *
+ * @param alloc The allocation to fill in.
+ * @param trace The recorded trace.
+ */
+static void allocate(Allocation *alloc, const Trace *trace) {
+    static const uint8_t callee_saved[] = {RBP, R12, R13, R14, R15};
+    static const uint8_t caller_saved[] = {RDX, RSI, RDI, R8, R9, R10, R11};
+
+    size_t uses[NUM_VARIABLES] = {0};
+    bool   calls_out           = false;
+    memset(alloc->host, NO_HOST, sizeof(alloc->host));
+    alloc->written = 0;
+
+    for (size_t s = 0; s < trace->length; s++) {
+        const Instr *ins = &trace->steps[s].ins;
+        switch ((Opcode) ins->op) {
+            case OP_MOV_RI:
+                uses[ins->dst]++;
+                alloc->written |= 1u << ins->dst;
+                break;
+            case OP_ADD_RRR:
+            case OP_SUB_RRR:
+            case OP_AND_RRR:
+            case OP_ORR_RRR:
+            case OP_EOR_RRR:
+                uses[ins->a]++;
+                uses[ins->b]++;
+                uses[ins->dst]++;
+                alloc->written |= 1u << ins->dst;
+                break;
+            case OP_ADD_RRI:
+            case OP_SUB_RRI:
+            case OP_LSL_RRI:
+            case OP_LSR_RRI:
+            case OP_ASR_RRI:
+                uses[ins->a]++;
+                uses[ins->dst]++;
+                alloc->written |= 1u << ins->dst;
+                break;
+            case OP_CMP_RR:
+            case OP_CMP_U_RR:
+                uses[ins->a]++;
+                uses[ins->b]++;
+                break;
+            case OP_CMP_RI:
+            case OP_CMP_U_RI:
+                uses[ins->a]++;
+                break;
+            case OP_LOAD_RR:
+            case OP_LOAD_RI:
+                uses[ins->dst]++;
+                uses[ins->b] += ins->op == OP_LOAD_RR;
+                alloc->written |= 1u << ins->dst;
+                calls_out = true;
+                break;
+            case OP_STORE_RR:
+            case OP_STORE_RI:
+                uses[ins->dst]++;
+                uses[ins->a] += ins->op == OP_STORE_RR;
+                calls_out = true;
+                break;
+            case OP_PRINT_R:
+            case OP_PUT_R:
+                uses[ins->a]++;
+                calls_out = true;
+                break;
+            case OP_PRINT_I:
+            case OP_PUT_I:
+                calls_out = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    size_t available = sizeof(callee_saved) + (calls_out ? 0 : sizeof(caller_saved));
+    for (size_t r = 0; r < available; r++) {
+        size_t best = NUM_VARIABLES;
+        for (size_t v = 0; v < NUM_VARIABLES; v++) {
+            if (uses[v] && alloc->host[v] == NO_HOST &&
+                (best == NUM_VARIABLES || uses[v] > uses[best])) {
+                best = v;
+            }
+        }
+        if (best == NUM_VARIABLES) {
+            break;
+        }
+        alloc->host[best] = r < sizeof(callee_saved) ? callee_saved[r]
+                                                     : caller_saved[r - sizeof(callee_saved)];
+    }
+}
+
+/**
+ * @brief Compiles a recorded trace into a native loop.
+ *
+ * The allocated variables are loaded once on entry and kept in registers
+ * while the loop runs. Each exit writes back the ones the trace changes and
+ * returns the index the interpreter should continue at.
+ *
+ * @param trace The recorded trace.
+ * @param prog The program the trace was recorded from.
+ * @param size Set to the size of the mapping.
+ * @return The executable trace, or NULL if it could not be generated.
+ */
+static uint8_t *compile(const Trace *trace, const Program *prog, size_t *size) {
+    Allocation alloc;
+    allocate(&alloc, trace);
+
+    // Every step leaves the loop at most once.
+    uint32_t *exits   = malloc(trace->length * sizeof(uint32_t));
+    size_t   *offsets = malloc((trace->length + 2) * sizeof(size_t));
+    if (!exits || !offsets) {
+        free(exits);
+        free(offsets);
+        return NULL;
+    }
+    size_t exit_count = 0;
+
+    // Prologue: save every callee-saved register and keep the stack 16-byte
+    // aligned for the helpers.
+    Emitter e = {0};
+    emit_push(&e, RBX);
+    emit_push(&e, RBP);
+    emit_push(&e, R12);
+    emit_push(&e, R13);
+    emit_push(&e, R14);
+    emit_push(&e, R15);
+    emit8(&e, 0x48), emit8(&e, 0x83), emit8(&e, 0xEC), emit8(&e, 0x08);  // sub rsp, 8
+    emit_mov(&e, RBX, RDI);
+    for (uint8_t v = 0; v < NUM_VARIABLES; v++) {
+        if (alloc.host[v] != NO_HOST) {
+            emit_load(&e, alloc.host[v], JIT_VAR(v));
+        }
+    }
+
+    offsets[LABEL_LOOP] = e.length;
+    for (size_t s = 0; s < trace->length; s++) {
+        emit_step(&e, trace, s, prog, &alloc, exits, &exit_count);
+    }
+    emit_jump(&e, LABEL_LOOP);
+
+    for (size_t k = 0; k < exit_count; k++) {
+        offsets[LABEL_EXIT(k)] = e.length;
+        for (uint8_t v = 0; v < NUM_VARIABLES; v++) {
+            if (alloc.host[v] != NO_HOST && (alloc.written & (1u << v))) {
+                emit_store(&e, JIT_VAR(v), alloc.host[v]);
+            }
+        }
+        emit_mov_imm(&e, RAX, exits[k]);
+        emit_jump(&e, LABEL_RETURN);
+    }
+
+    offsets[LABEL_RETURN] = e.length;
+    emit8(&e, 0x48), emit8(&e, 0x83), emit8(&e, 0xC4), emit8(&e, 0x08);  // add rsp, 8
+    emit_pop(&e, R15);
+    emit_pop(&e, R14);
+    emit_pop(&e, R13);
+    emit_pop(&e, R12);
+    emit_pop(&e, RBP);
+    emit_pop(&e, RBX);
+    emit8(&e, 0xC3);  // ret
+
+    emit_resolve(&e, offsets);
+    uint8_t *code = emit_map(&e, size);
+    emit_free(&e);
+    free(exits);
+    free(offsets);
+    return code;
+}
+
+/**
+ * @brief Emits the code of one step of a trace.
+ *
+ * Branches become guards that leave the loop when they go the other way than
+ * they did while recording. Helpers that fail leave it at their own index, so
+ * the interpreter runs them again and reports the error.
+ *
+ * @param e The emitter to append to.
+ * @param trace The recorded trace.
+ * @param s The index of the step in the trace.
+ * @param prog The program the trace was recorded from.
+ * @param alloc Where each variable lives.
+ * @param exits The resume index of each exit, appended to.
+ * @param exit_count The number of entries in `exits`.
+ */
+static void emit_step(Emitter *e, const Trace *trace, size_t s, const Program *prog,
+                      const Allocation *alloc, uint32_t *exits, size_t *exit_count) {
+    const TraceStep *step = &trace->steps[s];
+    const Instr     *ins  = &step->ins;
+    int64_t          imm  = ins->arg < prog->const_count ? prog->consts[ins->arg] : 0;
+    uint8_t          dst  = alloc->host[ins->dst];
+    uint8_t          out;
+
+    switch ((Opcode) ins->op) {
+        case OP_MOV_RI:
+            if (dst != NO_HOST) {
+                emit_mov_imm(e, dst, imm);
+            } else {
+                emit_store_imm(e, JIT_VAR(ins->dst), imm);
+            }
+            break;
+        case OP_ADD_RRR:
+        case OP_SUB_RRR:
+        case OP_AND_RRR:
+        case OP_ORR_RRR:
+        case OP_EOR_RRR:
+            // Compute straight into the destination unless that clobbers `b`.
+            out = dst != NO_HOST && (ins->dst != ins->b || ins->dst == ins->a) ? dst : RAX;
+            emit_get(e, alloc, out, ins->a);
+            emit_operand(e, alloc, jit_alu_op(ins->op), out, ins->b);
+            emit_set(e, alloc, ins->dst, out);
+            break;
+        case OP_ADD_RRI:
+        case OP_SUB_RRI:
+            out = dst != NO_HOST ? dst : RAX;
+            emit_get(e, alloc, out, ins->a);
+            emit_alu_imm(e, jit_alu_op(ins->op), out, imm);
+            emit_set(e, alloc, ins->dst, out);
+            break;
+        case OP_LSL_RRI:
+        case OP_LSR_RRI:
+        case OP_ASR_RRI:
+            out = dst != NO_HOST ? dst : RAX;
+            emit_get(e, alloc, out, ins->a);
+            emit_shift(e, jit_shift_op(ins->op), out, imm);
+            emit_set(e, alloc, ins->dst, out);
+            break;
+        case OP_CMP_RR:
+        case OP_CMP_U_RR:
+        case OP_CMP_RI:
+        case OP_CMP_U_RI:
+            out = alloc->host[ins->a] != NO_HOST ? alloc->host[ins->a] : RAX;
+            emit_get(e, alloc, out, ins->a);
+            if (ins->op == OP_CMP_RR || ins->op == OP_CMP_U_RR) {
+                emit_operand(e, alloc, ALU_CMP, out, ins->b);
+            } else {
+                emit_alu_imm(e, ALU_CMP, out, imm);
+            }
+            jit_emit_set_flags(e, ins->op == OP_CMP_U_RR || ins->op == OP_CMP_U_RI);
+            break;
+        case OP_LOAD_RR:
+        case OP_LOAD_RI:
+            // The helper writes the variable in memory.
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_lea(e, RSI, JIT_VAR(ins->dst));
+            if (ins->op == OP_LOAD_RR) {
+                emit_get(e, alloc, RDX, ins->b);
+            } else {
+                emit_mov_imm(e, RDX, imm);
+            }
+            emit_mov_imm(e, RCX, ins->a);
+            emit_call(e, (uint64_t) (uintptr_t) mem_load_word);
+            emit8(e, 0x84), emit8(e, 0xC0);  // test al, al
+            emit_jcc(e, CC_E, LABEL_EXIT(add_exit(exits, exit_count, step->index)));
+            if (dst != NO_HOST) {
+                emit_load(e, dst, JIT_VAR(ins->dst));
+            }
+            break;
+        case OP_STORE_RR:
+        case OP_STORE_RI:
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_get(e, alloc, RSI, ins->dst);
+            if (ins->op == OP_STORE_RR) {
+                emit_get(e, alloc, RDX, ins->a);
+            } else {
+                emit_mov_imm(e, RDX, imm);
+            }
+            emit_mov_imm(e, RCX, ins->b);
+            emit_call(e, (uint64_t) (uintptr_t) mem_store_word);
+            emit8(e, 0x84), emit8(e, 0xC0);  // test al, al
+            emit_jcc(e, CC_E, LABEL_EXIT(add_exit(exits, exit_count, step->index)));
+            break;
+        case OP_PRINT_R:
+        case OP_PRINT_I:
+            emit_mov(e, RDI, RBX);
+            if (ins->op == OP_PRINT_R) {
+                emit_get(e, alloc, RSI, ins->a);
+            } else {
+                emit_mov_imm(e, RSI, imm);
+            }
+            emit_mov_imm(e, RDX, ins->b);
+            emit_call(e, (uint64_t) (uintptr_t) print_base);
+            break;
+        case OP_PUT_R:
+        case OP_PUT_I:
+            emit_lea(e, RDI, JIT_MEMORY);
+            emit_mov_imm(e, RSI, (int64_t) (uintptr_t) prog->strings[imm]);
+            if (ins->op == OP_PUT_R) {
+                emit_get(e, alloc, RDX, ins->a);
+            } else {
+                emit_mov_imm(e, RDX, prog->consts[ins->arg + 1]);
+            }
+            emit_call(e, (uint64_t) (uintptr_t) mem_store_string);
+            emit8(e, 0x84), emit8(e, 0xC0);  // test al, al
+            emit_jcc(e, CC_E, LABEL_EXIT(add_exit(exits, exit_count, step->index)));
+            break;
+        case OP_B_EQ:
+        case OP_B_NE:
+        case OP_B_GT:
+        case OP_B_LT:
+        case OP_B_GE:
+        case OP_B_LE: {
+            // The trace is a straight line, so the step before is the only way
+            // in and a compare there has left the host flags intact.
+            int     cond = ins->op - OP_B_EQ;
+            uint8_t prev = s > 0 ? trace->steps[s - 1].ins.op : OP_B;
+            uint8_t cc;
+            if (prev >= OP_CMP_RR && prev <= OP_CMP_U_RI) {
+                cc = jit_branch_cc(cond, prev >= OP_CMP_U_RR);
+            } else {
+                cc = jit_emit_flag_test(e, cond);
+            }
+            uint32_t other = step->taken ? step->index + 1 : ins->arg;
+            emit_jcc(e, step->taken ? cc ^ 1 : cc, LABEL_EXIT(add_exit(exits, exit_count, other)));
+            break;
+        }
+        default:
+            // OP_B: the next step is already where it goes.
+            break;
+    }
+}
+
+/**
+ * @brief Copies a variable into a host register.
+ *
+ * @param e The emitter to append to.
+ * @param alloc Where each variable lives.
+ * @param reg The host register to write.
+ * @param var The variable to read.
+ */
+static void emit_get(Emitter *e, const Allocation *alloc, uint8_t reg, uint8_t var) {
+    if (alloc->host[var] == NO_HOST) {
+        emit_load(e, reg, JIT_VAR(var));
+    } else if (alloc->host[var] != reg) {
+        emit_mov(e, reg, alloc->host[var]);
+    }
+}
+
+/**
+ * @brief Copies a host register into a variable.
+ *
+ * @param e The emitter to append to.
+ * @param alloc Where each variable lives.
+ * @param var The variable to write.
+ * @param reg The host register to read.
+ */
+static void emit_set(Emitter *e, const Allocation *alloc, uint8_t var, uint8_t reg) {
+    if (alloc->host[var] == NO_HOST) {
+        emit_store(e, JIT_VAR(var), reg);
+    } else if (alloc->host[var] != reg) {
+        emit_mov(e, alloc->host[var], reg);
+    }
+}
+
+/**
+ * @brief Emits `op reg, var`, reading the variable from wherever it lives.
+ *
+ * @param e The emitter to append to.
+ * @param alloc Where each variable lives.
+ * @param op One of the `ALU_*` operations.
+ * @param reg The host register holding the first operand and the result.
+ * @param var The variable holding the second operand.
+ */
+static void emit_operand(Emitter *e, const Allocation *alloc, uint8_t op, uint8_t reg,
+                         uint8_t var) {
+    if (alloc->host[var] == NO_HOST) {
+        emit_alu_load(e, op, reg, JIT_VAR(var));
+    } else {
+        emit_alu(e, op, reg, alloc->host[var]);
+    }
+}
+
+/**
+ * @brief Adds an exit from the trace.
+ *
+ * @param exits The resume index of each exit.
+ * @param exit_count The number of entries in `exits`.
+ * @param index The index the interpreter continues at after this exit.
+ * @return The number of the new exit.
+ */
+static size_t add_exit(uint32_t *exits, size_t *exit_count, uint32_t index) {
+    exits[*exit_count] = index;
+    return (*exit_count)++;
+}
+
+#else
+
+bool trace_cache_init(TraceCache *cache, const Program *prog) {
+    if (cache) {
+        memset(cache, 0, sizeof(TraceCache));
+    }
+    return false;
+}
+
+size_t trace_enter(TraceCache *cache, Interpreter *intr, const Program *prog, size_t header) {
+    return header;
+}
+
+void trace_cache_free(TraceCache *cache) {
+}
+
+#endif
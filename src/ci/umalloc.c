@@ -1,9 +1,13 @@
 #include "umalloc.h"
 #include "csbrk.h"
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <threads.h>
 #include "ansicolors.h"
 
+static_assert(UCACHE_SLAB_SIZE == PAGESIZE, "a slab is one page");
+
 const char author[] = ANSI_BOLD ANSI_COLOR_RED "Jay Dasari" ANSI_RESET;
 
 /*
@@ -11,32 +15,107 @@ const char author[] = ANSI_BOLD ANSI_COLOR_RED "Jay Dasari" ANSI_RESET;
  * struct, they can be adjusted as necessary.
  */
 
-mem_block_header_t *free_heads[BIN_COUNT];
+/*
+ * thread_cache_t - The blocks of up to TCACHE_MAX_SIZE bytes a thread freed
+ * and keeps for itself, by exact size. They stay marked allocated, so the
+ * arena does not see them, until the cache overflows or the thread exits.
+ */
+typedef struct {
+    umalloc_arena_t *arena;                       // The arena the thread allocates from
+    mem_block_header_t *blocks[TCACHE_CLASSES];   // Cached blocks of 16, 32, ... bytes
+    size_t counts[TCACHE_CLASSES];                // Number of blocks in each list
+} thread_cache_t;
 
 /*
- * select_bin - selects a free list bin to use based on the
- * block size.
+ * tree_links_t - The links of a free block of over SMALL_BIN_MAX bytes in the
+ * tree of its arena, kept at the start of its payload instead of the list
+ * links of smaller blocks. The tree is an AVL tree, ordered by size and then
+ * by address, so the best fit is unique and found in O(log n).
+ */
+typedef struct {
+    mem_block_header_t *left;    // Smaller blocks, or as large ones at lower addresses
+    mem_block_header_t *right;   // Larger blocks, or as large ones at higher addresses
+    size_t height;               // Height of the subtree the block is the root of
+} tree_links_t;
+
+/*
+ * Threads are spread over the arenas in the order they first allocate. A
+ * thread frees into its own cache or arena, or pushes the block onto the
+ * remote-free queue of the arena that owns it. Growing the heap, which every
+ * arena does through the one program break, is serialized by heap_lock.
  */
+static umalloc_arena_t arenas[ARENA_COUNT];
+static atomic_size_t next_arena;
+static once_flag arenas_once = ONCE_FLAG_INIT;
+static tss_t cache_key;
+static mtx_t heap_lock;
+static atomic_size_t heap_size;
+static _Thread_local thread_cache_t thread_cache;
 
-mem_block_header_t *select_bin(size_t size)
+static void flush_cache(void *cache);
+int select_bin_index(size_t size);
+void freelist_add(umalloc_arena_t *arena, mem_block_header_t *block, size_t size);
+
+/*
+ * With UMALLOC_TRACE every umalloc and ufree is appended to the file named by
+ * the UMALLOC_TRACE environment variable, or umalloc.trace, one per line:
+ * "a <pointer> <size>" or "f <pointer> 0". umalloc_replay reads it back.
+ */
+#ifdef UMALLOC_TRACE
+static mtx_t trace_lock;
+static FILE *trace_file;
+static void trace_event(char op, void *ptr, size_t size);
+#else
+#define trace_event(op, ptr, size) ((void)0)
+#endif
+
+/*
+ * init_arenas - creates the locks of the heap and the arenas, and the key
+ * that flushes thread caches, once per process.
+ */
+static void init_arenas(void)
 {
-    // 4 bins with sizes <128, <512, <1024, and >1024
-    if (size < 128)
-    {
-        return free_heads[0];
-    }
-    else if (size < 512)
+    mtx_init(&heap_lock, mtx_plain);
+    for (int i = 0; i < ARENA_COUNT; i++)
     {
-        return free_heads[1];
+        mtx_init(&arenas[i].lock, mtx_plain);
+        atomic_init(&arenas[i].remote_frees, NULL);
     }
-    else if (size < 1024)
+    tss_create(&cache_key, flush_cache);
+#ifdef UMALLOC_TRACE
+    mtx_init(&trace_lock, mtx_plain);
+#endif
+}
+
+/*
+ * get_cache - returns the cache of the calling thread, attaching the thread
+ * to an arena the first time.
+ */
+static thread_cache_t *get_cache(void)
+{
+    thread_cache_t *cache = &thread_cache;
+    if (cache->arena == NULL)
     {
-        return free_heads[2];
+        call_once(&arenas_once, init_arenas);
+        cache->arena = &arenas[atomic_fetch_add(&next_arena, 1) % ARENA_COUNT];
+        // the key only exists to run flush_cache when the thread exits
+        tss_set(cache_key, cache);
     }
-    else
+    return cache;
+}
+
+/*
+ * select_bin - selects a free list bin to use based on the
+ * block size.
+ */
+
+mem_block_header_t *select_bin(umalloc_arena_t *arena, size_t size)
+{
+    if (size > SMALL_BIN_MAX)
     {
-        return free_heads[3];
+        return arena->large_blocks;
     }
+    return arena->free_heads[select_bin_index(size)];
 }
 
 /*
@@ -51,6 +130,32 @@ bool is_allocated(mem_block_header_t *block)
     return false;
 }
 
+/*
+ * is_prev_allocated - returns true unless the block before a block is in a
+ * free list.
+ */
+bool is_prev_allocated(mem_block_header_t *block)
+{
+    return (block->block_metadata & PREV_ALLOCATED) != 0;
+}
+
+/*
+ * set_prev_allocated - records whether the block before a block is in a free
+ * list. The block may be allocated to a thread reading its size without the
+ * arena's lock, so the bit flips atomically.
+ */
+static void set_prev_allocated(mem_block_header_t *block, bool alloc)
+{
+    if (alloc)
+    {
+        __atomic_fetch_or(&block->block_metadata, (size_t)PREV_ALLOCATED, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_and(&block->block_metadata, ~(size_t)PREV_ALLOCATED, __ATOMIC_RELAXED);
+    }
+}
+
 /*
  * allocate - marks a block as allocated.
  */
@@ -95,17 +200,64 @@ mem_block_header_t *get_next(mem_block_header_t *block)
     return block->next;
 }
 
+/*
+ * get_successor - gets the block right after a block in memory.
+ */
+mem_block_header_t *get_successor(mem_block_header_t *block)
+{
+    return (mem_block_header_t *)((uintptr_t)block + sizeof(mem_block_header_t) + get_size(block));
+}
+
+/*
+ * get_predecessor - gets the block right before a block in memory, from its
+ * footer. Only valid while that block is in a free list.
+ */
+mem_block_header_t *get_predecessor(mem_block_header_t *block)
+{
+    size_t size = ((size_t *)block)[-1];
+    return (mem_block_header_t *)((uintptr_t)block - size - sizeof(mem_block_header_t));
+}
+
+/*
+ * get_prev_free - gets the block before a block in its free list, kept in the
+ * first word of the payload.
+ */
+static mem_block_header_t *get_prev_free(mem_block_header_t *block)
+{
+    return *(mem_block_header_t **)get_payload(block);
+}
+
+/*
+ * set_prev_free - sets the block before a block in its free list.
+ */
+static void set_prev_free(mem_block_header_t *block, mem_block_header_t *prev)
+{
+    *(mem_block_header_t **)get_payload(block) = prev;
+}
+
+/*
+ * set_footer - copies the size of a free block into the last word of its
+ * payload.
+ */
+static void set_footer(mem_block_header_t *block)
+{
+    // not get_size, whose NULL check has GCC warn about a footer near NULL
+    size_t size = block->block_metadata >> 4;
+    *(size_t *)((uintptr_t)block + sizeof(mem_block_header_t) + size - sizeof(size_t)) = size;
+}
+
 /*
  * set_block_metadata
  * Optional helper method that can be used to initialize the fields for the
- * memory block struct.
+ * memory block struct. The PREV_ALLOCATED bit is kept as it is.
  */
 void set_block_metadata(mem_block_header_t *block, size_t size, bool alloc)
 {
     // add size block_metadata and then shift left to make space for alloc bit
+    size_t prev_allocated = block->block_metadata & PREV_ALLOCATED;
     block->block_metadata = size;
     block->block_metadata = block->block_metadata << 4;
-    block->block_metadata += (int)alloc;
+    block->block_metadata += (int)alloc + prev_allocated;
 }
 
 /*
@@ -125,25 +277,270 @@ mem_block_header_t *get_header(void *payload)
     return (mem_block_header_t *)payload - 1;
 }
 
+/*
+ * select_bin_index - returns the bin of a free block of 1 to SMALL_BIN_MAX
+ * bytes. Each size has a bin of its own.
+ */
 int select_bin_index(size_t size)
 {
-    if (size < 128)
+    return (int)((size - 1) / ALIGNMENT);
+}
+
+/*
+ * bin_push - adds a free block to the front of a bin.
+ */
+static void bin_push(umalloc_arena_t *arena, int index, mem_block_header_t *block)
+{
+    mem_block_header_t *head = arena->free_heads[index];
+    block->next = head;
+    set_prev_free(block, NULL);
+    if (head != NULL)
     {
-        return 0;
+        set_prev_free(head, block);
+    }
+    arena->free_heads[index] = block;
+    arena->bin_map[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+/*
+ * bin_unlink - removes a block from a bin.
+ */
+static void bin_unlink(umalloc_arena_t *arena, int index, mem_block_header_t *block)
+{
+    mem_block_header_t *prev = get_prev_free(block);
+    mem_block_header_t *next = block->next;
+    if (prev == NULL)
+    {
+        arena->free_heads[index] = next;
+    }
+    else
+    {
+        prev->next = next;
+    }
+    if (next != NULL)
+    {
+        set_prev_free(next, prev);
+    }
+    if (arena->free_heads[index] == NULL)
+    {
+        arena->bin_map[index / 64] &= ~((uint64_t)1 << (index % 64));
+    }
+}
+
+/*
+ * get_links - gets the tree links of a free block of over SMALL_BIN_MAX bytes.
+ */
+static tree_links_t *get_links(mem_block_header_t *block)
+{
+    return (tree_links_t *)get_payload(block);
+}
+
+/*
+ * tree_height - returns the height of a subtree, 0 if it is empty.
+ */
+static size_t tree_height(mem_block_header_t *root)
+{
+    return root == NULL ? 0 : get_links(root)->height;
+}
+
+/*
+ * tree_before - returns true if block a sorts before block b: it is smaller,
+ * or as large and at a lower address.
+ */
+static bool tree_before(mem_block_header_t *a, mem_block_header_t *b)
+{
+    return get_size(a) < get_size(b) || (get_size(a) == get_size(b) && (uintptr_t)a < (uintptr_t)b);
+}
+
+/*
+ * tree_rotate - rotates the child on one side of a subtree up into its place,
+ * and returns it.
+ */
+static mem_block_header_t *tree_rotate(mem_block_header_t *root, bool left_up)
+{
+    tree_links_t *links = get_links(root);
+    mem_block_header_t *child = left_up ? links->left : links->right;
+    tree_links_t *child_links = get_links(child);
+    if (left_up)
+    {
+        links->left = child_links->right;
+        child_links->right = root;
+    }
+    else
+    {
+        links->right = child_links->left;
+        child_links->left = root;
     }
-    else if (size < 512)
+    size_t left = tree_height(links->left), right = tree_height(links->right);
+    links->height = (left > right ? left : right) + 1;
+    left = tree_height(child_links->left);
+    right = tree_height(child_links->right);
+    child_links->height = (left > right ? left : right) + 1;
+    return child;
+}
+
+/*
+ * tree_balance - updates the height of a subtree whose children are balanced,
+ * rotating it if they differ in height by 2, and returns its new root.
+ */
+static mem_block_header_t *tree_balance(mem_block_header_t *root)
+{
+    tree_links_t *links = get_links(root);
+    size_t left = tree_height(links->left), right = tree_height(links->right);
+    if (left > right + 1)
+    {
+        tree_links_t *child = get_links(links->left);
+        if (tree_height(child->right) > tree_height(child->left))
+        {
+            links->left = tree_rotate(links->left, false);
+        }
+        return tree_rotate(root, true);
+    }
+    if (right > left + 1)
+    {
+        tree_links_t *child = get_links(links->right);
+        if (tree_height(child->left) > tree_height(child->right))
+        {
+            links->right = tree_rotate(links->right, true);
+        }
+        return tree_rotate(root, false);
+    }
+    links->height = (left > right ? left : right) + 1;
+    return root;
+}
+
+/*
+ * tree_insert - adds a free block to a subtree, and returns its new root.
+ */
+static mem_block_header_t *tree_insert(mem_block_header_t *root, mem_block_header_t *block)
+{
+    if (root == NULL)
+    {
+        tree_links_t *links = get_links(block);
+        links->left = NULL;
+        links->right = NULL;
+        links->height = 1;
+        return block;
+    }
+    tree_links_t *links = get_links(root);
+    if (tree_before(block, root))
+    {
+        links->left = tree_insert(links->left, block);
+    }
+    else
+    {
+        links->right = tree_insert(links->right, block);
+    }
+    return tree_balance(root);
+}
+
+/*
+ * tree_remove_first - removes the first block of a non-empty subtree, stores
+ * it in first, and returns the new root.
+ */
+static mem_block_header_t *tree_remove_first(mem_block_header_t *root, mem_block_header_t **first)
+{
+    tree_links_t *links = get_links(root);
+    if (links->left == NULL)
     {
-        return 1;
+        *first = root;
+        return links->right;
     }
-    else if (size < 1024)
+    links->left = tree_remove_first(links->left, first);
+    return tree_balance(root);
+}
+
+/*
+ * tree_remove - removes a block from the subtree holding it, and returns the
+ * new root.
+ */
+static mem_block_header_t *tree_remove(mem_block_header_t *root, mem_block_header_t *block)
+{
+    tree_links_t *links = get_links(root);
+    if (root == block)
+    {
+        // the block right after it takes its place
+        if (links->left == NULL || links->right == NULL)
+        {
+            return links->left == NULL ? links->right : links->left;
+        }
+        mem_block_header_t *next;
+        mem_block_header_t *right = tree_remove_first(links->right, &next);
+        get_links(next)->left = links->left;
+        get_links(next)->right = right;
+        return tree_balance(next);
+    }
+    if (tree_before(block, root))
+    {
+        links->left = tree_remove(links->left, block);
+    }
+    else
+    {
+        links->right = tree_remove(links->right, block);
+    }
+    return tree_balance(root);
+}
+
+/*
+ * tree_best_fit - returns the smallest block of at least size bytes in a
+ * subtree, the one at the lowest address if several are, or NULL.
+ */
+static mem_block_header_t *tree_best_fit(mem_block_header_t *root, size_t size)
+{
+    mem_block_header_t *best = NULL;
+    while (root != NULL)
+    {
+        if (get_size(root) >= size)
+        {
+            best = root;
+            root = get_links(root)->left;
+        }
+        else
+        {
+            root = get_links(root)->right;
+        }
+    }
+    return best;
+}
+
+/*
+ * freelist_remove - removes a free block from the bin or tree it is in.
+ */
+static void freelist_remove(umalloc_arena_t *arena, mem_block_header_t *block)
+{
+    size_t size = get_size(block);
+    if (size <= SMALL_BIN_MAX)
     {
-        return 2;
+        bin_unlink(arena, select_bin_index(size), block);
     }
     else
     {
-        return 3;
+        arena->large_blocks = tree_remove(arena->large_blocks, block);
     }
+    set_prev_allocated(get_successor(block), true);
 }
+
+/*
+ * first_bin - returns the first bin at or after index that is not empty, or
+ * -1 if there is none.
+ */
+static int first_bin(umalloc_arena_t *arena, int index)
+{
+    for (int word = index / 64; word < BIN_MAP_WORDS; word++)
+    {
+        uint64_t bits = arena->bin_map[word];
+        if (word == index / 64)
+        {
+            bits &= ~(uint64_t)0 << (index % 64);
+        }
+        if (bits != 0)
+        {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
 /*
  * The following are helper functions that can be implemented to assist in your
  * design, but they are not required.
@@ -152,38 +549,47 @@ int select_bin_index(size_t size)
 /*
  * find - finds a free block that can satisfy the umalloc request.
  */
-mem_block_header_t *find(size_t payload_size)
+mem_block_header_t *find(umalloc_arena_t *arena, size_t payload_size)
 {
-    int index = select_bin_index(payload_size);
-    while (index < BIN_COUNT)
+    // every block of a bin fits, so the first non-empty bin from the
+    // request's own does
+    size_t size = ALIGN(payload_size);
+    if (size <= SMALL_BIN_MAX)
     {
-        // find first free node with min space, remove from list and return
-        // if none free in bin, try to move in next bin
-        mem_block_header_t *bin = free_heads[index];
-        mem_block_header_t *prev = NULL;
-        mem_block_header_t *returnBin = NULL;
-        while (bin != NULL)
+        int found = first_bin(arena, select_bin_index(size));
+        if (found >= 0)
         {
-            if (get_size(bin) >= payload_size)
-            {
-                if (prev == NULL)
-                {
-                    returnBin = bin;
-                    free_heads[index] = bin->next;
-                }
-                else
-                {
-                    returnBin = bin;
-                    prev->next = bin->next;
-                }
-                return returnBin;
-            }
-            prev = bin;
-            bin = get_next(bin);
+            mem_block_header_t *block = arena->free_heads[found];
+            freelist_remove(arena, block);
+            return block;
         }
-        index++;
     }
-    return NULL;
+
+    // larger requests, and smaller ones no bin can serve, take the best fit
+    mem_block_header_t *block = tree_best_fit(arena->large_blocks, size);
+    if (block != NULL)
+    {
+        freelist_remove(arena, block);
+    }
+    return block;
+}
+
+/*
+ * make_chunk - turns memory fresh from the heap into a chunk holding one free
+ * block of size bytes, not yet in any free list.
+ */
+static mem_block_header_t *make_chunk(void *memory, size_t size)
+{
+    // the chunk starts as if after an allocated block and ends in an empty
+    // allocated one, so coalesce never reads outside it, into memory another
+    // arena or another allocator owns
+    mem_block_header_t *block = memory;
+    block->block_metadata = PREV_ALLOCATED;
+    set_block_metadata(block, size, false);
+    mem_block_header_t *epilogue = get_successor(block);
+    epilogue->block_metadata = PREV_ALLOCATED;
+    set_block_metadata(epilogue, 0, true);
+    return block;
 }
 
 /*
@@ -191,50 +597,133 @@ mem_block_header_t *find(size_t payload_size)
  */
 mem_block_header_t *extend(size_t size)
 {
-    mem_block_header_t *extended = (mem_block_header_t *)csbrk(ALIGN(size + sizeof(mem_block_header_t)));
+    call_once(&arenas_once, init_arenas);
+    mtx_lock(&heap_lock);
+    void *extended = csbrk(ALIGN(size) + 2 * sizeof(mem_block_header_t));
+    mtx_unlock(&heap_lock);
     if (extended == NULL)
     {
         return NULL;
     }
-    set_block_metadata(extended, size, false);
-    return extended;
+    atomic_fetch_add(&heap_size, ALIGN(size) + 2 * sizeof(mem_block_header_t));
+    return make_chunk(extended, ALIGN(size));
 }
 
-// helper method to add block to freelist, used in split and ufree
-void freelist_add(mem_block_header_t *block, size_t size)
+/*
+ * extend_top - grows the heap by at least size bytes in place, if the chunk
+ * of an arena ending in epilogue is the last one before the program break.
+ * Returns the number of bytes the epilogue moved up by, or 0.
+ */
+static size_t extend_top(umalloc_arena_t *arena, mem_block_header_t *epilogue, size_t size)
 {
-    int index = select_bin_index(size);
-    mem_block_header_t *bin = free_heads[index];
-    mem_block_header_t *prev = NULL;
-    while (bin != NULL && get_size(block) > get_size(bin))
+    // at least enough for a chunk, in case the break moves meanwhile
+    size_t increment = ALIGN(size) < 3 * sizeof(mem_block_header_t) ? 3 * sizeof(mem_block_header_t) : ALIGN(size);
+    mtx_lock(&heap_lock);
+    void *top = csbrk(0);
+    void *memory = top == (void *)get_successor(epilogue) ? csbrk(increment) : NULL;
+    mtx_unlock(&heap_lock);
+    if (memory == NULL)
     {
-        prev = bin;
-        bin = bin->next;
+        return 0;
     }
-    if (prev == NULL)
+    atomic_fetch_add(&heap_size, increment);
+    if (memory != top)
+    {
+        // another allocator moved the break in between, so the memory does not
+        // follow the chunk; the arena keeps it as a chunk of its own
+        mem_block_header_t *chunk = make_chunk(memory, increment - 2 * sizeof(mem_block_header_t));
+        freelist_add(arena, chunk, get_size(chunk));
+        return 0;
+    }
+
+    mem_block_header_t *moved = (mem_block_header_t *)((uintptr_t)epilogue + increment);
+    moved->block_metadata = PREV_ALLOCATED;
+    set_block_metadata(moved, 0, true);
+    return increment;
+}
+
+/*
+ * add_chunk - hands size bytes of memory no chunk covers to an arena, as a
+ * chunk holding one free block.
+ */
+static void add_chunk(umalloc_arena_t *arena, void *memory, size_t size)
+{
+    mem_block_header_t *chunk = make_chunk(memory, size - 2 * sizeof(mem_block_header_t));
+    mtx_lock(&arena->lock);
+    freelist_add(arena, chunk, get_size(chunk));
+    mtx_unlock(&arena->lock);
+}
+
+/*
+ * extend_pages - takes a page from the heap, starting at a page boundary. The
+ * memory up to the boundary becomes a chunk of the calling thread's arena.
+ */
+static void *extend_pages(void)
+{
+    umalloc_arena_t *arena = get_cache()->arena;
+    while (true)
+    {
+        // the gap must hold a chunk, even an empty one
+        mtx_lock(&heap_lock);
+        uintptr_t top = (uintptr_t)csbrk(0);
+        size_t gap = (UCACHE_SLAB_SIZE - top % UCACHE_SLAB_SIZE) % UCACHE_SLAB_SIZE;
+        if (gap != 0 && gap < 3 * sizeof(mem_block_header_t))
+        {
+            gap += UCACHE_SLAB_SIZE;
+        }
+        void *memory = csbrk(gap + UCACHE_SLAB_SIZE);
+        mtx_unlock(&heap_lock);
+        if (memory == NULL)
+        {
+            return NULL;
+        }
+        atomic_fetch_add(&heap_size, gap + UCACHE_SLAB_SIZE);
+        if ((uintptr_t)memory != top)
+        {
+            // another allocator moved the break in between, so the page is
+            // not aligned; the arena keeps the memory and the page is retried
+            add_chunk(arena, memory, gap + UCACHE_SLAB_SIZE);
+            continue;
+        }
+        if (gap != 0)
+        {
+            add_chunk(arena, memory, gap);
+        }
+        return (void *)(top + gap);
+    }
+}
+
+// helper method to add block to freelist, used in split and ufree
+void freelist_add(umalloc_arena_t *arena, mem_block_header_t *block, size_t size)
+{
+    if (size <= SMALL_BIN_MAX)
     {
-        block->next = free_heads[index];
-        free_heads[index] = block;
+        bin_push(arena, select_bin_index(size), block);
     }
     else
     {
-        block->next = prev->next;
-        prev->next = block;
+        arena->large_blocks = tree_insert(arena->large_blocks, block);
     }
+    // the block after it can now find it and merge with it
+    set_footer(block);
+    set_prev_allocated(get_successor(block), false);
 }
 
 /*
  * split - splits a given block in parts, one allocated, one free.
  */
-mem_block_header_t *split(mem_block_header_t *block, size_t new_block_size)
+mem_block_header_t *split(umalloc_arena_t *arena, mem_block_header_t *block, size_t new_block_size)
 {
     if (get_size(block) >= ALIGN(new_block_size) + sizeof(mem_block_header_t) + 32)
     {
         size_t remaining_size = get_size(block) - ALIGN(new_block_size) - sizeof(mem_block_header_t);
         set_block_metadata(block, ALIGN(new_block_size), true);
         mem_block_header_t *freeBlock = (mem_block_header_t *)((uintptr_t)block + sizeof(mem_block_header_t) + ALIGN(new_block_size));
+        freeBlock->block_metadata = PREV_ALLOCATED;
         set_block_metadata(freeBlock, remaining_size, false);
-        freelist_add(freeBlock, remaining_size);
+        // the block after may be free when a block shrinks in place
+        freeBlock = coalesce(arena, freeBlock);
+        freelist_add(arena, freeBlock, get_size(freeBlock));
     }
     return block;
 }
@@ -242,57 +731,141 @@ mem_block_header_t *split(mem_block_header_t *block, size_t new_block_size)
 /*
  * coalesce - coalesces a free memory block with neighbors.
  */
-mem_block_header_t *coalesce(mem_block_header_t *block)
+mem_block_header_t *coalesce(umalloc_arena_t *arena, mem_block_header_t *block)
 {
-    mem_block_header_t *current = block;
-    bool coalesced;
-    // do-while loop runs until there are no more blocks to coalesce in bin
-    do
+    // free blocks are merged as soon as they are released, so at most one
+    // neighbor on each side is free. A chunk of the heap is carved up by one
+    // arena only, so neither neighbor can belong to another arena.
+    mem_block_header_t *after = get_successor(block);
+    if (!is_allocated(after))
+    {
+        freelist_remove(arena, after);
+        set_block_metadata(block, get_size(block) + get_size(after) + sizeof(mem_block_header_t), false);
+    }
+    if (!is_prev_allocated(block))
+    {
+        mem_block_header_t *before = get_predecessor(block);
+        freelist_remove(arena, before);
+        set_block_metadata(before, get_size(before) + get_size(block) + sizeof(mem_block_header_t), false);
+        block = before;
+    }
+    return block;
+}
+
+/*
+ * resize - grows or shrinks an allocated block in place to hold size bytes.
+ * The caller holds the lock of the block's arena. Returns false if the block
+ * cannot grow in place.
+ */
+static bool resize(umalloc_arena_t *arena, mem_block_header_t *block, size_t size)
+{
+    // shrinking, or growing within the block, gives back the tail
+    size_t new_size = ALIGN(size);
+    if (get_size(block) >= new_size)
+    {
+        split(arena, block, new_size);
+        return true;
+    }
+
+    // otherwise the block can absorb a free block after it, and the memory
+    // past the break if its chunk ends there
+    mem_block_header_t *after = get_successor(block);
+    mem_block_header_t *end = after;
+    size_t available = get_size(block);
+    if (!is_allocated(after))
+    {
+        available += sizeof(mem_block_header_t) + get_size(after);
+        end = get_successor(after);
+    }
+    bool at_top = get_size(end) == 0; // only epilogues are empty
+    if (available < new_size && !at_top)
+    {
+        return false;
+    }
+    if (!is_allocated(after))
+    {
+        freelist_remove(arena, after);
+    }
+    if (available < new_size)
     {
-        coalesced = false;
-        int index = select_bin_index(get_size(current));
-        mem_block_header_t *prev = NULL;
-        mem_block_header_t *next = free_heads[index];
-        while (next != NULL)
+        size_t grown = extend_top(arena, end, new_size - available);
+        if (grown == 0)
         {
-            if (next != current)
+            // give the free block back
+            if (after != end)
             {
-                // checks if memory addresses are right next to each other and combines if they are
-                if ((uintptr_t)next + get_size(next) + sizeof(mem_block_header_t) == (uintptr_t)current)
-                {
-                    set_block_metadata(next, get_size(next) + get_size(current) + sizeof(mem_block_header_t), false);
-                    if (prev == NULL)
-                    {
-                        free_heads[index] = next->next;
-                    }
-                    else
-                    {
-                        prev->next = next->next;
-                    }
-                    current = next;
-                    coalesced = true;
-                    break;
-                }
-                else if ((uintptr_t)current + get_size(current) + sizeof(mem_block_header_t) == (uintptr_t)next)
-                {
-                    set_block_metadata(current, get_size(current) + get_size(next) + sizeof(mem_block_header_t), false);
-                    if (prev == NULL)
-                    {
-                        free_heads[index] = next->next;
-                    }
-                    else
-                    {
-                        prev->next = next->next;
-                    }
-                    coalesced = true;
-                    break;
-                }
+                freelist_add(arena, after, get_size(after));
             }
-            prev = next;
-            next = next->next;
+            return false;
         }
-    } while (coalesced);
-    return current;
+        available += grown;
+    }
+    set_block_metadata(block, available, true);
+    split(arena, block, new_size);
+    return true;
+}
+
+/*
+ * release - returns a block to the free lists of its arena. The caller holds
+ * the arena's lock.
+ */
+static void release(umalloc_arena_t *arena, mem_block_header_t *block)
+{
+    deallocate(block);
+    block = coalesce(arena, block);
+    freelist_add(arena, block, get_size(block));
+}
+
+/*
+ * drain_remote_frees - releases the blocks other arenas' threads freed. The
+ * caller holds the arena's lock. Taking the whole queue at once means a
+ * block can never be popped while another thread pushes it again.
+ */
+static void drain_remote_frees(umalloc_arena_t *arena)
+{
+    mem_block_header_t *block =
+        atomic_exchange_explicit(&arena->remote_frees, NULL, memory_order_acquire);
+    while (block != NULL)
+    {
+        mem_block_header_t *next = block->next;
+        release(arena, block);
+        block = next;
+    }
+}
+
+/*
+ * push_remote_free - hands a block back to the arena owning it, without
+ * taking its lock.
+ */
+static void push_remote_free(umalloc_arena_t *arena, mem_block_header_t *block)
+{
+    mem_block_header_t *head = atomic_load_explicit(&arena->remote_frees, memory_order_relaxed);
+    do
+    {
+        block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&arena->remote_frees, &head, block,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/*
+ * flush_cache - returns every block in a thread cache to its arena. Runs
+ * when the thread exits.
+ */
+static void flush_cache(void *ptr)
+{
+    thread_cache_t *cache = ptr;
+    mtx_lock(&cache->arena->lock);
+    for (int i = 0; i < TCACHE_CLASSES; i++)
+    {
+        while (cache->blocks[i] != NULL)
+        {
+            mem_block_header_t *block = cache->blocks[i];
+            cache->blocks[i] = block->next;
+            release(cache->arena, block);
+        }
+        cache->counts[i] = 0;
+    }
+    mtx_unlock(&cache->arena->lock);
 }
 
 /*
@@ -301,31 +874,86 @@ mem_block_header_t *coalesce(mem_block_header_t *block)
  */
 int uinit()
 {
-    // initializes bins with memory based on bin size
+    // seeds the bins of the calling thread's arena based on bin size
+    umalloc_arena_t *arena = get_cache()->arena;
     size_t arr[] = {64, 256, 512, 2048};
-    for (int i = 0; i < BIN_COUNT; i++)
+    mtx_lock(&arena->lock);
+    for (size_t i = 0; i < sizeof(arr) / sizeof(arr[0]); i++)
     {
-        mem_block_header_t *bin = free_heads[i];
-        bin = extend(arr[i]);
-        set_block_metadata(bin, arr[i], false);
+        mem_block_header_t *bin = extend(arr[i]);
+        if (bin == NULL)
+        {
+            mtx_unlock(&arena->lock);
+            return -1;
+        }
+        freelist_add(arena, bin, get_size(bin));
     }
+    mtx_unlock(&arena->lock);
     return 0;
 }
 
 /*
- * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * allocate_block - allocates a block of at least size bytes. fresh is set if
+ * the block was cut from memory the heap just grew by.
  */
-void *umalloc(size_t size)
+static mem_block_header_t *allocate_block(size_t size, bool *fresh)
 {
-    // find free node, if none found, extend space and return
-    mem_block_header_t *mem = find(size);
+    // small sizes come from the thread cache when it has a block of the class
+    thread_cache_t *cache = get_cache();
+    size_t class = size == 0 ? 0 : ALIGN(size) / ALIGNMENT - 1;
+    *fresh = false;
+    if (class < TCACHE_CLASSES && cache->blocks[class] != NULL)
+    {
+        mem_block_header_t *cached = cache->blocks[class];
+        cache->blocks[class] = cached->next;
+        cache->counts[class]--;
+        cached->arena = cache->arena;
+        return cached;
+    }
+
+    // find free node, if none found, extend space and return. A free block
+    // needs room for its list link and its footer.
+    size_t block_size = size == 0 ? ALIGNMENT : size;
+    umalloc_arena_t *arena = cache->arena;
+    mtx_lock(&arena->lock);
+    drain_remote_frees(arena);
+    mem_block_header_t *mem = find(arena, block_size);
+    if (mem == NULL)
+    {
+        mem = extend(block_size);
+        *fresh = true;
+    }
     if (mem == NULL)
     {
-        mem = extend(size);
+        mtx_unlock(&arena->lock);
+        return NULL;
     }
-    mem = split(mem, size);
+    mem = split(arena, mem, block_size);
     allocate(mem);
-    return get_payload(mem);
+    mtx_unlock(&arena->lock);
+    mem->arena = arena;
+    return mem;
+}
+
+/*
+ * get_owned_size - gets the size of an allocated block without the lock of
+ * its arena, which may flip its PREV_ALLOCATED bit meanwhile.
+ */
+static size_t get_owned_size(mem_block_header_t *block)
+{
+    return __atomic_load_n(&block->block_metadata, __ATOMIC_RELAXED) >> 4;
+}
+
+/*
+ * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ */
+void *umalloc(size_t size)
+{
+    bool fresh;
+    mem_block_header_t *mem = allocate_block(size, &fresh);
+    void *payload = mem == NULL ? NULL : get_payload(mem);
+    trace_event('a', payload, size);
+    return payload;
 }
 
 /**
@@ -340,9 +968,355 @@ void ufree(void *ptr)
         return; // Do nothing if the pointer is NULL
     }
 
-    // adds block back into freelist after it has been deallocated
+    // blocks of other arenas go back through their remote-free queue
     mem_block_header_t *pointer = get_header(ptr);
-    deallocate(pointer);
-    pointer = coalesce(pointer);
-    freelist_add(pointer, get_size(pointer));
-}
\ No newline at end of file
+    umalloc_arena_t *arena = pointer->arena;
+    thread_cache_t *cache = get_cache();
+    trace_event('f', ptr, 0);
+    if (arena != cache->arena)
+    {
+        push_remote_free(arena, pointer);
+        return;
+    }
+
+    // small blocks stay in the thread cache while it has room
+    size_t size = get_owned_size(pointer);
+    size_t class = size / ALIGNMENT - 1;
+    if (size % ALIGNMENT == 0 && class < TCACHE_CLASSES && cache->counts[class] < TCACHE_DEPTH)
+    {
+        pointer->next = cache->blocks[class];
+        cache->blocks[class] = pointer;
+        cache->counts[class]++;
+        return;
+    }
+
+    // adds block back into freelist after it has been deallocated
+    mtx_lock(&arena->lock);
+    release(arena, pointer);
+    mtx_unlock(&arena->lock);
+}
+
+/*
+ * urealloc - resizes the block ptr points to, or moves it to a new block of
+ * size bytes, and returns where it is. Growing absorbs a free block after it,
+ * and the memory past the break if its chunk ends there, before it moves.
+ */
+void *urealloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return umalloc(size);
+    }
+    if (size == 0)
+    {
+        ufree(ptr);
+        return NULL;
+    }
+
+    // the block may belong to another arena, whose lock guards its neighbors
+    mem_block_header_t *block = get_header(ptr);
+    umalloc_arena_t *arena = block->arena;
+    mtx_lock(&arena->lock);
+    bool resized = resize(arena, block, size);
+    mtx_unlock(&arena->lock);
+    if (resized)
+    {
+        trace_event('f', ptr, 0);
+        trace_event('a', ptr, size);
+        return ptr;
+    }
+
+    void *moved = umalloc(size);
+    if (moved != NULL)
+    {
+        size_t old_size = get_owned_size(block);
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+        ufree(ptr);
+    }
+    return moved;
+}
+
+/*
+ * ucalloc - allocates zeroed memory for count elements of size bytes each.
+ */
+void *ucalloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    size_t total = count * size;
+    bool fresh;
+    mem_block_header_t *mem = allocate_block(total, &fresh);
+    if (mem == NULL)
+    {
+        trace_event('a', NULL, total);
+        return NULL;
+    }
+
+    // pages the heap grew into are still zero from the kernel, but the page the
+    // break was in may hold whatever was there before it last moved down
+    uintptr_t payload = (uintptr_t)get_payload(mem);
+    size_t dirty = total;
+    if (fresh)
+    {
+        uintptr_t first_page_end = ((uintptr_t)mem + PAGESIZE) & ~(uintptr_t)(PAGESIZE - 1);
+        size_t before_page_end = first_page_end > payload ? first_page_end - payload : 0;
+        dirty = before_page_end < total ? before_page_end : total;
+    }
+    memset((void *)payload, 0, dirty);
+    trace_event('a', (void *)payload, total);
+    return (void *)payload;
+}
+
+/*
+ * uheap_size - returns the number of bytes umalloc has taken from the heap.
+ */
+size_t uheap_size(void)
+{
+    return atomic_load(&heap_size);
+}
+
+/*
+ * ucache_create - creates a cache of objects of size bytes, each aligned to
+ * align bytes.
+ */
+ucache_t *ucache_create(size_t size, size_t align)
+{
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0)
+    {
+        return NULL;
+    }
+    // a free slot has no links, but the bitmap of a slab only covers slots of
+    // ALIGNMENT bytes or more
+    size_t slot_size = size < ALIGNMENT ? ALIGNMENT : size;
+    slot_size = (slot_size + align - 1) & ~(align - 1);
+    size_t first_slot = (sizeof(ucache_slab_t) + align - 1) & ~(align - 1);
+    if (first_slot + slot_size > UCACHE_SLAB_SIZE)
+    {
+        return NULL;
+    }
+
+    ucache_t *cache = umalloc(sizeof(ucache_t));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    if (mtx_init(&cache->lock, mtx_plain) != thrd_success)
+    {
+        ufree(cache);
+        return NULL;
+    }
+    cache->slot_size = slot_size;
+    cache->first_slot = first_slot;
+    cache->slots_per_slab = (UCACHE_SLAB_SIZE - first_slot) / slot_size;
+    cache->partial = NULL;
+    cache->empty_slabs = 0;
+    cache->hits = 0;
+    cache->refills = 0;
+    return cache;
+}
+
+/*
+ * slab_push - adds a slab to the front of the slabs with a free slot.
+ */
+static void slab_push(ucache_t *cache, ucache_slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial != NULL)
+    {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+/*
+ * slab_unlink - removes a slab from the slabs with a free slot.
+ */
+static void slab_unlink(ucache_t *cache, ucache_slab_t *slab)
+{
+    if (slab->prev == NULL)
+    {
+        cache->partial = slab->next;
+    }
+    else
+    {
+        slab->prev->next = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/*
+ * slab_create - takes a page from the heap and makes it an empty slab of a
+ * cache.
+ */
+static ucache_slab_t *slab_create(ucache_t *cache)
+{
+    ucache_slab_t *slab = extend_pages();
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    slab->cache = cache;
+    slab->free_count = cache->slots_per_slab;
+    for (size_t i = 0; i < UCACHE_MAP_WORDS; i++)
+    {
+        size_t first = i * 64;
+        size_t slots = first >= cache->slots_per_slab ? 0 : cache->slots_per_slab - first;
+        slab->free_map[i] = slots >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << slots) - 1;
+    }
+    slab_push(cache, slab);
+    cache->empty_slabs++;
+    return slab;
+}
+
+/*
+ * cache_alloc - allocates an object from a cache, in the first free slot of
+ * the slab most recently given one. Only takes a new slab if refill is set.
+ */
+static void *cache_alloc(ucache_t *cache, bool refill)
+{
+    mtx_lock(&cache->lock);
+    ucache_slab_t *slab = cache->partial;
+    if (slab != NULL)
+    {
+        cache->hits++;
+    }
+    else if (refill && (slab = slab_create(cache)) != NULL)
+    {
+        cache->refills++;
+    }
+    else
+    {
+        mtx_unlock(&cache->lock);
+        return NULL;
+    }
+
+    if (slab->free_count == cache->slots_per_slab)
+    {
+        cache->empty_slabs--;
+    }
+    size_t word = 0;
+    while (slab->free_map[word] == 0)
+    {
+        word++;
+    }
+    size_t bit = (size_t)__builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= ~((uint64_t)1 << bit);
+    if (--slab->free_count == 0)
+    {
+        slab_unlink(cache, slab);
+    }
+    mtx_unlock(&cache->lock);
+    return (void *)((uintptr_t)slab + cache->first_slot + (word * 64 + bit) * cache->slot_size);
+}
+
+/*
+ * ucache_alloc - allocates an object from a cache, taking a page from the
+ * heap if no slab has a free slot.
+ */
+void *ucache_alloc(ucache_t *cache)
+{
+    return cache_alloc(cache, true);
+}
+
+/*
+ * ucache_try_alloc - allocates an object from a slab the cache already has,
+ * and never grows the heap.
+ */
+void *ucache_try_alloc(ucache_t *cache)
+{
+    return cache_alloc(cache, false);
+}
+
+/*
+ * ucache_free - returns an object to the cache it was allocated from. A slab
+ * left empty goes back to umalloc if the cache already holds an empty one.
+ */
+void ucache_free(ucache_t *cache, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    ucache_slab_t *slab = (ucache_slab_t *)((uintptr_t)ptr & ~(uintptr_t)(UCACHE_SLAB_SIZE - 1));
+    assert(slab->cache == cache);
+    size_t slot = ((uintptr_t)ptr - (uintptr_t)slab - cache->first_slot) / cache->slot_size;
+
+    mtx_lock(&cache->lock);
+    slab->free_map[slot / 64] |= (uint64_t)1 << (slot % 64);
+    if (slab->free_count++ == 0)
+    {
+        slab_push(cache, slab);
+    }
+    if (slab->free_count == cache->slots_per_slab)
+    {
+        if (cache->empty_slabs > 0)
+        {
+            slab_unlink(cache, slab);
+            add_chunk(get_cache()->arena, slab, UCACHE_SLAB_SIZE);
+        }
+        else
+        {
+            cache->empty_slabs++;
+        }
+    }
+    mtx_unlock(&cache->lock);
+}
+
+/*
+ * ucache_stats - reads the hit and refill counters of a cache.
+ */
+void ucache_stats(ucache_t *cache, size_t *hits, size_t *refills)
+{
+    mtx_lock(&cache->lock);
+    *hits = cache->hits;
+    *refills = cache->refills;
+    mtx_unlock(&cache->lock);
+}
+
+/*
+ * ucache_destroy - returns the slabs of a cache to umalloc and frees it. Every
+ * object of the cache must have been freed.
+ */
+void ucache_destroy(ucache_t *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+    umalloc_arena_t *arena = get_cache()->arena;
+    while (cache->partial != NULL)
+    {
+        ucache_slab_t *slab = cache->partial;
+        assert(slab->free_count == cache->slots_per_slab);
+        cache->partial = slab->next;
+        add_chunk(arena, slab, UCACHE_SLAB_SIZE);
+    }
+    mtx_destroy(&cache->lock);
+    ufree(cache);
+}
+
+#ifdef UMALLOC_TRACE
+/*
+ * trace_event - appends one call to the trace, opening it the first time.
+ */
+static void trace_event(char op, void *ptr, size_t size)
+{
+    mtx_lock(&trace_lock);
+    if (trace_file == NULL)
+    {
+        const char *path = getenv("UMALLOC_TRACE");
+        trace_file = fopen(path != NULL ? path : "umalloc.trace", "w");
+    }
+    if (trace_file != NULL)
+    {
+        fprintf(trace_file, "%c %p %zu\n", op, ptr, size);
+    }
+    mtx_unlock(&trace_lock);
+}
+#endif
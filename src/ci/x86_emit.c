@@ -0,0 +1,279 @@
+#define _DEFAULT_SOURCE  // MAP_ANONYMOUS
+#include "x86_emit.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_NATIVE_CODE
+#include <sys/mman.h>
+#endif
+
+static void emit_rex(Emitter *e, uint8_t reg, uint8_t rm);
+static void emit_rbx_operand(Emitter *e, uint8_t reg, int32_t disp);
+static void emit_fixup(Emitter *e, size_t label);
+
+void emit8(Emitter *e, uint8_t byte) {
+    if (e->length == e->capacity) {
+        size_t   capacity = e->capacity ? e->capacity * 2 : 4096;
+        uint8_t *buf      = realloc(e->buf, capacity);
+        if (!buf) {
+            e->failed = true;
+            return;
+        }
+        e->buf      = buf;
+        e->capacity = capacity;
+    }
+    e->buf[e->length++] = byte;
+}
+
+void emit32(Emitter *e, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit8(e, (uint8_t) (value >> (8 * i)));
+    }
+}
+
+void emit64(Emitter *e, uint64_t value) {
+    emit32(e, (uint32_t) value);
+    emit32(e, (uint32_t) (value >> 32));
+}
+
+void emit_patch32(Emitter *e, size_t at, size_t to) {
+    if (e->failed) {
+        return;
+    }
+    uint32_t rel = (uint32_t) (to - (at + 4));
+    for (int i = 0; i < 4; i++) {
+        e->buf[at + i] = (uint8_t) (rel >> (8 * i));
+    }
+}
+
+void emit_load(Emitter *e, uint8_t reg, int32_t disp) {
+    emit_rex(e, reg, RBX);
+    emit8(e, 0x8B);
+    emit_rbx_operand(e, reg, disp);
+}
+
+void emit_store(Emitter *e, int32_t disp, uint8_t reg) {
+    emit_rex(e, reg, RBX);
+    emit8(e, 0x89);
+    emit_rbx_operand(e, reg, disp);
+}
+
+void emit_lea(Emitter *e, uint8_t reg, int32_t disp) {
+    emit_rex(e, reg, RBX);
+    emit8(e, 0x8D);
+    emit_rbx_operand(e, reg, disp);
+}
+
+void emit_store_imm(Emitter *e, int32_t disp, int64_t value) {
+    if (value == (int32_t) value) {
+        emit8(e, 0x48), emit8(e, 0xC7);
+        emit_rbx_operand(e, 0, disp);
+        emit32(e, (uint32_t) value);
+    } else {
+        emit_mov_imm(e, RAX, value);
+        emit_store(e, disp, RAX);
+    }
+}
+
+void emit_store_byte(Emitter *e, int32_t disp, uint8_t value) {
+    emit8(e, 0xC6);
+    emit_rbx_operand(e, 0, disp);
+    emit8(e, value);
+}
+
+void emit_mov(Emitter *e, uint8_t dst, uint8_t src) {
+    emit_rex(e, src, dst);
+    emit8(e, 0x89);
+    emit8(e, 0xC0 | (uint8_t) ((src & 7) << 3) | (dst & 7));
+}
+
+void emit_mov_imm(Emitter *e, uint8_t reg, int64_t value) {
+    if (value == (int32_t) value) {
+        emit_rex(e, 0, reg);
+        emit8(e, 0xC7), emit8(e, 0xC0 | (reg & 7));
+        emit32(e, (uint32_t) value);
+    } else if (value > 0 && value <= (int64_t) UINT32_MAX) {
+        // Writing the 32-bit register zero-extends into the full one.
+        if (reg >= R8) {
+            emit8(e, 0x41);
+        }
+        emit8(e, 0xB8 | (reg & 7));
+        emit32(e, (uint32_t) value);
+    } else {
+        emit_rex(e, 0, reg);
+        emit8(e, 0xB8 | (reg & 7));
+        emit64(e, (uint64_t) value);
+    }
+}
+
+void emit_alu(Emitter *e, uint8_t op, uint8_t dst, uint8_t src) {
+    emit_rex(e, src, dst);
+    emit8(e, op);
+    emit8(e, 0xC0 | (uint8_t) ((src & 7) << 3) | (dst & 7));
+}
+
+void emit_alu_load(Emitter *e, uint8_t op, uint8_t reg, int32_t disp) {
+    emit_rex(e, reg, RBX);
+    emit8(e, op + 2);
+    emit_rbx_operand(e, reg, disp);
+}
+
+void emit_alu_imm(Emitter *e, uint8_t op, uint8_t reg, int64_t value) {
+    if (value == (int32_t) value) {
+        emit_rex(e, 0, reg);
+        emit8(e, 0x81), emit8(e, 0xC0 | (uint8_t) ((op >> 3) << 3) | (reg & 7));
+        emit32(e, (uint32_t) value);
+    } else {
+        emit_mov_imm(e, RCX, value);
+        emit_alu(e, op, reg, RCX);
+    }
+}
+
+void emit_shift(Emitter *e, uint8_t shift, uint8_t reg, int64_t count) {
+    emit_rex(e, 0, reg);
+    emit8(e, 0xC1), emit8(e, 0xC0 | (uint8_t) (shift << 3) | (reg & 7));
+    emit8(e, (uint8_t) (count & 63));
+}
+
+void emit_setcc(Emitter *e, uint8_t cc, int32_t disp) {
+    emit8(e, 0x0F), emit8(e, 0x90 | cc);
+    emit_rbx_operand(e, 0, disp);
+}
+
+void emit_test_byte(Emitter *e, int32_t disp) {
+    emit8(e, 0x80);
+    emit_rbx_operand(e, 7, disp);
+    emit8(e, 0);
+}
+
+void emit_test_either(Emitter *e, int32_t first, int32_t second) {
+    emit8(e, 0x0F), emit8(e, 0xB6);
+    emit_rbx_operand(e, RAX, first);
+    emit8(e, 0x0A);
+    emit_rbx_operand(e, RAX, second);
+}
+
+void emit_push(Emitter *e, uint8_t reg) {
+    if (reg >= R8) {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x50 | (reg & 7));
+}
+
+void emit_pop(Emitter *e, uint8_t reg) {
+    if (reg >= R8) {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x58 | (reg & 7));
+}
+
+void emit_call(Emitter *e, uint64_t function) {
+    emit8(e, 0x48), emit8(e, 0xB8), emit64(e, function);  // mov rax, function
+    emit8(e, 0xFF), emit8(e, 0xD0);                        // call rax
+}
+
+void emit_jump(Emitter *e, size_t label) {
+    emit8(e, 0xE9), emit32(e, 0);
+    emit_fixup(e, label);
+}
+
+void emit_jcc(Emitter *e, uint8_t cc, size_t label) {
+    emit8(e, 0x0F), emit8(e, 0x80 | cc), emit32(e, 0);
+    emit_fixup(e, label);
+}
+
+void emit_resolve(Emitter *e, const size_t *offsets) {
+    for (size_t f = 0; f < e->fixup_count; f++) {
+        emit_patch32(e, e->fixups[f].at, offsets[e->fixups[f].label]);
+    }
+    e->fixup_count = 0;
+}
+
+uint8_t *emit_map(Emitter *e, size_t *size) {
+#ifdef HAVE_NATIVE_CODE
+    if (e->failed || e->length == 0) {
+        return NULL;
+    }
+
+    uint8_t *code = mmap(NULL, e->length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(code, e->buf, e->length);
+    if (mprotect(code, e->length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, e->length);
+        return NULL;
+    }
+
+    *size = e->length;
+    return code;
+#else
+    return NULL;
+#endif
+}
+
+void emit_unmap(uint8_t *code, size_t size) {
+#ifdef HAVE_NATIVE_CODE
+    if (code) {
+        munmap(code, size);
+    }
+#endif
+}
+
+void emit_free(Emitter *e) {
+    free(e->buf);
+    free(e->fixups);
+    memset(e, 0, sizeof(Emitter));
+}
+
+/**
+ * @brief Emits the REX prefix of a 64-bit instruction.
+ *
+ * @param e The emitter to append to.
+ * @param reg The register in the ModRM reg field.
+ * @param rm The register in the ModRM rm field.
+ */
+static void emit_rex(Emitter *e, uint8_t reg, uint8_t rm) {
+    emit8(e, 0x48 | (uint8_t) ((reg & 8) >> 1) | (uint8_t) ((rm & 8) >> 3));
+}
+
+/**
+ * @brief Emits a ModRM operand addressing `[rbx + disp]`.
+ *
+ * @param e The emitter to append to.
+ * @param reg The register or opcode extension of the ModRM byte.
+ * @param disp The displacement from rbx.
+ */
+static void emit_rbx_operand(Emitter *e, uint8_t reg, int32_t disp) {
+    uint8_t field = (uint8_t) ((reg & 7) << 3) | RBX;
+    if (disp >= INT8_MIN && disp <= INT8_MAX) {
+        emit8(e, 0x40 | field);
+        emit8(e, (uint8_t) disp);
+    } else {
+        emit8(e, 0x80 | field);
+        emit32(e, (uint32_t) disp);
+    }
+}
+
+/**
+ * @brief Records a fixup for the displacement that was just emitted.
+ *
+ * @param e The emitter holding the code.
+ * @param label The label the jump should land on.
+ */
+static void emit_fixup(Emitter *e, size_t label) {
+    if (e->fixup_count == e->fixup_capacity) {
+        size_t capacity = e->fixup_capacity ? e->fixup_capacity * 2 : 256;
+        Fixup *fixups   = realloc(e->fixups, capacity * sizeof(Fixup));
+        if (!fixups) {
+            e->failed = true;
+            return;
+        }
+        e->fixups         = fixups;
+        e->fixup_capacity = capacity;
+    }
+    e->fixups[e->fixup_count].at    = e->length - 4;
+    e->fixups[e->fixup_count].label = label;
+    e->fixup_count++;
+}
@@ -0,0 +1,2 @@
+// flags: -b testcases/flags/batch -w 2 -O -v
+// Runs the programs in testcases/flags/batch on two threads.
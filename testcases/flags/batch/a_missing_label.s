@@ -0,0 +1,5 @@
+// The warning about the missing label is printed with this program's output.
+    mov x1, 1
+    cmp x1, 2
+    b.gt nowhere
+    print x1, d
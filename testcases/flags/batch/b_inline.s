@@ -0,0 +1,9 @@
+// The report of the inlined call is printed with this program's output.
+    mov x1, 20
+    call inc
+    print x0, d
+    b end
+inc:
+    add x0, x1, 1
+    ret
+end:
@@ -0,0 +1,77 @@
+// flags: -O -v
+// The popcount stages, a counted sum, a counted series and a loop stepping
+// its counter by two. The first three become native kernels; the last one
+// is not a counted accumulation and stays a loop.
+    mov x0, 0xDEADBEEF
+    call popcount
+    print x0, d
+    mov x0, 0x137F
+    call popcount
+    print x0, d
+
+    // x1 += 7 until x2 counts from 0 up to 1000.
+    mov x1, 5
+    mov x2, 0
+    mov x3, 1000
+sum:
+    add x1, x1, 7
+    add x2, x2, 1
+    cmp x2, x3
+    b.eq sum_done
+    b sum
+sum_done:
+    print x1, d
+
+    // x4 += x5 while x5 counts down from 300 to 0.
+    mov x4, 0
+    mov x5, 300
+series:
+    cmp x5, 0
+    b.eq series_done
+    add x4, x4, x5
+    sub x5, x5, 1
+    b series
+series_done:
+    print x4, d
+
+    // Steps by two, so it has no closed form here.
+    mov x6, 0
+    mov x7, 0
+near_miss:
+    add x6, x6, 3
+    add x7, x7, 2
+    cmp x7, 50
+    b.eq near_done
+    b near_miss
+near_done:
+    print x6, d
+    b end
+
+popcount:
+    mov x10, 0x55555555
+    and x11, x0, x10
+    lsr x12, x0, 1
+    and x12, x12, x10
+    add x0, x11, x12
+    mov x10, 0x33333333
+    and x11, x0, x10
+    lsr x12, x0, 2
+    and x12, x12, x10
+    add x0, x11, x12
+    mov x10, 0x0F0F0F0F
+    and x11, x0, x10
+    lsr x12, x0, 4
+    and x12, x12, x10
+    add x0, x11, x12
+    mov x10, 0x00FF00FF
+    and x11, x0, x10
+    lsr x12, x0, 8
+    and x12, x12, x10
+    add x0, x11, x12
+    mov x10, 0x0000FFFF
+    and x11, x0, x10
+    lsr x12, x0, 16
+    and x12, x12, x10
+    add x0, x11, x12
+    ret
+end:
@@ -0,0 +1,23 @@
+// flags: -O -s 12 -n 2 -v
+// dbl is inlined into sum_dbl in the first round and sum_dbl into main in the
+// second; the caller's x3 survives both copies.
+    mov x3, 100
+    mov x1, 3
+    mov x2, 4
+    call sum_dbl
+    print x0, d
+    print x3, d
+    b end
+sum_dbl:
+    call dbl
+    add x3, x0, 0
+    add x1, x2, 0
+    call dbl
+    add x0, x0, x3
+    ret
+dbl:
+    mov x0, 0
+    add x0, x0, x1
+    lsl x0, x0, 1
+    ret
+end:
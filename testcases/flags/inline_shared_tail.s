@@ -0,0 +1,14 @@
+// flags: -O
+// f ends in code the caller also runs after the call, so f is not copied.
+    mov x1, 5
+    mov x2, 1
+    call f
+.A:
+    print x1, d
+    add x2, x2, 1
+    print x2, d
+    ret
+f:
+    mov x1, 7
+    mov x2, 10
+    b .A
@@ -0,0 +1,23 @@
+// flags: -j
+// Every access size through the bounds-checked memory calls the generated
+// code makes, a string put at a constant and at a register address, and an
+// out-of-bounds load that stops the run.
+    mov x0, 0x1122334455667788
+    store x0 0 8
+    load x1 1 0
+    load x2 2 0
+    load x3 4 0
+    load x4 8 0
+    print x4 x
+    store x1 16 1
+    store x2 17 2
+    store x3 19 4
+    load x5 8 16
+    print x5 x
+    put "jit" 32
+    print 32 s
+    mov x6, 40
+    put "ok" x6
+    print x6 s
+    load x7 8 0xFFFFFFFF
+    print x7 d
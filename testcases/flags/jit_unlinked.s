@@ -0,0 +1,15 @@
+// flags: -j
+// Unresolved labels reach the generated code as error paths: an untaken
+// branch to one falls through, and a call to one stops the run.
+    mov x0, 3
+    cmp x0, 4
+    b.eq missing_branch
+    call double
+    print x0 d
+    call missing_call
+    print x0 d
+    b end
+double:
+    add x0, x0, x0
+    ret
+end:
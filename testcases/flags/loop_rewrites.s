@@ -0,0 +1,22 @@
+// flags: -O -u 4 -v
+// The loop in sum_loop gets all three rewrites: x5 is invariant and hoisted,
+// x6 is a shifted induction variable stepped by 8 instead, and the loop,
+// one block counted by x2, is unrolled four times.
+    mov x1, 10
+    call sum_loop
+    print x0, d
+    b end
+sum_loop:
+    mov x2, 0
+    mov x0, 0
+loop:
+    add x5, x1, 7
+    lsl x6, x2, 3
+    add x6, x6, 100
+    add x0, x0, x6
+    add x0, x0, x5
+    add x2, x2, 1
+    cmp x2, 21
+    b.lt loop
+    ret
+end:
@@ -0,0 +1,26 @@
+// flags: -m 8 -d 4
+// f is cached at the top level, then called again four calls deep. The hit
+// must not hide the overflow the call raises without -m.
+    mov x9, 4
+    cmp x9, 4
+    mov x1, 3
+    call f
+    mov x2, 0
+    call g
+    b end
+g:
+    add x2, x2, 1
+    cmp x2, 4
+    b.lt deeper
+    mov x1, 3
+    call f
+    add x0, x0, 0
+    ret
+deeper:
+    call g
+    add x0, x0, 0
+    ret
+f:
+    add x0, x1, 1
+    ret
+end:
@@ -0,0 +1,20 @@
+// flags: -m 4 -e lru
+// A table of four under LRU keeps the two calls each level needs next.
+    mov x0, 24
+    call fib
+    print x0, d
+    b end
+fib:
+    cmp x0, 1
+    b.le .Lexit
+    sub x1, x0, 1
+    sub x2, x0, 2
+    add x0, x1, 0
+    call fib
+    add x3, x0, 0
+    add x0, x2, 0
+    call fib
+    add x0, x0, x3
+.Lexit:
+    ret
+end:
@@ -0,0 +1,52 @@
+// flags: -O
+// Constant propagation folds every line here down to known values: a long
+// chain of arithmetic, shift counts of 64 and over, which the host takes
+// modulo 64, a branch on flags known at compile time and the block it makes
+// unreachable, a store that is overwritten before it is read, and put and
+// load at addresses held in registers known to be constant.
+    mov x1, 6
+    mov x2, 7
+    add x3, x1, x2
+    sub x4, x3, 20
+    and x5, x3, x2
+    orr x6, x5, x1
+    eor x7, x6, x4
+    add x7, x7, 0
+    print x3, d
+    print x4, d
+    print x7, d
+    mov x8, 1
+    lsl x9, x8, 64
+    lsl x10, x8, 67
+    mov x11, 0
+    sub x11, x11, 256
+    lsr x12, x11, 68
+    asr x13, x11, 130
+    print x9, d
+    print x10, d
+    print x12, x
+    print x13, d
+    mov x14, 100
+    mov x14, 200
+    add x14, x14, 1
+    cmp x1, 6
+    b.eq known
+    print x14, d
+    mov x14, 0
+known:
+    b.ne dead
+    print x14, d
+    b done
+dead:
+    print 999, d
+    mov x15, 1
+done:
+    mov x16, 64
+    put "opt" x16
+    print x16, s
+    mov x17, 0x6D6974
+    store x17 80 4
+    mov x18, 80
+    load x19 4 x18
+    print x19, x
+    print x18, s
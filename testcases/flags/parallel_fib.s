@@ -0,0 +1,26 @@
+// flags: -t 4
+// The two recursive calls of fib are independent and pure, so the second
+// runs on another thread while the first runs here.
+    mov x19, 0
+loop:
+    add x0, x19, 0
+    call fib
+    print x0, d
+    add x19, x19, 5
+    cmp x19, 25
+    b.le loop
+    b end
+fib:
+    cmp x0, 1
+    b.le .Lexit
+    sub x1, x0, 1
+    sub x2, x0, 2
+    add x0, x1, 0
+    call fib
+    add x3, x0, 0
+    add x0, x2, 0
+    call fib
+    add x0, x0, x3
+.Lexit:
+    ret
+end:
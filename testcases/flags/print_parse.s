@@ -0,0 +1,14 @@
+// flags: -p
+// Branches and calls keep their label apart from the other operands.
+    mov x1, 2
+    b start
+    mov x1, 3
+start:
+    call double
+    print x1, d
+    b.gt done
+done:
+    ret
+double:
+    add x1, x1, x1
+    ret
@@ -0,0 +1,17 @@
+// flags: -d 10
+// A loop of 100000 calls in tail position. Tail calls use no frame, so it
+// finishes within a call depth of ten.
+    mov x0, 0
+    mov x2, 100000
+    call count
+    print x0, d
+    b end
+count:
+    cmp x2, 0
+    b.eq done
+    sub x2, x2, 1
+    add x0, x0, 3
+    call count
+done:
+    ret
+end:
@@ -0,0 +1,251 @@
+#include "mem.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DUMP_MAX 4096  // Bytes of `mem_print()` output kept for checking.
+
+// Records a failed check and where it was, and carries on with the next one.
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        checks++;                                                          \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+static size_t checks;
+static size_t failures;
+
+static void test_fill(void);
+static void test_copy(void);
+static void test_compare(void);
+static void test_reset(void);
+static void test_empty(void);
+static void test_dump_range(void);
+static bool dump(const Memory *mem, char *text);
+static bool all_equal(const Memory *mem, size_t offset, uint8_t value, size_t length);
+
+/**
+ * @brief Checks the bulk operations of `Memory` at the edges of their ranges,
+ * and the range `mem_print()` shows around every placement of modified bytes.
+ *
+ * Usage: mem_test
+ */
+int main(void) {
+    test_fill();
+    test_copy();
+    test_compare();
+    test_reset();
+    test_empty();
+    test_dump_range();
+    printf("%zu of %zu checks passed\n", checks - failures, checks);
+    return failures > 0;
+}
+
+/**
+ * @brief Fills of no bytes, up to the end, and past it.
+ */
+static void test_fill(void) {
+    Memory mem;
+    CHECK(mem_init(&mem, 40));
+
+    CHECK(mem_fill(&mem, 0, 0xAA, 0));
+    CHECK(mem_fill(&mem, 40, 0xAA, 0));
+    CHECK(!mem_fill(&mem, 41, 0xAA, 0));
+    CHECK(all_equal(&mem, 0, 0, 40));
+
+    CHECK(mem_fill(&mem, 3, 0xAA, 37));
+    CHECK(all_equal(&mem, 0, 0, 3));
+    CHECK(all_equal(&mem, 3, 0xAA, 37));
+
+    // A range that runs past the end writes nothing, even where it would wrap.
+    CHECK(!mem_fill(&mem, 4, 0x55, 37));
+    CHECK(!mem_fill(&mem, 40, 0x55, 1));
+    CHECK(!mem_fill(&mem, SIZE_MAX, 0x55, 2));
+    CHECK(!mem_fill(&mem, 1, 0x55, SIZE_MAX));
+    CHECK(all_equal(&mem, 3, 0xAA, 37));
+    mem_free(&mem);
+}
+
+/**
+ * @brief Copies between two memories, and within one in both directions of
+ * overlap.
+ */
+static void test_copy(void) {
+    Memory a;
+    Memory b;
+    CHECK(mem_init(&a, 40));
+    CHECK(mem_init(&b, 40));
+    for (size_t i = 0; i < 40; i++) {
+        a.bytes[i] = (uint8_t) i;
+    }
+
+    CHECK(mem_copy(&b, 40, &a, 0, 0));
+    CHECK(mem_copy(&b, 0, &a, 40, 0));
+    CHECK(!mem_copy(&b, 0, &a, 1, 40));
+    CHECK(!mem_copy(&b, 1, &a, 0, 40));
+    CHECK(!mem_copy(&b, SIZE_MAX, &a, 0, 1));
+    CHECK(all_equal(&b, 0, 0, 40));
+
+    CHECK(mem_copy(&b, 0, &a, 0, 40));
+    CHECK(memcmp(a.bytes, b.bytes, 40) == 0);
+
+    // Forwards: the source is read before the overlap is overwritten.
+    CHECK(mem_copy(&a, 5, &a, 0, 30));
+    for (size_t i = 0; i < 30; i++) {
+        CHECK(a.bytes[5 + i] == i);
+    }
+    CHECK(a.bytes[35] == 35);
+
+    // Backwards, from the snapshot taken above.
+    CHECK(mem_copy(&b, 0, &b, 7, 33));
+    for (size_t i = 0; i < 33; i++) {
+        CHECK(b.bytes[i] == 7 + i);
+    }
+    CHECK(b.bytes[33] == 33);
+    mem_free(&a);
+    mem_free(&b);
+}
+
+/**
+ * @brief Comparisons of empty, equal and differing ranges, and of ranges out
+ * of bounds.
+ */
+static void test_compare(void) {
+    Memory a;
+    Memory b;
+    int    order = 1;
+    CHECK(mem_init(&a, 40));
+    CHECK(mem_init(&b, 20));
+
+    CHECK(mem_compare(&a, 40, &b, 20, 0, &order) && order == 0);
+    CHECK(mem_compare(&a, 20, &b, 0, 20, &order) && order == 0);
+    CHECK(!mem_compare(&a, 0, &b, 1, 20, &order));
+    CHECK(!mem_compare(&a, 21, &b, 0, 20, &order));
+
+    // Bytes compare unsigned, so 0x80 sorts after 0x7F.
+    a.bytes[39] = 0x80;
+    b.bytes[19] = 0x7F;
+    CHECK(mem_compare(&a, 20, &b, 0, 20, &order) && order > 0);
+    CHECK(mem_compare(&b, 0, &a, 20, 20, &order) && order < 0);
+    CHECK(mem_compare(&a, 0, &a, 1, 38, &order) && order == 0);
+    CHECK(mem_compare(&a, 0, &a, 1, 39, &order) && order < 0);
+    mem_free(&a);
+    mem_free(&b);
+}
+
+/**
+ * @brief Resets a memory that has been written throughout.
+ */
+static void test_reset(void) {
+    Memory mem;
+    char   text[DUMP_MAX];
+    CHECK(mem_init(&mem, 33));
+    CHECK(mem_fill(&mem, 0, 0xFF, 33));
+    mem_reset(&mem);
+    CHECK(all_equal(&mem, 0, 0, 33));
+    CHECK(dump(&mem, text) && strcmp(text, "Memory state:\nUnmodified\n") == 0);
+    mem_free(&mem);
+}
+
+/**
+ * @brief A memory of capacity 0 refuses every access but empty ones.
+ */
+static void test_empty(void) {
+    Memory  mem;
+    char    text[DUMP_MAX];
+    int64_t value = 1;
+    int     order = 1;
+    CHECK(mem_init(&mem, 0));
+    CHECK(mem.bytes == NULL);
+
+    CHECK(!mem_load_word(&mem, &value, 0, 1) && value == 0);
+    CHECK(!mem_store_word(&mem, 1, 0, 1));
+    CHECK(!mem_store_string(&mem, "", 0));
+    CHECK(mem_fill(&mem, 0, 0xAA, 0));
+    CHECK(!mem_fill(&mem, 0, 0xAA, 1));
+    CHECK(mem_copy(&mem, 0, &mem, 0, 0));
+    CHECK(!mem_copy(&mem, 0, &mem, 0, 1));
+    CHECK(mem_compare(&mem, 0, &mem, 0, 0, &order) && order == 0);
+    CHECK(!mem_compare(&mem, 0, &mem, 0, 1, &order));
+    mem_reset(&mem);
+    CHECK(dump(&mem, text) && strcmp(text, "Memory state:\nUnmodified\n") == 0);
+    mem_free(&mem);
+}
+
+/**
+ * @brief Places the first and last modified bytes everywhere in memories
+ * whose capacities are not all multiples of 16, so the vector scans meet
+ * modified bytes in a full chunk, in the tail after the last one, and at
+ * either end.
+ */
+static void test_dump_range(void) {
+    static const size_t capacities[] = {1, 15, 16, 17, 31, 32, 33, 47, 50};
+    char                text[DUMP_MAX];
+
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        size_t capacity = capacities[c];
+        Memory mem;
+        CHECK(mem_init(&mem, capacity));
+        for (size_t first = 0; first < capacity; first++) {
+            for (size_t last = first; last < capacity; last++) {
+                mem_reset(&mem);
+                mem.bytes[first] = 1;
+                mem.bytes[last]  = 0x80;
+
+                size_t start    = 0;
+                size_t end      = 0;
+                size_t expected = (last + 16) & ~(size_t) 0xF;
+                if (expected > capacity) {
+                    expected = capacity;
+                }
+                CHECK(dump(&mem, text) &&
+                      sscanf(text, "Memory state:\n0x%zx-0x%zx:", &start, &end) == 2);
+                CHECK(start == (first & ~(size_t) 0xF));
+                CHECK(end == expected - 1);
+            }
+        }
+        mem_free(&mem);
+    }
+}
+
+/**
+ * @brief Captures what `mem_print()` writes for a memory.
+ *
+ * @param mem The memory to print.
+ * @param text Receives the output, NUL-terminated; `DUMP_MAX` bytes.
+ * @return True if the output was captured whole, false otherwise.
+ */
+static bool dump(const Memory *mem, char *text) {
+    FILE *out = tmpfile();
+    if (!out) {
+        return false;
+    }
+    mem_print(mem, out);
+    rewind(out);
+    size_t length = fread(text, 1, DUMP_MAX - 1, out);
+    bool   whole  = feof(out) || fgetc(out) == EOF;
+    fclose(out);
+    text[length] = '\0';
+    return whole;
+}
+
+/**
+ * @brief Checks that every byte of a range holds one value.
+ *
+ * @param mem The memory to check.
+ * @param offset The offset of the first byte.
+ * @param value The value expected.
+ * @param length Number of bytes to check.
+ * @return True if every byte in the range equals `value`.
+ */
+static bool all_equal(const Memory *mem, size_t offset, uint8_t value, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (mem->bytes[offset + i] != value) {
+            return false;
+        }
+    }
+    return true;
+}
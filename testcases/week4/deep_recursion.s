@@ -0,0 +1,17 @@
+// Recursion far deeper than any fixed stack limit; only -d caps it.
+main:
+    mov x0, 300000
+    call depth
+    print x0, d
+    ret
+
+depth:
+    cmp x0, 0
+    b.eq bottom
+    sub x0, x0, 1
+    call depth
+    add x0, x0, 1
+    ret
+
+bottom:
+    ret